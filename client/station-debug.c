@@ -275,6 +275,108 @@ static enum cmd_status cmd_debug_get_networks(const char *device_name,
 	return CMD_STATUS_TRIGGERED;
 }
 
+static void get_scan_history_method_callback(struct l_dbus_message *message,
+								void *user_data)
+{
+	struct l_dbus_message_iter iter;
+	struct l_dbus_message_iter dict;
+	struct l_dbus_message_iter variant;
+	const char *key;
+
+	if (dbus_message_has_error(message))
+		return;
+
+	if (!l_dbus_message_get_arguments(message, "aa{sv}", &iter)) {
+		l_error("Failed to parse GetScanHistory message");
+		return;
+	}
+
+	display_table_header("Scan History (debug)",
+				"%s%-*s  %-*s  %-*s  %-*s  %-*s  %-*s  %-*s  %-*s",
+				MARGIN, 4, "Id", 7, "Type", 6, "Result",
+				9, "Queue(ms)", 11, "Latency(ms)", 6, "BSSes",
+				7, "Retries", 16, "Segments(n:ms)");
+
+	while (l_dbus_message_iter_next_entry(&iter, &dict)) {
+		uint32_t id = 0;
+		bool passive = false;
+		bool cached = false;
+		int32_t result = 0;
+		uint64_t queue_time = 0;
+		uint64_t latency = 0;
+		uint32_t num_bss = 0;
+		uint32_t retries = 0;
+		char segments[64] = "";
+		size_t pos = 0;
+
+		while (l_dbus_message_iter_next_entry(&dict, &key, &variant)) {
+			struct l_dbus_message_iter array;
+			uint32_t num_freqs;
+			uint64_t duration;
+
+			if (!strcmp(key, "Id"))
+				id = get_u32(&variant);
+			else if (!strcmp(key, "Passive"))
+				l_dbus_message_iter_get_variant(&variant, "b",
+								&passive);
+			else if (!strcmp(key, "Cached"))
+				l_dbus_message_iter_get_variant(&variant, "b",
+								&cached);
+			else if (!strcmp(key, "Result"))
+				result = get_i32(&variant);
+			else if (!strcmp(key, "QueueTime"))
+				l_dbus_message_iter_get_variant(&variant, "t",
+								&queue_time);
+			else if (!strcmp(key, "Latency"))
+				l_dbus_message_iter_get_variant(&variant, "t",
+								&latency);
+			else if (!strcmp(key, "BSSCount"))
+				num_bss = get_u32(&variant);
+			else if (!strcmp(key, "Retries"))
+				retries = get_u32(&variant);
+			else if (!strcmp(key, "Segments") &&
+					l_dbus_message_iter_get_variant(
+						&variant, "a(ut)", &array)) {
+				while (pos < sizeof(segments) &&
+						l_dbus_message_iter_next_entry(
+							&array, &num_freqs,
+							&duration))
+					pos += snprintf(segments + pos,
+						sizeof(segments) - pos,
+						"%s%u:%u",
+						pos ? " " : "", num_freqs,
+						(unsigned int) (duration / 1000));
+			}
+		}
+
+		display("%s%-*u  %-*s  %-*i  %-*u  %-*u  %-*u  %-*u  %s\n",
+				MARGIN, 4, id, 7, cached ? "cached" :
+					passive ? "passive" : "active",
+				6, result, 9, (unsigned int) (queue_time / 1000),
+				11, (unsigned int) (latency / 1000),
+				6, num_bss, 7, retries, segments);
+	}
+
+	display_table_footer();
+}
+
+static enum cmd_status cmd_debug_get_scan_history(const char *device_name,
+						char **argv, int argc)
+{
+	const struct proxy_interface *debug_i;
+
+	debug_i = device_proxy_find(device_name, IWD_STATION_DEBUG_INTERFACE);
+	if (!debug_i) {
+		display_error("IWD not in developer mode");
+		return CMD_STATUS_INVALID_VALUE;
+	}
+
+	proxy_interface_method_call(debug_i, "GetScanHistory", "",
+					get_scan_history_method_callback);
+
+	return CMD_STATUS_TRIGGERED;
+}
+
 static char *connect_debug_cmd_arg_completion(const char *text, int state,
 						const char *device_name)
 {
@@ -376,6 +478,8 @@ static const struct command station_debug_commands[] = {
 					"Roam to a BSS", false },
 	{ "<wlan>", "get-networks", NULL, cmd_debug_get_networks,
 					"Get networks", true },
+	{ "<wlan>", "get-scan-history", NULL, cmd_debug_get_scan_history,
+					"Get timing of recent scans", true },
 	{ "<wlan>", "autoconnect", "on|off", cmd_debug_set_autoconnect,
 					"Set AutoConnect property", false },
 	{ }
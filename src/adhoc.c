@@ -37,6 +37,7 @@
 #include "src/netdev.h"
 #include "src/wiphy.h"
 #include "src/crypto.h"
+#include "src/crypto-worker.h"
 #include "src/ie.h"
 #include "src/util.h"
 #include "src/eapol.h"
@@ -50,6 +51,7 @@ struct adhoc_state {
 	struct l_genl_family *nl80211;
 	char *ssid;
 	uint8_t pmk[32];
+	uint32_t psk_job;
 	struct l_queue *sta_states;
 	uint32_t sta_watch_id;
 	uint32_t netdev_watch_id;
@@ -131,6 +133,11 @@ static void adhoc_remove_sta(struct sta_state *sta)
 
 static void adhoc_reset(struct adhoc_state *adhoc)
 {
+	if (adhoc->psk_job) {
+		crypto_worker_cancel(adhoc->psk_job);
+		adhoc->psk_job = 0;
+	}
+
 	if (adhoc->pending)
 		dbus_pending_reply(&adhoc->pending,
 				dbus_error_aborted(adhoc->pending));
@@ -536,29 +543,22 @@ static void adhoc_mlme_notify(struct l_genl_msg *msg, void *user_data)
 	}
 }
 
-static struct l_dbus_message *adhoc_dbus_start(struct l_dbus *dbus,
-						struct l_dbus_message *message,
-						void *user_data)
+static void adhoc_psk_derived_cb(int err, const uint8_t *psk, void *user_data)
 {
 	struct adhoc_state *adhoc = user_data;
-	struct netdev *netdev = adhoc->netdev;
-	struct wiphy *wiphy = netdev_get_wiphy(netdev);
-	const char *ssid, *wpa2_psk;
 	struct ie_rsn_info rsn;
 	struct iovec rsn_ie;
 	uint8_t ie_elems[32];
 
-	if (adhoc->pending)
-		return dbus_error_busy(message);
+	adhoc->psk_job = 0;
 
-	if (!l_dbus_message_get_arguments(message, "ss", &ssid, &wpa2_psk))
-		return dbus_error_invalid_args(message);
+	if (err < 0) {
+		dbus_pending_reply(&adhoc->pending,
+					dbus_error_invalid_args(adhoc->pending));
+		return;
+	}
 
-	adhoc->ssid = l_strdup(ssid);
-	adhoc->pending = l_dbus_message_ref(message);
-	adhoc->sta_states = l_queue_new();
-	adhoc->ciphers = wiphy_select_cipher(wiphy, 0xffff);
-	adhoc->group_cipher = wiphy_select_cipher(wiphy, 0xffff);
+	memcpy(adhoc->pmk, psk, 32);
 
 	adhoc_set_rsn_info(adhoc, &rsn);
 	ie_build_rsne(&rsn, ie_elems);
@@ -566,19 +566,52 @@ static struct l_dbus_message *adhoc_dbus_start(struct l_dbus *dbus,
 	rsn_ie.iov_base = ie_elems;
 	rsn_ie.iov_len = ie_elems[1] + 2;
 
-	if (crypto_psk_from_passphrase(wpa2_psk, (uint8_t *) ssid,
-			strlen(ssid), adhoc->pmk))
-		return dbus_error_invalid_args(message);
-
-	if (netdev_join_adhoc(netdev, ssid, &rsn_ie, 1, true, adhoc_join_cb,
-			adhoc))
-		return dbus_error_invalid_args(message);
+	if (netdev_join_adhoc(adhoc->netdev, adhoc->ssid, &rsn_ie, 1, true,
+				adhoc_join_cb, adhoc)) {
+		dbus_pending_reply(&adhoc->pending,
+					dbus_error_invalid_args(adhoc->pending));
+		return;
+	}
 
 	adhoc->mlme_watch = l_genl_family_register(adhoc->nl80211, "mlme",
 						adhoc_mlme_notify, adhoc, NULL);
 	if (!adhoc->mlme_watch)
+		dbus_pending_reply(&adhoc->pending,
+					dbus_error_failed(adhoc->pending));
+}
+
+static struct l_dbus_message *adhoc_dbus_start(struct l_dbus *dbus,
+						struct l_dbus_message *message,
+						void *user_data)
+{
+	struct adhoc_state *adhoc = user_data;
+	struct netdev *netdev = adhoc->netdev;
+	struct wiphy *wiphy = netdev_get_wiphy(netdev);
+	const char *ssid, *wpa2_psk;
+
+	if (adhoc->pending || adhoc->psk_job)
+		return dbus_error_busy(message);
+
+	if (!l_dbus_message_get_arguments(message, "ss", &ssid, &wpa2_psk))
+		return dbus_error_invalid_args(message);
+
+	if (strlen(ssid) > 32 || !crypto_passphrase_is_valid(wpa2_psk))
+		return dbus_error_invalid_args(message);
+
+	/* The join continues in adhoc_psk_derived_cb */
+	adhoc->psk_job = crypto_worker_psk_from_passphrase(wpa2_psk,
+						(uint8_t *) ssid, strlen(ssid),
+						adhoc_psk_derived_cb, adhoc,
+						NULL);
+	if (!adhoc->psk_job)
 		return dbus_error_failed(message);
 
+	adhoc->ssid = l_strdup(ssid);
+	adhoc->pending = l_dbus_message_ref(message);
+	adhoc->sta_states = l_queue_new();
+	adhoc->ciphers = wiphy_select_cipher(wiphy, 0xffff);
+	adhoc->group_cipher = wiphy_select_cipher(wiphy, 0xffff);
+
 	return NULL;
 }
 
@@ -784,3 +817,4 @@ static void adhoc_exit(void)
 
 IWD_MODULE(adhoc, adhoc_init, adhoc_exit)
 IWD_MODULE_DEPENDS(adhoc, netdev);
+IWD_MODULE_DEPENDS(adhoc, crypto_worker);
@@ -42,6 +42,7 @@
 #include "src/netdev.h"
 #include "src/wiphy.h"
 #include "src/crypto.h"
+#include "src/crypto-worker.h"
 #include "src/ie.h"
 #include "src/mpdu.h"
 #include "src/util.h"
@@ -60,6 +61,21 @@
 #include "src/band.h"
 #include "src/common.h"
 
+/*
+ * Stations usually send several broadcast Probe Requests on each channel
+ * they visit during a scan.  Remember the last broadcast Probe Request
+ * answered for a few recent stations, in a direct-mapped table indexed by
+ * the address hash, and don't answer the duplicates.
+ */
+#define AP_PROBE_RECORDS	64
+#define AP_PROBE_COALESCE_TIME	(20 * L_USEC_PER_MSEC)
+#define AP_GTK_REKEY_DEFAULT_WINDOW	10	/* seconds */
+
+struct ap_probe_record {
+	uint8_t addr[6];
+	uint64_t timestamp;
+};
+
 struct ap_state {
 	struct netdev *netdev;
 	struct l_genl_family *nl80211;
@@ -70,6 +86,7 @@ struct ap_state {
 	char ssid[33];
 	char passphrase[64];
 	uint8_t psk[32];
+	uint32_t psk_job;
 	enum band_freq band;
 	uint8_t channel;
 	struct band_chandef chandef;
@@ -91,8 +108,8 @@ struct ap_state {
 	uint16_t wsc_dpid;
 	uint8_t wsc_uuid_r[16];
 
-	uint16_t last_aid;
-	struct l_queue *sta_states;
+	struct l_uintset *aids;
+	struct l_hashmap *sta_states;
 
 	struct l_dhcp_server *netconfig_dhcp;
 	struct l_rtnl_address *netconfig_addr4;
@@ -107,8 +124,28 @@ struct ap_state {
 	struct l_queue *networks;
 
 	struct l_timeout *rekey_timeout;
+	struct l_queue *rekey_queue;
 	unsigned int rekey_time;
 
+	struct l_timeout *gtk_rekey_timeout;
+	struct l_timeout *gtk_rekey_tick;
+	struct l_queue *gtk_rekey_queue;
+	unsigned int gtk_rekey_time;
+	unsigned int gtk_rekey_window;
+	unsigned int gtk_rekey_interval;
+	unsigned int gtk_rekey_batch;
+	unsigned int gtk_rekey_pending;
+	unsigned int gtk_rekey_stas;
+	uint64_t gtk_rekey_start;
+	uint8_t next_gtk[CRYPTO_MAX_GTK_LEN];
+	uint8_t next_gtk_index;
+
+	uint8_t *probe_resp;
+	size_t probe_resp_len;
+	struct ap_probe_record probe_records[AP_PROBE_RECORDS];
+	unsigned int probe_resp_sent;
+	unsigned int probe_resp_suppressed;
+
 	bool started : 1;
 	bool gtk_set : 1;
 	bool netconfig_set_addr4 : 1;
@@ -144,6 +181,19 @@ struct sta_state {
 
 	bool ht_support : 1;
 	bool ht_greenfield : 1;
+	bool gtk_rekey_pending : 1;
+	bool ptk_rekey_deferred : 1;
+};
+
+/*
+ * Every station uses the same rekey interval so scheduling a rekey always
+ * appends the latest deadline and the queue stays sorted.  Entries are
+ * matched against the station's current rekey_time when they expire rather
+ * than being removed when a station goes away or is rescheduled.
+ */
+struct ap_rekey_entry {
+	uint8_t addr[6];
+	uint64_t rekey_time;
 };
 
 struct ap_wsc_pbc_probe_record {
@@ -272,11 +322,68 @@ static void ap_sta_free(void *data)
 		l_dhcp_server_lease_remove(ap->netconfig_dhcp,
 						sta->ip_alloc_lease);
 
+	if (sta->aid && ap->aids)
+		l_uintset_take(ap->aids, sta->aid);
+
 	ap_stop_handshake(sta);
 
 	l_free(sta);
 }
 
+/* 802.11-2016 9.4.1.8: AID values are in the range 1 - 2007 */
+#define AP_MAX_AID 2007
+
+static unsigned int ap_sta_hash(const void *p)
+{
+	return util_address_hash(p);
+}
+
+static int ap_sta_compare(const void *a, const void *b)
+{
+	return memcmp(a, b, 6);
+}
+
+static struct sta_state *ap_sta_find(struct ap_state *ap, const uint8_t *addr)
+{
+	return l_hashmap_lookup(ap->sta_states, addr);
+}
+
+static void ap_sta_add(struct ap_state *ap, struct sta_state *sta)
+{
+	if (!ap->sta_states) {
+		ap->sta_states = l_hashmap_new();
+		l_hashmap_set_hash_function(ap->sta_states, ap_sta_hash);
+		l_hashmap_set_compare_function(ap->sta_states,
+						ap_sta_compare);
+	}
+
+	l_hashmap_insert(ap->sta_states, sta->addr, sta);
+}
+
+static uint16_t ap_sta_alloc_aid(struct ap_state *ap)
+{
+	uint32_t aid;
+
+	if (!ap->aids)
+		ap->aids = l_uintset_new_from_range(1, AP_MAX_AID);
+
+	aid = l_uintset_find_unused_min(ap->aids);
+	if (aid > AP_MAX_AID)
+		return 0;
+
+	l_uintset_put(ap->aids, aid);
+	return aid;
+}
+
+static void ap_sta_release_aid(struct sta_state *sta)
+{
+	if (!sta->aid)
+		return;
+
+	l_uintset_take(sta->ap->aids, sta->aid);
+	sta->aid = 0;
+}
+
 static void ap_reset(struct ap_state *ap)
 {
 	struct netdev *netdev = ap->netdev;
@@ -306,6 +413,11 @@ static void ap_reset(struct ap_state *ap)
 		ap->rtnl_add_cmd = 0;
 	}
 
+	if (ap->psk_job) {
+		crypto_worker_cancel(ap->psk_job);
+		ap->psk_job = 0;
+	}
+
 	if (ap->rtnl_get_gateway4_mac_cmd) {
 		l_netlink_cancel(rtnl, ap->rtnl_get_gateway4_mac_cmd);
 		ap->rtnl_get_gateway4_mac_cmd = 0;
@@ -316,7 +428,10 @@ static void ap_reset(struct ap_state *ap)
 		ap->rtnl_get_dns4_mac_cmd = 0;
 	}
 
-	l_queue_destroy(l_steal_ptr(ap->sta_states), ap_sta_free);
+	l_hashmap_destroy(l_steal_ptr(ap->sta_states), ap_sta_free);
+
+	if (ap->aids)
+		l_uintset_free(l_steal_ptr(ap->aids));
 
 	if (ap->rates)
 		l_uintset_free(l_steal_ptr(ap->rates));
@@ -354,6 +469,24 @@ static void ap_reset(struct ap_state *ap)
 		l_timeout_remove(ap->rekey_timeout);
 		ap->rekey_timeout = NULL;
 	}
+
+	l_queue_destroy(l_steal_ptr(ap->rekey_queue), l_free);
+
+	l_timeout_remove(l_steal_ptr(ap->gtk_rekey_timeout));
+	l_timeout_remove(l_steal_ptr(ap->gtk_rekey_tick));
+	l_queue_destroy(l_steal_ptr(ap->gtk_rekey_queue), l_free);
+	ap->gtk_rekey_pending = 0;
+	explicit_bzero(ap->next_gtk, sizeof(ap->next_gtk));
+
+	if (ap->probe_resp_sent || ap->probe_resp_suppressed)
+		l_debug("Probe Responses sent: %u, suppressed duplicates: %u",
+			ap->probe_resp_sent, ap->probe_resp_suppressed);
+
+	l_free(l_steal_ptr(ap->probe_resp));
+	ap->probe_resp_len = 0;
+	ap->probe_resp_sent = 0;
+	ap->probe_resp_suppressed = 0;
+	memset(ap->probe_records, 0, sizeof(ap->probe_records));
 }
 
 static bool ap_event_done(struct ap_state *ap, bool prev_in_event)
@@ -386,7 +519,8 @@ static bool ap_event(struct ap_state *ap, enum ap_event_type event,
 	return ap_event_done(ap, prev);
 }
 
-static void ap_check_rekeys(struct ap_state *ap);
+static void ap_sta_gtk_rekey_done(struct sta_state *sta);
+static void ap_gtk_rekey_check_done(struct ap_state *ap);
 
 static void ap_del_station(struct sta_state *sta, uint16_t reason,
 				bool disassociate)
@@ -404,6 +538,7 @@ static void ap_del_station(struct sta_state *sta, uint16_t reason,
 	l_genl_family_send(ap->nl80211, msg, NULL, NULL, NULL);
 
 	sta->associated = false;
+	ap_sta_release_aid(sta);
 
 	if (sta->rsna) {
 		if (ap->ops->handle_event) {
@@ -427,6 +562,8 @@ static void ap_del_station(struct sta_state *sta, uint16_t reason,
 	}
 
 	ap_stop_handshake(sta);
+	ap_sta_gtk_rekey_done(sta);
+	sta->ptk_rekey_deferred = false;
 
 	/*
 	 * If the event handler tears the AP down, we've made sure above that
@@ -458,12 +595,10 @@ static void ap_del_station(struct sta_state *sta, uint16_t reason,
 		ap_event_done(ap, prev);
 	}
 
-	/*
-	 * Set the rekey time to zero which will skip this station when
-	 * determining the next rekey.
-	 */
+	/* Any queued rekey entry no longer matches and will be dropped */
 	sta->rekey_time = 0;
-	ap_check_rekeys(ap);
+
+	ap_gtk_rekey_check_done(ap);
 }
 
 static void ap_start_rekey(struct ap_state *ap, struct sta_state *sta)
@@ -473,6 +608,8 @@ static void ap_start_rekey(struct ap_state *ap, struct sta_state *sta)
 	eapol_start(sta->sm);
 }
 
+static void ap_check_rekeys(struct ap_state *ap);
+
 static void ap_rekey_timeout(struct l_timeout *timeout, void *user_data)
 {
 	struct ap_state *ap = user_data;
@@ -480,87 +617,332 @@ static void ap_rekey_timeout(struct l_timeout *timeout, void *user_data)
 	ap_check_rekeys(ap);
 }
 
-/*
- * Used to check/start any rekeys which are due and reset the rekey timer to the
- * next soonest station needing a rekey.
- *
- * TODO: Could adapt this to also take into account the next GTK rekey and
- * service that as well. But GTK rekeys are not yet supported in AP mode.
- */
-static void ap_check_rekeys(struct ap_state *ap)
+static void ap_rekey_timer_update(struct ap_state *ap)
 {
-	const struct l_queue_entry *e;
+	struct ap_rekey_entry *entry = l_queue_peek_head(ap->rekey_queue);
 	uint64_t now = l_time_now();
-	uint64_t next = 0;
+	uint64_t ms;
 
-	if (!ap->rekey_time)
+	if (!entry) {
+		l_timeout_remove(ap->rekey_timeout);
+		ap->rekey_timeout = NULL;
 		return;
+	}
 
-	/* Find the station(s) that need a rekey and start it */
-	for (e = l_queue_get_entries(ap->sta_states); e; e = e->next) {
-		struct sta_state *sta = e->data;
+	ms = l_time_before(now, entry->rekey_time) ?
+		(l_time_diff(now, entry->rekey_time) + 999) / 1000 : 1;
 
-		if (!sta->associated || !sta->rsna || sta->rekey_time == 0)
-			continue;
+	if (ap->rekey_timeout)
+		l_timeout_modify_ms(ap->rekey_timeout, ms);
+	else
+		ap->rekey_timeout = l_timeout_create_ms(ms, ap_rekey_timeout,
+							ap, NULL);
+}
 
-		if (l_time_before(now, sta->rekey_time)) {
-			uint64_t diff = l_time_diff(now, sta->rekey_time);
+/*
+ * Used to start any rekeys which are due and reset the rekey timer to the
+ * next soonest station needing a rekey.  Only the expired entries at the
+ * head of ap->rekey_queue are looked at.
+ *
+ * GTK rekeys are scheduled separately, see ap_gtk_rekey_start().
+ */
+static void ap_check_rekeys(struct ap_state *ap)
+{
+	struct ap_rekey_entry *entry;
+	uint64_t now = l_time_now();
 
-			/* Finding the next rekey time */
-			if (next < diff)
-				next = diff;
+	while ((entry = l_queue_peek_head(ap->rekey_queue))) {
+		struct sta_state *sta = ap_sta_find(ap, entry->addr);
 
+		/* Drop stale entries, the station is gone or rescheduled */
+		if (!sta || !sta->associated || !sta->rsna ||
+				sta->rekey_time != entry->rekey_time) {
+			l_free(l_queue_pop_head(ap->rekey_queue));
 			continue;
 		}
 
-		ap_start_rekey(ap, sta);
-	}
+		if (l_time_before(now, entry->rekey_time))
+			break;
 
-	/*
-	 * Set the next rekey to the station needing it the soonest, or remove
-	 * if a single station and wait until the rekey is complete to reset
-	 * the timer.
-	 */
-	if (next)
-		l_timeout_modify(ap->rekey_timeout, l_time_to_secs(next));
-	else {
-		l_timeout_remove(ap->rekey_timeout);
-		ap->rekey_timeout = NULL;
+		l_free(l_queue_pop_head(ap->rekey_queue));
+
+		/* Don't interrupt a Group Key Handshake, start after it */
+		if (sta->gtk_rekey_pending)
+			sta->ptk_rekey_deferred = true;
+		else
+			ap_start_rekey(ap, sta);
 	}
+
+	ap_rekey_timer_update(ap);
 }
 
 static void ap_set_sta_rekey_timer(struct ap_state *ap, struct sta_state *sta)
 {
+	struct ap_rekey_entry *entry;
+
 	if (!ap->rekey_time)
 		return;
 
 	sta->rekey_time = l_time_now() + ap->rekey_time - 1;
 
+	entry = l_new(struct ap_rekey_entry, 1);
+	memcpy(entry->addr, sta->addr, 6);
+	entry->rekey_time = sta->rekey_time;
+
+	if (!ap->rekey_queue)
+		ap->rekey_queue = l_queue_new();
+
+	l_queue_push_tail(ap->rekey_queue, entry);
+
 	/*
-	 * First/only station authenticated, set rekey timer. Any more stations
-	 * will just set their rekey time and be serviced by the single callback
+	 * First/only station queued, set rekey timer.  Any more stations
+	 * expire later and will be serviced by the same callback
 	 */
 	if (!ap->rekey_timeout)
-		ap->rekey_timeout = l_timeout_create(
-						l_time_to_secs(ap->rekey_time),
-						ap_rekey_timeout, ap, NULL);
+		ap_rekey_timer_update(ap);
 }
 
-static bool ap_sta_match_addr(const void *a, const void *b)
+static void ap_gtk_op_cb(struct l_genl_msg *msg, void *user_data)
 {
-	const struct sta_state *sta = a;
+	if (l_genl_msg_get_error(msg) < 0) {
+		uint8_t cmd = l_genl_msg_get_command(msg);
+		const char *cmd_name =
+			cmd == NL80211_CMD_NEW_KEY ? "NEW_KEY" :
+			cmd == NL80211_CMD_SET_KEY ? "SET_KEY" :
+			"DEL_KEY";
 
-	return !memcmp(sta->addr, b, 6);
+		l_error("%s failed for the GTK: %i",
+			cmd_name, l_genl_msg_get_error(msg));
+	}
+}
+
+/*
+ * The group rekey spreads the Group Key Handshakes with the individual
+ * stations over ap->gtk_rekey_window instead of sending them all at once.
+ * The new GTK is installed with a single NEW_KEY before the first handshake
+ * and only becomes the Tx key, with a single SET_KEY, once every station
+ * has acknowledged it or has gone away.  Until then the old GTK is still
+ * used for the group traffic so no station misses any frames.
+ */
+#define AP_GTK_REKEY_MIN_INTERVAL	20	/* ms */
+
+static void ap_gtk_rekey_timeout(struct l_timeout *timeout, void *user_data);
+
+static void ap_gtk_rekey_schedule(struct ap_state *ap)
+{
+	if (!ap->gtk_rekey_time)
+		return;
+
+	if (ap->gtk_rekey_timeout)
+		l_timeout_modify(ap->gtk_rekey_timeout, ap->gtk_rekey_time);
+	else
+		ap->gtk_rekey_timeout = l_timeout_create(ap->gtk_rekey_time,
+							ap_gtk_rekey_timeout,
+							ap, NULL);
+}
+
+static void ap_gtk_rekey_finish(struct ap_state *ap)
+{
+	struct l_genl_msg *msg;
+	uint64_t elapsed = l_time_diff(ap->gtk_rekey_start, l_time_now());
+
+	l_timeout_remove(l_steal_ptr(ap->gtk_rekey_tick));
+	l_queue_destroy(l_steal_ptr(ap->gtk_rekey_queue), l_free);
+
+	msg = nl80211_build_set_key(netdev_get_ifindex(ap->netdev),
+					ap->next_gtk_index);
+	if (!l_genl_family_send(ap->nl80211, msg, ap_gtk_op_cb, NULL, NULL)) {
+		l_genl_msg_unref(msg);
+		l_error("Issuing SET_KEY failed");
+	}
+
+	memcpy(ap->gtk, ap->next_gtk, sizeof(ap->gtk));
+	ap->gtk_index = ap->next_gtk_index;
+	explicit_bzero(ap->next_gtk, sizeof(ap->next_gtk));
+
+	l_info("AP GTK rekey of %u stations completed in %u ms",
+		ap->gtk_rekey_stas, (unsigned int) (elapsed / L_USEC_PER_MSEC));
+
+	ap_gtk_rekey_schedule(ap);
+}
+
+static void ap_gtk_rekey_check_done(struct ap_state *ap)
+{
+	if (ap->gtk_rekey_queue && l_queue_isempty(ap->gtk_rekey_queue) &&
+			!ap->gtk_rekey_pending)
+		ap_gtk_rekey_finish(ap);
+}
+
+static void ap_sta_gtk_rekey_done(struct sta_state *sta)
+{
+	if (!sta->gtk_rekey_pending)
+		return;
+
+	sta->gtk_rekey_pending = false;
+	sta->ap->gtk_rekey_pending--;
+}
+
+static bool ap_sta_start_gtk_rekey(struct ap_state *ap, struct sta_state *sta)
+{
+	static const uint8_t zero_gtk_rsc[6];
+	uint8_t old_gtk[32];
+	uint8_t old_gtk_rsc[6];
+	unsigned int old_gtk_index = sta->hs->gtk_index;
+
+	memcpy(old_gtk, sta->hs->gtk, sizeof(old_gtk));
+	memcpy(old_gtk_rsc, sta->hs->gtk_rsc, sizeof(old_gtk_rsc));
+
+	/*
+	 * The new key hasn't been used for transmission yet so its Tx RSC
+	 * is still all zeros, no need for a GET_KEY.  If this fails because
+	 * a 4-Way Handshake is in progress, the station keeps the current
+	 * GTK, which that handshake may still be delivering, and gets
+	 * retried later.
+	 */
+	handshake_state_set_gtk(sta->hs, ap->next_gtk, ap->next_gtk_index,
+				zero_gtk_rsc);
+
+	if (!eapol_start_group_rekey(sta->sm)) {
+		handshake_state_set_gtk(sta->hs, old_gtk, old_gtk_index,
+					old_gtk_rsc);
+		explicit_bzero(old_gtk, sizeof(old_gtk));
+		return false;
+	}
+
+	explicit_bzero(old_gtk, sizeof(old_gtk));
+
+	sta->gtk_rekey_pending = true;
+	ap->gtk_rekey_pending++;
+	return true;
+}
+
+static void ap_gtk_rekey_tick_cb(struct l_timeout *timeout, void *user_data)
+{
+	struct ap_state *ap = user_data;
+	unsigned int n = ap->gtk_rekey_batch;
+	uint8_t *addr;
+
+	while (n && (addr = l_queue_pop_head(ap->gtk_rekey_queue))) {
+		struct sta_state *sta = ap_sta_find(ap, addr);
+
+		if (!sta || !sta->associated || !sta->rsna || !sta->sm ||
+				sta->gtk_rekey_pending) {
+			l_free(addr);
+			continue;
+		}
+
+		n--;
+
+		if (ap_sta_start_gtk_rekey(ap, sta)) {
+			l_free(addr);
+			continue;
+		}
+
+		l_queue_push_tail(ap->gtk_rekey_queue, addr);
+	}
+
+	if (l_queue_isempty(ap->gtk_rekey_queue)) {
+		l_timeout_remove(l_steal_ptr(ap->gtk_rekey_tick));
+		ap_gtk_rekey_check_done(ap);
+		return;
+	}
+
+	l_timeout_modify_ms(ap->gtk_rekey_tick, ap->gtk_rekey_interval);
+}
+
+static void ap_gtk_rekey_queue_sta(struct ap_state *ap, struct sta_state *sta)
+{
+	l_queue_push_tail(ap->gtk_rekey_queue, l_memdup(sta->addr, 6));
+	ap->gtk_rekey_stas++;
+
+	if (!ap->gtk_rekey_tick)
+		ap->gtk_rekey_tick = l_timeout_create_ms(
+						ap->gtk_rekey_interval,
+						ap_gtk_rekey_tick_cb, ap, NULL);
+}
+
+static void ap_gtk_rekey_add_sta(const void *key, void *value,
+					void *user_data)
+{
+	struct sta_state *sta = value;
+	struct ap_state *ap = user_data;
+
+	if (sta->associated && sta->rsna && sta->sm && sta->assoc_rsne)
+		ap_gtk_rekey_queue_sta(ap, sta);
+}
+
+static void ap_gtk_rekey_start(struct ap_state *ap)
+{
+	enum crypto_cipher group_cipher =
+		ie_rsn_cipher_suite_to_cipher(ap->group_cipher);
+	int gtk_len = crypto_cipher_key_len(group_cipher);
+	unsigned int n;
+	struct l_genl_msg *msg;
+
+	/* Alternate between key indexes 1 and 2, 802.11-2016 12.7.1.4 */
+	ap->next_gtk_index = ap->gtk_index == 1 ? 2 : 1;
+	l_getrandom(ap->next_gtk, gtk_len);
+
+	msg = nl80211_build_new_key_group(netdev_get_ifindex(ap->netdev),
+					group_cipher, ap->next_gtk_index,
+					ap->next_gtk, gtk_len, NULL, 0, NULL);
+	if (!l_genl_family_send(ap->nl80211, msg, ap_gtk_op_cb, NULL, NULL)) {
+		l_genl_msg_unref(msg);
+		l_error("Issuing NEW_KEY failed");
+		explicit_bzero(ap->next_gtk, sizeof(ap->next_gtk));
+		ap_gtk_rekey_schedule(ap);
+		return;
+	}
+
+	ap->gtk_rekey_queue = l_queue_new();
+	ap->gtk_rekey_start = l_time_now();
+	ap->gtk_rekey_stas = 0;
+	ap->gtk_rekey_interval = AP_GTK_REKEY_MIN_INTERVAL;
+	ap->gtk_rekey_batch = 1;
+
+	n = ap->sta_states ? l_hashmap_size(ap->sta_states) : 0;
+	if (n && ap->gtk_rekey_window) {
+		/* One handshake every window / n, or batches if too short */
+		ap->gtk_rekey_interval = maxsize(ap->gtk_rekey_window / n,
+						AP_GTK_REKEY_MIN_INTERVAL);
+		ap->gtk_rekey_batch = (n * ap->gtk_rekey_interval +
+					ap->gtk_rekey_window - 1) /
+					ap->gtk_rekey_window;
+	} else if (n) {
+		ap->gtk_rekey_interval = AP_GTK_REKEY_MIN_INTERVAL;
+		ap->gtk_rekey_batch = n;
+	}
+
+	l_debug("Rekeying GTK at index %u, %u stations, %u every %u ms",
+		ap->next_gtk_index, n, ap->gtk_rekey_batch,
+		ap->gtk_rekey_interval);
+
+	if (n)
+		l_hashmap_foreach(ap->sta_states, ap_gtk_rekey_add_sta, ap);
+
+	ap_gtk_rekey_check_done(ap);
+}
+
+static void ap_gtk_rekey_timeout(struct l_timeout *timeout, void *user_data)
+{
+	struct ap_state *ap = user_data;
+
+	ap_gtk_rekey_start(ap);
 }
 
 static void ap_remove_sta(struct sta_state *sta)
 {
-	if (!l_queue_remove(sta->ap->sta_states, sta)) {
+	struct ap_state *ap = sta->ap;
+
+	if (l_hashmap_remove(ap->sta_states, sta->addr) != sta) {
 		l_error("tried to remove station that doesn't exist");
 		return;
 	}
 
+	ap_sta_gtk_rekey_done(sta);
+
 	ap_sta_free(sta);
+	ap_gtk_rekey_check_done(ap);
 }
 
 static void ap_set_sta_cb(struct l_genl_msg *msg, void *user_data)
@@ -586,6 +968,10 @@ static void ap_new_rsna(struct sta_state *sta)
 
 	ap_set_sta_rekey_timer(ap, sta);
 
+	/* Handshake used the old GTK, this STA needs the new one too */
+	if (ap->gtk_rekey_queue && sta->assoc_rsne)
+		ap_gtk_rekey_queue_sta(ap, sta);
+
 	event_data.mac = sta->addr;
 	event_data.assoc_ies = sta->assoc_ies;
 	event_data.assoc_ies_len = sta->assoc_ies_len;
@@ -678,7 +1064,7 @@ static void ap_process_wsc_probe_req(struct ap_state *ap, const uint8_t *from,
 	uint64_t now;
 	bool empty;
 	uint8_t first_sta_addr[6] = {};
-	const struct l_queue_entry *entry;
+	struct sta_state *sta;
 
 	if (wsc_parse_probe_request(wsc_data, wsc_data_len, &req) < 0)
 		return;
@@ -746,35 +1132,29 @@ static void ap_process_wsc_probe_req(struct ap_state *ap, const uint8_t *from,
 	 *
 	 * For simplicity just interrupt the handshake with that enrollee.
 	 */
-	for (entry = l_queue_get_entries(ap->sta_states); entry;
-			entry = entry->next) {
-		struct sta_state *sta = entry->data;
-
-		if (!sta->associated || sta->assoc_rsne)
-			continue;
+	/*
+	 * Check whether the enrollee is in PBC Registration Protocol by
+	 * looking up the mac of the first (and only) record we had in
+	 * ap->wsc_pbc_probes.  If we had more than one record we wouldn't
+	 * have been in "active PBC mode".
+	 */
+	if (!memcmp(first_sta_addr, from, 6))
+		return;
 
-		/*
-		 * Check whether this enrollee is in PBC Registration
-		 * Protocol by comparing its mac with the first (and only)
-		 * record we had in ap->wsc_pbc_probes.  If we had more
-		 * than one record we wouldn't have been in
-		 * "active PBC mode".
-		 */
-		if (memcmp(sta->addr, first_sta_addr, 6) ||
-				!memcmp(sta->addr, from, 6))
-			continue;
+	sta = ap_sta_find(ap, first_sta_addr);
+	if (!sta || !sta->associated || sta->assoc_rsne)
+		return;
 
-		l_debug("Interrupting handshake with %s due to Session Overlap",
-			util_address_to_string(sta->addr));
+	l_debug("Interrupting handshake with %s due to Session Overlap",
+		util_address_to_string(sta->addr));
 
-		if (sta->hs) {
-			netdev_handshake_failed(sta->hs,
+	if (sta->hs) {
+		netdev_handshake_failed(sta->hs,
 					MMPDU_REASON_CODE_DISASSOC_AP_BUSY);
-			sta->sm = NULL;
-		}
-
-		ap_remove_sta(sta);
+		sta->sm = NULL;
 	}
+
+	ap_remove_sta(sta);
 }
 
 static void ap_write_authorized_macs(struct ap_state *ap,
@@ -878,8 +1258,7 @@ static size_t ap_write_wsc_ie(struct ap_state *ap,
 			MPDU_MANAGEMENT_SUBTYPE_REASSOCIATION_RESPONSE)) {
 		const uint8_t *from = client_frame->address_2;
 		struct wsc_association_response wsc_resp = {};
-		struct sta_state *sta =
-			l_queue_find(ap->sta_states, ap_sta_match_addr, from);
+		struct sta_state *sta = ap_sta_find(ap, from);
 
 		if (!sta || sta->assoc_rsne)
 			return 0;
@@ -1053,11 +1432,28 @@ static size_t ap_build_ht_capability(struct ap_state *ap, uint8_t *buf)
 	return ht_capa_len;
 }
 
+struct ap_sta_ht_data {
+	bool non_ht;
+	bool non_greenfield;
+};
+
+static void ap_check_sta_ht(const void *key, void *value, void *user_data)
+{
+	struct sta_state *sta = value;
+	struct ap_sta_ht_data *ht_data = user_data;
+
+	if (!sta->associated)
+		return;
+
+	if (!sta->ht_support)
+		ht_data->non_ht = true;
+	else if (!sta->ht_greenfield)
+		ht_data->non_greenfield = true;
+}
+
 static size_t ap_build_ht_operation(struct ap_state *ap, uint8_t *buf)
 {
-	const struct l_queue_entry *e;
-	unsigned int non_ht = false;
-	unsigned int non_greenfield = false;
+	struct ap_sta_ht_data ht_data = {};
 
 	memset(buf, 0, 22);
 	*buf++ = ap->channel;
@@ -1076,22 +1472,12 @@ static size_t ap_build_ht_operation(struct ap_state *ap, uint8_t *buf)
 	*buf |= 1 << 2;
 
 check_stas:
-	for (e = l_queue_get_entries(ap->sta_states); e; e = e->next) {
-		struct sta_state *sta = e->data;
+	l_hashmap_foreach(ap->sta_states, ap_check_sta_ht, &ht_data);
 
-		if (!sta->associated)
-			continue;
-
-		if (!sta->ht_support)
-			non_ht = true;
-		else if (!sta->ht_greenfield)
-			non_greenfield = true;
-	}
-
-	if (non_greenfield)
+	if (ht_data.non_greenfield)
 		set_bit(buf, 10);
 
-	if (non_ht)
+	if (ht_data.non_ht)
 		set_bit(buf, 12);
 
 	/*
@@ -1316,6 +1702,9 @@ void ap_update_beacon(struct ap_state *ap)
 	if (L_WARN_ON(!ap->started))
 		return;
 
+	/* The Probe Response contents follow the Beacon's, rebuild later */
+	l_free(l_steal_ptr(ap->probe_resp));
+
 	head_len = ap_build_beacon_pr_head(ap, MPDU_MANAGEMENT_SUBTYPE_BEACON,
 						bcast_addr, head, sizeof(head));
 	tail_len = ap_build_beacon_pr_tail(ap, MPDU_MANAGEMENT_SUBTYPE_BEACON,
@@ -1483,6 +1872,16 @@ static void ap_handshake_event(struct handshake_state *hs,
 	case HANDSHAKE_EVENT_REKEY_COMPLETE:
 		ap_set_sta_rekey_timer(ap, sta);
 		return;
+	case HANDSHAKE_EVENT_GROUP_REKEY_COMPLETE:
+		ap_sta_gtk_rekey_done(sta);
+
+		if (sta->ptk_rekey_deferred) {
+			sta->ptk_rekey_deferred = false;
+			ap_start_rekey(ap, sta);
+		}
+
+		ap_gtk_rekey_check_done(ap);
+		break;
 	default:
 		break;
 	}
@@ -1680,20 +2079,6 @@ static struct l_genl_msg *ap_build_cmd_new_station(struct sta_state *sta)
 	return msg;
 }
 
-static void ap_gtk_op_cb(struct l_genl_msg *msg, void *user_data)
-{
-	if (l_genl_msg_get_error(msg) < 0) {
-		uint8_t cmd = l_genl_msg_get_command(msg);
-		const char *cmd_name =
-			cmd == NL80211_CMD_NEW_KEY ? "NEW_KEY" :
-			cmd == NL80211_CMD_SET_KEY ? "SET_KEY" :
-			"DEL_KEY";
-
-		l_error("%s failed for the GTK: %i",
-			cmd_name, l_genl_msg_get_error(msg));
-	}
-}
-
 static void ap_associate_sta_cb(struct l_genl_msg *msg, void *user_data)
 {
 	struct sta_state *sta = user_data;
@@ -1775,6 +2160,7 @@ static void ap_associate_sta_cb(struct l_genl_msg *msg, void *user_data)
 		 * just use NL80211_CMD_GET_KEY from now.
 		 */
 		ap->gtk_set = true;
+		ap_gtk_rekey_schedule(ap);
 	}
 
 	if (ap->group_cipher == IE_RSN_CIPHER_SUITE_NO_GROUP_TRAFFIC)
@@ -2267,14 +2653,18 @@ static void ap_assoc_reassoc(struct sta_state *sta, bool reassoc,
 	else if (sta->associated)
 		ap_stop_handshake(sta);
 
-	if (!sta->associated) {
+	if (!sta->associated && !sta->aid) {
 		/*
 		 * Everything fine so far, assign an AID, send response.
 		 * According to 802.11-2016 11.3.5.3 l) we will only go to
 		 * State 3 (set sta->associated) once we receive the station's
 		 * ACK or gave up on resends.
 		 */
-		sta->aid = ++ap->last_aid;
+		sta->aid = ap_sta_alloc_aid(ap);
+		if (!sta->aid) {
+			err = MMPDU_STATUS_CODE_DENIED_NO_MORE_STAS;
+			goto unsupported;
+		}
 	}
 
 	sta->capability = *capability;
@@ -2347,7 +2737,7 @@ static void ap_assoc_req_cb(const struct mmpdu_header *hdr, const void *body,
 			memcmp(hdr->address_3, bssid, 6))
 		return;
 
-	sta = l_queue_find(ap->sta_states, ap_sta_match_addr, from);
+	sta = ap_sta_find(ap, from);
 	if (!sta) {
 		if (!ap_assoc_resp(ap, NULL, from,
 				MMPDU_REASON_CODE_STA_REQ_ASSOC_WITHOUT_AUTH,
@@ -2381,7 +2771,7 @@ static void ap_reassoc_req_cb(const struct mmpdu_header *hdr, const void *body,
 			memcmp(hdr->address_3, bssid, 6))
 		return;
 
-	sta = l_queue_find(ap->sta_states, ap_sta_match_addr, from);
+	sta = ap_sta_find(ap, from);
 	if (!sta) {
 		err = MMPDU_REASON_CODE_STA_REQ_ASSOC_WITHOUT_AUTH;
 		goto bad_frame;
@@ -2415,6 +2805,47 @@ static void ap_probe_resp_cb(int err, void *user_data)
 		l_info("AP Probe Response delivered OK");
 }
 
+static bool ap_probe_req_is_duplicate(struct ap_state *ap,
+					const uint8_t *from)
+{
+	struct ap_probe_record *record =
+		&ap->probe_records[ap_sta_hash(from) % AP_PROBE_RECORDS];
+	uint64_t now = l_time_now();
+
+	if (!memcmp(record->addr, from, 6) &&
+			l_time_diff(record->timestamp, now) <
+			AP_PROBE_COALESCE_TIME)
+		return true;
+
+	memcpy(record->addr, from, 6);
+	record->timestamp = now;
+	return false;
+}
+
+static uint8_t *ap_build_probe_resp(struct ap_state *ap,
+					const struct mmpdu_header *req,
+					size_t req_len, size_t *out_len)
+{
+	uint32_t resp_len;
+	uint8_t *resp;
+	size_t len;
+
+	resp_len = 512 + ap_get_extra_ies_len(ap,
+					MPDU_MANAGEMENT_SUBTYPE_PROBE_RESPONSE,
+					req, req_len);
+	resp = l_new(uint8_t, resp_len);
+	len = ap_build_beacon_pr_head(ap,
+					MPDU_MANAGEMENT_SUBTYPE_PROBE_RESPONSE,
+					req->address_2, resp, resp_len);
+	len += ap_build_beacon_pr_tail(ap,
+					MPDU_MANAGEMENT_SUBTYPE_PROBE_RESPONSE,
+					req, req_len, resp + len,
+					resp_len - len);
+
+	*out_len = len;
+	return resp;
+}
+
 /*
  * Parse Probe Request according to 802.11-2016 9.3.3.10 and act according
  * to 802.11-2016 11.1.4.3
@@ -2431,7 +2862,8 @@ static void ap_probe_req_cb(const struct mmpdu_header *hdr, const void *body,
 	struct ie_tlv_iter iter;
 	const uint8_t *bssid = netdev_get_address(ap->netdev);
 	bool match = false;
-	uint32_t resp_len;
+	bool wsc = false;
+	size_t req_len = body + body_len - (void *) hdr;
 	uint8_t *resp;
 
 	l_info("AP Probe Request from %s",
@@ -2457,6 +2889,15 @@ static void ap_probe_req_cb(const struct mmpdu_header *hdr, const void *body,
 
 			dsss_channel = ie_tlv_iter_get_data(&iter)[0];
 			break;
+
+		case IE_TYPE_VENDOR_SPECIFIC:
+			if (ie_tlv_iter_get_length(&iter) >= 4 &&
+					!memcmp(ie_tlv_iter_get_data(&iter),
+						microsoft_oui, 3) &&
+					ie_tlv_iter_get_data(&iter)[3] == 0x04)
+				wsc = true;
+
+			break;
 		}
 
 	/*
@@ -2504,21 +2945,38 @@ static void ap_probe_req_cb(const struct mmpdu_header *hdr, const void *body,
 	if (!match)
 		return;
 
-	resp_len = 512 + ap_get_extra_ies_len(ap,
-					MPDU_MANAGEMENT_SUBTYPE_PROBE_RESPONSE,
-					hdr, body + body_len - (void *) hdr);
-	resp = l_new(uint8_t, resp_len);
-	len = ap_build_beacon_pr_head(ap,
-					MPDU_MANAGEMENT_SUBTYPE_PROBE_RESPONSE,
-					hdr->address_2, resp, resp_len);
-	len += ap_build_beacon_pr_tail(ap,
-					MPDU_MANAGEMENT_SUBTYPE_PROBE_RESPONSE,
-					hdr, body + body_len - (void *) hdr,
-					resp + len, resp_len - len);
+	/*
+	 * The WSC IE in the request has to be processed and the extra IEs
+	 * from ap->ops may depend on the request, build a new response for
+	 * those.  Otherwise the contents only change along with the Beacon
+	 * and the cached response is sent with only the DA updated.
+	 */
+	if (wsc || ap->ops->write_extra_ies) {
+		resp = ap_build_probe_resp(ap, hdr, req_len, &len);
+		ap_send_mgmt_frame(ap, (struct mmpdu_header *) resp, len,
+					ap_probe_resp_cb, NULL);
+		ap->probe_resp_sent++;
+		l_free(resp);
+		return;
+	}
 
-	ap_send_mgmt_frame(ap, (struct mmpdu_header *) resp, len,
-				ap_probe_resp_cb, NULL);
-	l_free(resp);
+	if (util_is_broadcast_address(hdr->address_1) &&
+			ap_probe_req_is_duplicate(ap, hdr->address_2)) {
+		l_debug("Suppressed duplicate Probe Response to %s",
+			util_address_to_string(hdr->address_2));
+		ap->probe_resp_suppressed++;
+		return;
+	}
+
+	if (!ap->probe_resp)
+		ap->probe_resp = ap_build_probe_resp(ap, hdr, req_len,
+							&ap->probe_resp_len);
+
+	memcpy(((struct mmpdu_header *) ap->probe_resp)->address_1,
+		hdr->address_2, 6);
+	ap_send_mgmt_frame(ap, (struct mmpdu_header *) ap->probe_resp,
+				ap->probe_resp_len, ap_probe_resp_cb, NULL);
+	ap->probe_resp_sent++;
 }
 
 /* 802.11-2016 9.3.3.5 (frame format), 802.11-2016 11.3.5.9 (MLME/SME) */
@@ -2538,7 +2996,7 @@ static void ap_disassoc_cb(const struct mmpdu_header *hdr, const void *body,
 			memcmp(hdr->address_3, bssid, 6))
 		return;
 
-	sta = l_queue_find(ap->sta_states, ap_sta_match_addr, hdr->address_2);
+	sta = ap_sta_find(ap, hdr->address_2);
 
 	if (sta && sta->assoc_resp_cmd_id) {
 		l_genl_family_cancel(ap->nl80211, sta->assoc_resp_cmd_id);
@@ -2635,7 +3093,7 @@ static void ap_auth_cb(const struct mmpdu_header *hdr, const void *body,
 		return;
 	}
 
-	sta = l_queue_find(ap->sta_states, ap_sta_match_addr, from);
+	sta = ap_sta_find(ap, from);
 
 	/*
 	 * Figure 11-13 in 802.11-2016 11.3.2 shows a transition from
@@ -2658,11 +3116,7 @@ static void ap_auth_cb(const struct mmpdu_header *hdr, const void *body,
 	sta = l_new(struct sta_state, 1);
 	memcpy(sta->addr, from, 6);
 	sta->ap = ap;
-
-	if (!ap->sta_states)
-		ap->sta_states = l_queue_new();
-
-	l_queue_push_tail(ap->sta_states, sta);
+	ap_sta_add(ap, sta);
 
 	/*
 	 * Nothing to do here netlink-wise as we can't receive any data
@@ -2903,6 +3357,10 @@ static void ap_ifaddr4_added_cb(int error, uint16_t type, const void *data,
 		return;
 	}
 
+	/* Still deriving the PSK, ap_psk_derived_cb will continue */
+	if (ap->psk_job)
+		return;
+
 	if (!ap_start_send(ap))
 		ap_start_failed(ap, -EIO);
 }
@@ -2963,6 +3421,7 @@ static void ap_handle_new_station(struct ap_state *ap, struct l_genl_msg *msg)
 	const void *data;
 	uint8_t mac[6];
 	uint8_t *assoc_rsne = NULL;
+	uint16_t aid;
 
 	if (!l_genl_attr_init(&attr, msg))
 		return;
@@ -2993,22 +3452,30 @@ static void ap_handle_new_station(struct ap_state *ap, struct l_genl_msg *msg)
 	 * Softmac's should already have a station created. The above check
 	 * may also fail for softmac cards.
 	 */
-	sta = l_queue_find(ap->sta_states, ap_sta_match_addr, mac);
+	sta = ap_sta_find(ap, mac);
 	if (sta)
 		goto cleanup;
 
+	/* The firmware has already associated it, kick it back out */
+	aid = ap_sta_alloc_aid(ap);
+	if (!aid) {
+		l_error("No AID left for station "MAC", rejecting",
+				MAC_STR(mac));
+		msg = nl80211_build_del_station(netdev_get_ifindex(ap->netdev),
+					mac, MMPDU_REASON_CODE_DISASSOC_AP_BUSY,
+					MPDU_MANAGEMENT_SUBTYPE_DISASSOCIATION);
+		l_genl_family_send(ap->nl80211, msg, NULL, NULL, NULL);
+		goto cleanup;
+	}
+
 	sta = l_new(struct sta_state, 1);
 	memcpy(sta->addr, mac, 6);
 	sta->ap = ap;
 	sta->assoc_rsne = assoc_rsne;
-	sta->aid = ++ap->last_aid;
+	sta->aid = aid;
 
 	sta->associated = true;
-
-	if (!ap->sta_states)
-		ap->sta_states = l_queue_new();
-
-	l_queue_push_tail(ap->sta_states, sta);
+	ap_sta_add(ap, sta);
 
 	if (ap->supports_ht)
 		ap_update_beacon(ap);
@@ -3468,11 +3935,34 @@ done:
 	return ret;
 }
 
+static void ap_psk_derived_cb(int err, const uint8_t *psk, void *user_data)
+{
+	struct ap_state *ap = user_data;
+
+	ap->psk_job = 0;
+
+	if (err < 0) {
+		l_error("AP couldn't generate the PSK from given "
+			"[Security].Passphrase value: %s (%i)",
+			strerror(-err), -err);
+		ap_start_failed(ap, err);
+		return;
+	}
+
+	memcpy(ap->psk, psk, 32);
+
+	/* Still setting the IP address, ap_ifaddr4_added_cb will continue */
+	if (ap->rtnl_add_cmd)
+		return;
+
+	if (!ap_start_send(ap))
+		ap_start_failed(ap, -EIO);
+}
+
 static bool ap_load_psk(struct ap_state *ap, const struct l_settings *config)
 {
 	L_AUTO_FREE_VAR(char *, passphrase) =
 		l_settings_get_string(config, "Security", "Passphrase");
-	int err;
 
 	if (passphrase) {
 		if (strlen(passphrase) > 63) {
@@ -3507,16 +3997,18 @@ static bool ap_load_psk(struct ap_state *ap, const struct l_settings *config)
 		return false;
 	}
 
-	err = crypto_psk_from_passphrase(passphrase, (uint8_t *) ap->ssid,
-						strlen(ap->ssid), ap->psk);
-	if (err < 0) {
-		l_error("AP couldn't generate the PSK from given "
-			"[Security].Passphrase value: %s (%i)",
-			strerror(-err), -err);
+	if (!crypto_passphrase_is_valid(passphrase)) {
+		l_error("AP [Security].Passphrase is not a valid passphrase");
 		return false;
 	}
 
-	return true;
+	/* Starting the AP is deferred until the PSK is available */
+	ap->psk_job = crypto_worker_psk_from_passphrase(passphrase,
+						(uint8_t *) ap->ssid,
+						strlen(ap->ssid),
+						ap_psk_derived_cb, ap, NULL);
+
+	return ap->psk_job != 0;
 }
 
 /*
@@ -3771,6 +4263,32 @@ static int ap_load_config(struct ap_state *ap, const struct l_settings *config,
 	} else
 		ap->rekey_time = 0;
 
+	if (l_settings_has_key(config, "General", "GroupRekeyTimeout")) {
+		unsigned int uintval;
+
+		if (!l_settings_get_uint(config, "General",
+					"GroupRekeyTimeout", &uintval)) {
+			l_error("AP [General].GroupRekeyTimeout is not valid");
+			return -EINVAL;
+		}
+
+		ap->gtk_rekey_time = uintval;
+	} else
+		ap->gtk_rekey_time = 0;
+
+	if (l_settings_has_key(config, "General", "GroupRekeyWindow")) {
+		unsigned int uintval;
+
+		if (!l_settings_get_uint(config, "General",
+					"GroupRekeyWindow", &uintval)) {
+			l_error("AP [General].GroupRekeyWindow is not valid");
+			return -EINVAL;
+		}
+
+		ap->gtk_rekey_window = uintval * 1000;
+	} else
+		ap->gtk_rekey_window = AP_GTK_REKEY_DEFAULT_WINDOW * 1000;
+
 	/*
 	 * Since 5GHz won't ever support only CCK rates we can ignore this
 	 * setting on that band.
@@ -3959,6 +4477,9 @@ struct ap_state *ap_start(struct netdev *netdev, struct l_settings *config,
 		return ap;
 	}
 
+	if (ap->psk_job)
+		return ap;
+
 	if (ap_start_send(ap)) {
 		if (err_out)
 			*err_out = 0;
@@ -4095,7 +4616,7 @@ bool ap_station_disconnect(struct ap_state *ap, const uint8_t *mac,
 	if (!ap->started)
 		return false;
 
-	sta = l_queue_remove_if(ap->sta_states, ap_sta_match_addr, mac);
+	sta = l_hashmap_remove(ap->sta_states, mac);
 	if (!sta)
 		return false;
 
@@ -4738,11 +5259,41 @@ static struct l_dbus_message *ap_dbus_get_diagnostics(struct l_dbus *dbus,
 	return NULL;
 }
 
+static struct l_dbus_message *ap_dbus_get_probe_statistics(
+						struct l_dbus *dbus,
+						struct l_dbus_message *message,
+						void *user_data)
+{
+	struct ap_if_data *ap_if = user_data;
+	struct ap_state *ap = ap_if->ap;
+	struct l_dbus_message *reply =
+				l_dbus_message_new_method_return(message);
+	struct l_dbus_message_builder *builder =
+				l_dbus_message_builder_new(reply);
+
+	l_dbus_message_builder_enter_array(builder, "{sv}");
+
+	dbus_append_dict_basic(builder, "ProbeResponsesSent", 'u',
+					&ap->probe_resp_sent);
+	dbus_append_dict_basic(builder, "ProbeResponsesSuppressed", 'u',
+					&ap->probe_resp_suppressed);
+
+	l_dbus_message_builder_leave_array(builder);
+
+	l_dbus_message_builder_finalize(builder);
+	l_dbus_message_builder_destroy(builder);
+
+	return reply;
+}
+
 static void ap_setup_diagnostic_interface(struct l_dbus_interface *interface)
 {
 	l_dbus_interface_method(interface, "GetDiagnostics", 0,
 				ap_dbus_get_diagnostics,
 				"aa{sv}", "", "diagnostic");
+	l_dbus_interface_method(interface, "GetProbeStatistics", 0,
+				ap_dbus_get_probe_statistics,
+				"a{sv}", "", "statistics");
 }
 
 static void ap_diagnostic_interface_destroy(void *user_data)
@@ -4841,3 +5392,4 @@ static void ap_exit(void)
 
 IWD_MODULE(ap, ap_init, ap_exit)
 IWD_MODULE_DEPENDS(ap, netdev);
+IWD_MODULE_DEPENDS(ap, crypto_worker);
@@ -0,0 +1,1146 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2024  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+/*
+ * In-process implementation of the crypto_checksum and crypto_aes API,
+ * selected with --enable-soft-crypto.  The AF_ALG backed ell primitives cost
+ * a socket and several syscalls per operation, which adds up over the many
+ * HMAC, CMAC and AES operations of a handshake or an FT roam.
+ *
+ * SHA-1/SHA-256 use the SHA extensions when the CPU supports them, with
+ * portable C code used otherwise.  AES and AES-CMAC are only done in-process
+ * with AES-NI, see aes_init.
+ */
+#ifdef HAVE_SOFT_CRYPTO
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include <ell/ell.h>
+
+#include "ell/useful.h"
+#include "src/missing.h"
+#include "src/crypto.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+
+#define HAVE_X86_ACCEL
+#endif
+
+#define ROL32(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define ROR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define ROR64(x, n) (((x) >> (n)) | ((x) << (64 - (n))))
+
+#define HASH_MAX_BLOCK_SIZE 128
+#define HASH_MAX_DIGEST_SIZE 64
+
+struct hash_desc;
+
+struct hash_ctx {
+	const struct hash_desc *desc;
+	union {
+		uint32_t w32[8];
+		uint64_t w64[8];
+	} state;
+	uint8_t buf[HASH_MAX_BLOCK_SIZE];
+	size_t buf_len;
+	uint64_t len;
+};
+
+struct hash_desc {
+	enum l_checksum_type type;
+	size_t block_size;
+	size_t digest_len;
+	bool little_endian;
+	void (*init)(struct hash_ctx *ctx);
+	void (*compress)(struct hash_ctx *ctx, const uint8_t *data,
+				size_t blocks);
+};
+
+struct crypto_aes {
+	/* Only used without AES-NI, see aes_init */
+	struct l_cipher *cipher;
+	unsigned int rounds;
+	uint8_t ek[15][16];
+	/* Round keys of the AES-NI equivalent inverse cipher */
+	uint8_t dk[15][16];
+};
+
+enum checksum_kind {
+	CHECKSUM_HASH,
+	CHECKSUM_HMAC,
+	CHECKSUM_CMAC,
+	/* AES-CMAC without AES-NI, see aes_init */
+	CHECKSUM_ELL,
+};
+
+struct crypto_checksum {
+	enum checksum_kind kind;
+	struct hash_ctx ctx;
+	/* HMAC states after the ipad and opad blocks */
+	struct hash_ctx inner;
+	struct hash_ctx outer;
+	/* CMAC */
+	struct crypto_aes aes;
+	uint8_t k1[16];
+	uint8_t k2[16];
+	uint8_t x[16];
+	uint8_t buf[16];
+	size_t buf_len;
+	struct l_checksum *ell;
+};
+
+static bool have_aesni;
+static bool have_shani;
+
+/*
+ * Run once before main() so that the flags are never written while the
+ * crypto worker thread may be reading them
+ */
+static void __attribute__((constructor)) cpu_features_init(void)
+{
+#ifdef HAVE_X86_ACCEL
+	unsigned int eax, ebx, ecx, edx;
+
+	if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+		have_aesni = (ecx & bit_AES) && (ecx & bit_SSE4_1);
+
+		if ((ecx & bit_SSE4_1) &&
+				__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+			have_shani = ebx & bit_SHA;
+	}
+#endif
+}
+
+static void md5_init(struct hash_ctx *ctx)
+{
+	static const uint32_t iv[4] = {
+		0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476,
+	};
+
+	memcpy(ctx->state.w32, iv, sizeof(iv));
+}
+
+static void md5_compress(struct hash_ctx *ctx, const uint8_t *data,
+				size_t blocks)
+{
+	static const uint32_t k[64] = {
+		0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee,
+		0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+		0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+		0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+		0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa,
+		0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+		0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed,
+		0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+		0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+		0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+		0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05,
+		0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+		0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039,
+		0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+		0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+		0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+	};
+	static const uint8_t r[16] = {
+		7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21,
+	};
+	uint32_t *s = ctx->state.w32;
+	uint32_t w[16];
+	uint32_t a, b, c, d, f, t;
+	unsigned int i, g;
+
+	for (; blocks; blocks--, data += 64) {
+		for (i = 0; i < 16; i++)
+			w[i] = l_get_le32(data + i * 4);
+
+		a = s[0];
+		b = s[1];
+		c = s[2];
+		d = s[3];
+
+		for (i = 0; i < 64; i++) {
+			if (i < 16) {
+				f = d ^ (b & (c ^ d));
+				g = i;
+			} else if (i < 32) {
+				f = c ^ (d & (b ^ c));
+				g = (5 * i + 1) & 15;
+			} else if (i < 48) {
+				f = b ^ c ^ d;
+				g = (3 * i + 5) & 15;
+			} else {
+				f = c ^ (b | ~d);
+				g = (7 * i) & 15;
+			}
+
+			t = d;
+			d = c;
+			c = b;
+			b += ROL32(a + f + k[i] + w[g],
+					r[(i / 16) * 4 + (i & 3)]);
+			a = t;
+		}
+
+		s[0] += a;
+		s[1] += b;
+		s[2] += c;
+		s[3] += d;
+	}
+}
+
+static void sha1_init(struct hash_ctx *ctx)
+{
+	static const uint32_t iv[5] = {
+		0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0,
+	};
+
+	memcpy(ctx->state.w32, iv, sizeof(iv));
+}
+
+#ifdef HAVE_X86_ACCEL
+__attribute__((target("sha,sse4.1")))
+static void sha1_ni_compress(uint32_t *s, const uint8_t *data, size_t blocks)
+{
+	const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL,
+						0x08090a0b0c0d0e0fULL);
+	__m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128((void *) s), 0x1b);
+	__m128i e0 = _mm_set_epi32(s[4], 0, 0, 0);
+	__m128i abcd_save;
+	__m128i prev;
+	__m128i e;
+	__m128i m[4];
+	unsigned int i;
+
+	for (; blocks; blocks--, data += 64) {
+		abcd_save = abcd;
+		prev = abcd;
+
+		for (i = 0; i < 4; i++)
+			m[i] = _mm_shuffle_epi8(_mm_loadu_si128((void *)
+							(data + i * 16)), mask);
+
+		/* 20 groups of 4 rounds, message schedule computed alongside */
+		for (i = 0; i < 20; i++) {
+			if (i == 0)
+				e = _mm_add_epi32(e0, m[0]);
+			else
+				e = _mm_sha1nexte_epu32(prev, m[i & 3]);
+
+			prev = abcd;
+
+			switch (i / 5) {
+			case 0:
+				abcd = _mm_sha1rnds4_epu32(abcd, e, 0);
+				break;
+			case 1:
+				abcd = _mm_sha1rnds4_epu32(abcd, e, 1);
+				break;
+			case 2:
+				abcd = _mm_sha1rnds4_epu32(abcd, e, 2);
+				break;
+			default:
+				abcd = _mm_sha1rnds4_epu32(abcd, e, 3);
+				break;
+			}
+
+			if (i >= 3 && i <= 18)
+				m[(i + 1) & 3] = _mm_sha1msg2_epu32(
+							m[(i + 1) & 3],
+							m[i & 3]);
+
+			if (i >= 1 && i <= 16)
+				m[(i - 1) & 3] = _mm_sha1msg1_epu32(
+							m[(i - 1) & 3],
+							m[i & 3]);
+
+			if (i >= 2 && i <= 17)
+				m[(i - 2) & 3] = _mm_xor_si128(m[(i - 2) & 3],
+								m[i & 3]);
+		}
+
+		e0 = _mm_sha1nexte_epu32(prev, e0);
+		abcd = _mm_add_epi32(abcd, abcd_save);
+	}
+
+	_mm_storeu_si128((void *) s, _mm_shuffle_epi32(abcd, 0x1b));
+	s[4] = _mm_extract_epi32(e0, 3);
+}
+#endif
+
+static void sha1_compress(struct hash_ctx *ctx, const uint8_t *data,
+				size_t blocks)
+{
+	uint32_t *s = ctx->state.w32;
+	uint32_t w[16];
+	uint32_t a, b, c, d, e, f, k, t;
+	unsigned int i;
+
+#ifdef HAVE_X86_ACCEL
+	if (have_shani) {
+		sha1_ni_compress(s, data, blocks);
+		return;
+	}
+#endif
+
+	for (; blocks; blocks--, data += 64) {
+		a = s[0];
+		b = s[1];
+		c = s[2];
+		d = s[3];
+		e = s[4];
+
+		for (i = 0; i < 80; i++) {
+			if (i < 16)
+				w[i] = l_get_be32(data + i * 4);
+			else {
+				t = w[(i + 13) & 15] ^ w[(i + 8) & 15] ^
+					w[(i + 2) & 15] ^ w[i & 15];
+				w[i & 15] = ROL32(t, 1);
+			}
+
+			if (i < 20) {
+				f = d ^ (b & (c ^ d));
+				k = 0x5a827999;
+			} else if (i < 40) {
+				f = b ^ c ^ d;
+				k = 0x6ed9eba1;
+			} else if (i < 60) {
+				f = (b & c) | (d & (b | c));
+				k = 0x8f1bbcdc;
+			} else {
+				f = b ^ c ^ d;
+				k = 0xca62c1d6;
+			}
+
+			t = ROL32(a, 5) + f + e + k + w[i & 15];
+			e = d;
+			d = c;
+			c = ROL32(b, 30);
+			b = a;
+			a = t;
+		}
+
+		s[0] += a;
+		s[1] += b;
+		s[2] += c;
+		s[3] += d;
+		s[4] += e;
+	}
+}
+
+static const uint32_t sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static void sha256_init(struct hash_ctx *ctx)
+{
+	static const uint32_t iv[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+		0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+	};
+
+	memcpy(ctx->state.w32, iv, sizeof(iv));
+}
+
+#ifdef HAVE_X86_ACCEL
+__attribute__((target("sha,sse4.1")))
+static void sha256_ni_compress(uint32_t *s, const uint8_t *data,
+				size_t blocks)
+{
+	const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+						0x0405060700010203ULL);
+	__m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((void *) s), 0xb1);
+	__m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((void *) (s + 4)),
+						0x1b);
+	/* ABEF and CDGH, the layout used by the SHA256RNDS2 instruction */
+	__m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+	__m128i abef_save;
+	__m128i cdgh_save;
+	__m128i msg;
+	__m128i m[4];
+	unsigned int i;
+
+	state1 = _mm_blend_epi16(state1, tmp, 0xf0);
+
+	for (; blocks; blocks--, data += 64) {
+		abef_save = state0;
+		cdgh_save = state1;
+
+		for (i = 0; i < 4; i++)
+			m[i] = _mm_shuffle_epi8(_mm_loadu_si128((void *)
+							(data + i * 16)), mask);
+
+		/* 16 groups of 4 rounds, message schedule computed alongside */
+		for (i = 0; i < 16; i++) {
+			msg = _mm_add_epi32(m[i & 3], _mm_loadu_si128((void *)
+							(sha256_k + i * 4)));
+			state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+			msg = _mm_shuffle_epi32(msg, 0x0e);
+			state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+
+			if (i >= 12)
+				continue;
+
+			tmp = _mm_sha256msg1_epu32(m[i & 3], m[(i + 1) & 3]);
+			tmp = _mm_add_epi32(tmp, _mm_alignr_epi8(m[(i + 3) & 3],
+							m[(i + 2) & 3], 4));
+			m[i & 3] = _mm_sha256msg2_epu32(tmp, m[(i + 3) & 3]);
+		}
+
+		state0 = _mm_add_epi32(state0, abef_save);
+		state1 = _mm_add_epi32(state1, cdgh_save);
+	}
+
+	tmp = _mm_shuffle_epi32(state0, 0x1b);
+	state1 = _mm_shuffle_epi32(state1, 0xb1);
+	_mm_storeu_si128((void *) s, _mm_blend_epi16(tmp, state1, 0xf0));
+	_mm_storeu_si128((void *) (s + 4), _mm_alignr_epi8(state1, tmp, 8));
+}
+#endif
+
+static void sha256_compress(struct hash_ctx *ctx, const uint8_t *data,
+				size_t blocks)
+{
+	uint32_t *s = ctx->state.w32;
+	uint32_t w[64];
+	uint32_t v[8];
+	uint32_t t1, t2;
+	unsigned int i;
+
+#ifdef HAVE_X86_ACCEL
+	if (have_shani) {
+		sha256_ni_compress(s, data, blocks);
+		return;
+	}
+#endif
+
+	for (; blocks; blocks--, data += 64) {
+		for (i = 0; i < 16; i++)
+			w[i] = l_get_be32(data + i * 4);
+
+		for (i = 16; i < 64; i++)
+			w[i] = w[i - 16] + w[i - 7] +
+				(ROR32(w[i - 15], 7) ^ ROR32(w[i - 15], 18) ^
+					(w[i - 15] >> 3)) +
+				(ROR32(w[i - 2], 17) ^ ROR32(w[i - 2], 19) ^
+					(w[i - 2] >> 10));
+
+		memcpy(v, s, sizeof(v));
+
+		for (i = 0; i < 64; i++) {
+			t1 = v[7] + (ROR32(v[4], 6) ^ ROR32(v[4], 11) ^
+					ROR32(v[4], 25)) +
+				(v[6] ^ (v[4] & (v[5] ^ v[6]))) +
+				sha256_k[i] + w[i];
+			t2 = (ROR32(v[0], 2) ^ ROR32(v[0], 13) ^
+					ROR32(v[0], 22)) +
+				((v[0] & v[1]) | (v[2] & (v[0] | v[1])));
+			memmove(v + 1, v, 7 * sizeof(uint32_t));
+			v[4] += t1;
+			v[0] = t1 + t2;
+		}
+
+		for (i = 0; i < 8; i++)
+			s[i] += v[i];
+	}
+}
+
+static void sha384_init(struct hash_ctx *ctx)
+{
+	static const uint64_t iv[8] = {
+		0xcbbb9d5dc1059ed8ULL, 0x629a292a367cd507ULL,
+		0x9159015a3070dd17ULL, 0x152fecd8f70e5939ULL,
+		0x67332667ffc00b31ULL, 0x8eb44a8768581511ULL,
+		0xdb0c2e0d64f98fa7ULL, 0x47b5481dbefa4fa4ULL,
+	};
+
+	memcpy(ctx->state.w64, iv, sizeof(iv));
+}
+
+static void sha512_init(struct hash_ctx *ctx)
+{
+	static const uint64_t iv[8] = {
+		0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL,
+		0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+		0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL,
+		0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL,
+	};
+
+	memcpy(ctx->state.w64, iv, sizeof(iv));
+}
+
+static void sha512_compress(struct hash_ctx *ctx, const uint8_t *data,
+				size_t blocks)
+{
+	static const uint64_t k[80] = {
+		0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL,
+		0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
+		0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL,
+		0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
+		0xd807aa98a3030242ULL, 0x12835b0145706fbeULL,
+		0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+		0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL,
+		0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
+		0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL,
+		0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+		0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL,
+		0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+		0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL,
+		0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
+		0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL,
+		0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
+		0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL,
+		0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+		0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL,
+		0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+		0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL,
+		0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
+		0xd192e819d6ef5218ULL, 0xd69906245565a910ULL,
+		0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+		0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL,
+		0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
+		0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL,
+		0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
+		0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL,
+		0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+		0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL,
+		0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
+		0xca273eceea26619cULL, 0xd186b8c721c0c207ULL,
+		0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
+		0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL,
+		0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+		0x28db77f523047d84ULL, 0x32caab7b40c72493ULL,
+		0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
+		0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL,
+		0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL,
+	};
+	uint64_t *s = ctx->state.w64;
+	uint64_t w[80];
+	uint64_t v[8];
+	uint64_t t1, t2;
+	unsigned int i;
+
+	for (; blocks; blocks--, data += 128) {
+		for (i = 0; i < 16; i++)
+			w[i] = l_get_be64(data + i * 8);
+
+		for (i = 16; i < 80; i++)
+			w[i] = w[i - 16] + w[i - 7] +
+				(ROR64(w[i - 15], 1) ^ ROR64(w[i - 15], 8) ^
+					(w[i - 15] >> 7)) +
+				(ROR64(w[i - 2], 19) ^ ROR64(w[i - 2], 61) ^
+					(w[i - 2] >> 6));
+
+		memcpy(v, s, sizeof(v));
+
+		for (i = 0; i < 80; i++) {
+			t1 = v[7] + (ROR64(v[4], 14) ^ ROR64(v[4], 18) ^
+					ROR64(v[4], 41)) +
+				(v[6] ^ (v[4] & (v[5] ^ v[6]))) + k[i] + w[i];
+			t2 = (ROR64(v[0], 28) ^ ROR64(v[0], 34) ^
+					ROR64(v[0], 39)) +
+				((v[0] & v[1]) | (v[2] & (v[0] | v[1])));
+			memmove(v + 1, v, 7 * sizeof(uint64_t));
+			v[4] += t1;
+			v[0] = t1 + t2;
+		}
+
+		for (i = 0; i < 8; i++)
+			s[i] += v[i];
+	}
+}
+
+static const struct hash_desc hash_descs[] = {
+	{ L_CHECKSUM_MD5, 64, 16, true, md5_init, md5_compress },
+	{ L_CHECKSUM_SHA1, 64, 20, false, sha1_init, sha1_compress },
+	{ L_CHECKSUM_SHA256, 64, 32, false, sha256_init, sha256_compress },
+	{ L_CHECKSUM_SHA384, 128, 48, false, sha384_init, sha512_compress },
+	{ L_CHECKSUM_SHA512, 128, 64, false, sha512_init, sha512_compress },
+};
+
+static const struct hash_desc *hash_find(enum l_checksum_type type)
+{
+	unsigned int i;
+
+	for (i = 0; i < L_ARRAY_SIZE(hash_descs); i++)
+		if (hash_descs[i].type == type)
+			return &hash_descs[i];
+
+	return NULL;
+}
+
+static void hash_init(struct hash_ctx *ctx, const struct hash_desc *desc)
+{
+	ctx->desc = desc;
+	ctx->buf_len = 0;
+	ctx->len = 0;
+	desc->init(ctx);
+}
+
+static void hash_update(struct hash_ctx *ctx, const void *data, size_t len)
+{
+	const struct hash_desc *desc = ctx->desc;
+	const uint8_t *p = data;
+	size_t n;
+
+	ctx->len += len;
+
+	if (ctx->buf_len) {
+		n = minsize(len, desc->block_size - ctx->buf_len);
+		memcpy(ctx->buf + ctx->buf_len, p, n);
+		ctx->buf_len += n;
+		p += n;
+		len -= n;
+
+		if (ctx->buf_len < desc->block_size)
+			return;
+
+		desc->compress(ctx, ctx->buf, 1);
+		ctx->buf_len = 0;
+	}
+
+	n = len / desc->block_size;
+	if (n) {
+		desc->compress(ctx, p, n);
+		p += n * desc->block_size;
+		len -= n * desc->block_size;
+	}
+
+	memcpy(ctx->buf, p, len);
+	ctx->buf_len = len;
+}
+
+static void hash_final(struct hash_ctx *ctx, uint8_t *out)
+{
+	const struct hash_desc *desc = ctx->desc;
+	/* 64 bit length for 64 byte blocks, 128 bit for 128 byte blocks */
+	size_t len_size = desc->block_size / 8;
+	uint64_t bits = ctx->len * 8;
+	unsigned int i;
+
+	ctx->buf[ctx->buf_len++] = 0x80;
+
+	if (ctx->buf_len > desc->block_size - len_size) {
+		memset(ctx->buf + ctx->buf_len, 0,
+				desc->block_size - ctx->buf_len);
+		desc->compress(ctx, ctx->buf, 1);
+		ctx->buf_len = 0;
+	}
+
+	memset(ctx->buf + ctx->buf_len, 0, desc->block_size - ctx->buf_len);
+
+	if (desc->little_endian)
+		l_put_le64(bits, ctx->buf + desc->block_size - 8);
+	else
+		l_put_be64(bits, ctx->buf + desc->block_size - 8);
+
+	desc->compress(ctx, ctx->buf, 1);
+
+	if (desc->block_size == 128)
+		for (i = 0; i < desc->digest_len / 8; i++)
+			l_put_be64(ctx->state.w64[i], out + i * 8);
+	else if (desc->little_endian)
+		for (i = 0; i < desc->digest_len / 4; i++)
+			l_put_le32(ctx->state.w32[i], out + i * 4);
+	else
+		for (i = 0; i < desc->digest_len / 4; i++)
+			l_put_be32(ctx->state.w32[i], out + i * 4);
+
+	explicit_bzero(ctx->buf, sizeof(ctx->buf));
+}
+
+#ifdef HAVE_X86_ACCEL
+/* SubWord() of the key expansion, AESKEYGENASSIST applies it to dword 1 */
+__attribute__((target("aes,sse4.1")))
+static uint32_t aes_ni_sub_word(uint32_t w)
+{
+	return _mm_cvtsi128_si32(_mm_aeskeygenassist_si128(
+					_mm_set_epi32(0, 0, w, 0), 0));
+}
+
+__attribute__((target("aes,sse4.1")))
+static void aes_ni_init_dk(struct crypto_aes *aes)
+{
+	unsigned int r;
+
+	memcpy(aes->dk[0], aes->ek[aes->rounds], 16);
+
+	for (r = 1; r < aes->rounds; r++)
+		_mm_storeu_si128((void *) aes->dk[r], _mm_aesimc_si128(
+				_mm_loadu_si128((void *)
+						aes->ek[aes->rounds - r])));
+
+	memcpy(aes->dk[aes->rounds], aes->ek[0], 16);
+}
+
+static void aes_ni_expand_key(struct crypto_aes *aes, const void *key,
+				size_t key_len)
+{
+	uint8_t *w = aes->ek[0];
+	unsigned int nk = key_len / 4;
+	unsigned int i;
+	uint8_t rcon = 0x01;
+	uint32_t t;
+
+	aes->rounds = nk + 6;
+	memcpy(w, key, key_len);
+
+	/* Words are little endian so RotWord() is a rotation by one byte */
+	for (i = nk; i < 4 * (aes->rounds + 1); i++) {
+		t = l_get_le32(w + (i - 1) * 4);
+
+		if (i % nk == 0) {
+			t = aes_ni_sub_word(ROR32(t, 8)) ^ rcon;
+			rcon = (rcon << 1) ^ ((rcon >> 7) * 0x1b);
+		} else if (nk > 6 && i % nk == 4)
+			t = aes_ni_sub_word(t);
+
+		l_put_le32(l_get_le32(w + (i - nk) * 4) ^ t, w + i * 4);
+	}
+
+	aes_ni_init_dk(aes);
+	explicit_bzero(&t, sizeof(t));
+}
+
+__attribute__((target("aes,sse4.1")))
+static void aes_ni_encrypt(const struct crypto_aes *aes, const uint8_t *in,
+				uint8_t *out, size_t blocks)
+{
+	__m128i b;
+	unsigned int r;
+
+	for (; blocks; blocks--, in += 16, out += 16) {
+		b = _mm_xor_si128(_mm_loadu_si128((void *) in),
+					_mm_loadu_si128((void *) aes->ek[0]));
+
+		for (r = 1; r < aes->rounds; r++)
+			b = _mm_aesenc_si128(b, _mm_loadu_si128((void *)
+							aes->ek[r]));
+
+		b = _mm_aesenclast_si128(b, _mm_loadu_si128((void *)
+							aes->ek[r]));
+		_mm_storeu_si128((void *) out, b);
+	}
+}
+
+__attribute__((target("aes,sse4.1")))
+static void aes_ni_decrypt(const struct crypto_aes *aes, const uint8_t *in,
+				uint8_t *out, size_t blocks)
+{
+	__m128i b;
+	unsigned int r;
+
+	for (; blocks; blocks--, in += 16, out += 16) {
+		b = _mm_xor_si128(_mm_loadu_si128((void *) in),
+					_mm_loadu_si128((void *) aes->dk[0]));
+
+		for (r = 1; r < aes->rounds; r++)
+			b = _mm_aesdec_si128(b, _mm_loadu_si128((void *)
+							aes->dk[r]));
+
+		b = _mm_aesdeclast_si128(b, _mm_loadu_si128((void *)
+							aes->dk[r]));
+		_mm_storeu_si128((void *) out, b);
+	}
+}
+#endif
+
+/*
+ * There is no portable AES in this backend.  A fast one would be table
+ * based, and lookups indexed by key dependent data leak the key through
+ * cache timing.  Without AES-NI, AES is left to ell as in the default
+ * backend.
+ */
+static bool aes_init(struct crypto_aes *aes, const void *key, size_t key_len)
+{
+	if (key_len != 16 && key_len != 24 && key_len != 32)
+		return false;
+
+#ifdef HAVE_X86_ACCEL
+	if (have_aesni) {
+		aes_ni_expand_key(aes, key, key_len);
+		return true;
+	}
+#endif
+
+	aes->cipher = l_cipher_new(L_CIPHER_AES, key, key_len);
+
+	return aes->cipher != NULL;
+}
+
+static bool aes_encrypt(const struct crypto_aes *aes, const uint8_t *in,
+				uint8_t *out, size_t blocks)
+{
+#ifdef HAVE_X86_ACCEL
+	if (have_aesni) {
+		aes_ni_encrypt(aes, in, out, blocks);
+		return true;
+	}
+#endif
+
+	return l_cipher_encrypt(aes->cipher, in, out, blocks * 16);
+}
+
+static bool aes_decrypt(const struct crypto_aes *aes, const uint8_t *in,
+				uint8_t *out, size_t blocks)
+{
+#ifdef HAVE_X86_ACCEL
+	if (have_aesni) {
+		aes_ni_decrypt(aes, in, out, blocks);
+		return true;
+	}
+#endif
+
+	return l_cipher_decrypt(aes->cipher, in, out, blocks * 16);
+}
+
+static void aes_clear(struct crypto_aes *aes)
+{
+	l_cipher_free(aes->cipher);
+	explicit_bzero(aes, sizeof(*aes));
+}
+
+struct crypto_aes *crypto_aes_new(const void *key, size_t key_len)
+{
+	struct crypto_aes *aes = l_new(struct crypto_aes, 1);
+
+	if (!aes_init(aes, key, key_len)) {
+		l_free(aes);
+		return NULL;
+	}
+
+	return aes;
+}
+
+bool crypto_aes_encrypt(struct crypto_aes *aes, const void *in, void *out,
+			size_t len)
+{
+	if (!aes || len % 16)
+		return false;
+
+	return aes_encrypt(aes, in, out, len / 16);
+}
+
+bool crypto_aes_decrypt(struct crypto_aes *aes, const void *in, void *out,
+			size_t len)
+{
+	if (!aes || len % 16)
+		return false;
+
+	return aes_decrypt(aes, in, out, len / 16);
+}
+
+void crypto_aes_free(struct crypto_aes *aes)
+{
+	if (!aes)
+		return;
+
+	aes_clear(aes);
+	l_free(aes);
+}
+
+struct crypto_checksum *crypto_checksum_new(enum l_checksum_type type)
+{
+	const struct hash_desc *desc = hash_find(type);
+	struct crypto_checksum *checksum;
+
+	if (!desc)
+		return NULL;
+
+	checksum = l_new(struct crypto_checksum, 1);
+	checksum->kind = CHECKSUM_HASH;
+	hash_init(&checksum->ctx, desc);
+
+	return checksum;
+}
+
+struct crypto_checksum *crypto_checksum_new_hmac(enum l_checksum_type type,
+						const void *key,
+						size_t key_len)
+{
+	const struct hash_desc *desc = hash_find(type);
+	struct crypto_checksum *checksum;
+	uint8_t pad[HASH_MAX_BLOCK_SIZE] = {};
+	unsigned int i;
+
+	if (!desc)
+		return NULL;
+
+	checksum = l_new(struct crypto_checksum, 1);
+	checksum->kind = CHECKSUM_HMAC;
+
+	/* Keys longer than a block are hashed first */
+	if (key_len > desc->block_size) {
+		hash_init(&checksum->inner, desc);
+		hash_update(&checksum->inner, key, key_len);
+		hash_final(&checksum->inner, pad);
+	} else
+		memcpy(pad, key, key_len);
+
+	for (i = 0; i < desc->block_size; i++)
+		pad[i] ^= 0x36;
+
+	hash_init(&checksum->inner, desc);
+	hash_update(&checksum->inner, pad, desc->block_size);
+
+	for (i = 0; i < desc->block_size; i++)
+		pad[i] ^= 0x36 ^ 0x5c;
+
+	hash_init(&checksum->outer, desc);
+	hash_update(&checksum->outer, pad, desc->block_size);
+
+	checksum->ctx = checksum->inner;
+
+	explicit_bzero(pad, sizeof(pad));
+	return checksum;
+}
+
+static void block_xor(uint8_t *b, const uint8_t *x)
+{
+	unsigned int i;
+
+	for (i = 0; i < 16; i++)
+		b[i] ^= x[i];
+}
+
+/* RFC 4493 Section 2.3 - Subkey Generation */
+static void cmac_dbl(const uint8_t *in, uint8_t *out)
+{
+	uint8_t msb = in[0] >> 7;
+	unsigned int i;
+
+	for (i = 0; i < 15; i++)
+		out[i] = (in[i] << 1) | (in[i + 1] >> 7);
+
+	out[15] = (in[15] << 1) ^ (msb * 0x87);
+}
+
+struct crypto_checksum *crypto_checksum_new_cmac_aes(const void *key,
+							size_t key_len)
+{
+	struct crypto_checksum *checksum;
+	struct l_checksum *ell;
+	uint8_t l[16] = {};
+
+	if (!have_aesni) {
+		ell = l_checksum_new_cmac_aes(key, key_len);
+		if (!ell)
+			return NULL;
+
+		checksum = l_new(struct crypto_checksum, 1);
+		checksum->kind = CHECKSUM_ELL;
+		checksum->ell = ell;
+		return checksum;
+	}
+
+	checksum = l_new(struct crypto_checksum, 1);
+	checksum->kind = CHECKSUM_CMAC;
+
+	if (!aes_init(&checksum->aes, key, key_len)) {
+		l_free(checksum);
+		return NULL;
+	}
+
+	aes_encrypt(&checksum->aes, l, l, 1);
+	cmac_dbl(l, checksum->k1);
+	cmac_dbl(checksum->k1, checksum->k2);
+
+	explicit_bzero(l, sizeof(l));
+	return checksum;
+}
+
+static void cmac_update(struct crypto_checksum *checksum, const uint8_t *p,
+			size_t len)
+{
+	size_t n;
+
+	/* The last block is held back, it is treated specially by cmac_final */
+	while (len) {
+		if (checksum->buf_len == 16) {
+			block_xor(checksum->x, checksum->buf);
+			aes_encrypt(&checksum->aes, checksum->x,
+					checksum->x, 1);
+			checksum->buf_len = 0;
+		}
+
+		n = minsize(len, 16 - checksum->buf_len);
+		memcpy(checksum->buf + checksum->buf_len, p, n);
+		checksum->buf_len += n;
+		p += n;
+		len -= n;
+	}
+}
+
+static void cmac_final(struct crypto_checksum *checksum, uint8_t *out)
+{
+	if (checksum->buf_len == 16)
+		block_xor(checksum->buf, checksum->k1);
+	else {
+		memset(checksum->buf + checksum->buf_len, 0,
+				16 - checksum->buf_len);
+		checksum->buf[checksum->buf_len] = 0x80;
+		block_xor(checksum->buf, checksum->k2);
+	}
+
+	block_xor(checksum->x, checksum->buf);
+	aes_encrypt(&checksum->aes, checksum->x, out, 1);
+}
+
+void crypto_checksum_reset(struct crypto_checksum *checksum)
+{
+	if (!checksum)
+		return;
+
+	switch (checksum->kind) {
+	case CHECKSUM_HASH:
+		hash_init(&checksum->ctx, checksum->ctx.desc);
+		break;
+	case CHECKSUM_HMAC:
+		checksum->ctx = checksum->inner;
+		break;
+	case CHECKSUM_CMAC:
+		memset(checksum->x, 0, sizeof(checksum->x));
+		explicit_bzero(checksum->buf, sizeof(checksum->buf));
+		checksum->buf_len = 0;
+		break;
+	case CHECKSUM_ELL:
+		l_checksum_reset(checksum->ell);
+		break;
+	}
+}
+
+bool crypto_checksum_update(struct crypto_checksum *checksum,
+				const void *data, size_t len)
+{
+	if (!checksum)
+		return false;
+
+	switch (checksum->kind) {
+	case CHECKSUM_HASH:
+	case CHECKSUM_HMAC:
+		hash_update(&checksum->ctx, data, len);
+		break;
+	case CHECKSUM_CMAC:
+		cmac_update(checksum, data, len);
+		break;
+	case CHECKSUM_ELL:
+		return l_checksum_update(checksum->ell, data, len);
+	}
+
+	return true;
+}
+
+bool crypto_checksum_updatev(struct crypto_checksum *checksum,
+				const struct iovec *iov, size_t iov_len)
+{
+	size_t i;
+
+	if (!checksum)
+		return false;
+
+	for (i = 0; i < iov_len; i++)
+		crypto_checksum_update(checksum, iov[i].iov_base,
+					iov[i].iov_len);
+
+	return true;
+}
+
+/*
+ * Same semantics as l_checksum_get_digest, the digest is truncated to len
+ * and the checksum is reset afterwards
+ */
+ssize_t crypto_checksum_get_digest(struct crypto_checksum *checksum,
+					void *digest, size_t len)
+{
+	uint8_t out[HASH_MAX_DIGEST_SIZE];
+	size_t digest_len;
+
+	if (!checksum)
+		return -EINVAL;
+
+	switch (checksum->kind) {
+	case CHECKSUM_HASH:
+		digest_len = checksum->ctx.desc->digest_len;
+		hash_final(&checksum->ctx, out);
+		break;
+	case CHECKSUM_HMAC:
+		digest_len = checksum->ctx.desc->digest_len;
+		hash_final(&checksum->ctx, out);
+		checksum->ctx = checksum->outer;
+		hash_update(&checksum->ctx, out, digest_len);
+		hash_final(&checksum->ctx, out);
+		break;
+	case CHECKSUM_CMAC:
+		digest_len = 16;
+		cmac_final(checksum, out);
+		break;
+	case CHECKSUM_ELL:
+		return l_checksum_get_digest(checksum->ell, digest, len);
+	default:
+		return -EINVAL;
+	}
+
+	len = minsize(len, digest_len);
+	memcpy(digest, out, len);
+	explicit_bzero(out, sizeof(out));
+
+	crypto_checksum_reset(checksum);
+
+	return len;
+}
+
+void crypto_checksum_free(struct crypto_checksum *checksum)
+{
+	if (!checksum)
+		return;
+
+	l_checksum_free(checksum->ell);
+	explicit_bzero(checksum, sizeof(*checksum));
+	l_free(checksum);
+}
+
+#endif /* HAVE_SOFT_CRYPTO */
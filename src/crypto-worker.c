@@ -0,0 +1,532 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2024  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include <ell/ell.h>
+
+#include "ell/useful.h"
+#include "src/missing.h"
+#include "src/module.h"
+#include "src/crypto.h"
+#include "src/crypto-worker.h"
+
+/*
+ * PBKDF2 and SAE hash-to-element derivations take long enough to stall the
+ * main loop, especially on slow hardware with many profiles.  These are run
+ * by a worker thread instead, with completion callbacks dispatched back on
+ * the main loop.  Only the job itself runs in the worker, it must not touch
+ * any state other than the job structure, nor use l_debug and friends.
+ *
+ * ell is not thread-safe, so the worker only runs self-contained code, i.e.
+ * the in-tree PBKDF2 and field arithmetic, on plain buffers.  For SAE PTs the
+ * hashing into u1 and u2 is done with ell when the job is submitted, which is
+ * cheap, the worker then maps these onto the curve and the point is built
+ * from the resulting coordinates once back on the main loop.
+ */
+
+/* Number of PSK jobs the worker picks up at once */
+#define CRYPTO_WORKER_PSK_BATCH 4
+
+enum crypto_job_state {
+	CRYPTO_JOB_STATE_PENDING,
+	CRYPTO_JOB_STATE_RUNNING,
+	CRYPTO_JOB_STATE_DONE,
+};
+
+struct crypto_job {
+	uint32_t id;
+	enum crypto_job_state state;
+	void (*run)(struct crypto_job *job);
+	void (*complete)(struct crypto_job *job);
+	void *func;
+	void *user_data;
+	crypto_worker_destroy_func_t destroy;
+	/* Used if the worker thread couldn't be started */
+	struct l_idle *idle;
+	/* Inputs */
+	char *passphrase;
+	char *identifier;
+	char ssid[33];
+	size_t ssid_len;
+	unsigned int group;
+	uint8_t u1[L_ECC_SCALAR_MAX_BYTES];
+	uint8_t u2[L_ECC_SCALAR_MAX_BYTES];
+	/* Outputs */
+	int err;
+	uint8_t psk[32];
+	uint8_t pt[L_ECC_POINT_MAX_BYTES];
+};
+
+static uint32_t next_job_id;
+/* All jobs not yet completed, only accessed from the main loop */
+static struct l_queue *jobs;
+
+/* Protected by 'lock' */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pending_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static struct l_queue *pending;
+static struct l_queue *done;
+static bool quit;
+
+static pthread_t worker;
+static bool worker_started;
+static struct l_io *done_io;
+
+static void crypto_job_free(struct crypto_job *job)
+{
+	if (job->idle)
+		l_idle_remove(job->idle);
+
+	if (job->destroy)
+		job->destroy(job->user_data);
+
+	if (job->passphrase) {
+		explicit_bzero(job->passphrase, strlen(job->passphrase));
+		l_free(job->passphrase);
+	}
+
+	if (job->identifier) {
+		explicit_bzero(job->identifier, strlen(job->identifier));
+		l_free(job->identifier);
+	}
+
+	explicit_bzero(job->psk, sizeof(job->psk));
+	explicit_bzero(job->u1, sizeof(job->u1));
+	explicit_bzero(job->u2, sizeof(job->u2));
+	explicit_bzero(job->pt, sizeof(job->pt));
+
+	l_free(job);
+}
+
+static bool crypto_job_match(const void *a, const void *b)
+{
+	const struct crypto_job *job = a;
+
+	return job->id == L_PTR_TO_UINT(b);
+}
+
+static void crypto_job_complete(struct crypto_job *job)
+{
+	l_queue_remove(jobs, job);
+
+	if (job->func)
+		job->complete(job);
+
+	crypto_job_free(job);
+}
+
+static void crypto_job_run_psk(struct crypto_job *job)
+{
+	job->err = crypto_psk_from_passphrase(job->passphrase,
+						(const uint8_t *) job->ssid,
+						job->ssid_len, job->psk);
+}
+
+static void crypto_job_run_psk_batch(struct crypto_job **batch,
+					unsigned int n_jobs)
+{
+	struct crypto_psk_derivation reqs[CRYPTO_WORKER_PSK_BATCH] = {};
+	unsigned int i;
+
+	for (i = 0; i < n_jobs; i++) {
+		reqs[i].passphrase = batch[i]->passphrase;
+		reqs[i].ssid = (const uint8_t *) batch[i]->ssid;
+		reqs[i].ssid_len = batch[i]->ssid_len;
+	}
+
+	crypto_psk_from_passphrase_batch(reqs, n_jobs);
+
+	for (i = 0; i < n_jobs; i++) {
+		batch[i]->err = reqs[i].err;
+		memcpy(batch[i]->psk, reqs[i].psk, sizeof(batch[i]->psk));
+	}
+
+	explicit_bzero(reqs, sizeof(reqs));
+}
+
+static void *crypto_worker_thread(void *user_data)
+{
+	struct crypto_job *batch[CRYPTO_WORKER_PSK_BATCH];
+	struct crypto_job *job;
+	unsigned int n_jobs;
+	unsigned int i;
+
+	pthread_mutex_lock(&lock);
+
+	while (!quit) {
+		job = l_queue_pop_head(pending);
+		if (!job) {
+			pthread_cond_wait(&pending_cond, &lock);
+			continue;
+		}
+
+		batch[0] = job;
+		n_jobs = 1;
+
+		/*
+		 * PSK jobs queued back to back, e.g. when the known networks
+		 * are loaded, are derived together by the multi-buffer PBKDF2
+		 */
+		while (job->run == crypto_job_run_psk &&
+				n_jobs < L_ARRAY_SIZE(batch)) {
+			struct crypto_job *next = l_queue_peek_head(pending);
+
+			if (!next || next->run != crypto_job_run_psk)
+				break;
+
+			batch[n_jobs++] = l_queue_pop_head(pending);
+		}
+
+		for (i = 0; i < n_jobs; i++)
+			batch[i]->state = CRYPTO_JOB_STATE_RUNNING;
+
+		pthread_mutex_unlock(&lock);
+
+		if (n_jobs > 1)
+			crypto_job_run_psk_batch(batch, n_jobs);
+		else
+			job->run(job);
+
+		pthread_mutex_lock(&lock);
+
+		for (i = 0; i < n_jobs; i++) {
+			batch[i]->state = CRYPTO_JOB_STATE_DONE;
+			l_queue_push_tail(done, batch[i]);
+		}
+
+		pthread_cond_broadcast(&done_cond);
+
+		eventfd_write(l_io_get_fd(done_io), 1);
+	}
+
+	pthread_mutex_unlock(&lock);
+
+	return NULL;
+}
+
+static bool crypto_worker_done_read(struct l_io *io, void *user_data)
+{
+	struct l_queue *completed;
+	eventfd_t count;
+	struct crypto_job *job;
+
+	if (eventfd_read(l_io_get_fd(io), &count) < 0)
+		return true;
+
+	pthread_mutex_lock(&lock);
+	completed = done;
+	done = l_queue_new();
+	pthread_mutex_unlock(&lock);
+
+	while ((job = l_queue_pop_head(completed)))
+		crypto_job_complete(job);
+
+	l_queue_destroy(completed, NULL);
+
+	return true;
+}
+
+/* Used if the worker thread couldn't be started */
+static void crypto_worker_run_idle(struct l_idle *idle, void *user_data)
+{
+	struct crypto_job *job = user_data;
+
+	l_idle_remove(l_steal_ptr(job->idle));
+
+	job->run(job);
+	crypto_job_complete(job);
+}
+
+static uint32_t crypto_job_submit(struct crypto_job *job)
+{
+	if (!++next_job_id)
+		next_job_id = 1;
+
+	job->id = next_job_id;
+	l_queue_push_tail(jobs, job);
+
+	if (!worker_started) {
+		job->idle = l_idle_create(crypto_worker_run_idle, job, NULL);
+		return job->id;
+	}
+
+	pthread_mutex_lock(&lock);
+	l_queue_push_tail(pending, job);
+	pthread_cond_signal(&pending_cond);
+	pthread_mutex_unlock(&lock);
+
+	return job->id;
+}
+
+static void crypto_job_complete_psk(struct crypto_job *job)
+{
+	crypto_worker_psk_func_t func = job->func;
+
+	func(job->err, job->err < 0 ? NULL : job->psk, job->user_data);
+}
+
+uint32_t crypto_worker_psk_from_passphrase(const char *passphrase,
+					const uint8_t *ssid, size_t ssid_len,
+					crypto_worker_psk_func_t func,
+					void *user_data,
+					crypto_worker_destroy_func_t destroy)
+{
+	struct crypto_job *job;
+
+	if (!passphrase || !func || ssid_len > 32)
+		return 0;
+
+	job = l_new(struct crypto_job, 1);
+	job->run = crypto_job_run_psk;
+	job->complete = crypto_job_complete_psk;
+	job->func = func;
+	job->user_data = user_data;
+	job->destroy = destroy;
+	job->passphrase = l_strdup(passphrase);
+	memcpy(job->ssid, ssid, ssid_len);
+	job->ssid_len = ssid_len;
+
+	return crypto_job_submit(job);
+}
+
+static void crypto_job_run_sae_pt(struct crypto_job *job)
+{
+	if (job->err)
+		return;
+
+	if (!crypto_sae_pt_from_u_ecc(job->group, job->u1, job->u2, job->pt))
+		job->err = -ENOTSUP;
+}
+
+static void crypto_job_complete_sae_pt(struct crypto_job *job)
+{
+	crypto_worker_sae_pt_func_t func = job->func;
+	const struct l_ecc_curve *curve;
+	struct l_ecc_point *pt;
+	size_t len;
+
+	/*
+	 * Groups other than 19 and 20, or the (practically impossible) case
+	 * of P1 = +/- P2, are left to ell
+	 */
+	if (job->err) {
+		pt = crypto_derive_sae_pt_ecc(job->group, job->ssid,
+						job->passphrase,
+						job->identifier);
+	} else {
+		curve = l_ecc_curve_from_ike_group(job->group);
+		len = l_ecc_curve_get_scalar_bytes(curve);
+		pt = l_ecc_point_from_data(curve, L_ECC_POINT_TYPE_FULL,
+						job->pt, len * 2);
+	}
+
+	func(pt, job->user_data);
+}
+
+uint32_t crypto_worker_derive_sae_pt_ecc(unsigned int group,
+					const char *ssid,
+					const char *password,
+					const char *identifier,
+					crypto_worker_sae_pt_func_t func,
+					void *user_data,
+					crypto_worker_destroy_func_t destroy)
+{
+	struct crypto_job *job;
+
+	if (!ssid || !password || !func || strlen(ssid) > 32)
+		return 0;
+
+	job = l_new(struct crypto_job, 1);
+	job->run = crypto_job_run_sae_pt;
+	job->complete = crypto_job_complete_sae_pt;
+	job->func = func;
+	job->user_data = user_data;
+	job->destroy = destroy;
+	job->group = group;
+	job->passphrase = l_strdup(password);
+	job->identifier = l_strdup(identifier);
+	strcpy(job->ssid, ssid);
+
+	if (!crypto_derive_sae_pt_u_ecc(group, ssid, password, identifier,
+						job->u1, job->u2))
+		job->err = -EINVAL;
+
+	return crypto_job_submit(job);
+}
+
+/*
+ * Completes the job right away, running it on the calling thread if the
+ * worker hasn't picked it up yet.  For when the result is needed now, e.g.
+ * in the middle of setting up a connection.  The callback is invoked before
+ * this function returns.
+ */
+bool crypto_worker_flush(uint32_t id)
+{
+	struct crypto_job *job = l_queue_find(jobs, crypto_job_match,
+						L_UINT_TO_PTR(id));
+
+	if (!job)
+		return false;
+
+	if (job->idle) {
+		l_idle_remove(l_steal_ptr(job->idle));
+		job->run(job);
+		crypto_job_complete(job);
+		return true;
+	}
+
+	pthread_mutex_lock(&lock);
+
+	if (job->state == CRYPTO_JOB_STATE_PENDING) {
+		l_queue_remove(pending, job);
+		job->state = CRYPTO_JOB_STATE_RUNNING;
+		pthread_mutex_unlock(&lock);
+
+		job->run(job);
+	} else {
+		while (job->state != CRYPTO_JOB_STATE_DONE)
+			pthread_cond_wait(&done_cond, &lock);
+
+		l_queue_remove(done, job);
+		pthread_mutex_unlock(&lock);
+	}
+
+	crypto_job_complete(job);
+
+	return true;
+}
+
+/*
+ * Cancels the job, its callback will not be invoked.  The destroy callback
+ * is invoked right away.  A job which is already being run by the worker is
+ * allowed to finish, its result is discarded.
+ */
+bool crypto_worker_cancel(uint32_t id)
+{
+	struct crypto_job *job = l_queue_find(jobs, crypto_job_match,
+						L_UINT_TO_PTR(id));
+	bool removed = false;
+
+	if (!job)
+		return false;
+
+	if (job->idle)
+		removed = true;
+	else {
+		pthread_mutex_lock(&lock);
+
+		if (job->state == CRYPTO_JOB_STATE_PENDING)
+			removed = l_queue_remove(pending, job);
+
+		pthread_mutex_unlock(&lock);
+	}
+
+	if (removed) {
+		l_queue_remove(jobs, job);
+		crypto_job_free(job);
+		return true;
+	}
+
+	job->func = NULL;
+
+	if (job->destroy) {
+		job->destroy(job->user_data);
+		job->destroy = NULL;
+	}
+
+	return true;
+}
+
+static int crypto_worker_init(void)
+{
+	int fd;
+
+	jobs = l_queue_new();
+	pending = l_queue_new();
+	done = l_queue_new();
+
+	fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (fd < 0) {
+		l_warn("Unable to create crypto worker eventfd: %s (%i)",
+			strerror(errno), errno);
+		return 0;
+	}
+
+	done_io = l_io_new(fd);
+	l_io_set_close_on_destroy(done_io, true);
+	l_io_set_read_handler(done_io, crypto_worker_done_read, NULL, NULL);
+
+	quit = false;
+
+	if (pthread_create(&worker, NULL, crypto_worker_thread, NULL)) {
+		l_warn("Unable to start crypto worker, running jobs inline");
+		l_io_destroy(done_io);
+		done_io = NULL;
+		return 0;
+	}
+
+	worker_started = true;
+
+	return 0;
+}
+
+static void crypto_worker_exit(void)
+{
+	struct crypto_job *job;
+
+	if (worker_started) {
+		pthread_mutex_lock(&lock);
+		quit = true;
+		pthread_cond_signal(&pending_cond);
+		pthread_mutex_unlock(&lock);
+
+		pthread_join(worker, NULL);
+		worker_started = false;
+	}
+
+	l_io_destroy(done_io);
+	done_io = NULL;
+
+	/* Jobs still queued or completed but not dispatched are dropped */
+	while ((job = l_queue_pop_head(jobs))) {
+		job->func = NULL;
+		crypto_job_free(job);
+	}
+
+	l_queue_destroy(jobs, NULL);
+	l_queue_destroy(pending, NULL);
+	l_queue_destroy(done, NULL);
+	jobs = NULL;
+	pending = NULL;
+	done = NULL;
+}
+
+IWD_MODULE(crypto_worker, crypto_worker_init, crypto_worker_exit)
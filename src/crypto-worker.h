@@ -0,0 +1,46 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2024  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+struct l_ecc_point;
+
+typedef void (*crypto_worker_psk_func_t)(int err, const uint8_t *psk,
+						void *user_data);
+/* The callback takes ownership of the point, NULL on failure */
+typedef void (*crypto_worker_sae_pt_func_t)(struct l_ecc_point *pt,
+						void *user_data);
+typedef void (*crypto_worker_destroy_func_t)(void *user_data);
+
+uint32_t crypto_worker_psk_from_passphrase(const char *passphrase,
+					const uint8_t *ssid, size_t ssid_len,
+					crypto_worker_psk_func_t func,
+					void *user_data,
+					crypto_worker_destroy_func_t destroy);
+uint32_t crypto_worker_derive_sae_pt_ecc(unsigned int group,
+					const char *ssid,
+					const char *password,
+					const char *identifier,
+					crypto_worker_sae_pt_func_t func,
+					void *user_data,
+					crypto_worker_destroy_func_t destroy);
+
+bool crypto_worker_flush(uint32_t id);
+bool crypto_worker_cancel(uint32_t id);
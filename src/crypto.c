@@ -71,20 +71,149 @@ size_t crypto_dh5_prime_size = sizeof(crypto_dh5_prime);
 const unsigned char crypto_dh5_generator[] = { 0x2 };
 size_t crypto_dh5_generator_size = sizeof(crypto_dh5_generator);
 
+#ifndef HAVE_SOFT_CRYPTO
+/*
+ * Default backend, built on ell's l_checksum and l_cipher which use the
+ * kernel's AF_ALG sockets.  See crypto-soft.c for the in-process backend
+ * selected with --enable-soft-crypto.
+ */
+struct crypto_checksum {
+	struct l_checksum *checksum;
+};
+
+struct crypto_aes {
+	struct l_cipher *cipher;
+};
+
+static struct crypto_checksum *crypto_checksum_wrap(struct l_checksum *c)
+{
+	struct crypto_checksum *checksum;
+
+	if (!c)
+		return NULL;
+
+	checksum = l_new(struct crypto_checksum, 1);
+	checksum->checksum = c;
+
+	return checksum;
+}
+
+struct crypto_checksum *crypto_checksum_new(enum l_checksum_type type)
+{
+	return crypto_checksum_wrap(l_checksum_new(type));
+}
+
+struct crypto_checksum *crypto_checksum_new_hmac(enum l_checksum_type type,
+						const void *key,
+						size_t key_len)
+{
+	return crypto_checksum_wrap(l_checksum_new_hmac(type, key, key_len));
+}
+
+struct crypto_checksum *crypto_checksum_new_cmac_aes(const void *key,
+							size_t key_len)
+{
+	return crypto_checksum_wrap(l_checksum_new_cmac_aes(key, key_len));
+}
+
+void crypto_checksum_reset(struct crypto_checksum *checksum)
+{
+	if (checksum)
+		l_checksum_reset(checksum->checksum);
+}
+
+bool crypto_checksum_update(struct crypto_checksum *checksum,
+				const void *data, size_t len)
+{
+	if (!checksum)
+		return false;
+
+	return l_checksum_update(checksum->checksum, data, len);
+}
+
+bool crypto_checksum_updatev(struct crypto_checksum *checksum,
+				const struct iovec *iov, size_t iov_len)
+{
+	if (!checksum)
+		return false;
+
+	return l_checksum_updatev(checksum->checksum, iov, iov_len);
+}
+
+ssize_t crypto_checksum_get_digest(struct crypto_checksum *checksum,
+					void *digest, size_t len)
+{
+	if (!checksum)
+		return -EINVAL;
+
+	return l_checksum_get_digest(checksum->checksum, digest, len);
+}
+
+void crypto_checksum_free(struct crypto_checksum *checksum)
+{
+	if (!checksum)
+		return;
+
+	l_checksum_free(checksum->checksum);
+	l_free(checksum);
+}
+
+struct crypto_aes *crypto_aes_new(const void *key, size_t key_len)
+{
+	struct l_cipher *cipher = l_cipher_new(L_CIPHER_AES, key, key_len);
+	struct crypto_aes *aes;
+
+	if (!cipher)
+		return NULL;
+
+	aes = l_new(struct crypto_aes, 1);
+	aes->cipher = cipher;
+
+	return aes;
+}
+
+bool crypto_aes_encrypt(struct crypto_aes *aes, const void *in, void *out,
+			size_t len)
+{
+	if (!aes)
+		return false;
+
+	return l_cipher_encrypt(aes->cipher, in, out, len);
+}
+
+bool crypto_aes_decrypt(struct crypto_aes *aes, const void *in, void *out,
+			size_t len)
+{
+	if (!aes)
+		return false;
+
+	return l_cipher_decrypt(aes->cipher, in, out, len);
+}
+
+void crypto_aes_free(struct crypto_aes *aes)
+{
+	if (!aes)
+		return;
+
+	l_cipher_free(aes->cipher);
+	l_free(aes);
+}
+#endif
+
 static bool hmac_common(enum l_checksum_type type,
 			const void *key, size_t key_len,
 			const void *data, size_t data_len,
 			void *output, size_t size)
 {
-	struct l_checksum *hmac;
+	struct crypto_checksum *hmac;
 
-	hmac = l_checksum_new_hmac(type, key, key_len);
+	hmac = crypto_checksum_new_hmac(type, key, key_len);
 	if (!hmac)
 		return false;
 
-	l_checksum_update(hmac, data, data_len);
-	l_checksum_get_digest(hmac, output, size);
-	l_checksum_free(hmac);
+	crypto_checksum_update(hmac, data, data_len);
+	crypto_checksum_get_digest(hmac, output, size);
+	crypto_checksum_free(hmac);
 
 	return true;
 }
@@ -120,15 +249,15 @@ bool hmac_sha384(const void *key, size_t key_len,
 bool cmac_aes(const void *key, size_t key_len,
 		const void *data, size_t data_len, void *output, size_t size)
 {
-	struct l_checksum *cmac_aes;
+	struct crypto_checksum *cmac_aes;
 
-	cmac_aes = l_checksum_new_cmac_aes(key, key_len);
+	cmac_aes = crypto_checksum_new_cmac_aes(key, key_len);
 	if (!cmac_aes)
 		return false;
 
-	l_checksum_update(cmac_aes, data, data_len);
-	l_checksum_get_digest(cmac_aes, output, size);
-	l_checksum_free(cmac_aes);
+	crypto_checksum_update(cmac_aes, data, data_len);
+	crypto_checksum_get_digest(cmac_aes, output, size);
+	crypto_checksum_free(cmac_aes);
 
 	return true;
 }
@@ -151,10 +280,10 @@ bool aes_unwrap(const uint8_t *kek, size_t kek_len, const uint8_t *in, size_t le
 	uint64_t *r;
 	size_t n = (len - 8) >> 3;
 	int i, j;
-	struct l_cipher *cipher;
+	struct crypto_aes *cipher;
 	uint64_t t = n * 6;
 
-	cipher = l_cipher_new(L_CIPHER_AES, kek, kek_len);
+	cipher = crypto_aes_new(kek, kek_len);
 	if (!cipher)
 		return false;
 
@@ -170,7 +299,7 @@ bool aes_unwrap(const uint8_t *kek, size_t kek_len, const uint8_t *in, size_t le
 			b[0] ^= L_CPU_TO_BE64(t);
 			b[1] = L_GET_UNALIGNED(r);
 
-			if (!l_cipher_decrypt(cipher, b, b, 16)) {
+			if (!crypto_aes_decrypt(cipher, b, b, 16)) {
 				b[0] = 0;
 				goto done;
 			}
@@ -181,7 +310,7 @@ bool aes_unwrap(const uint8_t *kek, size_t kek_len, const uint8_t *in, size_t le
 	}
 
 done:
-	l_cipher_free(cipher);
+	crypto_aes_free(cipher);
 	explicit_bzero(&b[1], 8);
 
 	/* Check IV */
@@ -209,9 +338,9 @@ bool aes_wrap(const uint8_t *kek, const uint8_t *in, size_t len, uint8_t *out)
 	size_t n = len >> 3;
 	unsigned int i, j;
 	uint32_t t = 1;
-	struct l_cipher *cipher;
+	struct crypto_aes *cipher;
 
-	cipher = l_cipher_new(L_CIPHER_AES, kek, 16);
+	cipher = crypto_aes_new(kek, 16);
 	if (!cipher)
 		return false;
 
@@ -220,7 +349,7 @@ bool aes_wrap(const uint8_t *kek, const uint8_t *in, size_t len, uint8_t *out)
 	for (j = 0; j < 6; j++) {
 		for (i = 0; i < n; i++, t++) {
 			b[1] = L_GET_UNALIGNED(r + i);
-			l_cipher_encrypt(cipher, b, b, 16);
+			crypto_aes_encrypt(cipher, b, b, 16);
 			L_PUT_UNALIGNED(b[1], r + i);
 			b[0] ^= L_CPU_TO_BE64(t);
 		}
@@ -228,7 +357,7 @@ bool aes_wrap(const uint8_t *kek, const uint8_t *in, size_t len, uint8_t *out)
 
 	L_PUT_UNALIGNED(b[0], r - 1);
 
-	l_cipher_free(cipher);
+	crypto_aes_free(cipher);
 
 	return true;
 }
@@ -266,8 +395,8 @@ static void xor(uint8_t *a, uint8_t *b, size_t len)
 /*
  * RFC 5297 Section 2.4 - S2V
  */
-static bool s2v(struct l_checksum *cmac, struct iovec *iov, size_t iov_len,
-		uint8_t *v)
+static bool s2v(struct crypto_checksum *cmac, struct iovec *iov,
+		size_t iov_len, uint8_t *v)
 {
 	uint8_t zero[16] = { 0 };
 	uint8_t d[16];
@@ -275,10 +404,10 @@ static bool s2v(struct l_checksum *cmac, struct iovec *iov, size_t iov_len,
 	size_t i;
 
 	/* AES-CMAC(K, <zero>) */
-	if (!l_checksum_update(cmac, zero, sizeof(zero)))
+	if (!crypto_checksum_update(cmac, zero, sizeof(zero)))
 		return false;
 
-	l_checksum_get_digest(cmac, d, sizeof(d));
+	crypto_checksum_get_digest(cmac, d, sizeof(d));
 
 	/* Last element is treated special */
 	for (i = 0; i < iov_len - 1; i++) {
@@ -286,16 +415,17 @@ static bool s2v(struct l_checksum *cmac, struct iovec *iov, size_t iov_len,
 		dbl(d);
 
 		/* AES-CMAC(K, Si) */
-		if (!l_checksum_update(cmac, iov[i].iov_base, iov[i].iov_len))
+		if (!crypto_checksum_update(cmac, iov[i].iov_base,
+						iov[i].iov_len))
 			return false;
 
-		l_checksum_get_digest(cmac, tmp, sizeof(tmp));
+		crypto_checksum_get_digest(cmac, tmp, sizeof(tmp));
 		/* D = D xor AES-CMAC(K, Si) */
 		xor(d, tmp, sizeof(tmp));
 	}
 
 	if (iov[i].iov_len >= 16) {
-		if (!l_checksum_update(cmac, iov[i].iov_base,
+		if (!crypto_checksum_update(cmac, iov[i].iov_base,
 					iov[i].iov_len - 16))
 			return false;
 		/* xorend(d) */
@@ -311,14 +441,68 @@ static bool s2v(struct l_checksum *cmac, struct iovec *iov, size_t iov_len,
 		d[iov[i].iov_len] ^= 0x80;
 	}
 
-	if (!l_checksum_update(cmac, d, 16))
+	if (!crypto_checksum_update(cmac, d, 16))
 		return false;
 
-	l_checksum_get_digest(cmac, v, 16);
+	crypto_checksum_get_digest(cmac, v, 16);
 
 	return true;
 }
 
+/*
+ * AES-CTR with a 128-bit big endian counter, as used by SIV.  The key stream
+ * is generated several blocks at a time to keep the number of cipher calls
+ * low.
+ */
+static bool aes_ctr(const void *key, size_t key_len, const uint8_t *iv,
+			const uint8_t *in, uint8_t *out, size_t len)
+{
+	struct crypto_aes *aes;
+	uint8_t ctr[16];
+	uint8_t stream[256];
+	size_t n;
+	size_t stream_len;
+	size_t i;
+	int j;
+	bool r = true;
+
+	aes = crypto_aes_new(key, key_len);
+	if (!aes)
+		return false;
+
+	memcpy(ctr, iv, 16);
+
+	while (len) {
+		n = minsize(len, sizeof(stream));
+		stream_len = (n + 15) & ~15;
+
+		for (i = 0; i < stream_len; i += 16) {
+			memcpy(stream + i, ctr, 16);
+
+			for (j = 15; j >= 0; j--)
+				if (++ctr[j])
+					break;
+		}
+
+		if (!crypto_aes_encrypt(aes, stream, stream, stream_len)) {
+			r = false;
+			break;
+		}
+
+		for (i = 0; i < n; i++)
+			out[i] = in[i] ^ stream[i];
+
+		in += n;
+		out += n;
+		len -= n;
+	}
+
+	crypto_aes_free(aes);
+	explicit_bzero(stream, sizeof(stream));
+
+	return r;
+}
+
 /*
  * RFC 5297 Section 2.6 - SIV Encrypt
  */
@@ -326,8 +510,7 @@ bool aes_siv_encrypt(const void *key, size_t key_len, const void *in,
 			size_t in_len, struct iovec *ad, size_t num_ad,
 			void *out)
 {
-	struct l_checksum *cmac;
-	struct l_cipher *ctr;
+	struct crypto_checksum *cmac;
 	struct iovec iov[num_ad + 1];
 	uint8_t v[16];
 
@@ -342,47 +525,31 @@ bool aes_siv_encrypt(const void *key, size_t key_len, const void *in,
 	 * key is split into two equal halves... K1 is used for S2V and K2 is
 	 * used for CTR
 	 */
-	cmac = l_checksum_new_cmac_aes(key, key_len / 2);
+	cmac = crypto_checksum_new_cmac_aes(key, key_len / 2);
 	if (!cmac)
 		return false;
 
 	if (!s2v(cmac, iov, num_ad, v)) {
-		l_checksum_free(cmac);
+		crypto_checksum_free(cmac);
 		return false;
 	}
 
-	l_checksum_free(cmac);
+	crypto_checksum_free(cmac);
 
 	memcpy(out, v, 16);
 
 	v[8] &= 0x7f;
 	v[12] &= 0x7f;
 
-	ctr = l_cipher_new(L_CIPHER_AES_CTR, key + (key_len / 2), key_len / 2);
-	if (!ctr)
-		return false;
-
-	if (!l_cipher_set_iv(ctr, v, 16))
-		goto free_ctr;
-
-	if (!l_cipher_encrypt(ctr, in, out + 16, in_len))
-		goto free_ctr;
-
-	l_cipher_free(ctr);
-
-	return true;
-
-free_ctr:
-	l_cipher_free(ctr);
-	return false;
+	return aes_ctr(key + (key_len / 2), key_len / 2, v, in, out + 16,
+			in_len);
 }
 
 bool aes_siv_decrypt(const void *key, size_t key_len, const void *in,
 			size_t in_len, struct iovec *ad, size_t num_ad,
 			void *out)
 {
-	struct l_checksum *cmac;
-	struct l_cipher *ctr;
+	struct crypto_checksum *cmac;
 	struct iovec iov[num_ad + 1];
 	uint8_t iv[16];
 	uint8_t v[16];
@@ -405,38 +572,26 @@ bool aes_siv_decrypt(const void *key, size_t key_len, const void *in,
 	iv[8] &= 0x7f;
 	iv[12] &= 0x7f;
 
-	ctr = l_cipher_new(L_CIPHER_AES_CTR, key + (key_len / 2), key_len / 2);
-	if (!ctr)
+	if (!aes_ctr(key + (key_len / 2), key_len / 2, iv, in + 16, out,
+			in_len - 16))
 		return false;
 
-	if (!l_cipher_set_iv(ctr, iv, 16))
-		goto free_ctr;
-
-	if (!l_cipher_decrypt(ctr, in + 16, out, in_len - 16))
-		goto free_ctr;
-
-	l_cipher_free(ctr);
-
 check_cmac:
-	cmac = l_checksum_new_cmac_aes(key, key_len / 2);
+	cmac = crypto_checksum_new_cmac_aes(key, key_len / 2);
 	if (!cmac)
 		return false;
 
 	if (!s2v(cmac, iov, num_ad, v)) {
-		l_checksum_free(cmac);
+		crypto_checksum_free(cmac);
 		return false;
 	}
 
-	l_checksum_free(cmac);
+	crypto_checksum_free(cmac);
 
 	if (memcmp(v, in, 16))
 		return false;
 
 	return true;
-
-free_ctr:
-	l_cipher_free(ctr);
-	return false;
 }
 
 static void arc4_set_key(struct arc4_ctx *ctx, unsigned int length,
@@ -551,13 +706,219 @@ bool crypto_passphrase_is_valid(const char *passphrase)
 	return true;
 }
 
-int crypto_psk_from_passphrase(const char *passphrase,
-				const unsigned char *ssid, size_t ssid_len,
-				unsigned char *out_psk)
+/*
+ * Multi-buffer PBKDF2-HMAC-SHA1 for PSK derivation.  Each PSK is made up of
+ * two PBKDF2 blocks (T1 and 12 bytes of T2), each of which takes 8192 SHA1
+ * compressions.  All of these are independent, so the blocks of several
+ * passphrase/SSID pairs are run side by side in the lanes of a vector.
+ *
+ * The vector type uses the GCC vector extensions, which are lowered to
+ * SSE2/AVX2 or NEON where available and to plain scalar code otherwise.
+ */
+#ifdef __AVX2__
+#define SHA1_MB_LANES 8
+#else
+#define SHA1_MB_LANES 4
+#endif
+
+typedef uint32_t sha1_mb_vec_t
+			__attribute__((vector_size(SHA1_MB_LANES * 4)));
+
+#define SHA1_MB_ROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+static const uint32_t sha1_iv[5] = {
+	0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0,
+};
+
+static void sha1_mb_compress(sha1_mb_vec_t *state, const sha1_mb_vec_t *in)
+{
+	sha1_mb_vec_t w[16];
+	sha1_mb_vec_t a = state[0];
+	sha1_mb_vec_t b = state[1];
+	sha1_mb_vec_t c = state[2];
+	sha1_mb_vec_t d = state[3];
+	sha1_mb_vec_t e = state[4];
+	sha1_mb_vec_t f;
+	sha1_mb_vec_t t;
+	uint32_t k;
+	unsigned int i;
+
+	for (i = 0; i < 80; i++) {
+		if (i < 16)
+			w[i] = in[i];
+		else {
+			t = w[(i + 13) & 15] ^ w[(i + 8) & 15] ^
+				w[(i + 2) & 15] ^ w[i & 15];
+			w[i & 15] = SHA1_MB_ROL(t, 1);
+		}
+
+		if (i < 20) {
+			f = d ^ (b & (c ^ d));
+			k = 0x5a827999;
+		} else if (i < 40) {
+			f = b ^ c ^ d;
+			k = 0x6ed9eba1;
+		} else if (i < 60) {
+			f = (b & c) | (d & (b | c));
+			k = 0x8f1bbcdc;
+		} else {
+			f = b ^ c ^ d;
+			k = 0xca62c1d6;
+		}
+
+		t = SHA1_MB_ROL(a, 5) + f + e + k + w[i & 15];
+		e = d;
+		d = c;
+		c = SHA1_MB_ROL(b, 30);
+		b = a;
+		a = t;
+	}
+
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+}
+
+/* Loads one 64 byte block per lane, lanes past n_lanes repeat lane 0 */
+static void sha1_mb_load(sha1_mb_vec_t *out,
+				uint8_t blocks[][64], unsigned int n_lanes)
+{
+	unsigned int i;
+	unsigned int lane;
+
+	for (i = 0; i < 16; i++)
+		for (lane = 0; lane < SHA1_MB_LANES; lane++)
+			out[i][lane] = l_get_be32(blocks[lane < n_lanes ?
+							lane : 0] + i * 4);
+}
+
+/* Sets up the padding of a block which holds a 20 byte digest */
+static void sha1_mb_digest_block_init(sha1_mb_vec_t *block)
+{
+	unsigned int i;
+
+	block[5] = (sha1_mb_vec_t) {} + 0x80000000;
+
+	for (i = 6; i < 15; i++)
+		block[i] = (sha1_mb_vec_t) {};
+
+	/* The 64 byte HMAC key block followed by the 20 byte digest */
+	block[15] = (sha1_mb_vec_t) {} + (64 + 20) * 8;
+}
+
+/*
+ * Computes one PBKDF2 block per lane, of the request reqs[lane] and with the
+ * block index indices[lane].  The resulting T value of each lane is in t.
+ */
+static void pbkdf2_sha1_mb(struct crypto_psk_derivation **reqs,
+				const uint32_t *indices, unsigned int n_lanes,
+				sha1_mb_vec_t *t)
+{
+	uint8_t blocks[SHA1_MB_LANES][64];
+	sha1_mb_vec_t ipad[5];
+	sha1_mb_vec_t opad[5];
+	sha1_mb_vec_t state[5];
+	sha1_mb_vec_t block[16];
+	unsigned int lane;
+	unsigned int i;
+	unsigned int j;
+	size_t len;
+
+	for (i = 0; i < 5; i++) {
+		ipad[i] = (sha1_mb_vec_t) {} + sha1_iv[i];
+		opad[i] = ipad[i];
+	}
+
+	/* HMAC key pads, the passphrase is at most 63 bytes */
+	for (lane = 0; lane < n_lanes; lane++) {
+		len = strlen(reqs[lane]->passphrase);
+
+		memset(blocks[lane], 0x36, 64);
+
+		for (i = 0; i < len; i++)
+			blocks[lane][i] ^= reqs[lane]->passphrase[i];
+	}
+
+	sha1_mb_load(block, blocks, n_lanes);
+	sha1_mb_compress(ipad, block);
+
+	for (lane = 0; lane < n_lanes; lane++)
+		for (i = 0; i < 64; i++)
+			blocks[lane][i] ^= 0x36 ^ 0x5c;
+
+	sha1_mb_load(block, blocks, n_lanes);
+	sha1_mb_compress(opad, block);
+
+	/* U1 = HMAC(passphrase, SSID || INT(index)), fits in one block */
+	for (lane = 0; lane < n_lanes; lane++) {
+		len = reqs[lane]->ssid_len;
+
+		memset(blocks[lane], 0, 64);
+		memcpy(blocks[lane], reqs[lane]->ssid, len);
+		l_put_be32(indices[lane], blocks[lane] + len);
+		blocks[lane][len + 4] = 0x80;
+		l_put_be32((64 + len + 4) * 8, blocks[lane] + 60);
+	}
+
+	memcpy(state, ipad, sizeof(state));
+	sha1_mb_load(block, blocks, n_lanes);
+	sha1_mb_compress(state, block);
+
+	sha1_mb_digest_block_init(block);
+
+	for (j = 0; j < 4096; j++) {
+		if (j) {
+			memcpy(state, ipad, sizeof(state));
+			sha1_mb_compress(state, block);
+		}
+
+		memcpy(block, state, sizeof(state));
+		memcpy(state, opad, sizeof(state));
+		sha1_mb_compress(state, block);
+		memcpy(block, state, sizeof(state));
+
+		for (i = 0; i < 5; i++)
+			t[i] = j ? t[i] ^ state[i] : state[i];
+	}
+
+	explicit_bzero(blocks, sizeof(blocks));
+	explicit_bzero(ipad, sizeof(ipad));
+	explicit_bzero(opad, sizeof(opad));
+	explicit_bzero(state, sizeof(state));
+	explicit_bzero(block, sizeof(block));
+}
+
+static void psk_mb_derive(struct crypto_psk_derivation **reqs,
+				const uint32_t *indices, unsigned int n_lanes)
 {
-	bool result;
-	unsigned char psk[32];
+	sha1_mb_vec_t t[5];
+	uint8_t out[20];
+	unsigned int lane;
+	unsigned int i;
+
+	pbkdf2_sha1_mb(reqs, indices, n_lanes, t);
+
+	/* PSK = T1 || first 12 bytes of T2 */
+	for (lane = 0; lane < n_lanes; lane++) {
+		for (i = 0; i < 5; i++)
+			l_put_be32(t[i][lane], out + i * 4);
+
+		if (indices[lane] == 1)
+			memcpy(reqs[lane]->psk, out, 20);
+		else
+			memcpy(reqs[lane]->psk + 20, out, 12);
+	}
+
+	explicit_bzero(t, sizeof(t));
+	explicit_bzero(out, sizeof(out));
+}
 
+static int crypto_psk_check_input(const char *passphrase,
+					const unsigned char *ssid,
+					size_t ssid_len)
+{
 	if (!passphrase)
 		return -EINVAL;
 
@@ -570,16 +931,65 @@ int crypto_psk_from_passphrase(const char *passphrase,
 	if (ssid_len == 0 || ssid_len > 32)
 		return -ERANGE;
 
-	result = l_cert_pkcs5_pbkdf2(L_CHECKSUM_SHA1, passphrase,
-					ssid, ssid_len, 4096,
-					psk, sizeof(psk));
-	if (!result)
-		return -ENOKEY;
+	return 0;
+}
+
+/*
+ * Derives the PSKs of several passphrase/SSID pairs at once, which is faster
+ * than deriving them one by one.  The result of each derivation is stored in
+ * its err and psk members.
+ */
+void crypto_psk_from_passphrase_batch(struct crypto_psk_derivation *reqs,
+					unsigned int n_reqs)
+{
+	struct crypto_psk_derivation *lane_reqs[SHA1_MB_LANES];
+	uint32_t indices[SHA1_MB_LANES];
+	unsigned int n_lanes = 0;
+	unsigned int i;
+	uint32_t j;
+
+	for (i = 0; i < n_reqs; i++) {
+		reqs[i].err = crypto_psk_check_input(reqs[i].passphrase,
+							reqs[i].ssid,
+							reqs[i].ssid_len);
+		if (reqs[i].err < 0)
+			continue;
+
+		for (j = 1; j <= 2; j++) {
+			lane_reqs[n_lanes] = &reqs[i];
+			indices[n_lanes++] = j;
+
+			if (n_lanes < SHA1_MB_LANES)
+				continue;
+
+			psk_mb_derive(lane_reqs, indices, n_lanes);
+			n_lanes = 0;
+		}
+	}
+
+	if (n_lanes)
+		psk_mb_derive(lane_reqs, indices, n_lanes);
+}
+
+int crypto_psk_from_passphrase(const char *passphrase,
+				const unsigned char *ssid, size_t ssid_len,
+				unsigned char *out_psk)
+{
+	struct crypto_psk_derivation req = {
+		.passphrase = passphrase,
+		.ssid = ssid,
+		.ssid_len = ssid_len,
+	};
+
+	crypto_psk_from_passphrase_batch(&req, 1);
+
+	if (req.err < 0)
+		return req.err;
 
 	if (out_psk)
-		memcpy(out_psk, psk, sizeof(psk));
+		memcpy(out_psk, req.psk, sizeof(req.psk));
 
-	explicit_bzero(psk, sizeof(psk));
+	explicit_bzero(req.psk, sizeof(req.psk));
 	return 0;
 }
 
@@ -587,7 +997,7 @@ bool prf_sha1(const void *key, size_t key_len,
 		const void *prefix, size_t prefix_len,
 		const void *data, size_t data_len, void *output, size_t size)
 {
-	struct l_checksum *hmac;
+	struct crypto_checksum *hmac;
 	unsigned int i, offset = 0;
 	unsigned char empty = '\0';
 	unsigned char counter;
@@ -598,7 +1008,7 @@ bool prf_sha1(const void *key, size_t key_len,
 		[3] = { .iov_base = &counter, .iov_len = 1 },
 	};
 
-	hmac = l_checksum_new_hmac(L_CHECKSUM_SHA1, key, key_len);
+	hmac = crypto_checksum_new_hmac(L_CHECKSUM_SHA1, key, key_len);
 	if (!hmac)
 		return false;
 
@@ -611,13 +1021,13 @@ bool prf_sha1(const void *key, size_t key_len,
 		else
 			len = size - offset;
 
-		l_checksum_updatev(hmac, iov, 4);
-		l_checksum_get_digest(hmac, output + offset, len);
+		crypto_checksum_updatev(hmac, iov, 4);
+		crypto_checksum_get_digest(hmac, output + offset, len);
 
 		offset += len;
 	}
 
-	l_checksum_free(hmac);
+	crypto_checksum_free(hmac);
 
 	return true;
 }
@@ -633,7 +1043,7 @@ bool prf_plus(enum l_checksum_type type, const void *key, size_t key_len,
 	uint8_t count = 1;
 	uint8_t *out_ptr = out;
 	va_list va;
-	struct l_checksum *hmac;
+	struct crypto_checksum *hmac;
 	ssize_t ret;
 	size_t i;
 
@@ -649,7 +1059,7 @@ bool prf_plus(enum l_checksum_type type, const void *key, size_t key_len,
 	iov[n_extra + 1].iov_base = &count;
 	iov[n_extra + 1].iov_len = 1;
 
-	hmac = l_checksum_new_hmac(type, key, key_len);
+	hmac = crypto_checksum_new_hmac(type, key, key_len);
 	if (!hmac)
 		return false;
 
@@ -657,14 +1067,14 @@ bool prf_plus(enum l_checksum_type type, const void *key, size_t key_len,
 		iov[0].iov_base = t;
 		iov[0].iov_len = t_len;
 
-		if (!l_checksum_updatev(hmac, iov, n_extra + 2)) {
-			l_checksum_free(hmac);
+		if (!crypto_checksum_updatev(hmac, iov, n_extra + 2)) {
+			crypto_checksum_free(hmac);
 			return false;
 		}
 
-		ret = l_checksum_get_digest(hmac, out_ptr, out_len);
+		ret = crypto_checksum_get_digest(hmac, out_ptr, out_len);
 		if (ret < 0) {
-			l_checksum_free(hmac);
+			crypto_checksum_free(hmac);
 			return false;
 		}
 
@@ -680,10 +1090,10 @@ bool prf_plus(enum l_checksum_type type, const void *key, size_t key_len,
 		out_ptr += ret;
 
 		if (out_len)
-			l_checksum_reset(hmac);
+			crypto_checksum_reset(hmac);
 	}
 
-	l_checksum_free(hmac);
+	crypto_checksum_free(hmac);
 
 	return true;
 }
@@ -709,7 +1119,7 @@ bool prf_plus_sha1(const void *key, size_t key_len,
 
 	static const uint8_t SHA1_MAC_LEN = 20;
 	static const uint8_t nil_bytes[2] = { 0, 0 };
-	struct l_checksum *hmac;
+	struct crypto_checksum *hmac;
 	uint8_t t[SHA1_MAC_LEN];
 	uint8_t counter;
 	struct iovec iov[5] = {
@@ -720,7 +1130,7 @@ bool prf_plus_sha1(const void *key, size_t key_len,
 		[4] = { .iov_base = (void *) nil_bytes, .iov_len = 2 },
 	};
 
-	hmac = l_checksum_new_hmac(L_CHECKSUM_SHA1, key, key_len);
+	hmac = crypto_checksum_new_hmac(L_CHECKSUM_SHA1, key, key_len);
 	if (!hmac)
 		return false;
 
@@ -733,8 +1143,8 @@ bool prf_plus_sha1(const void *key, size_t key_len,
 		else
 			len = size;
 
-		l_checksum_updatev(hmac, iov, 5);
-		l_checksum_get_digest(hmac, t, len);
+		crypto_checksum_updatev(hmac, iov, 5);
+		crypto_checksum_get_digest(hmac, t, len);
 
 		memcpy(output, t, len);
 
@@ -747,7 +1157,7 @@ bool prf_plus_sha1(const void *key, size_t key_len,
 		iov[0].iov_len = len;
 	}
 
-	l_checksum_free(hmac);
+	crypto_checksum_free(hmac);
 
 	return true;
 }
@@ -757,7 +1167,7 @@ bool crypto_kdf(enum l_checksum_type type, const void *key, size_t key_len,
 		const void *prefix, size_t prefix_len,
 		const void *data, size_t data_len, void *output, size_t size)
 {
-	struct l_checksum *hmac;
+	struct crypto_checksum *hmac;
 	unsigned int i, offset = 0;
 	unsigned int counter;
 	unsigned int chunk_size;
@@ -771,7 +1181,7 @@ bool crypto_kdf(enum l_checksum_type type, const void *key, size_t key_len,
 		[3] = { .iov_base = length_le, .iov_len = 2 },
 	};
 
-	hmac = l_checksum_new_hmac(type, key, key_len);
+	hmac = crypto_checksum_new_hmac(type, key, key_len);
 	if (!hmac)
 		return false;
 
@@ -791,13 +1201,13 @@ bool crypto_kdf(enum l_checksum_type type, const void *key, size_t key_len,
 
 		l_put_le16(counter, counter_le);
 
-		l_checksum_updatev(hmac, iov, 4);
-		l_checksum_get_digest(hmac, output + offset, len);
+		crypto_checksum_updatev(hmac, iov, 4);
+		crypto_checksum_get_digest(hmac, output + offset, len);
 
 		offset += len;
 	}
 
-	l_checksum_free(hmac);
+	crypto_checksum_free(hmac);
 
 	return true;
 }
@@ -827,7 +1237,7 @@ bool hkdf_extract(enum l_checksum_type type, const void *key,
 				size_t key_len, uint8_t num_args,
 				void *out, ...)
 {
-	struct l_checksum *hmac;
+	struct crypto_checksum *hmac;
 	struct iovec iov[num_args];
 	const uint8_t zero_key[64] = { 0 };
 	size_t dlen = l_checksum_digest_length(type);
@@ -840,7 +1250,7 @@ bool hkdf_extract(enum l_checksum_type type, const void *key,
 	if (dlen <= 0)
 		return false;
 
-	hmac = l_checksum_new_hmac(type, k, k_len);
+	hmac = crypto_checksum_new_hmac(type, k, k_len);
 	if (!hmac)
 		return false;
 
@@ -851,14 +1261,14 @@ bool hkdf_extract(enum l_checksum_type type, const void *key,
 		iov[i].iov_len = va_arg(va, size_t);
 	}
 
-	if (!l_checksum_updatev(hmac, iov, num_args)) {
-		l_checksum_free(hmac);
+	if (!crypto_checksum_updatev(hmac, iov, num_args)) {
+		crypto_checksum_free(hmac);
 		va_end(va);
 		return false;
 	}
 
-	ret = l_checksum_get_digest(hmac, out, dlen);
-	l_checksum_free(hmac);
+	ret = crypto_checksum_get_digest(hmac, out, dlen);
+	crypto_checksum_free(hmac);
 
 	va_end(va);
 	return (ret == (int) dlen);
@@ -952,7 +1362,7 @@ bool crypto_derive_pmk_r0(const uint8_t *xxkey, size_t xxkey_len,
 	size_t pos = 0;
 	uint8_t output[64];
 	size_t offset = sha384 ? 48 : 32;
-	struct l_checksum *sha;
+	struct crypto_checksum *sha;
 	bool r = false;
 	struct iovec iov[2] = {
 		[0] = { .iov_base = "FT-R0N", .iov_len = 6 },
@@ -985,14 +1395,15 @@ bool crypto_derive_pmk_r0(const uint8_t *xxkey, size_t xxkey_len,
 			goto exit;
 	}
 
-	sha = l_checksum_new((sha384) ? L_CHECKSUM_SHA384 : L_CHECKSUM_SHA256);
+	sha = crypto_checksum_new((sha384) ? L_CHECKSUM_SHA384 :
+						L_CHECKSUM_SHA256);
 	if (!sha)
 		goto exit;
 
-	l_checksum_updatev(sha, iov, 2);
-	l_checksum_get_digest(sha, out_pmk_r0_name, 16);
+	crypto_checksum_updatev(sha, iov, 2);
+	crypto_checksum_get_digest(sha, out_pmk_r0_name, 16);
 
-	l_checksum_free(sha);
+	crypto_checksum_free(sha);
 
 	memcpy(out_pmk_r0, output, offset);
 
@@ -1013,7 +1424,7 @@ bool crypto_derive_pmk_r1(const uint8_t *pmk_r0,
 				uint8_t *out_pmk_r1_name)
 {
 	uint8_t context[2 * ETH_ALEN];
-	struct l_checksum *sha;
+	struct crypto_checksum *sha;
 	bool r = false;
 	struct iovec iov[3] = {
 		[0] = { .iov_base = "FT-R1N", .iov_len = 6 },
@@ -1035,16 +1446,17 @@ bool crypto_derive_pmk_r1(const uint8_t *pmk_r0,
 			goto exit;
 	}
 
-	sha = l_checksum_new((sha384) ? L_CHECKSUM_SHA384 : L_CHECKSUM_SHA256);
+	sha = crypto_checksum_new((sha384) ? L_CHECKSUM_SHA384 :
+						L_CHECKSUM_SHA256);
 	if (!sha) {
 		explicit_bzero(out_pmk_r1, 48);
 		goto exit;
 	}
 
-	l_checksum_updatev(sha, iov, 3);
-	l_checksum_get_digest(sha, out_pmk_r1_name, 16);
+	crypto_checksum_updatev(sha, iov, 3);
+	crypto_checksum_get_digest(sha, out_pmk_r1_name, 16);
 
-	l_checksum_free(sha);
+	crypto_checksum_free(sha);
 
 	r = true;
 
@@ -1062,7 +1474,7 @@ bool crypto_derive_ft_ptk(const uint8_t *pmk_r1, const uint8_t *pmk_r1_name,
 				uint8_t *out_ptk_name)
 {
 	uint8_t context[ETH_ALEN * 2 + 64];
-	struct l_checksum *sha;
+	struct crypto_checksum *sha;
 	bool r = false;
 	struct iovec iov[3] = {
 		[0] = { .iov_base = (uint8_t *) pmk_r1_name, .iov_len = 16 },
@@ -1088,16 +1500,17 @@ bool crypto_derive_ft_ptk(const uint8_t *pmk_r1, const uint8_t *pmk_r1_name,
 			goto exit;
 	}
 
-	sha = l_checksum_new((sha384) ? L_CHECKSUM_SHA384 : L_CHECKSUM_SHA256);
+	sha = crypto_checksum_new((sha384) ? L_CHECKSUM_SHA384 :
+						L_CHECKSUM_SHA256);
 	if (!sha) {
 		explicit_bzero(out_ptk, ptk_len);
 		goto exit;
 	}
 
-	l_checksum_updatev(sha, iov, 3);
-	l_checksum_get_digest(sha, out_ptk_name, 16);
+	crypto_checksum_updatev(sha, iov, 3);
+	crypto_checksum_get_digest(sha, out_ptk_name, 16);
 
-	l_checksum_free(sha);
+	crypto_checksum_free(sha);
 
 	r = true;
 
@@ -1142,25 +1555,20 @@ enum l_checksum_type crypto_sae_hash_from_ecc_prime_len(enum crypto_sae type,
 	return L_CHECKSUM_SHA512;
 }
 
-struct l_ecc_point *crypto_derive_sae_pt_ecc(unsigned int group,
-						const char *ssid,
-						const char *password,
-						const char *identifier)
+static bool sae_pt_derive_u(const struct l_ecc_curve *curve,
+				const char *ssid, const char *password,
+				const char *identifier,
+				struct l_ecc_scalar **out_u1,
+				struct l_ecc_scalar **out_u2)
 {
-	const struct l_ecc_curve *curve = l_ecc_curve_from_ike_group(group);
 	enum l_checksum_type hash;
 	size_t hash_len;
 	uint8_t pwd_seed[64]; /* SHA512 is the biggest possible right now */
 	uint8_t pwd_value[128];
 	size_t pwd_value_len;
-	_auto_(l_ecc_scalar_free) struct l_ecc_scalar *u1 = NULL;
-	_auto_(l_ecc_scalar_free) struct l_ecc_scalar *u2 = NULL;
-	_auto_(l_ecc_point_free) struct l_ecc_point *p1 = NULL;
-	_auto_(l_ecc_point_free) struct l_ecc_point *p2 = NULL;
-	_auto_(l_ecc_point_free) struct l_ecc_point *pt = NULL;
 
 	if (!curve)
-		return NULL;
+		return false;
 
 	hash = crypto_sae_hash_from_ecc_prime_len(CRYPTO_SAE_HASH_TO_ELEMENT,
 					l_ecc_curve_get_scalar_bytes(curve));
@@ -1180,14 +1588,35 @@ struct l_ecc_point *crypto_derive_sae_pt_ecc(unsigned int group,
 	 */
 	hkdf_expand(hash, pwd_seed, hash_len, "SAE Hash to Element u1 P1",
 				pwd_value, pwd_value_len);
-	u1 = l_ecc_scalar_new_modp(curve, pwd_value, pwd_value_len);
+	*out_u1 = l_ecc_scalar_new_modp(curve, pwd_value, pwd_value_len);
 
 	/*
 	 * pwd-value = HKDF-Expand(pwd-seed, "SAE Hash to Element u2 P2", len)
 	 */
 	hkdf_expand(hash, pwd_seed, hash_len, "SAE Hash to Element u2 P2",
 				pwd_value, pwd_value_len);
-	u2 = l_ecc_scalar_new_modp(curve, pwd_value, pwd_value_len);
+	*out_u2 = l_ecc_scalar_new_modp(curve, pwd_value, pwd_value_len);
+
+	explicit_bzero(pwd_seed, sizeof(pwd_seed));
+	explicit_bzero(pwd_value, sizeof(pwd_value));
+
+	return *out_u1 && *out_u2;
+}
+
+struct l_ecc_point *crypto_derive_sae_pt_ecc(unsigned int group,
+						const char *ssid,
+						const char *password,
+						const char *identifier)
+{
+	const struct l_ecc_curve *curve = l_ecc_curve_from_ike_group(group);
+	_auto_(l_ecc_scalar_free) struct l_ecc_scalar *u1 = NULL;
+	_auto_(l_ecc_scalar_free) struct l_ecc_scalar *u2 = NULL;
+	_auto_(l_ecc_point_free) struct l_ecc_point *p1 = NULL;
+	_auto_(l_ecc_point_free) struct l_ecc_point *p2 = NULL;
+	_auto_(l_ecc_point_free) struct l_ecc_point *pt = NULL;
+
+	if (!sae_pt_derive_u(curve, ssid, password, identifier, &u1, &u2))
+		return NULL;
 
 	p1 = l_ecc_point_from_sswu(u1);
 	p2 = l_ecc_point_from_sswu(u2);
@@ -1198,6 +1627,482 @@ struct l_ecc_point *crypto_derive_sae_pt_ecc(unsigned int group,
 	return l_steal_ptr(pt);
 }
 
+/*
+ * The hashing half of crypto_derive_sae_pt_ecc, out_u1 and out_u2 receive
+ * u1 and u2 reduced modulo p, l_ecc_curve_get_scalar_bytes() bytes each.
+ * The rest can then be done by crypto_sae_pt_from_u_ecc.
+ */
+bool crypto_derive_sae_pt_u_ecc(unsigned int group, const char *ssid,
+				const char *password, const char *identifier,
+				uint8_t *out_u1, uint8_t *out_u2)
+{
+	const struct l_ecc_curve *curve = l_ecc_curve_from_ike_group(group);
+	_auto_(l_ecc_scalar_free) struct l_ecc_scalar *u1 = NULL;
+	_auto_(l_ecc_scalar_free) struct l_ecc_scalar *u2 = NULL;
+	size_t len;
+
+	if (!sae_pt_derive_u(curve, ssid, password, identifier, &u1, &u2))
+		return false;
+
+	len = l_ecc_curve_get_scalar_bytes(curve);
+
+	return l_ecc_scalar_get_data(u1, out_u1, len) == (ssize_t) len &&
+		l_ecc_scalar_get_data(u2, out_u2, len) == (ssize_t) len;
+}
+
+/*
+ * Self-contained arithmetic modulo the primes of the P-256 and P-384 curves
+ * (groups 19 and 20), so that the SAE PT can be derived without ell by the
+ * crypto worker thread.  Field elements are little endian arrays of 32-bit
+ * words kept in the Montgomery domain, R = 2^(32 * n_words).  None of the
+ * operations branch on, or index memory by, the value of an element; only
+ * the exponents, which are derived from p, are looked at bit by bit.
+ */
+#define SAE_FP_MAX_WORDS 12
+
+struct sae_fp {
+	unsigned int n_words;
+	size_t len;
+	uint32_t p[SAE_FP_MAX_WORDS];
+	uint32_t rr[SAE_FP_MAX_WORDS];		/* R^2 mod p */
+	uint32_t one[SAE_FP_MAX_WORDS];		/* R mod p */
+	uint32_t a[SAE_FP_MAX_WORDS];
+	uint32_t b[SAE_FP_MAX_WORDS];
+	uint32_t z[SAE_FP_MAX_WORDS];
+	uint32_t e_inv[SAE_FP_MAX_WORDS];	/* p - 2 */
+	uint32_t e_qr[SAE_FP_MAX_WORDS];	/* (p - 1) / 2 */
+	uint32_t e_sqrt[SAE_FP_MAX_WORDS];	/* (p + 1) / 4 */
+};
+
+static const uint8_t sae_p256_p[32] = {
+	0xff, 0xff, 0xff, 0xff, 0x00, 0x00, 0x00, 0x01,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+};
+
+static const uint8_t sae_p256_b[32] = {
+	0x5a, 0xc6, 0x35, 0xd8, 0xaa, 0x3a, 0x93, 0xe7,
+	0xb3, 0xeb, 0xbd, 0x55, 0x76, 0x98, 0x86, 0xbc,
+	0x65, 0x1d, 0x06, 0xb0, 0xcc, 0x53, 0xb0, 0xf6,
+	0x3b, 0xce, 0x3c, 0x3e, 0x27, 0xd2, 0x60, 0x4b,
+};
+
+static const uint8_t sae_p384_p[48] = {
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xfe,
+	0xff, 0xff, 0xff, 0xff, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0xff, 0xff, 0xff, 0xff,
+};
+
+static const uint8_t sae_p384_b[48] = {
+	0xb3, 0x31, 0x2f, 0xa7, 0xe2, 0x3e, 0xe7, 0xe4,
+	0x98, 0x8e, 0x05, 0x6b, 0xe3, 0xf8, 0x2d, 0x19,
+	0x18, 0x1d, 0x9c, 0x6e, 0xfe, 0x81, 0x41, 0x12,
+	0x03, 0x14, 0x08, 0x8f, 0x50, 0x13, 0x87, 0x5a,
+	0xc6, 0x56, 0x39, 0x8d, 0x8a, 0x2e, 0xd1, 0x9d,
+	0x2a, 0x85, 0xc8, 0xed, 0xd3, 0xec, 0x2a, 0xef,
+};
+
+static void sae_fp_from_be(uint32_t *r, const uint8_t *in,
+						unsigned int n_words)
+{
+	unsigned int i;
+
+	for (i = 0; i < n_words; i++)
+		r[i] = l_get_be32(in + (n_words - 1 - i) * 4);
+}
+
+static void sae_fp_to_be(uint8_t *out, const uint32_t *a,
+						unsigned int n_words)
+{
+	unsigned int i;
+
+	for (i = 0; i < n_words; i++)
+		l_put_be32(a[i], out + (n_words - 1 - i) * 4);
+}
+
+/* r = a + b, returns the carry out */
+static uint32_t sae_words_add(uint32_t *r, const uint32_t *a,
+				const uint32_t *b, unsigned int n_words)
+{
+	uint64_t c = 0;
+	unsigned int i;
+
+	for (i = 0; i < n_words; i++) {
+		c += (uint64_t) a[i] + b[i];
+		r[i] = c;
+		c >>= 32;
+	}
+
+	return c;
+}
+
+/* r = a - b, returns the borrow out */
+static uint32_t sae_words_sub(uint32_t *r, const uint32_t *a,
+				const uint32_t *b, unsigned int n_words)
+{
+	uint32_t borrow = 0;
+	uint64_t d;
+	unsigned int i;
+
+	for (i = 0; i < n_words; i++) {
+		d = (uint64_t) a[i] - b[i] - borrow;
+		r[i] = d;
+		borrow = (d >> 32) & 1;
+	}
+
+	return borrow;
+}
+
+/* r = mask ? a : b, mask being all ones or all zeros */
+static void sae_fp_select(const struct sae_fp *f, uint32_t *r, uint32_t mask,
+				const uint32_t *a, const uint32_t *b)
+{
+	unsigned int i;
+
+	for (i = 0; i < f->n_words; i++)
+		r[i] = (a[i] & mask) | (b[i] & ~mask);
+}
+
+/* Returns all ones if a is zero, all zeros otherwise */
+static uint32_t sae_fp_is_zero(const struct sae_fp *f, const uint32_t *a)
+{
+	uint32_t acc = 0;
+	unsigned int i;
+
+	for (i = 0; i < f->n_words; i++)
+		acc |= a[i];
+
+	return ((uint64_t) acc - 1) >> 32;
+}
+
+static void sae_fp_add(const struct sae_fp *f, uint32_t *r,
+				const uint32_t *a, const uint32_t *b)
+{
+	uint32_t t[SAE_FP_MAX_WORDS];
+	uint32_t s[SAE_FP_MAX_WORDS];
+	uint32_t carry;
+	uint32_t borrow;
+
+	carry = sae_words_add(t, a, b, f->n_words);
+	borrow = sae_words_sub(s, t, f->p, f->n_words);
+	sae_fp_select(f, r, 0 - (carry | (borrow ^ 1)), s, t);
+}
+
+static void sae_fp_sub(const struct sae_fp *f, uint32_t *r,
+				const uint32_t *a, const uint32_t *b)
+{
+	uint32_t t[SAE_FP_MAX_WORDS];
+	uint32_t s[SAE_FP_MAX_WORDS];
+	uint32_t borrow;
+
+	borrow = sae_words_sub(t, a, b, f->n_words);
+	sae_words_add(s, t, f->p, f->n_words);
+	sae_fp_select(f, r, 0 - borrow, s, t);
+}
+
+/*
+ * Montgomery multiplication, r = a * b / R mod p.  Both primes are -1 mod
+ * 2^32, which makes -p^-1 mod 2^32 equal to 1.
+ */
+static void sae_fp_mul(const struct sae_fp *f, uint32_t *r,
+				const uint32_t *a, const uint32_t *b)
+{
+	unsigned int n = f->n_words;
+	uint32_t t[SAE_FP_MAX_WORDS + 2] = {};
+	uint32_t s[SAE_FP_MAX_WORDS];
+	uint32_t borrow;
+	uint32_t m;
+	uint64_t c;
+	unsigned int i;
+	unsigned int j;
+
+	for (i = 0; i < n; i++) {
+		c = 0;
+
+		for (j = 0; j < n; j++) {
+			c += t[j] + (uint64_t) a[j] * b[i];
+			t[j] = c;
+			c >>= 32;
+		}
+
+		c += t[n];
+		t[n] = c;
+		t[n + 1] = c >> 32;
+
+		m = t[0];
+		c = (t[0] + (uint64_t) m * f->p[0]) >> 32;
+
+		for (j = 1; j < n; j++) {
+			c += t[j] + (uint64_t) m * f->p[j];
+			t[j - 1] = c;
+			c >>= 32;
+		}
+
+		c += t[n];
+		t[n - 1] = c;
+		t[n] = t[n + 1] + (c >> 32);
+	}
+
+	/* t < 2p, so at most one subtraction of p is needed */
+	borrow = sae_words_sub(s, t, f->p, n);
+	sae_fp_select(f, r, 0 - (t[n] | (borrow ^ 1)), s, t);
+}
+
+/* r = a^e, e is public */
+static void sae_fp_pow(const struct sae_fp *f, uint32_t *r,
+				const uint32_t *a, const uint32_t *e)
+{
+	uint32_t x[SAE_FP_MAX_WORDS];
+	int i;
+
+	memcpy(x, f->one, sizeof(x));
+
+	for (i = f->n_words * 32 - 1; i >= 0; i--) {
+		sae_fp_mul(f, x, x, x);
+
+		if (e[i / 32] & (1U << (i % 32)))
+			sae_fp_mul(f, x, x, a);
+	}
+
+	memcpy(r, x, sizeof(x));
+}
+
+static void sae_fp_from_bytes(const struct sae_fp *f, uint32_t *r,
+						const uint8_t *in)
+{
+	uint32_t t[SAE_FP_MAX_WORDS];
+
+	sae_fp_from_be(t, in, f->n_words);
+	sae_fp_mul(f, r, t, f->rr);
+}
+
+static void sae_fp_to_bytes(const struct sae_fp *f, uint8_t *out,
+						const uint32_t *a)
+{
+	uint32_t unity[SAE_FP_MAX_WORDS] = { 1 };
+	uint32_t t[SAE_FP_MAX_WORDS];
+
+	sae_fp_mul(f, t, a, unity);
+	sae_fp_to_be(out, t, f->n_words);
+}
+
+/* r = -w mod p in the Montgomery domain */
+static void sae_fp_from_neg_word(const struct sae_fp *f, uint32_t *r,
+							uint32_t w)
+{
+	uint32_t t[SAE_FP_MAX_WORDS] = { w };
+
+	sae_words_sub(t, f->p, t, f->n_words);
+	sae_fp_mul(f, r, t, f->rr);
+}
+
+static bool sae_fp_init(struct sae_fp *f, unsigned int group)
+{
+	static const uint32_t zero[SAE_FP_MAX_WORDS];
+	static const uint32_t unity[SAE_FP_MAX_WORDS] = { 1 };
+	static const uint32_t two[SAE_FP_MAX_WORDS] = { 2 };
+	uint32_t p_plus_1[SAE_FP_MAX_WORDS];
+	const uint8_t *p;
+	const uint8_t *b;
+	uint32_t z;
+	unsigned int i;
+
+	memset(f, 0, sizeof(*f));
+
+	/* 802.11-2020, Table 12-2 Unique curve parameter */
+	switch (group) {
+	case 19:
+		p = sae_p256_p;
+		b = sae_p256_b;
+		f->len = sizeof(sae_p256_p);
+		z = 10;
+		break;
+	case 20:
+		p = sae_p384_p;
+		b = sae_p384_b;
+		f->len = sizeof(sae_p384_p);
+		z = 12;
+		break;
+	default:
+		return false;
+	}
+
+	f->n_words = f->len / 4;
+	sae_fp_from_be(f->p, p, f->n_words);
+
+	/* R mod p = 2^(32 * n_words) - p, then double it into R^2 mod p */
+	sae_words_sub(f->one, zero, f->p, f->n_words);
+	memcpy(f->rr, f->one, sizeof(f->rr));
+
+	for (i = 0; i < f->n_words * 32; i++)
+		sae_fp_add(f, f->rr, f->rr, f->rr);
+
+	sae_fp_from_neg_word(f, f->a, 3);
+	sae_fp_from_bytes(f, f->b, b);
+	sae_fp_from_neg_word(f, f->z, z);
+
+	/* p = 3 mod 4 for both, which makes these plain shifts */
+	sae_words_sub(f->e_inv, f->p, two, f->n_words);
+	sae_words_add(p_plus_1, f->p, unity, f->n_words);
+
+	for (i = 0; i < f->n_words; i++) {
+		uint32_t next = i + 1 < f->n_words ? f->p[i + 1] : 0;
+		uint32_t next_plus_1 = i + 1 < f->n_words ? p_plus_1[i + 1] : 0;
+
+		f->e_qr[i] = (f->p[i] >> 1) | (next << 31);
+		f->e_sqrt[i] = (p_plus_1[i] >> 2) | (next_plus_1 << 30);
+	}
+
+	return true;
+}
+
+/* r = x^3 + a * x + b */
+static void sae_fp_curve_rhs(const struct sae_fp *f, uint32_t *r,
+						const uint32_t *x)
+{
+	uint32_t t[SAE_FP_MAX_WORDS];
+	uint32_t ax[SAE_FP_MAX_WORDS];
+
+	sae_fp_mul(f, t, x, x);
+	sae_fp_mul(f, t, t, x);
+	sae_fp_mul(f, ax, f->a, x);
+	sae_fp_add(f, t, t, ax);
+	sae_fp_add(f, r, t, f->b);
+}
+
+struct sae_sswu_state {
+	uint32_t u[SAE_FP_MAX_WORDS];
+	uint32_t zu2[SAE_FP_MAX_WORDS];
+	uint32_t m[SAE_FP_MAX_WORDS];
+	uint32_t t[SAE_FP_MAX_WORDS];
+	uint32_t x1[SAE_FP_MAX_WORDS];
+	uint32_t x1_alt[SAE_FP_MAX_WORDS];
+	uint32_t gx1[SAE_FP_MAX_WORDS];
+	uint32_t x2[SAE_FP_MAX_WORDS];
+	uint32_t gx2[SAE_FP_MAX_WORDS];
+	uint32_t v[SAE_FP_MAX_WORDS];
+	uint32_t neg_y[SAE_FP_MAX_WORDS];
+	uint8_t y_data[SAE_FP_MAX_WORDS * 4];
+};
+
+/* 802.11-2020, Section 12.4.4.2.3 Hash-to-curve generic algorithm */
+static void sae_fp_sswu(const struct sae_fp *f, const uint8_t *u_data,
+					uint32_t *out_x, uint32_t *out_y)
+{
+	static const uint32_t zero[SAE_FP_MAX_WORDS];
+	struct sae_sswu_state s;
+	uint32_t l;
+
+	sae_fp_from_bytes(f, s.u, u_data);
+
+	/* m = (z^2 * u^4 + z * u^2) mod p */
+	sae_fp_mul(f, s.t, s.u, s.u);
+	sae_fp_mul(f, s.zu2, f->z, s.t);
+	sae_fp_mul(f, s.m, s.zu2, s.zu2);
+	sae_fp_add(f, s.m, s.m, s.zu2);
+
+	/* l = CEQ(m, 0), t = inverse(m) */
+	l = sae_fp_is_zero(f, s.m);
+	sae_fp_pow(f, s.t, s.m, f->e_inv);
+
+	/* x1 = CSEL(l, (b / (z * a) mod p), ((- b / a) * (1 + t)) mod p) */
+	sae_fp_mul(f, s.x1_alt, f->z, f->a);
+	sae_fp_pow(f, s.x1_alt, s.x1_alt, f->e_inv);
+	sae_fp_mul(f, s.x1_alt, s.x1_alt, f->b);
+
+	sae_fp_pow(f, s.x1, f->a, f->e_inv);
+	sae_fp_mul(f, s.x1, s.x1, f->b);
+	sae_fp_sub(f, s.x1, zero, s.x1);
+	sae_fp_add(f, s.t, s.t, f->one);
+	sae_fp_mul(f, s.x1, s.x1, s.t);
+
+	sae_fp_select(f, s.x1, l, s.x1_alt, s.x1);
+
+	/* x2 = (z * u^2 * x1) mod p */
+	sae_fp_curve_rhs(f, s.gx1, s.x1);
+	sae_fp_mul(f, s.x2, s.zu2, s.x1);
+	sae_fp_curve_rhs(f, s.gx2, s.x2);
+
+	/* l = gx1 is a quadratic residue modulo p */
+	sae_fp_pow(f, s.t, s.gx1, f->e_qr);
+	sae_fp_sub(f, s.t, s.t, f->one);
+	l = sae_fp_is_zero(f, s.t);
+
+	/* v = CSEL(l, gx1, gx2), x = CSEL(l, x1, x2), y = sqrt(v) */
+	sae_fp_select(f, s.v, l, s.gx1, s.gx2);
+	sae_fp_select(f, out_x, l, s.x1, s.x2);
+	sae_fp_pow(f, out_y, s.v, f->e_sqrt);
+
+	/* l = CEQ(LSB(u), LSB(y)), P = CSEL(l, (x,y), (x, p-y)) */
+	sae_fp_to_bytes(f, s.y_data, out_y);
+	l = 0 - ((u_data[f->len - 1] ^ s.y_data[f->len - 1]) & 1);
+	sae_fp_sub(f, s.neg_y, zero, out_y);
+	sae_fp_select(f, out_y, l, s.neg_y, out_y);
+
+	explicit_bzero(&s, sizeof(s));
+}
+
+struct sae_pt_state {
+	uint32_t x1[SAE_FP_MAX_WORDS];
+	uint32_t y1[SAE_FP_MAX_WORDS];
+	uint32_t x2[SAE_FP_MAX_WORDS];
+	uint32_t y2[SAE_FP_MAX_WORDS];
+	uint32_t t[SAE_FP_MAX_WORDS];
+	uint32_t lambda[SAE_FP_MAX_WORDS];
+	uint32_t x3[SAE_FP_MAX_WORDS];
+	uint32_t y3[SAE_FP_MAX_WORDS];
+};
+
+/*
+ * Same as the ell part of crypto_derive_sae_pt_ecc: PT = SSWU(u1) + SSWU(u2)
+ * with u1 and u2 being big endian and already reduced modulo p.  Only plain
+ * buffers go in and out, out_pt receives the affine x || y.  Fails for
+ * groups other than 19 and 20, and if P1 = +/- P2 which, with u1 and u2 the
+ * outputs of a hash, is not going to happen in practice.
+ */
+bool crypto_sae_pt_from_u_ecc(unsigned int group, const uint8_t *u1,
+				const uint8_t *u2, uint8_t *out_pt)
+{
+	struct sae_fp f;
+	struct sae_pt_state s;
+	bool r = false;
+
+	if (!sae_fp_init(&f, group))
+		return false;
+
+	sae_fp_sswu(&f, u1, s.x1, s.y1);
+	sae_fp_sswu(&f, u2, s.x2, s.y2);
+
+	/* lambda = (y2 - y1) / (x2 - x1), x1 = x2 only if P1 = +/- P2 */
+	sae_fp_sub(&f, s.t, s.x2, s.x1);
+	if (sae_fp_is_zero(&f, s.t))
+		goto done;
+
+	sae_fp_pow(&f, s.t, s.t, f.e_inv);
+	sae_fp_sub(&f, s.lambda, s.y2, s.y1);
+	sae_fp_mul(&f, s.lambda, s.lambda, s.t);
+
+	/* x3 = lambda^2 - x1 - x2, y3 = lambda * (x1 - x3) - y1 */
+	sae_fp_mul(&f, s.x3, s.lambda, s.lambda);
+	sae_fp_sub(&f, s.x3, s.x3, s.x1);
+	sae_fp_sub(&f, s.x3, s.x3, s.x2);
+	sae_fp_sub(&f, s.y3, s.x1, s.x3);
+	sae_fp_mul(&f, s.y3, s.lambda, s.y3);
+	sae_fp_sub(&f, s.y3, s.y3, s.y1);
+
+	sae_fp_to_bytes(&f, out_pt, s.x3);
+	sae_fp_to_bytes(&f, out_pt + f.len, s.y3);
+	r = true;
+
+done:
+	explicit_bzero(&s, sizeof(s));
+	return r;
+}
+
 struct l_ecc_point *crypto_derive_sae_pwe_from_pt_ecc(const uint8_t *mac1,
 						const uint8_t *mac2,
 						const struct l_ecc_point *pt)
@@ -72,6 +72,35 @@ extern size_t crypto_dh5_prime_size;
 extern const unsigned char crypto_dh5_generator[];
 extern size_t crypto_dh5_generator_size;
 
+struct crypto_checksum;
+struct crypto_aes;
+
+/*
+ * Handshake MACs and ciphers.  Provided either by ell (AF_ALG) or by the
+ * in-process backend depending on --enable-soft-crypto.
+ */
+struct crypto_checksum *crypto_checksum_new(enum l_checksum_type type);
+struct crypto_checksum *crypto_checksum_new_hmac(enum l_checksum_type type,
+						const void *key,
+						size_t key_len);
+struct crypto_checksum *crypto_checksum_new_cmac_aes(const void *key,
+							size_t key_len);
+void crypto_checksum_reset(struct crypto_checksum *checksum);
+bool crypto_checksum_update(struct crypto_checksum *checksum,
+				const void *data, size_t len);
+bool crypto_checksum_updatev(struct crypto_checksum *checksum,
+				const struct iovec *iov, size_t iov_len);
+ssize_t crypto_checksum_get_digest(struct crypto_checksum *checksum,
+					void *digest, size_t len);
+void crypto_checksum_free(struct crypto_checksum *checksum);
+
+struct crypto_aes *crypto_aes_new(const void *key, size_t key_len);
+bool crypto_aes_encrypt(struct crypto_aes *aes, const void *in, void *out,
+			size_t len);
+bool crypto_aes_decrypt(struct crypto_aes *aes, const void *in, void *out,
+			size_t len);
+void crypto_aes_free(struct crypto_aes *aes);
+
 bool hmac_md5(const void *key, size_t key_len,
 		const void *data, size_t data_len, void *output, size_t size);
 bool hmac_sha1(const void *key, size_t key_len,
@@ -105,6 +134,17 @@ int crypto_psk_from_passphrase(const char *passphrase,
 				const unsigned char *ssid, size_t ssid_len,
 				unsigned char *out_psk);
 
+struct crypto_psk_derivation {
+	const char *passphrase;
+	const unsigned char *ssid;
+	size_t ssid_len;
+	int err;
+	unsigned char psk[32];
+};
+
+void crypto_psk_from_passphrase_batch(struct crypto_psk_derivation *reqs,
+					unsigned int n_reqs);
+
 bool crypto_kdf(enum l_checksum_type type, const void *key, size_t key_len,
 		const void *prefix, size_t prefix_len,
 		const void *data, size_t data_len, void *output, size_t size);
@@ -170,6 +210,11 @@ struct l_ecc_point *crypto_derive_sae_pt_ecc(unsigned int group,
 						const char *ssid,
 						const char *password,
 						const char *identifier);
+bool crypto_derive_sae_pt_u_ecc(unsigned int group, const char *ssid,
+				const char *password, const char *identifier,
+				uint8_t *out_u1, uint8_t *out_u2);
+bool crypto_sae_pt_from_u_ecc(unsigned int group, const uint8_t *u1,
+				const uint8_t *u2, uint8_t *out_pt);
 struct l_ecc_point *crypto_derive_sae_pwe_from_pt_ecc(const uint8_t *mac1,
 						const uint8_t *mac2,
 						const struct l_ecc_point *pt);
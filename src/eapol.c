@@ -40,14 +40,12 @@
 #include "src/mpdu.h"
 #include "src/eap.h"
 #include "src/handshake.h"
-#include "src/watchlist.h"
 #include "src/erp.h"
 #include "src/iwd.h"
 #include "src/band.h"
 
-static struct l_queue *state_machines;
-static struct l_queue *preauths;
-static struct watchlist frame_watches;
+static struct l_hashmap *state_machines;
+static struct l_hashmap *preauths;
 static uint32_t eapol_4way_handshake_time = 2;
 
 static eapol_rekey_offload_func_t rekey_offload = NULL;
@@ -138,7 +136,7 @@ bool eapol_verify_mic(enum ie_rsn_akm_suite akm, const uint8_t *kck,
 {
 	uint8_t mic[MIC_MAXLEN];
 	struct iovec iov[3];
-	struct l_checksum *checksum = NULL;
+	struct crypto_checksum *checksum = NULL;
 
 	iov[0].iov_base = (void *) frame;
 	iov[0].iov_len = offsetof(struct eapol_key, key_data);
@@ -152,39 +150,39 @@ bool eapol_verify_mic(enum ie_rsn_akm_suite akm, const uint8_t *kck,
 
 	switch (frame->key_descriptor_version) {
 	case EAPOL_KEY_DESCRIPTOR_VERSION_HMAC_MD5_ARC4:
-		checksum = l_checksum_new_hmac(L_CHECKSUM_MD5, kck, 16);
+		checksum = crypto_checksum_new_hmac(L_CHECKSUM_MD5, kck, 16);
 		break;
 	case EAPOL_KEY_DESCRIPTOR_VERSION_HMAC_SHA1_AES:
-		checksum = l_checksum_new_hmac(L_CHECKSUM_SHA1, kck, 16);
+		checksum = crypto_checksum_new_hmac(L_CHECKSUM_SHA1, kck, 16);
 		break;
 	case EAPOL_KEY_DESCRIPTOR_VERSION_AES_128_CMAC_AES:
-		checksum = l_checksum_new_cmac_aes(kck, 16);
+		checksum = crypto_checksum_new_cmac_aes(kck, 16);
 		break;
 	case EAPOL_KEY_DESCRIPTOR_VERSION_AKM_DEFINED:
 		switch (akm) {
 		case IE_RSN_AKM_SUITE_SAE_SHA256:
 		case IE_RSN_AKM_SUITE_FT_OVER_SAE_SHA256:
 		case IE_RSN_AKM_SUITE_OSEN:
-			checksum = l_checksum_new_cmac_aes(kck, 16);
+			checksum = crypto_checksum_new_cmac_aes(kck, 16);
 			break;
 		case IE_RSN_AKM_SUITE_FT_OVER_8021X_SHA384:
-			checksum = l_checksum_new_hmac(L_CHECKSUM_SHA384,
+			checksum = crypto_checksum_new_hmac(L_CHECKSUM_SHA384,
 							kck, 24);
 			break;
 		case IE_RSN_AKM_SUITE_OWE:
 			switch (mic_len) {
 			case 16:
-				checksum = l_checksum_new_hmac(
+				checksum = crypto_checksum_new_hmac(
 							L_CHECKSUM_SHA256,
 							kck, 16);
 				break;
 			case 24:
-				checksum = l_checksum_new_hmac(
+				checksum = crypto_checksum_new_hmac(
 							L_CHECKSUM_SHA384,
 							kck, 24);
 				break;
 			case 32:
-				checksum = l_checksum_new_hmac(
+				checksum = crypto_checksum_new_hmac(
 							L_CHECKSUM_SHA512,
 							kck, 32);
 				break;
@@ -207,9 +205,9 @@ bool eapol_verify_mic(enum ie_rsn_akm_suite akm, const uint8_t *kck,
 	if (checksum == NULL)
 		return false;
 
-	l_checksum_updatev(checksum, iov, 3);
-	l_checksum_get_digest(checksum, mic, mic_len);
-	l_checksum_free(checksum);
+	crypto_checksum_updatev(checksum, iov, 3);
+	crypto_checksum_get_digest(checksum, mic, mic_len);
+	crypto_checksum_free(checksum);
 
 	if (!memcmp(frame->key_data, mic, mic_len))
 		return true;
@@ -830,39 +828,112 @@ struct eapol_key *eapol_create_gtk_2_of_2(
 	return step2;
 }
 
-struct eapol_frame_watch {
+/*
+ * State machines are indexed by the interface and the address of the peer
+ * they're exchanging frames with so that the frame dispatch cost doesn't
+ * grow with the number of concurrent handshakes, e.g. one per station in
+ * AP mode.  Several state machines can share a peer (e.g. the supplicant
+ * and authenticator sides in Ad-Hoc mode) so each entry holds a queue.
+ */
+struct eapol_peer {
 	uint32_t ifindex;
-	struct watchlist_item super;
+	uint8_t addr[ETH_ALEN];
+	struct l_queue *entries;
 };
 
-static void eapol_frame_watch_free(struct watchlist_item *item)
+static unsigned int eapol_peer_hash(const void *p)
 {
-	struct eapol_frame_watch *efw =
-		l_container_of(item, struct eapol_frame_watch, super);
+	const struct eapol_peer *peer = p;
 
-	l_free(efw);
+	return util_hash_bytes(util_address_hash(peer->addr),
+				&peer->ifindex, sizeof(peer->ifindex));
 }
 
-static const struct watchlist_ops eapol_frame_watch_ops = {
-	.item_free = eapol_frame_watch_free,
-};
+static int eapol_peer_compare(const void *a, const void *b)
+{
+	const struct eapol_peer *peer_a = a;
+	const struct eapol_peer *peer_b = b;
 
-static int32_t eapol_frame_watch_add(uint32_t ifindex,
-					eapol_frame_watch_func_t handler,
-					void *user_data)
+	if (peer_a->ifindex != peer_b->ifindex)
+		return 1;
+
+	return memcmp(peer_a->addr, peer_b->addr, sizeof(peer_a->addr));
+}
+
+static struct l_hashmap *eapol_peer_index_new(void)
 {
-	struct eapol_frame_watch *efw;
+	struct l_hashmap *index = l_hashmap_new();
+
+	l_hashmap_set_hash_function(index, eapol_peer_hash);
+	l_hashmap_set_compare_function(index, eapol_peer_compare);
+
+	return index;
+}
+
+static struct l_queue *eapol_peer_index_lookup(struct l_hashmap *index,
+						uint32_t ifindex,
+						const uint8_t *addr)
+{
+	struct eapol_peer key = { .ifindex = ifindex };
+	struct eapol_peer *peer;
+
+	memcpy(key.addr, addr, ETH_ALEN);
+	peer = l_hashmap_lookup(index, &key);
+
+	return peer ? peer->entries : NULL;
+}
+
+static void eapol_peer_index_add(struct l_hashmap *index, uint32_t ifindex,
+					const uint8_t *addr, void *data)
+{
+	struct eapol_peer key = { .ifindex = ifindex };
+	struct eapol_peer *peer;
+
+	memcpy(key.addr, addr, ETH_ALEN);
+	peer = l_hashmap_lookup(index, &key);
+
+	if (!peer) {
+		peer = l_memdup(&key, sizeof(key));
+		peer->entries = l_queue_new();
+		l_hashmap_insert(index, peer, peer);
+	}
+
+	l_queue_push_head(peer->entries, data);
+}
+
+static bool eapol_peer_index_remove(struct l_hashmap *index, uint32_t ifindex,
+					const uint8_t *addr, void *data)
+{
+	struct eapol_peer key = { .ifindex = ifindex };
+	struct eapol_peer *peer;
+
+	memcpy(key.addr, addr, ETH_ALEN);
+	peer = l_hashmap_lookup(index, &key);
+
+	if (!peer || !l_queue_remove(peer->entries, data))
+		return false;
 
-	efw = l_new(struct eapol_frame_watch, 1);
-	efw->ifindex = ifindex;
+	if (l_queue_isempty(peer->entries)) {
+		l_hashmap_remove(index, peer);
+		l_queue_destroy(peer->entries, NULL);
+		l_free(peer);
+	}
 
-	return watchlist_link(&frame_watches, &efw->super,
-				handler, user_data, NULL);
+	return true;
 }
 
-static bool eapol_frame_watch_remove(uint32_t id)
+static bool eapol_peer_index_contains(struct l_hashmap *index,
+					uint32_t ifindex, const uint8_t *addr,
+					void *data)
 {
-	return watchlist_remove(&frame_watches, id);
+	struct l_queue *entries = eapol_peer_index_lookup(index, ifindex, addr);
+	const struct l_queue_entry *entry;
+
+	for (entry = l_queue_get_entries(entries); entry; entry = entry->next)
+		if (entry->data == data)
+			return true;
+
+	return false;
 }
 
 struct eapol_sm {
@@ -883,13 +954,15 @@ struct eapol_sm {
 	struct eap_state *eap;
 	struct eapol_frame *early_frame;
 	bool early_frame_unencrypted : 1;
-	uint32_t watch_id;
+	bool registered : 1;
+	uint8_t indexed_addr[ETH_ALEN];
 	uint8_t installed_gtk_len;
 	uint8_t installed_gtk[CRYPTO_MAX_GTK_LEN];
 	uint8_t installed_igtk_len;
 	uint8_t installed_igtk[CRYPTO_MAX_IGTK_LEN];
 	unsigned int mic_len;
 	bool rekey : 1;
+	bool group_rekey : 1;
 };
 
 static void eapol_sm_destroy(void *value)
@@ -904,8 +977,6 @@ static void eapol_sm_destroy(void *value)
 
 	l_free(sm->early_frame);
 
-	eapol_frame_watch_remove(sm->watch_id);
-
 	sm->installed_gtk_len = 0;
 	explicit_bzero(sm->installed_gtk, sizeof(sm->installed_gtk));
 	sm->installed_igtk_len = 0;
@@ -930,9 +1001,67 @@ struct eapol_sm *eapol_sm_new(struct handshake_state *hs)
 	return sm;
 }
 
+static const uint8_t *eapol_sm_peer_addr(const struct eapol_sm *sm)
+{
+	return sm->handshake->authenticator ?
+		sm->handshake->spa : sm->handshake->aa;
+}
+
+static void eapol_sm_index_add(struct eapol_sm *sm)
+{
+	memcpy(sm->indexed_addr, eapol_sm_peer_addr(sm), ETH_ALEN);
+	eapol_peer_index_add(state_machines, sm->handshake->ifindex,
+				sm->indexed_addr, sm);
+}
+
+static void eapol_sm_index_remove(struct eapol_sm *sm)
+{
+	eapol_peer_index_remove(state_machines, sm->handshake->ifindex,
+				sm->indexed_addr, sm);
+}
+
+static bool eapol_sm_match_moved(const void *a, const void *b)
+{
+	const struct eapol_sm *sm = a;
+
+	if (sm->handshake != b)
+		return false;
+
+	return memcmp(sm->indexed_addr, eapol_sm_peer_addr(sm), ETH_ALEN);
+}
+
+/*
+ * The handshake addresses may change after the state machine has been
+ * registered, e.g. on a firmware roam.  Move the state machines of that
+ * handshake which were indexed under the old peer address.
+ */
+static void eapol_handshake_address_changed(struct handshake_state *hs,
+						const uint8_t *old_addr)
+{
+	struct l_queue *entries;
+	struct eapol_sm *sm;
+
+	while (true) {
+		entries = eapol_peer_index_lookup(state_machines, hs->ifindex,
+							old_addr);
+		sm = l_queue_find(entries, eapol_sm_match_moved, hs);
+		if (!sm)
+			break;
+
+		eapol_sm_index_remove(sm);
+		eapol_sm_index_add(sm);
+	}
+}
+
+static struct l_queue *eapol_sm_lookup(uint32_t ifindex, const uint8_t *addr)
+{
+	return eapol_peer_index_lookup(state_machines, ifindex, addr);
+}
+
 void eapol_sm_free(struct eapol_sm *sm)
 {
-	l_queue_remove(state_machines, sm);
+	if (sm->registered)
+		eapol_sm_index_remove(sm);
 
 	eapol_sm_destroy(sm);
 }
@@ -1221,18 +1350,29 @@ static void eapol_handle_ptk_1_of_4(struct eapol_sm *sm,
 		bool found = false;
 		int i;
 
-		if (!pmkid)
-			goto error_unspecified;
-
-		for (i = 0; i < rsn_info.num_pmkids; i++)
+		for (i = 0; pmkid && i < rsn_info.num_pmkids; i++)
 			if (!l_secure_memcmp(rsn_info.pmkids + i * 16,
 						pmkid, 16)) {
 				found = true;
 				break;
 			}
 
-		if (!found)
+		if (!found) {
+			/*
+			 * The authenticator doesn't have the PMKSA we
+			 * offered.  If we can establish a new one through
+			 * EAP, drop the cached PMK and do that instead.
+			 */
+			if (sm->eap &&
+				handshake_state_remove_pmksa(sm->handshake)) {
+				l_debug("PMKSA not accepted, starting EAP");
+				sm->handshake->have_pmk = false;
+				__send_eapol_start(sm, unencrypted);
+				return;
+			}
+
 			goto error_unspecified;
+		}
 	} else if (pmkid) {
 		if (!handshake_state_pmkid_matches(sm->handshake, pmkid)) {
 			l_debug("Authenticator sent a PMKID that didn't match");
@@ -1506,6 +1646,82 @@ static void eapol_ptk_3_of_4_retry(struct l_timeout *timeout,
 	l_debug("attempt %i", sm->frame_retry);
 }
 
+#define EAPOL_GROUP_UPDATE_COUNT 3
+
+/* 802.11-2016 Section 12.7.7.2 */
+static void eapol_send_gtk_1_of_2(struct eapol_sm *sm)
+{
+	uint8_t frame_buf[512];
+	uint8_t key_data_buf[128];
+	int key_data_len;
+	struct eapol_key *ek = (struct eapol_key *) frame_buf;
+	enum crypto_cipher group_cipher = ie_rsn_cipher_suite_to_cipher(
+				sm->handshake->group_cipher);
+	const uint8_t *kck;
+	const uint8_t *kek;
+	uint8_t key_descriptor_version;
+
+	sm->replay_counter++;
+
+	memset(ek, 0, EAPOL_FRAME_LEN(sm->mic_len));
+	ek->header.protocol_version = sm->protocol_version;
+	ek->header.packet_type = 0x3;
+	ek->descriptor_type = EAPOL_DESCRIPTOR_TYPE_80211;
+	L_WARN_ON(eapol_key_descriptor_version_from_akm(
+				sm->handshake->akm_suite,
+				sm->handshake->pairwise_cipher,
+				&key_descriptor_version) < 0);
+	ek->key_descriptor_version = key_descriptor_version;
+	ek->key_ack = true;
+	ek->key_mic = true;
+	ek->secure = true;
+	ek->encrypted_key_data = true;
+	ek->key_replay_counter = L_CPU_TO_BE64(sm->replay_counter);
+	memcpy(ek->key_rsc, sm->handshake->gtk_rsc, 6);
+
+	handshake_util_build_gtk_kde(group_cipher, sm->handshake->gtk,
+					sm->handshake->gtk_index, key_data_buf);
+	key_data_len = key_data_buf[1] + 2;
+
+	kek = handshake_state_get_kek(sm->handshake);
+	key_data_len = eapol_encrypt_key_data(kek, key_data_buf,
+						key_data_len, ek, sm->mic_len);
+	explicit_bzero(key_data_buf, sizeof(key_data_buf));
+
+	if (key_data_len < 0)
+		return;
+
+	ek->header.packet_len = L_CPU_TO_BE16(EAPOL_FRAME_LEN(sm->mic_len) +
+				key_data_len - 4);
+
+	kck = handshake_state_get_kck(sm->handshake);
+
+	if (!eapol_calculate_mic(sm->handshake->akm_suite, kck, ek,
+			EAPOL_KEY_MIC(ek), sm->mic_len))
+		return;
+
+	l_debug("STA: "MAC" retries=%u", MAC_STR(sm->handshake->spa),
+			sm->frame_retry);
+
+	eapol_sm_write(sm, (struct eapol_frame *) ek, false);
+}
+
+static void eapol_gtk_1_of_2_retry(struct l_timeout *timeout,
+						void *user_data)
+{
+	struct eapol_sm *sm = user_data;
+
+	if (sm->frame_retry >= EAPOL_GROUP_UPDATE_COUNT) {
+		handshake_failed(sm,
+				MMPDU_REASON_CODE_GROUP_KEY_HANDSHAKE_TIMEOUT);
+		return;
+	}
+
+	eapol_send_gtk_1_of_2(sm);
+
+	eapol_set_key_timeout(sm, eapol_gtk_1_of_2_retry);
+}
+
 static const uint8_t *eapol_find_rsne(const uint8_t *data, size_t data_len,
 				const uint8_t **optional)
 {
@@ -2112,6 +2328,36 @@ static void eapol_handle_ptk_4_of_4(struct eapol_sm *sm,
 	sm->handshake->ptk_complete = true;
 }
 
+/* 802.11-2016 Section 12.7.7.3 */
+static void eapol_handle_gtk_2_of_2(struct eapol_sm *sm,
+					const struct eapol_key *ek)
+{
+	const uint8_t *kck;
+
+	l_debug("ifindex=%u", sm->handshake->ifindex);
+
+	if (!sm->group_rekey)
+		return;
+
+	if (!eapol_verify_gtk_2_of_2(ek, false))
+		return;
+
+	if (L_BE64_TO_CPU(ek->key_replay_counter) != sm->replay_counter)
+		return;
+
+	kck = handshake_state_get_kck(sm->handshake);
+
+	if (!eapol_verify_mic(sm->handshake->akm_suite, kck, ek,
+				sm->mic_len))
+		return;
+
+	l_timeout_remove(sm->timeout);
+	sm->timeout = NULL;
+	sm->group_rekey = false;
+
+	handshake_event(sm->handshake, HANDSHAKE_EVENT_GROUP_REKEY_COMPLETE);
+}
+
 static void eapol_handle_gtk_1_of_2(struct eapol_sm *sm,
 					const struct eapol_key *ek,
 					const uint8_t *decrypted_key_data,
@@ -2262,11 +2508,11 @@ static struct eapol_sm *eapol_find_sm(uint32_t ifindex, const uint8_t *aa)
 	const struct l_queue_entry *entry;
 	struct eapol_sm *sm;
 
-	for (entry = l_queue_get_entries(state_machines); entry;
+	for (entry = l_queue_get_entries(eapol_sm_lookup(ifindex, aa)); entry;
 					entry = entry->next) {
 		sm = entry->data;
 
-		if (sm->handshake->ifindex != ifindex)
+		if (sm->handshake->authenticator)
 			continue;
 
 		if (memcmp(sm->handshake->aa, aa, ETH_ALEN))
@@ -2586,6 +2832,11 @@ static void eapol_auth_key_handle(struct eapol_sm *sm,
 	if (!sm->handshake->have_anonce)
 		return; /* Not expecting an EAPoL-Key yet */
 
+	if (!ek->key_type) {
+		eapol_handle_gtk_2_of_2(sm, ek);
+		return;
+	}
+
 	key_data_len = EAPOL_KEY_DATA_LEN(ek, sm->mic_len);
 	if (key_data_len != 0)
 		eapol_handle_ptk_2_of_4(sm, ek);
@@ -2717,7 +2968,8 @@ static void eapol_rx_packet(uint16_t proto, const uint8_t *from,
 			/*
 			 * Either this is an error (EAP negotiation in
 			 * progress) or the server is giving us a chance to
-			 * use a cached PMK.  We don't yet cache PMKs so
+			 * use a cached PMK.  We don't have a PMKSA for this
+			 * authenticator (otherwise have_pmk would be set) so
 			 * send an EAPOL-Start if we haven't sent one yet.
 			 */
 			if (sm->eapol_start_timeout) {
@@ -2775,13 +3027,9 @@ void __eapol_set_install_pmk_func(eapol_install_pmk_func_t func)
 
 void eapol_register(struct eapol_sm *sm)
 {
-	eapol_frame_watch_func_t rx_handler = sm->handshake->authenticator ?
-		eapol_rx_auth_packet : eapol_rx_packet;
+	eapol_sm_index_add(sm);
+	sm->registered = true;
 
-	l_queue_push_head(state_machines, sm);
-
-	sm->watch_id = eapol_frame_watch_add(sm->handshake->ifindex,
-						rx_handler, sm);
 	sm->protocol_version = sm->handshake->proto_version;
 }
 
@@ -2871,6 +3119,27 @@ eap_error:
 	return false;
 }
 
+/*
+ * Authenticator side Group Key Handshake, used to distribute the GTK
+ * currently set in the handshake_state.  Only possible once the PTK has
+ * been installed and while no other EAPoL-Key exchange is pending.
+ */
+bool eapol_start_group_rekey(struct eapol_sm *sm)
+{
+	if (L_WARN_ON(!sm->handshake->authenticator))
+		return false;
+
+	if (!sm->handshake->ptk_complete || sm->timeout)
+		return false;
+
+	sm->frame_retry = 0;
+	sm->group_rekey = true;
+
+	eapol_gtk_1_of_2_retry(NULL, sm);
+
+	return true;
+}
+
 struct preauth_sm {
 	uint32_t ifindex;
 	uint8_t aa[6];
@@ -2881,7 +3150,6 @@ struct preauth_sm {
 	eapol_preauth_destroy_func_t destroy;
 	void *user_data;
 	struct l_timeout *timeout;
-	uint32_t watch_id;
 	bool initial_rx:1;
 };
 
@@ -2896,7 +3164,6 @@ static void preauth_sm_destroy(void *value)
 
 	eap_free(sm->eap);
 	l_timeout_remove(sm->timeout);
-	eapol_frame_watch_remove(sm->watch_id);
 	l_free(sm);
 }
 
@@ -2971,7 +3238,7 @@ static void preauth_eap_complete_cb(enum eap_result result, void *user_data)
 		result == EAP_RESULT_SUCCESS ? "eapSuccess" :
 		(result == EAP_RESULT_FAIL ? "eapFail" : "eapTimeout"));
 
-	l_queue_remove(preauths, sm);
+	eapol_peer_index_remove(preauths, sm->ifindex, sm->aa, sm);
 
 	if (result == EAP_RESULT_SUCCESS)
 		sm->cb(sm->pmk, sm->user_data);
@@ -3002,7 +3269,7 @@ static void preauth_eap_results_cb(const uint8_t *msk_data, size_t msk_len,
 msk_short:
 	l_error("Preauthentication MSK too short");
 
-	l_queue_remove(preauths, sm);
+	eapol_peer_index_remove(preauths, sm->ifindex, sm->aa, sm);
 
 	sm->cb(NULL, sm->user_data);
 
@@ -3015,7 +3282,7 @@ static void preauth_timeout(struct l_timeout *timeout, void *user_data)
 
 	l_error("Preauthentication timeout");
 
-	l_queue_remove(preauths, sm);
+	eapol_peer_index_remove(preauths, sm->ifindex, sm->aa, sm);
 
 	sm->cb(NULL, sm->user_data);
 
@@ -3050,10 +3317,7 @@ struct preauth_sm *eapol_preauth_start(const uint8_t *aa,
 	sm->timeout = l_timeout_create(EAPOL_TIMEOUT_SEC, preauth_timeout,
 					sm, NULL);
 
-	sm->watch_id = eapol_frame_watch_add(sm->ifindex,
-						preauth_rx_packet, sm);
-
-	l_queue_push_head(preauths, sm);
+	eapol_peer_index_add(preauths, sm->ifindex, sm->aa, sm);
 
 	/* Send EAPOL-Start */
 	preauth_frame(sm, 1, NULL, 0);
@@ -3068,30 +3332,81 @@ err_free_sm:
 	return NULL;
 }
 
-static bool preauth_remove_by_ifindex(void *data, void *user_data)
+static void preauth_peer_destroy(void *data)
+{
+	struct eapol_peer *peer = data;
+
+	l_queue_destroy(peer->entries, preauth_sm_destroy);
+	l_free(peer);
+}
+
+static bool preauth_remove_by_ifindex(const void *key, void *value,
+					void *user_data)
 {
-	struct preauth_sm *sm = data;
+	struct eapol_peer *peer = value;
 
-	if (sm->ifindex != L_PTR_TO_UINT(user_data))
+	if (peer->ifindex != L_PTR_TO_UINT(user_data))
 		return false;
 
-	preauth_sm_destroy(sm);
+	preauth_peer_destroy(peer);
 
 	return true;
 }
 
 void eapol_preauth_cancel(uint32_t ifindex)
 {
-	l_queue_foreach_remove(preauths, preauth_remove_by_ifindex,
-				L_UINT_TO_PTR(ifindex));
+	l_hashmap_foreach_remove(preauths, preauth_remove_by_ifindex,
+					L_UINT_TO_PTR(ifindex));
+}
+
+static void eapol_sm_peer_destroy(void *data)
+{
+	struct eapol_peer *peer = data;
+
+	l_queue_destroy(peer->entries, eapol_sm_destroy);
+	l_free(peer);
 }
 
-static bool eapol_frame_watch_match_ifindex(const void *a, const void *b)
+static eapol_frame_watch_func_t eapol_sm_rx_handler(void *data)
 {
-	struct eapol_frame_watch *efw =
-		l_container_of(a, struct eapol_frame_watch, super);
+	struct eapol_sm *sm = data;
 
-	return efw->ifindex == L_PTR_TO_UINT(b);
+	return sm->handshake->authenticator ?
+		eapol_rx_auth_packet : eapol_rx_packet;
+}
+
+static eapol_frame_watch_func_t preauth_rx_handler(void *data)
+{
+	return preauth_rx_packet;
+}
+
+/*
+ * Handlers may free any state machine, including the others sharing this
+ * peer, so work on a snapshot and check that each entry is still registered
+ * before passing the frame to it.
+ */
+static void eapol_rx_dispatch(struct l_hashmap *index, struct l_queue *entries,
+				eapol_frame_watch_func_t (*get_handler)(void *),
+				uint32_t ifindex, const uint8_t *src,
+				uint16_t proto, const struct eapol_frame *frame,
+				bool noencrypt)
+{
+	unsigned int n = l_queue_length(entries);
+	void *snapshot[n];
+	const struct l_queue_entry *entry;
+	unsigned int i = 0;
+
+	for (entry = l_queue_get_entries(entries); entry; entry = entry->next)
+		snapshot[i++] = entry->data;
+
+	for (i = 0; i < n; i++) {
+		if (i && !eapol_peer_index_contains(index, ifindex, src,
+							snapshot[i]))
+			continue;
+
+		get_handler(snapshot[i])(proto, src, frame, noencrypt,
+						snapshot[i]);
+	}
 }
 
 void __eapol_rx_packet(uint32_t ifindex, const uint8_t *src, uint16_t proto,
@@ -3099,6 +3414,9 @@ void __eapol_rx_packet(uint32_t ifindex, const uint8_t *src, uint16_t proto,
 					bool noencrypt)
 {
 	const struct eapol_header *eh;
+	struct l_hashmap *index;
+	struct l_queue *entries;
+	eapol_frame_watch_func_t (*get_handler)(void *data);
 
 	/* Validate Header */
 	if (len < sizeof(struct eapol_header))
@@ -3118,12 +3436,26 @@ void __eapol_rx_packet(uint32_t ifindex, const uint8_t *src, uint16_t proto,
 	if (len < sizeof(struct eapol_header) + L_BE16_TO_CPU(eh->packet_len))
 		return;
 
-	WATCHLIST_NOTIFY_MATCHES(&frame_watches,
-					eapol_frame_watch_match_ifindex,
-					L_UINT_TO_PTR(ifindex),
-					eapol_frame_watch_func_t, proto, src,
-					(const struct eapol_frame *) eh,
-					noencrypt);
+	switch (proto) {
+	case ETH_P_PAE:
+		index = state_machines;
+		entries = eapol_sm_lookup(ifindex, src);
+		get_handler = eapol_sm_rx_handler;
+		break;
+	case 0x88c7:
+		index = preauths;
+		entries = eapol_peer_index_lookup(preauths, ifindex, src);
+		get_handler = preauth_rx_handler;
+		break;
+	default:
+		return;
+	}
+
+	if (l_queue_isempty(entries))
+		return;
+
+	eapol_rx_dispatch(index, entries, get_handler, ifindex, src, proto,
+				(const struct eapol_frame *) eh, noencrypt);
 }
 
 void __eapol_tx_packet(uint32_t ifindex, const uint8_t *dst, uint16_t proto,
@@ -3144,26 +3476,27 @@ void __eapol_set_config(struct l_settings *config)
 
 int eapol_init(void)
 {
-	state_machines = l_queue_new();
-	preauths = l_queue_new();
-	watchlist_init(&frame_watches, &eapol_frame_watch_ops);
+	state_machines = eapol_peer_index_new();
+	preauths = eapol_peer_index_new();
+
+	__handshake_set_address_changed_func(eapol_handshake_address_changed);
 
 	return 0;
 }
 
 void eapol_exit(void)
 {
-	if (!l_queue_isempty(state_machines))
+	if (!l_hashmap_isempty(state_machines))
 		l_warn("stale eapol state machines found");
 
-	l_queue_destroy(state_machines, eapol_sm_destroy);
+	__handshake_set_address_changed_func(NULL);
 
-	if (!l_queue_isempty(preauths))
-		l_warn("stale preauth state machines found");
+	l_hashmap_destroy(state_machines, eapol_sm_peer_destroy);
 
-	l_queue_destroy(preauths, preauth_sm_destroy);
+	if (!l_hashmap_isempty(preauths))
+		l_warn("stale preauth state machines found");
 
-	watchlist_destroy(&frame_watches);
+	l_hashmap_destroy(preauths, preauth_peer_destroy);
 }
 
 IWD_MODULE(eapol, eapol_init, eapol_exit);
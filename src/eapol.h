@@ -129,6 +129,7 @@ void eapol_sm_set_user_data(struct eapol_sm *sm, void *user_data);
 
 void eapol_register(struct eapol_sm *sm);
 bool eapol_start(struct eapol_sm *sm);
+bool eapol_start_group_rekey(struct eapol_sm *sm);
 
 struct preauth_sm *eapol_preauth_start(const uint8_t *aa,
 					const struct handshake_state *hs,
@@ -78,7 +78,7 @@ static bool ft_calculate_fte_mic(struct handshake_state *hs, uint8_t seq_num,
 {
 	struct iovec iov[10];
 	int iov_elems = 0;
-	struct l_checksum *checksum;
+	struct crypto_checksum *checksum;
 	const uint8_t *kck = handshake_state_get_kck(hs);
 	size_t kck_len = handshake_state_get_kck_len(hs);
 	uint8_t zero_mic[24] = {};
@@ -117,16 +117,17 @@ static bool ft_calculate_fte_mic(struct handshake_state *hs, uint8_t seq_num,
 	}
 
 	if (kck_len == 16)
-		checksum = l_checksum_new_cmac_aes(kck, kck_len);
+		checksum = crypto_checksum_new_cmac_aes(kck, kck_len);
 	else
-		checksum = l_checksum_new_hmac(L_CHECKSUM_SHA384, kck, kck_len);
+		checksum = crypto_checksum_new_hmac(L_CHECKSUM_SHA384,
+							kck, kck_len);
 
 	if (!checksum)
 		return false;
 
-	l_checksum_updatev(checksum, iov, iov_elems);
-	l_checksum_get_digest(checksum, out_mic, kck_len);
-	l_checksum_free(checksum);
+	crypto_checksum_updatev(checksum, iov, iov_elems);
+	crypto_checksum_get_digest(checksum, out_mic, kck_len);
+	crypto_checksum_free(checksum);
 
 	return true;
 }
@@ -43,6 +43,7 @@
 #include "src/handshake.h"
 #include "src/erp.h"
 #include "src/band.h"
+#include "src/pmksa.h"
 
 static inline unsigned int n_ecc_groups(void)
 {
@@ -77,6 +78,7 @@ static handshake_install_tk_func_t install_tk = NULL;
 static handshake_install_gtk_func_t install_gtk = NULL;
 static handshake_install_igtk_func_t install_igtk = NULL;
 static handshake_install_ext_tk_func_t install_ext_tk = NULL;
+static handshake_address_changed_func_t address_changed = NULL;
 
 void __handshake_set_get_nonce_func(handshake_get_nonce_func_t func)
 {
@@ -103,6 +105,12 @@ void __handshake_set_install_ext_tk_func(handshake_install_ext_tk_func_t func)
 	install_ext_tk = func;
 }
 
+void __handshake_set_address_changed_func(
+				handshake_address_changed_func_t func)
+{
+	address_changed = func;
+}
+
 void handshake_state_free(struct handshake_state *s)
 {
 	__typeof__(s->free) destroy;
@@ -131,6 +139,8 @@ void handshake_state_free(struct handshake_state *s)
 	if (s->erp_cache)
 		erp_cache_put(s->erp_cache);
 
+	pmksa_cache_free(s->pmksa);
+
 	l_free(s->chandef);
 
 	if (s->passphrase) {
@@ -162,13 +172,31 @@ void handshake_state_free(struct handshake_state *s)
 void handshake_state_set_supplicant_address(struct handshake_state *s,
 						const uint8_t *spa)
 {
+	uint8_t old_spa[6];
+
+	if (!memcmp(s->spa, spa, sizeof(s->spa)))
+		return;
+
+	memcpy(old_spa, s->spa, sizeof(s->spa));
 	memcpy(s->spa, spa, sizeof(s->spa));
+
+	if (address_changed)
+		address_changed(s, old_spa);
 }
 
 void handshake_state_set_authenticator_address(struct handshake_state *s,
 						const uint8_t *aa)
 {
+	uint8_t old_aa[6];
+
+	if (!memcmp(s->aa, aa, sizeof(s->aa)))
+		return;
+
+	memcpy(old_aa, s->aa, sizeof(s->aa));
 	memcpy(s->aa, aa, sizeof(s->aa));
+
+	if (address_changed)
+		address_changed(s, old_aa);
 }
 
 void handshake_state_set_authenticator(struct handshake_state *s, bool auth)
@@ -179,6 +207,16 @@ void handshake_state_set_authenticator(struct handshake_state *s, bool auth)
 void handshake_state_set_pmk(struct handshake_state *s, const uint8_t *pmk,
 				size_t pmk_len)
 {
+	/*
+	 * A PMK obtained through a full authentication supersedes any cached
+	 * PMKSA we may have offered to the authenticator
+	 */
+	if (s->have_pmksa) {
+		pmksa_cache_free(l_steal_ptr(s->pmksa));
+		s->have_pmksa = false;
+		s->have_pmkid = false;
+	}
+
 	memcpy(s->pmk, pmk, pmk_len);
 	s->pmk_len = pmk_len;
 	s->have_pmk = true;
@@ -775,12 +813,9 @@ bool handshake_state_get_pmkid(struct handshake_state *s, uint8_t *out_pmkid,
 					sha);
 }
 
-bool handshake_state_pmkid_matches(struct handshake_state *s,
-					const uint8_t *check)
+static enum l_checksum_type handshake_state_pmkid_sha(
+						struct handshake_state *s)
 {
-	uint8_t own_pmkid[16];
-	enum l_checksum_type sha;
-
 	/*
 	 * 802.11-2020 Table 9-151 defines the hashing algorithm to use
 	 * for various AKM's. Note some AKMs are omitted here because they
@@ -801,11 +836,18 @@ bool handshake_state_pmkid_matches(struct handshake_state *s,
 	if (s->akm_suite & (IE_RSN_AKM_SUITE_8021X_SHA256 |
 			IE_RSN_AKM_SUITE_PSK_SHA256 |
 			IE_RSN_AKM_SUITE_FT_OVER_8021X))
-		sha = L_CHECKSUM_SHA256;
-	else
-		sha = L_CHECKSUM_SHA1;
+		return L_CHECKSUM_SHA256;
+
+	return L_CHECKSUM_SHA1;
+}
 
-	if (!handshake_state_get_pmkid(s, own_pmkid, sha))
+bool handshake_state_pmkid_matches(struct handshake_state *s,
+					const uint8_t *check)
+{
+	uint8_t own_pmkid[16];
+
+	if (!handshake_state_get_pmkid(s, own_pmkid,
+					handshake_state_pmkid_sha(s)))
 		return false;
 
 	if (l_secure_memcmp(own_pmkid, check, 16)) {
@@ -823,6 +865,77 @@ bool handshake_state_pmkid_matches(struct handshake_state *s,
 	return true;
 }
 
+/*
+ * Takes ownership of a PMKSA obtained from pmksa_cache_get().  The cached
+ * PMK and PMKID are used for the 4-Way Handshake unless the authenticator
+ * forces a full authentication, in which case the entry is dropped.
+ */
+void handshake_state_set_pmksa(struct handshake_state *s,
+				struct pmksa *pmksa)
+{
+	pmksa_cache_free(s->pmksa);
+
+	s->pmksa = pmksa;
+	s->have_pmksa = true;
+
+	memcpy(s->pmk, pmksa->pmk, pmksa->pmk_len);
+	s->pmk_len = pmksa->pmk_len;
+	s->have_pmk = true;
+
+	handshake_state_set_pmkid(s, pmksa->pmkid);
+}
+
+void handshake_state_cache_pmksa(struct handshake_state *s)
+{
+	struct pmksa *pmksa;
+
+	/* The cached PMKSA was used successfully, hand it back to the cache */
+	if (s->have_pmksa) {
+		s->have_pmksa = false;
+		pmksa_cache_put(l_steal_ptr(s->pmksa));
+		return;
+	}
+
+	if (!(s->akm_suite & HANDSHAKE_PMKSA_AKMS) || !s->have_pmk ||
+			s->authenticator)
+		return;
+
+	pmksa = l_new(struct pmksa, 1);
+
+	if (!handshake_state_get_pmkid(s, pmksa->pmkid,
+					handshake_state_pmkid_sha(s))) {
+		l_free(pmksa);
+		return;
+	}
+
+	pmksa->expiration = l_time_offset(l_time_now(), pmksa_lifetime());
+	memcpy(pmksa->spa, s->spa, sizeof(s->spa));
+	memcpy(pmksa->aa, s->aa, sizeof(s->aa));
+	memcpy(pmksa->ssid, s->ssid, s->ssid_len);
+	pmksa->ssid_len = s->ssid_len;
+	pmksa->akm = s->akm_suite;
+	memcpy(pmksa->pmk, s->pmk, s->pmk_len);
+	pmksa->pmk_len = s->pmk_len;
+
+	pmksa_cache_put(pmksa);
+}
+
+/*
+ * Drops the PMKSA offered in this handshake, e.g. when the authenticator
+ * rejected the PMKID.  Returns true if there was one.
+ */
+bool handshake_state_remove_pmksa(struct handshake_state *s)
+{
+	if (!s->have_pmksa)
+		return false;
+
+	pmksa_cache_free(l_steal_ptr(s->pmksa));
+	s->have_pmksa = false;
+	s->have_pmkid = false;
+
+	return true;
+}
+
 void handshake_state_set_gtk(struct handshake_state *s, const uint8_t *key,
 				unsigned int key_index, const uint8_t *rsc)
 {
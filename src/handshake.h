@@ -29,6 +29,7 @@
 struct handshake_state;
 enum crypto_cipher;
 struct eapol_frame;
+struct pmksa;
 
 enum handshake_kde {
 	/* 802.11-2020 Table 12-9 in section 12.7.2 */
@@ -51,6 +52,14 @@ enum handshake_kde {
 	HANDSHAKE_KDE_TRANSITION_DISABLE = 0x506f9a20,
 };
 
+/*
+ * PMKSA caching is only used for AKMs where the PMK is the result of an
+ * expensive exchange (EAP or SAE) and isn't otherwise covered by FT/FILS.
+ */
+#define HANDSHAKE_PMKSA_AKMS (IE_RSN_AKM_SUITE_8021X |			\
+				IE_RSN_AKM_SUITE_8021X_SHA256 |		\
+				IE_RSN_AKM_SUITE_SAE_SHA256)
+
 enum handshake_event {
 	HANDSHAKE_EVENT_STARTED,
 	HANDSHAKE_EVENT_SETTING_KEYS,
@@ -62,6 +71,7 @@ enum handshake_event {
 	HANDSHAKE_EVENT_TRANSITION_DISABLE,
 	HANDSHAKE_EVENT_P2P_IP_REQUEST,
 	HANDSHAKE_EVENT_REKEY_COMPLETE,
+	HANDSHAKE_EVENT_GROUP_REKEY_COMPLETE,
 };
 
 typedef void (*handshake_event_func_t)(struct handshake_state *hs,
@@ -87,12 +97,16 @@ typedef void (*handshake_install_ext_tk_func_t)(struct handshake_state *hs,
 					uint32_t cipher,
 					const struct eapol_frame *step4,
 					uint16_t proto, bool noencrypt);
+typedef void (*handshake_address_changed_func_t)(struct handshake_state *hs,
+						const uint8_t *old_addr);
 
 void __handshake_set_get_nonce_func(handshake_get_nonce_func_t func);
 void __handshake_set_install_tk_func(handshake_install_tk_func_t func);
 void __handshake_set_install_gtk_func(handshake_install_gtk_func_t func);
 void __handshake_set_install_igtk_func(handshake_install_igtk_func_t func);
 void __handshake_set_install_ext_tk_func(handshake_install_ext_tk_func_t func);
+void __handshake_set_address_changed_func(
+				handshake_address_changed_func_t func);
 
 struct handshake_state {
 	uint32_t ifindex;
@@ -154,6 +168,8 @@ struct handshake_state {
 	unsigned int gtk_index;
 	uint8_t active_tk_index;
 	struct erp_cache_entry *erp_cache;
+	struct pmksa *pmksa;
+	bool have_pmksa : 1;
 	bool support_ip_allocation : 1;
 	uint32_t client_ip_addr;
 	uint32_t subnet_mask;
@@ -282,6 +298,10 @@ bool handshake_state_get_pmkid(struct handshake_state *s, uint8_t *out_pmkid,
 				enum l_checksum_type sha);
 bool handshake_state_pmkid_matches(struct handshake_state *s,
 					const uint8_t *check);
+void handshake_state_set_pmksa(struct handshake_state *s,
+				struct pmksa *pmksa);
+void handshake_state_cache_pmksa(struct handshake_state *s);
+bool handshake_state_remove_pmksa(struct handshake_state *s);
 bool handshake_decode_fte_key(struct handshake_state *s, const uint8_t *wrapped,
 				size_t key_len, uint8_t *key_out);
 
@@ -2720,6 +2720,307 @@ int ie_parse_oci(const void *data, size_t len, const uint8_t **oci)
 	return 0;
 }
 
+static int ie_walk_reduced_neighbor_report(const uint8_t *data, size_t len,
+						ie_rnr_func_t func,
+						void *user_data)
+{
+	const uint8_t *end = data + len;
+
+	if (len < 5)
+		return -EINVAL;
+
+	while (data < end) {
+		struct ie_rnr_info info;
+		uint8_t type;
+		uint8_t count;
+		uint8_t info_len;
+		uint8_t i;
+
+		if (end - data < 4)
+			return -EINVAL;
+
+		/* TBTT Information Header, IEEE 802.11-2020 Figure 9-632 */
+		type = bit_field(data[0], 0, 2);
+		count = bit_field(data[0], 4, 4) + 1;
+		info_len = data[1];
+
+		if (info_len == 0 || info_len == 3 || info_len == 4 ||
+				info_len == 10)
+			return -EINVAL;
+
+		if ((size_t) (end - data - 4) < (size_t) count * info_len)
+			return -EINVAL;
+
+		memset(&info, 0, sizeof(info));
+		info.oper_class = data[2];
+		info.channel = data[3];
+		data += 4;
+
+		/* Only the Neighbor AP Information field type is defined */
+		if (type != 0) {
+			data += count * info_len;
+			continue;
+		}
+
+		for (i = 0; i < count; i++, data += info_len) {
+			const uint8_t *pos = data + 1;	/* TBTT Offset */
+
+			if (info_len >= 7) {
+				memcpy(info.bssid, pos, 6);
+				info.bssid_present = true;
+				pos += 6;
+			}
+
+			if (info_len == 5 || info_len == 6 || info_len >= 11) {
+				info.short_ssid = l_get_le32(pos);
+				info.short_ssid_present = true;
+				pos += 4;
+			}
+
+			if (info_len == 2 || info_len == 6 || info_len == 8 ||
+					info_len == 9 || info_len >= 12) {
+				info.bss_params = *pos;
+				info.bss_params_present = true;
+			}
+
+			if (func)
+				func(&info, user_data);
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Parse the Reduced Neighbor Report element body, calling func for each
+ * neighbor AP described.  The element is validated in its entirety first,
+ * func is not called at all if it is malformed.
+ */
+int ie_parse_reduced_neighbor_report(const void *data, size_t len,
+					ie_rnr_func_t func, void *user_data)
+{
+	int r = ie_walk_reduced_neighbor_report(data, len, NULL, NULL);
+
+	if (r < 0)
+		return r;
+
+	return ie_walk_reduced_neighbor_report(data, len, func, user_data);
+}
+
+/* Multiple BSSID element subelements, IEEE 802.11-2020 Table 9-222 */
+#define MBSSID_SUBELEM_NONTRANSMITTED_PROFILE	0
+
+static const uint8_t *ie_tlv_iter_get_element(struct ie_tlv_iter *iter,
+						size_t *out_len)
+{
+	/* Include the Element ID, Length and Element ID Extension fields */
+	size_t hdr_len = iter->tag >= 256 ? 3 : 2;
+
+	*out_len = iter->len + hdr_len;
+
+	return iter->data - hdr_len;
+}
+
+/*
+ * An element of the transmitted BSS is overridden if the profile carries
+ * an element with the same ID, or for Vendor Specific elements with the
+ * same OUI and type
+ */
+static bool ie_mbssid_profile_overrides(const uint8_t *profile,
+					size_t profile_len, unsigned int tag,
+					const uint8_t *data, size_t len)
+{
+	struct ie_tlv_iter iter;
+
+	ie_tlv_iter_init(&iter, profile, profile_len);
+
+	while (ie_tlv_iter_next(&iter)) {
+		if (ie_tlv_iter_get_tag(&iter) != tag)
+			continue;
+
+		if (tag != IE_TYPE_VENDOR_SPECIFIC)
+			return true;
+
+		if (len >= 4 && iter.len >= 4 && !memcmp(iter.data, data, 4))
+			return true;
+	}
+
+	return false;
+}
+
+/* IEEE 802.11-2020 Section 9.4.2.240 Non-Inheritance element */
+static bool ie_non_inheritance_excludes(const uint8_t *data, size_t len,
+					unsigned int tag)
+{
+	uint8_t n_ids;
+	uint8_t n_ext_ids;
+
+	if (!data || len < 2)
+		return false;
+
+	n_ids = data[0];
+	if ((size_t) n_ids + 2 > len)
+		return false;
+
+	n_ext_ids = data[n_ids + 1];
+	if ((size_t) n_ids + n_ext_ids + 2 > len)
+		return false;
+
+	if (tag < 256)
+		return memchr(data + 1, tag, n_ids) != NULL;
+
+	return memchr(data + n_ids + 2, tag - 256, n_ext_ids) != NULL;
+}
+
+static bool ie_mbssid_build_profile(const uint8_t *ies, size_t ies_len,
+				const uint8_t *profile, size_t profile_len,
+				const uint8_t *transmitted_bssid,
+				uint8_t max_bssid_indicator,
+				ie_nontransmitted_bss_func_t func,
+				void *user_data)
+{
+	struct ie_tlv_iter iter;
+	const uint8_t *non_inheritance = NULL;
+	size_t non_inheritance_len = 0;
+	uint16_t capability = 0;
+	bool have_capability = false;
+	bool have_ssid = false;
+	unsigned int index = 0;
+	uint8_t mask = (1 << max_bssid_indicator) - 1;
+	uint8_t bssid[6];
+	uint8_t *buf = l_malloc(ies_len + profile_len);
+	size_t pos = 0;
+	bool ret = false;
+
+	/* Elements specific to the nontransmitted BSS come first */
+	ie_tlv_iter_init(&iter, profile, profile_len);
+
+	while (ie_tlv_iter_next(&iter)) {
+		const uint8_t *element;
+		size_t element_len;
+
+		switch (ie_tlv_iter_get_tag(&iter)) {
+		case IE_TYPE_NONTRANSMITTED_BSSID_CAPABILITY:
+			if (iter.len != 2)
+				goto done;
+
+			capability = l_get_le16(iter.data);
+			have_capability = true;
+			continue;
+		case IE_TYPE_MULTIPLE_BSSID_INDEX:
+			if (iter.len < 1)
+				goto done;
+
+			index = iter.data[0];
+			continue;
+		case IE_TYPE_NON_INHERITANCE:
+			non_inheritance = iter.data;
+			non_inheritance_len = iter.len;
+			continue;
+		case IE_TYPE_SSID:
+			have_ssid = true;
+			break;
+		}
+
+		element = ie_tlv_iter_get_element(&iter, &element_len);
+		memcpy(buf + pos, element, element_len);
+		pos += element_len;
+	}
+
+	/*
+	 * Profiles split across several Multiple BSSID elements are not
+	 * supported, these lack one of the mandatory elements
+	 */
+	if (!have_capability || !have_ssid || !index || index > mask)
+		goto done;
+
+	/* Then everything inherited from the transmitted BSS */
+	ie_tlv_iter_init(&iter, ies, ies_len);
+
+	while (ie_tlv_iter_next(&iter)) {
+		unsigned int tag = ie_tlv_iter_get_tag(&iter);
+		const uint8_t *element;
+		size_t element_len;
+
+		if (L_IN_SET(tag, IE_TYPE_SSID, IE_TYPE_MULTIPLE_BSSID,
+				IE_TYPE_MULTIPLE_BSSID_CONFIGURATION))
+			continue;
+
+		if (ie_mbssid_profile_overrides(profile, profile_len, tag,
+							iter.data, iter.len))
+			continue;
+
+		if (ie_non_inheritance_excludes(non_inheritance,
+						non_inheritance_len, tag))
+			continue;
+
+		element = ie_tlv_iter_get_element(&iter, &element_len);
+		memcpy(buf + pos, element, element_len);
+		pos += element_len;
+	}
+
+	/* IEEE 802.11-2020 Section 9.4.2.45 */
+	memcpy(bssid, transmitted_bssid, 6);
+	bssid[5] = (bssid[5] & ~mask) | ((bssid[5] + index) & mask);
+
+	func(bssid, capability, buf, pos, user_data);
+	ret = true;
+
+done:
+	l_free(buf);
+	return ret;
+}
+
+/*
+ * Calls func for each nontransmitted BSS described in the Multiple BSSID
+ * elements found in ies, with the BSSID and the complete set of elements
+ * of that BSS after applying the inheritance rules of IEEE 802.11-2020
+ * Section 35.3.3.5.  Returns the number of nontransmitted BSSes reported.
+ */
+int ie_parse_multiple_bssid(const void *ies, size_t ies_len,
+				const uint8_t *transmitted_bssid,
+				ie_nontransmitted_bss_func_t func,
+				void *user_data)
+{
+	struct ie_tlv_iter iter;
+	int count = 0;
+
+	ie_tlv_iter_init(&iter, ies, ies_len);
+
+	while (ie_tlv_iter_next(&iter)) {
+		struct ie_tlv_iter sub_iter;
+		uint8_t max_bssid_indicator;
+
+		if (ie_tlv_iter_get_tag(&iter) != IE_TYPE_MULTIPLE_BSSID)
+			continue;
+
+		if (iter.len < 1)
+			return -EINVAL;
+
+		max_bssid_indicator = iter.data[0];
+		if (max_bssid_indicator < 1 || max_bssid_indicator > 8)
+			return -EINVAL;
+
+		ie_tlv_iter_init(&sub_iter, iter.data + 1, iter.len - 1);
+
+		while (ie_tlv_iter_next(&sub_iter)) {
+			if (ie_tlv_iter_get_tag(&sub_iter) !=
+					MBSSID_SUBELEM_NONTRANSMITTED_PROFILE)
+				continue;
+
+			if (ie_mbssid_build_profile(ies, ies_len,
+							sub_iter.data,
+							sub_iter.len,
+							transmitted_bssid,
+							max_bssid_indicator,
+							func, user_data))
+				count++;
+		}
+	}
+
+	return count;
+}
+
 /*
  * Checks the supported width set (Table 9-322b) meets the following
  * requirements:
@@ -291,7 +291,7 @@ enum ie_type {
 	IE_TYPE_ESTIMATED_SERVICE_PARAMETERS_OUT     = 256 + 53,
 	IE_TYPE_OCI                                  = 256 + 54,
 	IE_TYPE_MULTIPLE_BSSID_CONFIGURATION         = 256 + 55,
-	/* Reserved 56 */
+	IE_TYPE_NON_INHERITANCE                      = 256 + 56,
 	IE_TYPE_KNOWN_BSSID                          = 256 + 57,
 	IE_TYPE_SHORT_SSID_LIST                      = 256 + 58,
 	IE_TYPE_HE_6GHZ_BAND_CAPABILITIES            = 256 + 59,
@@ -566,6 +566,35 @@ struct ie_owe_transition_info {
 	uint8_t channel;
 };
 
+/* BSS Parameters subfield, IEEE 802.11-2020 Figure 9-633 */
+#define IE_RNR_BSS_PARAM_OCT_RECOMMENDED	0x01
+#define IE_RNR_BSS_PARAM_SAME_SSID		0x02
+#define IE_RNR_BSS_PARAM_MULTIPLE_BSSID		0x04
+#define IE_RNR_BSS_PARAM_TRANSMITTED_BSSID	0x08
+#define IE_RNR_BSS_PARAM_COLOCATED_ESS		0x10
+#define IE_RNR_BSS_PARAM_UNSOLICITED_PROBE_RESP	0x20
+#define IE_RNR_BSS_PARAM_COLOCATED_AP		0x40
+
+struct ie_rnr_info {
+	uint8_t oper_class;
+	uint8_t channel;
+	uint8_t bssid[6];
+	uint32_t short_ssid;
+	uint8_t bss_params;
+	bool bssid_present : 1;
+	bool short_ssid_present : 1;
+	bool bss_params_present : 1;
+};
+
+typedef void (*ie_rnr_func_t)(const struct ie_rnr_info *info,
+				void *user_data);
+
+typedef void (*ie_nontransmitted_bss_func_t)(const uint8_t *bssid,
+						uint16_t capability,
+						const uint8_t *ies,
+						size_t ies_len,
+						void *user_data);
+
 extern const unsigned char ieee_oui[3];
 extern const unsigned char microsoft_oui[3];
 extern const unsigned char wifi_alliance_oui[3];
@@ -719,4 +748,11 @@ int ie_parse_owe_transition(const void *data, size_t len,
 
 int ie_parse_oci(const void *data, size_t len, const uint8_t **oci);
 
+int ie_parse_reduced_neighbor_report(const void *data, size_t len,
+					ie_rnr_func_t func, void *user_data);
+int ie_parse_multiple_bssid(const void *ies, size_t ies_len,
+				const uint8_t *transmitted_bssid,
+				ie_nontransmitted_bss_func_t func,
+				void *user_data);
+
 bool ie_validate_he_capabilities(const void *data, size_t len);
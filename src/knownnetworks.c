@@ -53,6 +53,22 @@ static struct l_dir_watch *storage_dir_watch;
 static struct watchlist known_network_watches;
 static struct l_settings *known_freqs;
 
+/*
+ * Per-site channel model: how often known networks were found on each
+ * frequency, kept sorted with the most hits first.  All counts are halved
+ * once one of them saturates so that the model follows the user between
+ * sites.  Persisted in the known frequency file.
+ */
+#define KNOWN_CHANNELS_GROUP		"ChannelHits"
+#define KNOWN_CHANNEL_HITS_MAX		1000
+
+struct known_channel {
+	uint32_t frequency;
+	uint32_t hits;
+};
+
+static struct l_queue *known_channels;
+
 void __network_config_parse(const struct l_settings *settings,
 					const char *full_path,
 					struct network_config *config)
@@ -554,6 +570,91 @@ struct scan_freq_set *known_networks_get_recent_frequencies(
 	return set;
 }
 
+static bool known_channel_match(const void *a, const void *b)
+{
+	const struct known_channel *channel = a;
+	const uint32_t *frequency = b;
+
+	return channel->frequency == *frequency;
+}
+
+static int known_channel_compare(const void *a, const void *b,
+					void *user_data)
+{
+	const struct known_channel *new_channel = a;
+	const struct known_channel *channel = b;
+
+	return new_channel->hits > channel->hits ? -1 : 1;
+}
+
+static bool known_channel_decay(void *data, void *user_data)
+{
+	struct known_channel *channel = data;
+
+	channel->hits /= 2;
+	if (channel->hits)
+		return false;
+
+	l_free(channel);
+	return true;
+}
+
+static void known_channel_add_hits(uint32_t frequency, uint32_t hits)
+{
+	struct known_channel *channel;
+
+	if (!known_channels)
+		known_channels = l_queue_new();
+
+	channel = l_queue_remove_if(known_channels, known_channel_match,
+					&frequency);
+	if (!channel) {
+		channel = l_new(struct known_channel, 1);
+		channel->frequency = frequency;
+	}
+
+	channel->hits = minsize(channel->hits + hits, KNOWN_CHANNEL_HITS_MAX);
+	l_queue_insert(known_channels, channel, known_channel_compare, NULL);
+
+	if (channel->hits == KNOWN_CHANNEL_HITS_MAX)
+		l_queue_foreach_remove(known_channels, known_channel_decay,
+					NULL);
+}
+
+/* Number of times a known network was found on this frequency */
+uint32_t known_networks_get_channel_hits(uint32_t frequency)
+{
+	const struct known_channel *channel = l_queue_find(known_channels,
+							known_channel_match,
+							&frequency);
+
+	return channel ? channel->hits : 0;
+}
+
+/*
+ * Returns up to max frequencies known networks were most often found on,
+ * or NULL if no known network was ever found
+ */
+struct scan_freq_set *known_networks_get_learned_frequencies(unsigned int max)
+{
+	const struct l_queue_entry *entry;
+	struct scan_freq_set *set;
+
+	if (l_queue_isempty(known_channels) || !max)
+		return NULL;
+
+	set = scan_freq_set_new();
+
+	for (entry = l_queue_get_entries(known_channels); entry && max;
+						entry = entry->next, max--) {
+		const struct known_channel *channel = entry->data;
+
+		scan_freq_set_add(set, channel->frequency);
+	}
+
+	return set;
+}
+
 static bool known_frequency_match(const void *a, const void *b)
 {
 	const struct known_frequency *known_freq = a;
@@ -582,6 +683,8 @@ int known_network_add_frequency(struct network_info *info, uint32_t frequency)
 
 	l_queue_push_head(info->known_frequencies, known_freq);
 
+	known_channel_add_hits(frequency, 1);
+
 	return 0;
 }
 
@@ -902,6 +1005,58 @@ static char *known_frequencies_to_string(struct l_queue *known_frequencies)
 	return l_string_unwrap(str);
 }
 
+/* Loads the channel model from a "frequency:hits ..." list */
+static void known_channels_from_string(char *str)
+{
+	while (*str != '\0') {
+		unsigned long frequency;
+		unsigned long hits;
+
+		errno = 0;
+
+		frequency = strtoul(str, &str, 10);
+		if (*str != ':')
+			goto error;
+
+		hits = strtoul(str + 1, &str, 10);
+
+		if (unlikely(errno == ERANGE || !frequency || !hits ||
+				frequency > UINT16_MAX ||
+				!band_freq_to_channel(frequency, NULL)))
+			goto error;
+
+		known_channel_add_hits(frequency,
+					minsize(hits, KNOWN_CHANNEL_HITS_MAX));
+	}
+
+	return;
+
+error:
+	l_warn("Invalid %s entry in the known frequency file",
+		KNOWN_CHANNELS_GROUP);
+	l_queue_clear(known_channels, l_free);
+}
+
+static void known_channel_to_string(void *data, void *user_data)
+{
+	struct known_channel *channel = data;
+	struct l_string *str = user_data;
+
+	l_string_append_printf(str, " %u:%u", channel->frequency,
+				channel->hits);
+}
+
+static char *known_channels_to_string(void)
+{
+	struct l_string *str;
+
+	str = l_string_new(100);
+
+	l_queue_foreach(known_channels, known_channel_to_string, str);
+
+	return l_string_unwrap(str);
+}
+
 struct hotspot_search {
 	struct network_info *info;
 	const char *path;
@@ -964,8 +1119,19 @@ static int known_network_frequencies_load(void)
 	for (i = 0; groups[i]; i++) {
 		struct network_info *info;
 		char *freq_list;
-		const char *path = l_settings_get_value(known_freqs, groups[i],
-							"name");
+		const char *path;
+
+		if (!strcmp(groups[i], KNOWN_CHANNELS_GROUP)) {
+			freq_list = l_settings_get_string(known_freqs,
+							groups[i], "list");
+			if (freq_list)
+				known_channels_from_string(freq_list);
+
+			l_free(freq_list);
+			continue;
+		}
+
+		path = l_settings_get_value(known_freqs, groups[i], "name");
 		if (!path)
 			goto invalid_entry;
 
@@ -1032,6 +1198,11 @@ void known_network_frequency_sync(struct network_info *info)
 	l_free(file_path);
 	l_free(freq_list_str);
 
+	freq_list_str = known_channels_to_string();
+	l_settings_set_value(known_freqs, KNOWN_CHANNELS_GROUP, "list",
+				freq_list_str);
+	l_free(freq_list_str);
+
 	storage_known_frequencies_sync(known_freqs);
 }
 
@@ -1134,6 +1305,8 @@ IWD_MODULE(known_networks, known_networks_init, known_networks_exit)
 static void known_frequencies_exit(void)
 {
 	l_settings_free(known_freqs);
+	l_queue_destroy(known_channels, l_free);
+	known_channels = NULL;
 }
 
 /*
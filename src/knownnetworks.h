@@ -115,6 +115,8 @@ struct network_info *known_networks_find(const char *ssid,
 struct scan_freq_set *known_networks_get_recent_frequencies(
 						uint8_t num_networks_tosearch);
 int known_network_add_frequency(struct network_info *info, uint32_t frequency);
+uint32_t known_networks_get_channel_hits(uint32_t frequency);
+struct scan_freq_set *known_networks_get_learned_frequencies(unsigned int max);
 void known_network_frequency_sync(struct network_info *info);
 
 uint32_t known_networks_watch_add(known_networks_watch_func_t func,
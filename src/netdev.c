@@ -2451,7 +2451,9 @@ static struct l_genl_msg *netdev_build_cmd_connect(struct netdev *netdev,
 {
 	struct netdev_handshake_state *nhs =
 		l_container_of(hs, struct netdev_handshake_state, super);
-	uint32_t auth_type = IE_AKM_IS_SAE(hs->akm_suite) ?
+	/* A cached SAE PMKSA is used with Open System authentication */
+	uint32_t auth_type = IE_AKM_IS_SAE(hs->akm_suite) &&
+					!hs->have_pmksa ?
 					NL80211_AUTHTYPE_SAE :
 					NL80211_AUTHTYPE_OPEN_SYSTEM;
 	enum mpdu_management_subtype subtype = prev_bssid ?
@@ -3815,6 +3817,13 @@ static void netdev_connect_common(struct netdev *netdev,
 	if (nhs->type != CONNECTION_TYPE_SOFTMAC)
 		goto build_cmd_connect;
 
+	/*
+	 * With a cached PMKSA the authenticator can go straight to the 4-Way
+	 * Handshake, skip SAE and let CMD_CONNECT do Open System auth
+	 */
+	if (hs->have_pmksa)
+		goto build_cmd_connect;
+
 	switch (hs->akm_suite) {
 	case IE_RSN_AKM_SUITE_SAE_SHA256:
 	case IE_RSN_AKM_SUITE_FT_OVER_SAE_SHA256:
@@ -39,6 +39,7 @@
 #include "src/module.h"
 #include "src/ie.h"
 #include "src/crypto.h"
+#include "src/crypto-worker.h"
 #include "src/iwd.h"
 #include "src/common.h"
 #include "src/storage.h"
@@ -73,6 +74,9 @@ struct network {
 	char *password_identifier;
 	struct l_ecc_point *sae_pt_19; /* SAE PT for Group 19 */
 	struct l_ecc_point *sae_pt_20; /* SAE PT for Group 20 */
+	uint32_t sae_pt_19_job;
+	uint32_t sae_pt_20_job;
+	uint32_t psk_job;
 	unsigned int agent_request;
 	struct l_queue *bss_list;
 	struct l_settings *settings;
@@ -94,21 +98,38 @@ struct network {
 	/* Holds DBus Connect() message if it comes in before ANQP finishes */
 	struct l_dbus_message *connect_after_anqp;
 	struct l_dbus_message *connect_after_owe_hidden;
+	struct l_dbus_message *connect_after_psk;
 };
 
+static void network_precompute_flush(const struct network_info *info);
+static void network_store_sae_pt(struct network *network,
+					struct l_ecc_point *pt);
+
 static bool network_settings_load(struct network *network)
 {
 	if (network->settings)
 		return true;
 
-	if (network->info)
+	/* Make sure any secrets still being derived end up in the profile */
+	if (network->info) {
+		network_precompute_flush(network->info);
 		network->settings = network_info_open_settings(network->info);
+	}
 
 	return network->settings != NULL;
 }
 
 static void network_reset_psk(struct network *network)
 {
+	if (network->psk_job) {
+		crypto_worker_cancel(network->psk_job);
+		network->psk_job = 0;
+	}
+
+	if (network->connect_after_psk)
+		dbus_pending_reply(&network->connect_after_psk,
+				dbus_error_aborted(network->connect_after_psk));
+
 	if (network->psk)
 		explicit_bzero(network->psk, 32);
 
@@ -132,6 +153,16 @@ static void network_reset_passphrase(struct network *network)
 		network->password_identifier = NULL;
 	}
 
+	if (network->sae_pt_19_job) {
+		crypto_worker_cancel(network->sae_pt_19_job);
+		network->sae_pt_19_job = 0;
+	}
+
+	if (network->sae_pt_20_job) {
+		crypto_worker_cancel(network->sae_pt_20_job);
+		network->sae_pt_20_job = 0;
+	}
+
 	if (network->sae_pt_19) {
 		l_ecc_point_free(network->sae_pt_19);
 		network->sae_pt_19 = NULL;
@@ -295,42 +326,137 @@ enum security network_get_security(const struct network *network)
 	return network->security;
 }
 
-static const uint8_t *network_get_psk(struct network *network)
+static void network_psk_derived(int err, const uint8_t *psk,
+					void *user_data)
 {
-	int r;
+	struct network *network = user_data;
+	struct l_dbus_message *message;
+	struct scan_bss *bss;
 
-	if (network->psk)
-		return network->psk;
+	network->psk_job = 0;
+	message = l_steal_ptr(network->connect_after_psk);
+
+	if (psk) {
+		network->psk = l_memdup(psk, 32);
+		network->sync_settings = true;
+	} else
+		l_error("PSK generation failed: %s.", strerror(-err));
+
+	if (!message)
+		return;
+
+	/* Did all good BSSes go away while we waited */
+	bss = network_bss_select(network, true);
+
+	if (!psk || !bss) {
+		dbus_pending_reply(&message, dbus_error_failed(message));
+		network_settings_close(network);
 
-	network->psk = l_malloc(32);
+		if (network->provisioning_hidden)
+			station_hide_network(network->station, network);
 
-	if ((r = crypto_psk_from_passphrase(network->passphrase,
-					(unsigned char *)network->ssid,
+		return;
+	}
+
+	station_connect_network(network->station, network, bss, message);
+	l_dbus_message_unref(message);
+}
+
+/* The PSK is derived by the crypto worker as soon as the passphrase is set */
+static void network_derive_psk(struct network *network)
+{
+	if (network->psk || network->psk_job || !network->passphrase)
+		return;
+
+	network->psk_job = crypto_worker_psk_from_passphrase(
+					network->passphrase,
+					(const uint8_t *) network->ssid,
 					strlen(network->ssid),
-					network->psk)) < 0) {
-		l_free(network->psk);
-		network->psk = NULL;
-		l_error("PSK generation failed: %s.", strerror(-r));
-	} else
-		network->sync_settings = true;
+					network_psk_derived, network, NULL);
+}
+
+static const uint8_t *network_get_psk(struct network *network)
+{
+	network_derive_psk(network);
+
+	/* Wait for the derivation if it is still in progress */
+	if (network->psk_job)
+		crypto_worker_flush(network->psk_job);
 
 	return network->psk;
 }
 
-static struct l_ecc_point *network_generate_sae_pt(struct network *network,
-							unsigned int group)
+static void network_sae_pt_derived(struct network *network,
+					unsigned int group,
+					struct l_ecc_point *pt)
 {
-	struct l_ecc_point *pt;
+	if (!pt) {
+		l_warn("SAE PT generation for Group %u failed", group);
+		return;
+	}
+
+	if (group == 19)
+		network->sae_pt_19 = pt;
+	else
+		network->sae_pt_20 = pt;
+
+	network->sync_settings = true;
+
+	/*
+	 * This may complete after the settings were synced on connect, so
+	 * write the PT to the profile right away
+	 */
+	network_store_sae_pt(network, pt);
+}
+
+static void network_sae_pt_19_derived(struct l_ecc_point *pt, void *user_data)
+{
+	struct network *network = user_data;
+
+	network->sae_pt_19_job = 0;
+	network_sae_pt_derived(network, 19, pt);
+}
+
+static void network_sae_pt_20_derived(struct l_ecc_point *pt, void *user_data)
+{
+	struct network *network = user_data;
+
+	network->sae_pt_20_job = 0;
+	network_sae_pt_derived(network, 20, pt);
+}
+
+/*
+ * The PT is derived by the crypto worker, it is only needed once we
+ * connect to an H2E capable AP, see network_flush_sae_pt
+ */
+static bool network_generate_sae_pt(struct network *network,
+					unsigned int group)
+{
+	uint32_t *job = group == 19 ? &network->sae_pt_19_job :
+						&network->sae_pt_20_job;
 
 	l_debug("Generating PT for Group %u", group);
 
-	pt = crypto_derive_sae_pt_ecc(group, network->ssid,
-						network->passphrase,
-						network->password_identifier);
-	if (!pt)
-		l_warn("SAE PT generation for Group %u failed", group);
+	if (*job)
+		crypto_worker_cancel(*job);
 
-	return pt;
+	*job = crypto_worker_derive_sae_pt_ecc(group, network->ssid,
+					network->passphrase,
+					network->password_identifier,
+					group == 19 ? network_sae_pt_19_derived :
+						network_sae_pt_20_derived,
+					network, NULL);
+
+	return *job != 0;
+}
+
+static void network_flush_sae_pt(struct network *network)
+{
+	if (network->sae_pt_19_job)
+		crypto_worker_flush(network->sae_pt_19_job);
+
+	if (network->sae_pt_20_job)
+		crypto_worker_flush(network->sae_pt_20_job);
 }
 
 static bool __network_set_passphrase(struct network *network,
@@ -342,8 +468,9 @@ static bool __network_set_passphrase(struct network *network,
 	network_reset_passphrase(network);
 	network->passphrase = l_strdup(passphrase);
 
-	network->sae_pt_19 = network_generate_sae_pt(network, 19);
-	network->sae_pt_20 = network_generate_sae_pt(network, 20);
+	network_generate_sae_pt(network, 19);
+	network_generate_sae_pt(network, 20);
+	network_derive_psk(network);
 
 	network->sync_settings = true;
 
@@ -478,6 +605,7 @@ static int network_set_handshake_secrets_psk(struct network *network,
 		if (ie_rsnxe_capable(hs->authenticator_rsnxe,
 							IE_RSNX_SAE_H2E)) {
 			l_debug("Authenticator is SAE H2E capable");
+			network_flush_sae_pt(network);
 			handshake_state_add_ecc_sae_pt(hs, network->sae_pt_19);
 			handshake_state_add_ecc_sae_pt(hs, network->sae_pt_20);
 		}
@@ -581,6 +709,12 @@ int network_handshake_setup(struct network *network, struct scan_bss *bss,
 	return 0;
 }
 
+/*
+ * Returns 1 if the PT has to be derived instead.  *out_pt is left untouched
+ * in that case, the PT is derived asynchronously into network->sae_pt_19 or
+ * network->sae_pt_20 and the profile updated once done, see
+ * network_sae_pt_derived
+ */
 static int network_settings_load_pt_ecc(struct network *network,
 					unsigned int group,
 					struct l_ecc_point **out_pt)
@@ -612,8 +746,7 @@ generate:
 	if (!network->passphrase)
 		return -ENOKEY;
 
-	*out_pt = network_generate_sae_pt(network, group);
-	if (*out_pt)
+	if (network_generate_sae_pt(network, group))
 		return 1;
 
 	return -EIO;
@@ -685,11 +818,8 @@ static int network_load_psk(struct network *network, struct scan_bss *bss)
 	network->passphrase = l_steal_ptr(passphrase);
 	network->password_identifier = l_steal_ptr(password_id);
 
-	if (network_settings_load_pt_ecc(network, 19, &network->sae_pt_19) > 0)
-		network->sync_settings = true;
-
-	if (network_settings_load_pt_ecc(network, 20, &network->sae_pt_20) > 0)
-		network->sync_settings = true;
+	network_settings_load_pt_ecc(network, 19, &network->sae_pt_19);
+	network_settings_load_pt_ecc(network, 20, &network->sae_pt_20);
 
 	network->psk = l_steal_ptr(psk);
 
@@ -714,6 +844,36 @@ static void network_settings_save_sae_pt_ecc(struct l_settings *settings,
 	l_settings_set_bytes(settings, "Security", key, buf, len);
 }
 
+static void network_store_sae_pt(struct network *network,
+					struct l_ecc_point *pt)
+{
+	struct network_info *info = network->info;
+	_auto_(l_settings_free) struct l_settings *settings = NULL;
+	_auto_(l_free) char *passphrase = NULL;
+
+	if (network->settings)
+		network_settings_save_sae_pt_ecc(network->settings, pt);
+
+	if (!info)
+		return;
+
+	settings = info->ops->open(info);
+	if (!settings)
+		return;
+
+	/* Not if the profile doesn't have this passphrase (yet) */
+	passphrase = l_settings_get_string(settings, "Security", "Passphrase");
+	if (!passphrase)
+		return;
+
+	if (!strcmp(passphrase, network->passphrase)) {
+		network_settings_save_sae_pt_ecc(settings, pt);
+		info->ops->sync(info, settings);
+	}
+
+	explicit_bzero(passphrase, strlen(passphrase));
+}
+
 static void network_settings_save(struct network *network,
 						struct l_settings *settings)
 {
@@ -765,6 +925,240 @@ static void network_settings_save(struct network *network,
 		network_settings_save_sae_pt_ecc(settings, network->sae_pt_20);
 }
 
+/*
+ * Secrets derived from the passphrase of a PSK profile are stored in the
+ * profile itself.  They're precomputed by the crypto worker as soon as a
+ * profile without them is read, so that connecting doesn't have to.
+ */
+struct network_precompute {
+	const struct network_info *info;
+	char *passphrase;
+	uint32_t psk_job;
+	uint32_t sae_pt_19_job;
+	uint32_t sae_pt_20_job;
+	uint8_t psk[32];
+	bool have_psk : 1;
+	struct l_ecc_point *sae_pt_19;
+	struct l_ecc_point *sae_pt_20;
+};
+
+static struct l_queue *precomputes;
+
+static void network_precompute_free(void *data)
+{
+	struct network_precompute *pc = data;
+
+	if (pc->psk_job)
+		crypto_worker_cancel(pc->psk_job);
+
+	if (pc->sae_pt_19_job)
+		crypto_worker_cancel(pc->sae_pt_19_job);
+
+	if (pc->sae_pt_20_job)
+		crypto_worker_cancel(pc->sae_pt_20_job);
+
+	explicit_bzero(pc->passphrase, strlen(pc->passphrase));
+	l_free(pc->passphrase);
+	explicit_bzero(pc->psk, sizeof(pc->psk));
+
+	if (pc->sae_pt_19)
+		l_ecc_point_free(pc->sae_pt_19);
+
+	if (pc->sae_pt_20)
+		l_ecc_point_free(pc->sae_pt_20);
+
+	l_free(pc);
+}
+
+static bool network_precompute_match(const void *a, const void *b)
+{
+	const struct network_precompute *pc = a;
+
+	return pc->info == b;
+}
+
+static void network_precompute_finish(struct network_precompute *pc)
+{
+	struct network_info *info = (struct network_info *) pc->info;
+	_auto_(l_settings_free) struct l_settings *settings = NULL;
+	_auto_(l_free) char *passphrase = NULL;
+
+	if (pc->psk_job || pc->sae_pt_19_job || pc->sae_pt_20_job)
+		return;
+
+	l_queue_remove(precomputes, pc);
+
+	settings = info->ops->open(info);
+	if (!settings)
+		goto done;
+
+	/* Don't store anything if the profile changed in the meantime */
+	passphrase = l_settings_get_string(settings, "Security", "Passphrase");
+	if (!passphrase || strcmp(passphrase, pc->passphrase))
+		goto done;
+
+	if (pc->have_psk)
+		l_settings_set_bytes(settings, "Security", "PreSharedKey",
+					pc->psk, 32);
+
+	if (pc->sae_pt_19)
+		network_settings_save_sae_pt_ecc(settings, pc->sae_pt_19);
+
+	if (pc->sae_pt_20)
+		network_settings_save_sae_pt_ecc(settings, pc->sae_pt_20);
+
+	l_debug("Storing precomputed secrets for %s", info->ssid);
+	info->ops->sync(info, settings);
+
+done:
+	if (passphrase)
+		explicit_bzero(passphrase, strlen(passphrase));
+
+	network_precompute_free(pc);
+}
+
+static void network_precompute_psk_cb(int err, const uint8_t *psk,
+					void *user_data)
+{
+	struct network_precompute *pc = user_data;
+
+	pc->psk_job = 0;
+
+	if (psk) {
+		memcpy(pc->psk, psk, 32);
+		pc->have_psk = true;
+	} else
+		l_error("PSK generation failed: %s.", strerror(-err));
+
+	network_precompute_finish(pc);
+}
+
+static void network_precompute_sae_pt_19_cb(struct l_ecc_point *pt,
+						void *user_data)
+{
+	struct network_precompute *pc = user_data;
+
+	pc->sae_pt_19_job = 0;
+	pc->sae_pt_19 = pt;
+	network_precompute_finish(pc);
+}
+
+static void network_precompute_sae_pt_20_cb(struct l_ecc_point *pt,
+						void *user_data)
+{
+	struct network_precompute *pc = user_data;
+
+	pc->sae_pt_20_job = 0;
+	pc->sae_pt_20 = pt;
+	network_precompute_finish(pc);
+}
+
+static bool network_precompute_has_pt(struct l_settings *settings,
+					unsigned int group)
+{
+	_auto_(l_free) char *key = l_strdup_printf(SAE_PT_SETTING, group);
+
+	return l_settings_has_key(settings, "Security", key);
+}
+
+static void network_precompute_cancel(const struct network_info *info)
+{
+	struct network_precompute *pc = l_queue_remove_if(precomputes,
+						network_precompute_match,
+						info);
+
+	if (pc)
+		network_precompute_free(pc);
+}
+
+static bool network_precompute_start(const struct network_info *info,
+					void *user_data)
+{
+	struct network_info *ni = (struct network_info *) info;
+	_auto_(l_settings_free) struct l_settings *settings = NULL;
+	_auto_(l_free) char *passphrase = NULL;
+	_auto_(l_free) char *password_id = NULL;
+	struct network_precompute *pc;
+
+	if (info->type != SECURITY_PSK || info->is_hotspot)
+		return true;
+
+	network_precompute_cancel(info);
+
+	settings = ni->ops->open(ni);
+	if (!settings)
+		return true;
+
+	passphrase = l_settings_get_string(settings, "Security", "Passphrase");
+	if (!passphrase || !crypto_passphrase_is_valid(passphrase))
+		goto done;
+
+	password_id = l_settings_get_string(settings, "Security",
+						"PasswordIdentifier");
+
+	pc = l_new(struct network_precompute, 1);
+	pc->info = info;
+	pc->passphrase = l_strdup(passphrase);
+
+	if (!l_settings_has_key(settings, "Security", "PreSharedKey"))
+		pc->psk_job = crypto_worker_psk_from_passphrase(passphrase,
+					(const uint8_t *) info->ssid,
+					strlen(info->ssid),
+					network_precompute_psk_cb, pc, NULL);
+
+	if (!network_precompute_has_pt(settings, 19))
+		pc->sae_pt_19_job = crypto_worker_derive_sae_pt_ecc(19,
+					info->ssid, passphrase, password_id,
+					network_precompute_sae_pt_19_cb,
+					pc, NULL);
+
+	if (!network_precompute_has_pt(settings, 20))
+		pc->sae_pt_20_job = crypto_worker_derive_sae_pt_ecc(20,
+					info->ssid, passphrase, password_id,
+					network_precompute_sae_pt_20_cb,
+					pc, NULL);
+
+	if (!pc->psk_job && !pc->sae_pt_19_job && !pc->sae_pt_20_job) {
+		network_precompute_free(pc);
+		goto done;
+	}
+
+	l_debug("Precomputing secrets for %s", info->ssid);
+
+	if (!precomputes)
+		precomputes = l_queue_new();
+
+	l_queue_push_tail(precomputes, pc);
+
+done:
+	if (passphrase)
+		explicit_bzero(passphrase, strlen(passphrase));
+
+	return true;
+}
+
+static void network_precompute_flush(const struct network_info *info)
+{
+	struct network_precompute *pc = l_queue_find(precomputes,
+						network_precompute_match,
+						info);
+
+	if (!pc)
+		return;
+
+	/* The last of these completes and frees pc */
+	if (pc->psk_job)
+		crypto_worker_flush(pc->psk_job);
+
+	pc = l_queue_find(precomputes, network_precompute_match, info);
+	if (pc && pc->sae_pt_19_job)
+		crypto_worker_flush(pc->sae_pt_19_job);
+
+	pc = l_queue_find(precomputes, network_precompute_match, info);
+	if (pc && pc->sae_pt_20_job)
+		crypto_worker_flush(pc->sae_pt_20_job);
+}
+
 void network_sync_settings(struct network *network)
 {
 	struct network_info *info = network->info;
@@ -979,7 +1373,7 @@ int network_autoconnect(struct network *network, struct scan_bss *bss)
 	int ret;
 
 	/* already waiting for an agent request, connect in progress */
-	if (network->agent_request)
+	if (network->agent_request || network->connect_after_psk)
 		return -EALREADY;
 
 	if (network->ask_passphrase)
@@ -1089,8 +1483,16 @@ static bool match_hotspot_network(const struct network_info *info,
 
 bool network_bss_add(struct network *network, struct scan_bss *bss)
 {
-	if (!l_queue_insert(network->bss_list, bss, scan_bss_rank_compare,
-									NULL))
+	struct scan_bss *tail = l_queue_peek_tail(network->bss_list);
+
+	/*
+	 * Scan results are handed to us already in rank order, in which case
+	 * appending is enough and we avoid walking the list for every BSS.
+	 */
+	if (!tail || scan_bss_rank_compare(bss, tail, NULL) > 0)
+		l_queue_push_tail(network->bss_list, bss);
+	else if (!l_queue_insert(network->bss_list, bss,
+					scan_bss_rank_compare, NULL))
 		return false;
 
 	if (network->info)
@@ -1138,6 +1540,11 @@ bool network_bss_update(struct network *network, struct scan_bss *bss)
 	return true;
 }
 
+bool network_bss_remove(struct network *network, struct scan_bss *bss)
+{
+	return l_queue_remove(network->bss_list, bss);
+}
+
 bool network_bss_list_isempty(struct network *network)
 {
 	return l_queue_isempty(network->bss_list);
@@ -1308,6 +1715,16 @@ static void passphrase_callback(enum agent_result result,
 		goto err;
 	}
 
+	/*
+	 * Unless SAE is used, which derives the PMK on its own, connect
+	 * once the PSK is ready, see network_psk_derived
+	 */
+	if (network->psk_job && !bss_is_sae(bss)) {
+		l_debug("PSK derivation in progress, delaying connect");
+		network->connect_after_psk = message;
+		return;
+	}
+
 	station_connect_network(station, network, bss, message);
 	l_dbus_message_unref(message);
 	return;
@@ -1678,7 +2095,7 @@ static struct l_dbus_message *network_connect(struct l_dbus *dbus,
 		 */
 		return l_dbus_message_new_method_return(message);
 
-	if (network->agent_request)
+	if (network->agent_request || network->connect_after_psk)
 		return dbus_error_busy(message);
 
 	/*
@@ -1709,7 +2126,7 @@ struct l_dbus_message *network_connect_new_hidden_network(
 
 	l_debug("");
 
-	if (network->agent_request)
+	if (network->agent_request || network->connect_after_psk)
 		return dbus_error_busy(message);
 
 	/*
@@ -1863,6 +2280,9 @@ void network_remove(struct network *network, int reason)
 	if (network->object_path)
 		network_unregister(network, reason);
 
+	/* Also cancels any pending SAE PT derivation */
+	network_reset_passphrase(network);
+
 	l_queue_destroy(network->secrets, eap_secret_info_free);
 	network->secrets = NULL;
 
@@ -2029,11 +2449,14 @@ static void known_networks_changed(enum known_networks_event event,
 
 		/* Syncs frequencies of newly known network */
 		known_network_frequency_sync((struct network_info *)info);
+		network_precompute_start(info, NULL);
 		break;
 	case KNOWN_NETWORKS_EVENT_REMOVED:
+		network_precompute_cancel(info);
 		station_foreach(emit_known_network_removed, (void *) info);
 		break;
 	case KNOWN_NETWORKS_EVENT_UPDATED:
+		network_precompute_start(info, NULL);
 		break;
 	}
 }
@@ -2128,6 +2551,9 @@ static int network_init(void)
 
 	event_watch = station_add_event_watch(event_watch_changed, NULL, NULL);
 
+	/* Profiles read before the watch was added */
+	known_networks_foreach(network_precompute_start, NULL);
+
 	return 0;
 }
 
@@ -2136,6 +2562,9 @@ static void network_exit(void)
 	known_networks_watch_remove(known_networks_watch);
 	known_networks_watch = 0;
 
+	l_queue_destroy(precomputes, network_precompute_free);
+	precomputes = NULL;
+
 	station_remove_event_watch(event_watch);
 	event_watch = 0;
 
@@ -2144,3 +2573,4 @@ static void network_exit(void)
 
 IWD_MODULE(network, network_init, network_exit)
 IWD_MODULE_DEPENDS(network, known_networks)
+IWD_MODULE_DEPENDS(network, crypto_worker)
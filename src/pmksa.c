@@ -0,0 +1,233 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2024  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+
+#include <ell/ell.h>
+
+#include "ell/useful.h"
+#include "src/missing.h"
+#include "src/module.h"
+#include "src/util.h"
+#include "src/pmksa.h"
+
+/* 802.11-2020 dot11RSNAConfigPMKLifetime default, in seconds */
+#define PMKSA_DEFAULT_LIFETIME		43200
+
+/* Upper bound on the number of cached PMKSAs */
+#define PMKSA_DEFAULT_MAX_ENTRIES	32
+
+static uint64_t pmksa_lifetime_us = PMKSA_DEFAULT_LIFETIME * L_USEC_PER_SEC;
+static unsigned int pmksa_max_entries = PMKSA_DEFAULT_MAX_ENTRIES;
+
+/* Kept sorted by expiration time, soonest to expire first */
+static struct l_queue *cache;
+
+struct pmksa_match_data {
+	const uint8_t *spa;
+	const uint8_t *aa;
+	const uint8_t *ssid;
+	size_t ssid_len;
+	uint32_t akm;
+};
+
+static void pmksa_destroy(void *data)
+{
+	pmksa_cache_free(data);
+}
+
+static int pmksa_expiration_compare(const void *a, const void *b,
+					void *user_data)
+{
+	const struct pmksa *new = a;
+	const struct pmksa *entry = b;
+
+	if (l_time_before(new->expiration, entry->expiration))
+		return -1;
+
+	return 1;
+}
+
+static bool pmksa_match(const void *a, const void *b)
+{
+	const struct pmksa *pmksa = a;
+	const struct pmksa_match_data *data = b;
+
+	if (memcmp(pmksa->spa, data->spa, 6))
+		return false;
+
+	if (memcmp(pmksa->aa, data->aa, 6))
+		return false;
+
+	if (pmksa->ssid_len != data->ssid_len ||
+			memcmp(pmksa->ssid, data->ssid, data->ssid_len))
+		return false;
+
+	return (pmksa->akm & data->akm) != 0;
+}
+
+static bool pmksa_expired(void *data, void *user_data)
+{
+	struct pmksa *pmksa = data;
+	uint64_t cutoff = l_get_u64(user_data);
+
+	if (l_time_after(pmksa->expiration, cutoff))
+		return false;
+
+	l_debug("Expiring PMKSA for "MAC, MAC_STR(pmksa->aa));
+	pmksa_cache_free(pmksa);
+
+	return true;
+}
+
+/*
+ * Takes the matching PMKSA out of the cache.  The caller owns the returned
+ * entry and is expected to either free it or hand it back through
+ * pmksa_cache_put() once it has been used successfully.
+ */
+struct pmksa *pmksa_cache_get(const uint8_t spa[static 6],
+				const uint8_t aa[static 6],
+				const uint8_t *ssid, size_t ssid_len,
+				uint32_t akm)
+{
+	struct pmksa_match_data data = {
+		.spa = spa,
+		.aa = aa,
+		.ssid = ssid,
+		.ssid_len = ssid_len,
+		.akm = akm,
+	};
+
+	pmksa_cache_expire(l_time_now());
+
+	return l_queue_remove_if(cache, pmksa_match, &data);
+}
+
+int pmksa_cache_put(struct pmksa *pmksa)
+{
+	struct pmksa_match_data data = {
+		.spa = pmksa->spa,
+		.aa = pmksa->aa,
+		.ssid = pmksa->ssid,
+		.ssid_len = pmksa->ssid_len,
+		.akm = pmksa->akm,
+	};
+	struct pmksa *old;
+
+	if (!cache)
+		cache = l_queue_new();
+
+	l_debug("Adding PMKSA for "MAC, MAC_STR(pmksa->aa));
+
+	/* A newer PMKSA for the same peer always supersedes the old one */
+	old = l_queue_remove_if(cache, pmksa_match, &data);
+	if (old)
+		pmksa_cache_free(old);
+
+	pmksa_cache_expire(l_time_now());
+
+	if (l_queue_length(cache) >= pmksa_max_entries)
+		pmksa_cache_free(l_queue_pop_head(cache));
+
+	l_queue_insert(cache, pmksa, pmksa_expiration_compare, NULL);
+
+	return 0;
+}
+
+int pmksa_cache_expire(uint64_t cutoff)
+{
+	return l_queue_foreach_remove(cache, pmksa_expired, &cutoff);
+}
+
+int pmksa_cache_flush(void)
+{
+	int n = l_queue_length(cache);
+
+	l_queue_clear(cache, pmksa_destroy);
+
+	return n;
+}
+
+unsigned int pmksa_cache_length(void)
+{
+	return l_queue_length(cache);
+}
+
+void pmksa_cache_foreach(pmksa_cache_foreach_func_t func, void *user_data)
+{
+	const struct l_queue_entry *entry;
+
+	for (entry = l_queue_get_entries(cache); entry; entry = entry->next)
+		func(entry->data, user_data);
+}
+
+void pmksa_cache_free(struct pmksa *pmksa)
+{
+	if (!pmksa)
+		return;
+
+	explicit_bzero(pmksa->pmk, sizeof(pmksa->pmk));
+	l_free(pmksa);
+}
+
+uint64_t pmksa_lifetime(void)
+{
+	return pmksa_lifetime_us;
+}
+
+void __pmksa_set_config(const struct l_settings *config)
+{
+	uint64_t lifetime;
+	unsigned int max_entries;
+
+	if (!l_settings_get_uint64(config, "General", "PMKSALifetime",
+					&lifetime))
+		lifetime = PMKSA_DEFAULT_LIFETIME;
+
+	if (!l_settings_get_uint(config, "General", "PMKSACacheSize",
+					&max_entries) || !max_entries)
+		max_entries = PMKSA_DEFAULT_MAX_ENTRIES;
+
+	/* For easier user configuration the lifetime is in seconds */
+	pmksa_lifetime_us = lifetime * L_USEC_PER_SEC;
+	pmksa_max_entries = max_entries;
+}
+
+static int pmksa_init(void)
+{
+	if (!cache)
+		cache = l_queue_new();
+
+	return 0;
+}
+
+static void pmksa_exit(void)
+{
+	l_queue_destroy(cache, pmksa_destroy);
+	cache = NULL;
+}
+
+IWD_MODULE(pmksa, pmksa_init, pmksa_exit)
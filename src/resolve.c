@@ -24,11 +24,17 @@
 #include <config.h>
 #endif
 
+#define _GNU_SOURCE
 #include <errno.h>
 #include <arpa/inet.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
+#include <spawn.h>
 
 #include <ell/ell.h>
 
@@ -372,67 +378,262 @@ static const struct resolve_method_ops resolve_method_systemd_ops = {
 };
 
 char *resolvconf_path;
+static struct l_queue *resolvconf_busy;
 
-static bool resolvconf_invoke(const char *ifname, const char *type,
-						const char *content)
-{
-	FILE *resolvconf;
-	L_AUTO_FREE_VAR(char *, cmd) = NULL;
-	int error;
-
-	if (content) {
-		cmd = l_strdup_printf("%s -a %s.%s", resolvconf_path,
-						ifname, type);
-		resolvconf = popen(cmd, "w");
-	} else {
-		cmd = l_strdup_printf("%s -d %s.%s", resolvconf_path,
-						ifname, type);
-		resolvconf = popen(cmd, "r");
+#define RESOLVCONF_POLL_INTERVAL 50	/* ms */
+
+enum resolvconf_record_type {
+	RESOLVCONF_RECORD_DNS,
+	RESOLVCONF_RECORD_DOMAIN,
+	RESOLVCONF_RECORD_COUNT,
+};
+
+static const char *resolvconf_record_name[] = { "dns", "domain" };
+
+struct resolvconf_record {
+	char *content;			/* Wanted content, NULL to delete */
+	char *applied;			/* Content last given to resolvconf */
+	bool changed : 1;
+};
+
+/*
+ * resolvconf is run in the background, one invocation at a time for each
+ * interface.  Updates only replace the wanted content of the interface's
+ * records and get processed from an idle callback or once the running
+ * invocation exits, so that a quick sequence of set_dns, set_domains and
+ * revert calls results in at most one invocation per record, or none if
+ * the record ends up unchanged.
+ */
+struct resolvconf {
+	struct resolve super;
+	char *ifname;
+	struct resolvconf_record records[RESOLVCONF_RECORD_COUNT];
+	struct l_idle *idle;
+	pid_t pid;
+	enum resolvconf_record_type running;
+	char *running_content;
+	struct l_io *child_io;
+	struct l_timeout *child_poll;
+	bool busy : 1;
+	bool destroyed : 1;
+};
+
+static void resolvconf_free(struct resolvconf *rc)
+{
+	unsigned int i;
+
+	for (i = 0; i < RESOLVCONF_RECORD_COUNT; i++) {
+		l_free(rc->records[i].content);
+		l_free(rc->records[i].applied);
 	}
 
-	if (!resolvconf) {
-		l_error("resolve: Failed to start %s (%s).", resolvconf_path,
+	l_free(rc->ifname);
+	l_free(rc);
+}
+
+static void resolvconf_child_exited(struct resolvconf *rc, int status)
+{
+	struct resolvconf_record *record = &rc->records[rc->running];
+
+	if (status < 0)
+		l_error("resolve: Failed to wait for %s (%s).",
+					resolvconf_path, strerror(errno));
+	else if (status > 0)
+		l_info("resolve: %s exited with status (%d).", resolvconf_path,
+									status);
+
+	/* A deleted record is gone either way, keep the old one on error */
+	if (!rc->running_content || !status) {
+		l_free(record->applied);
+		record->applied = l_steal_ptr(rc->running_content);
+	}
+
+	l_free(l_steal_ptr(rc->running_content));
+	l_io_destroy(l_steal_ptr(rc->child_io));
+	l_timeout_remove(l_steal_ptr(rc->child_poll));
+	rc->pid = 0;
+}
+
+static bool resolvconf_spawn(struct resolvconf *rc,
+				enum resolvconf_record_type type);
+static void resolvconf_child_check(struct resolvconf *rc);
+
+static void resolvconf_process(struct resolvconf *rc)
+{
+	unsigned int i;
+
+	l_idle_remove(l_steal_ptr(rc->idle));
+
+	if (rc->pid)
+		return;
+
+	for (i = 0; i < RESOLVCONF_RECORD_COUNT; i++) {
+		struct resolvconf_record *record = &rc->records[i];
+
+		if (!record->changed)
+			continue;
+
+		record->changed = false;
+
+		if (l_streq0(record->content, record->applied))
+			continue;
+
+		if (resolvconf_spawn(rc, i))
+			return;
+	}
+
+	l_queue_remove(resolvconf_busy, rc);
+	rc->busy = false;
+
+	if (rc->destroyed)
+		resolvconf_free(rc);
+}
+
+#ifdef __NR_pidfd_open
+static bool resolvconf_child_io_cb(struct l_io *io, void *user_data)
+{
+	resolvconf_child_check(user_data);
+
+	return true;
+}
+
+static bool resolvconf_child_watch(struct resolvconf *rc)
+{
+	int pidfd = syscall(__NR_pidfd_open, rc->pid, 0);
+
+	if (pidfd < 0)
+		return false;
+
+	rc->child_io = l_io_new(pidfd);
+	l_io_set_close_on_destroy(rc->child_io, true);
+	l_io_set_read_handler(rc->child_io, resolvconf_child_io_cb, rc, NULL);
+
+	return true;
+}
+#else
+static bool resolvconf_child_watch(struct resolvconf *rc)
+{
+	return false;
+}
+#endif
+
+static void resolvconf_child_poll_cb(struct l_timeout *timeout,
+					void *user_data)
+{
+	struct resolvconf *rc = user_data;
+
+	l_timeout_modify_ms(timeout, RESOLVCONF_POLL_INTERVAL);
+	resolvconf_child_check(rc);
+}
+
+static void resolvconf_child_check(struct resolvconf *rc)
+{
+	int status;
+	pid_t pid = waitpid(rc->pid, &status, WNOHANG);
+
+	if (!pid)
+		return;
+
+	resolvconf_child_exited(rc, pid < 0 ? -1 : status);
+	resolvconf_process(rc);
+}
+
+static bool resolvconf_spawn(struct resolvconf *rc,
+				enum resolvconf_record_type type)
+{
+	const char *content = rc->records[type].content;
+	L_AUTO_FREE_VAR(char *, name) = l_strdup_printf("%s.%s", rc->ifname,
+						resolvconf_record_name[type]);
+	char *argv[] = { resolvconf_path, content ? "-a" : "-d", name, NULL };
+	posix_spawn_file_actions_t actions;
+	int fds[2];
+	int err;
+
+	/*
+	 * Feed the content through a socket rather than a pipe so that
+	 * MSG_NOSIGNAL avoids a SIGPIPE if resolvconf exits early.  The
+	 * content is small enough to always fit in the socket buffer.
+	 */
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0) {
+		l_error("resolve: Failed to create socket (%s).",
 							strerror(errno));
 		return false;
 	}
 
-	if (content && fprintf(resolvconf, "%s", content) < 0)
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_adddup2(&actions, fds[1], STDIN_FILENO);
+	err = posix_spawn(&rc->pid, resolvconf_path, &actions, NULL, argv,
+				environ);
+	posix_spawn_file_actions_destroy(&actions);
+	close(fds[1]);
+
+	if (err) {
+		l_error("resolve: Failed to start %s (%s).", resolvconf_path,
+							strerror(err));
+		close(fds[0]);
+		rc->pid = 0;
+		return false;
+	}
+
+	if (content && send(fds[0], content, strlen(content),
+				MSG_DONTWAIT | MSG_NOSIGNAL) < 0)
 		l_error("resolve: Failed to print into %s stdin.",
 							resolvconf_path);
 
-	error = pclose(resolvconf);
-	if (error < 0)
-		l_error("resolve: Failed to close pipe to %s (%s).",
-					resolvconf_path, strerror(errno));
-	else if (error > 0)
-		l_info("resolve: %s exited with status (%d).", resolvconf_path,
-									error);
+	close(fds[0]);
+
+	rc->running = type;
+	rc->running_content = l_strdup(content);
+
+	/* Fall back to polling where pidfd_open isn't available */
+	if (!resolvconf_child_watch(rc))
+		rc->child_poll = l_timeout_create_ms(RESOLVCONF_POLL_INTERVAL,
+						resolvconf_child_poll_cb,
+						rc, NULL);
 
-	return !error;
+	return true;
 }
 
-struct resolvconf {
-	struct resolve super;
-	bool have_domain : 1;
-	bool have_dns : 1;
-	char *ifname;
-};
+static void resolvconf_idle_cb(struct l_idle *idle, void *user_data)
+{
+	resolvconf_process(user_data);
+}
+
+static void resolvconf_update(struct resolvconf *rc,
+				enum resolvconf_record_type type,
+				char *content)
+{
+	struct resolvconf_record *record = &rc->records[type];
+
+	if (l_streq0(record->content, content)) {
+		l_free(content);
+		return;
+	}
+
+	l_free(record->content);
+	record->content = content;
+	record->changed = true;
+
+	if (!rc->busy) {
+		l_queue_push_tail(resolvconf_busy, rc);
+		rc->busy = true;
+	}
+
+	if (!rc->pid && !rc->idle)
+		rc->idle = l_idle_create(resolvconf_idle_cb, rc, NULL);
+}
 
 static void resolve_resolvconf_set_dns(struct resolve *resolve, char **dns_list)
 {
 	struct resolvconf *rc =
 			l_container_of(resolve, struct resolvconf, super);
 	struct l_string *content;
-	L_AUTO_FREE_VAR(char *, str) = NULL;
 
 	if (L_WARN_ON(!resolvconf_path))
 		return;
 
 	if (!dns_list || !dns_list[0]) {
-		if (rc->have_dns)
-			resolvconf_invoke(rc->ifname, "dns", NULL);
-
-		rc->have_dns = false;
+		resolvconf_update(rc, RESOLVCONF_RECORD_DNS, NULL);
 		return;
 	}
 
@@ -441,10 +642,7 @@ static void resolve_resolvconf_set_dns(struct resolve *resolve, char **dns_list)
 	for (; *dns_list; dns_list++)
 		l_string_append_printf(content, "nameserver %s\n", *dns_list);
 
-	str = l_string_unwrap(content);
-
-	if (resolvconf_invoke(rc->ifname, "dns", str))
-		rc->have_dns = true;
+	resolvconf_update(rc, RESOLVCONF_RECORD_DNS, l_string_unwrap(content));
 }
 
 static void resolve_resolvconf_set_domains(struct resolve *resolve,
@@ -453,16 +651,12 @@ static void resolve_resolvconf_set_domains(struct resolve *resolve,
 	struct resolvconf *rc =
 			l_container_of(resolve, struct resolvconf, super);
 	struct l_string *content;
-	L_AUTO_FREE_VAR(char *, str) = NULL;
 
 	if (L_WARN_ON(!resolvconf_path))
 		return;
 
 	if (!domain_list || !domain_list[0]) {
-		if (rc->have_domain)
-			resolvconf_invoke(rc->ifname, "domain", NULL);
-
-		rc->have_domain = false;
+		resolvconf_update(rc, RESOLVCONF_RECORD_DOMAIN, NULL);
 		return;
 	}
 
@@ -471,10 +665,8 @@ static void resolve_resolvconf_set_domains(struct resolve *resolve,
 	for (; *domain_list; domain_list++)
 		l_string_append_printf(content, "search %s\n", *domain_list);
 
-	str = l_string_unwrap(content);
-
-	if (resolvconf_invoke(rc->ifname, "domain", str))
-		rc->have_domain = true;
+	resolvconf_update(rc, RESOLVCONF_RECORD_DOMAIN,
+				l_string_unwrap(content));
 }
 
 static void resolve_resolvconf_revert(struct resolve *resolve)
@@ -482,14 +674,8 @@ static void resolve_resolvconf_revert(struct resolve *resolve)
 	struct resolvconf *rc =
 			l_container_of(resolve, struct resolvconf, super);
 
-	if (rc->have_dns)
-		resolvconf_invoke(rc->ifname, "dns", NULL);
-
-	if (rc->have_domain)
-		resolvconf_invoke(rc->ifname, "domain", NULL);
-
-	rc->have_dns = false;
-	rc->have_domain = false;
+	resolvconf_update(rc, RESOLVCONF_RECORD_DNS, NULL);
+	resolvconf_update(rc, RESOLVCONF_RECORD_DOMAIN, NULL);
 }
 
 static void resolve_resolvconf_destroy(struct resolve *resolve)
@@ -497,8 +683,13 @@ static void resolve_resolvconf_destroy(struct resolve *resolve)
 	struct resolvconf *rc =
 			l_container_of(resolve, struct resolvconf, super);
 
-	l_free(rc->ifname);
-	l_free(rc);
+	/* Let any pending updates complete first */
+	if (rc->busy) {
+		rc->destroyed = true;
+		return;
+	}
+
+	resolvconf_free(rc);
 }
 
 static struct resolve_ops resolvconf_ops = {
@@ -530,11 +721,32 @@ static int resolve_resolvconf_init(void)
 	}
 
 	l_debug("resolvconf found as: %s", resolvconf_path);
+
+	resolvconf_busy = l_queue_new();
 	return 0;
 }
 
 static void resolve_resolvconf_exit(void)
 {
+	struct resolvconf *rc;
+
+	/* Wait for the outstanding updates, such as reverts, to complete */
+	while ((rc = l_queue_peek_head(resolvconf_busy))) {
+		int status;
+
+		if (rc->pid) {
+			if (waitpid(rc->pid, &status, 0) < 0)
+				status = -1;
+
+			resolvconf_child_exited(rc, status);
+		}
+
+		resolvconf_process(rc);
+	}
+
+	l_queue_destroy(resolvconf_busy, NULL);
+	resolvconf_busy = NULL;
+
 	l_free(resolvconf_path);
 	resolvconf_path = NULL;
 }
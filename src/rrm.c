@@ -50,6 +50,9 @@
 /* Microseconds between requests */
 #define MIN_MICROS_BETWEEN_REQUESTS	(1000000ULL / MAX_REQUESTS_PER_SEC)
 
+/* Maximum age, in ms, of scan results used to answer a beacon request */
+#define RRM_BEACON_MAX_AGE		2000
+
 /* 802.11-2016 Table 9-90 */
 #define REPORT_DETAIL_NO_FIELDS_OR_ELEMS		0
 #define REPORT_DETAIL_ALL_FIELDS_AND_ANY_REQUEST_ELEMS	1
@@ -443,6 +446,13 @@ static void rrm_handle_beacon_scan(struct rrm_state *rrm,
 	freq = band_channel_to_freq(beacon->channel, band);
 	scan_freq_set_add(freqs, freq);
 
+	/*
+	 * Unless the AP insists on the measurement duration, results of a
+	 * recent scan of this channel are as good as a new one
+	 */
+	if (!params.duration_mandatory)
+		params.max_age = RRM_BEACON_MAX_AGE;
+
 	if (!wiphy_constrain_freq_set(wiphy_find_by_wdev(rrm->wdev_id), freqs))
 		goto free_freqs;
 
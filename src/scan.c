@@ -50,21 +50,178 @@
 #include "src/p2putil.h"
 #include "src/mpdu.h"
 #include "src/band.h"
+#include "src/blacklist.h"
 #include "src/scan.h"
 
 /* User configurable options */
 static double RANK_2G_FACTOR;
 static double RANK_5G_FACTOR;
 static double RANK_6G_FACTOR;
+static uint32_t RANK_STATION_COUNT_THRESHOLD;
+static double RANK_STATION_COUNT_FACTOR;
+static double RANK_BLACKLIST_FACTOR;
+static double RANK_SIGNAL_TREND_WEIGHT;
+/* Channel utilization factor, precomputed for every BSS Load value */
+static double RANK_UTILIZATION_FACTOR[256];
 static uint32_t SCAN_MAX_INTERVAL;
 static uint32_t SCAN_INIT_INTERVAL;
+static bool SCAN_PERIODIC_ADAPTIVE;
+static bool SCAN_SCHED_SCAN_DISABLED;
+
+/*
+ * Adaptive periodic scan tuning.  The environment is considered to have
+ * changed, and the scan interval is reset, if at least this many new BSSes
+ * show up or the average signal of the BSSes seen before changed by at
+ * least this much (in mBm).  While the environment is stable only the
+ * frequencies of recently used known networks are scanned, except for
+ * every SCAN_PERIODIC_FULL_SCAN_RATIO'th scan.
+ */
+#define SCAN_PERIODIC_NEW_BSS_THRESHOLD		3
+#define SCAN_PERIODIC_SIGNAL_DELTA_THRESHOLD	600
+#define SCAN_PERIODIC_FULL_SCAN_RATIO		3
+
+/*
+ * The kernel expires BSSes not seen for 30 seconds, anything older than
+ * that can't be served from its scan results
+ */
+#define SCAN_CACHE_MAX_AGE			30000
+
+/*
+ * Scheduled scans only wake the host up once a known network is seen with
+ * at least this signal strength (in dBm)
+ */
+#define SCAN_SCHED_SCAN_RSSI_THRESHOLD		-80
+
+/*
+ * 6 GHz APs advertised in the Reduced Neighbor Reports of the BSSes seen
+ * on the other bands are remembered for this long (in seconds), so that
+ * they can be found with targeted scans instead of sweeping the 6 GHz band
+ */
+#define SCAN_COLOCATED_MAX_AGE			300
+#define SCAN_COLOCATED_MAX_APS			32
+
+/*
+ * An AP isn't probed again for this long (in seconds) after an active scan
+ * of its channel.  If it didn't answer, the delay doubles with each miss,
+ * up to SCAN_COLOCATED_BACKOFF_MAX.
+ */
+#define SCAN_COLOCATED_RESCAN_DELAY		30
+#define SCAN_COLOCATED_BACKOFF_MAX		600
 
 static struct l_queue *scan_contexts;
 
 static struct l_genl_family *nl80211;
+static uint32_t known_networks_watch;
+
+/*
+ * scan_bss objects, and the side structures hanging off them, are the most
+ * frequently allocated and freed objects in the daemon.  Released objects
+ * are kept on a per-type free list, up to a fixed limit, so they can be
+ * reused by the next scan instead of going back to the heap.
+ */
+struct scan_pool {
+	struct scan_pool_stats stats;
+	unsigned int max_cached;
+	void *cached;
+};
+
+#define SCAN_POOL(_name, _type, _max_cached)			\
+	{							\
+		.stats = {					\
+			.name = _name,				\
+			.object_size = sizeof(_type),		\
+		},						\
+		.max_cached = _max_cached,			\
+	}
+
+enum scan_pool_type {
+	SCAN_POOL_BSS,
+	SCAN_POOL_OWE_TRANS,
+	SCAN_POOL_P2P_PROBE_RESP,
+	SCAN_POOL_P2P_PROBE_REQ,
+	SCAN_POOL_P2P_BEACON,
+};
+
+static struct scan_pool scan_pools[] = {
+	[SCAN_POOL_BSS] = SCAN_POOL("scan_bss", struct scan_bss, 256),
+	[SCAN_POOL_OWE_TRANS] = SCAN_POOL("owe_transition",
+					struct ie_owe_transition_info, 16),
+	[SCAN_POOL_P2P_PROBE_RESP] = SCAN_POOL("p2p_probe_resp",
+					struct p2p_probe_resp, 16),
+	[SCAN_POOL_P2P_PROBE_REQ] = SCAN_POOL("p2p_probe_req",
+					struct p2p_probe_req, 16),
+	[SCAN_POOL_P2P_BEACON] = SCAN_POOL("p2p_beacon",
+					struct p2p_beacon, 16),
+};
+
+static void *scan_pool_alloc(enum scan_pool_type type)
+{
+	struct scan_pool *pool = &scan_pools[type];
+	void *obj = pool->cached;
+
+	if (obj) {
+		pool->cached = *(void **) obj;
+		pool->stats.cached--;
+		pool->stats.hits++;
+		memset(obj, 0, pool->stats.object_size);
+	} else {
+		obj = l_malloc(pool->stats.object_size);
+		memset(obj, 0, pool->stats.object_size);
+		pool->stats.misses++;
+	}
+
+	if (++pool->stats.in_use > pool->stats.peak)
+		pool->stats.peak = pool->stats.in_use;
+
+	return obj;
+}
+
+static void scan_pool_release(enum scan_pool_type type, void *obj)
+{
+	struct scan_pool *pool = &scan_pools[type];
+
+	if (!obj)
+		return;
+
+	pool->stats.in_use--;
+
+	if (pool->stats.cached >= pool->max_cached) {
+		l_free(obj);
+		return;
+	}
+
+	*(void **) obj = pool->cached;
+	pool->cached = obj;
+	pool->stats.cached++;
+}
+
+static void scan_pool_flush(struct scan_pool *pool)
+{
+	void *obj;
+
+	while ((obj = pool->cached)) {
+		pool->cached = *(void **) obj;
+		l_free(obj);
+	}
+
+	pool->stats.cached = 0;
+}
+
+void scan_pool_stats_foreach(scan_pool_stats_func_t func, void *user_data)
+{
+	unsigned int i;
+
+	for (i = 0; i < L_ARRAY_SIZE(scan_pools); i++)
+		func(&scan_pools[i].stats, user_data);
+}
 
 struct scan_context;
 
+struct scan_periodic_bss {
+	uint64_t addr;
+	int32_t signal_strength;
+};
+
 struct scan_periodic {
 	struct l_timeout *timeout;
 	uint16_t interval;
@@ -72,7 +229,20 @@ struct scan_periodic {
 	scan_notify_func_t callback;
 	void *userdata;
 	uint32_t id;
+	/* BSSes seen by the last full periodic scan, sorted by address */
+	struct scan_periodic_bss *snapshot;
+	unsigned int snapshot_len;
+	/* Number of consecutive periodic scans without significant change */
+	unsigned int stable_count;
 	bool needs_active_scan:1;
+	bool partial:1;
+	/*
+	 * Set while periodic scanning is offloaded to the firmware using a
+	 * scheduled scan, in which case the timeout is not armed.
+	 */
+	bool sched_scan:1;
+	unsigned int sched_scan_cmd_id;
+	struct scan_freq_set *sched_scan_freqs;
 };
 
 struct scan_request {
@@ -109,6 +279,32 @@ struct scan_request {
 	struct scan_freq_set *freqs_scanned;
 	/* Entire list of frequencies to scan */
 	struct scan_freq_set *scan_freqs;
+	/* Instrumentation, see scan_stats_foreach */
+	struct scan_stats stats;
+	uint64_t queued_time;
+	uint64_t work_start_time;
+	uint64_t segment_start_time;
+	/* TRIGGER_SCAN for the command at the head of 'cmds' was sent */
+	bool trigger_sent : 1;
+	/* Results of scans this recent (usecs) can be used, 0 if none */
+	uint64_t max_age;
+	/*
+	 * Set if coalesced with an earlier request covering the same
+	 * frequencies, results of scans started since then can be used
+	 */
+	uint64_t coalesce_time;
+	/* Cached results must have been seen after this time */
+	uint64_t cache_cutoff;
+	/* Being served from the scan cache, no TRIGGER_SCAN needed */
+	bool cached : 1;
+	/* A wildcard scan, results can be shared with other requests */
+	bool shareable : 1;
+};
+
+/* When a frequency was last covered by a scan, l_time_now() based */
+struct scan_freq_age {
+	uint64_t any;
+	uint64_t active;
 };
 
 struct scan_context {
@@ -132,6 +328,21 @@ struct scan_context {
 	 */
 	unsigned int get_fw_scan_cmd_id;
 	struct wiphy *wiphy;
+	/* Ring buffer of the most recently completed scan requests */
+	struct scan_stats stats[SCAN_STATS_HISTORY];
+	unsigned int stats_next;
+	unsigned int stats_count;
+	/*
+	 * Scan cache.  The BSSes themselves are kept by the kernel, we only
+	 * track when each frequency was last scanned so that requests
+	 * accepting older results can skip the TRIGGER_SCAN entirely.
+	 */
+	struct l_hashmap *freq_ages;
+	uint64_t cache_start_time_tsf;
+	/* START_SCHED_SCAN was rejected, don't try it again */
+	bool sched_scan_unsupported;
+	/* struct scan_colocated_ap entries, least recently seen first */
+	struct l_queue *colocated;
 };
 
 struct scan_results {
@@ -140,10 +351,16 @@ struct scan_results {
 	uint64_t time_stamp;
 	struct scan_request *sr;
 	struct scan_freq_set *freqs;
+	/* For cached results, drop BSSes last seen before this time */
+	uint64_t cutoff;
+	/* Expanded from Multiple BSSID elements, merged once dump is done */
+	struct l_queue *nontransmitted;
 };
 
 static bool start_next_scan_request(struct wiphy_radio_work_item *item);
 static void scan_periodic_rearm(struct scan_context *sc);
+static bool scan_sched_scan_start(struct scan_context *sc);
+static void scan_sched_scan_stop(struct scan_context *sc);
 
 static bool scan_context_match(const void *a, const void *b)
 {
@@ -177,9 +394,46 @@ static void scan_request_free(struct wiphy_radio_work_item *item)
 	l_free(sr);
 }
 
+static void scan_request_record_stats(struct scan_context *sc,
+					struct scan_request *sr, int err,
+					unsigned int num_bss)
+{
+	sr->stats.id = sr->work.id;
+	sr->stats.passive = sr->passive;
+	sr->stats.cached = sr->cached;
+	sr->stats.result = err;
+	sr->stats.num_bss = num_bss;
+	sr->stats.latency = l_time_diff(sr->queued_time, l_time_now());
+
+	if (sr->work_start_time)
+		sr->stats.queue_time = l_time_diff(sr->queued_time,
+							sr->work_start_time);
+
+	sc->stats[sc->stats_next] = sr->stats;
+	sc->stats_next = (sc->stats_next + 1) % SCAN_STATS_HISTORY;
+
+	if (sc->stats_count < SCAN_STATS_HISTORY)
+		sc->stats_count++;
+}
+
+static void scan_request_end_segment(struct scan_request *sr,
+					unsigned int num_freqs)
+{
+	struct scan_segment_stats *segment;
+
+	if (sr->stats.num_segments >= SCAN_STATS_MAX_SEGMENTS)
+		return;
+
+	segment = &sr->stats.segments[sr->stats.num_segments++];
+	segment->num_freqs = num_freqs;
+	segment->duration = l_time_diff(sr->segment_start_time, l_time_now());
+}
+
 static void scan_request_failed(struct scan_context *sc,
 				struct scan_request *sr, int err)
 {
+	scan_request_record_stats(sc, sr, err, 0);
+
 	sr->in_callback = true;
 
 	if (sr->trigger)
@@ -208,6 +462,13 @@ static void scan_context_free(struct scan_context *sc)
 	if (sc->sp.timeout)
 		l_timeout_remove(sc->sp.timeout);
 
+	if (nl80211)
+		scan_sched_scan_stop(sc);
+
+	l_free(sc->sp.snapshot);
+	l_hashmap_destroy(sc->freq_ages, l_free);
+	l_queue_destroy(sc->colocated, l_free);
+
 	if (sc->start_cmd_id && nl80211)
 		l_genl_family_cancel(nl80211, sc->start_cmd_id);
 
@@ -252,6 +513,8 @@ static void scan_request_triggered(struct l_genl_msg *msg, void *userdata)
 
 	sr->triggered = true;
 	sr->started = true;
+	sr->trigger_sent = false;
+	sr->segment_start_time = l_time_now();
 	l_genl_msg_unref(l_queue_pop_head(sr->cmds));
 
 	if (sr->trigger) {
@@ -627,6 +890,12 @@ static int scan_request_send_trigger(struct scan_context *sc,
 	if (!cmd)
 		return -ENOMSG;
 
+	/* Same command sent again, e.g. after an -EBUSY */
+	if (sr->trigger_sent)
+		sr->stats.retries++;
+
+	sr->trigger_sent = true;
+
 	sc->start_cmd_id = l_genl_family_send(nl80211, cmd,
 						scan_request_triggered, sc,
 									NULL);
@@ -664,6 +933,7 @@ static struct scan_request *scan_request_new(struct scan_context *sc,
 	sr->passive = passive;
 	sr->cmds = l_queue_new();
 	sr->freqs_scanned = scan_freq_set_new();
+	sr->queued_time = l_time_now();
 
 	return sr;
 }
@@ -679,6 +949,71 @@ static int insert_by_priority(const void *a, const void *b, void *user_data)
 	return -1;
 }
 
+struct scan_coalesce_data {
+	const struct scan_request *sr;
+	struct scan_freq_set *freqs;
+};
+
+static bool scan_request_subsumes(const void *a, const void *b)
+{
+	const struct scan_request *cur = a;
+	const struct scan_coalesce_data *data = b;
+	_auto_(scan_freq_set_free) struct scan_freq_set *missing = NULL;
+
+	if (cur == data->sr || cur->canceled || !cur->shareable)
+		return false;
+
+	/* Passive results might lack BSSes only answering probes */
+	if (cur->passive && !data->sr->passive)
+		return false;
+
+	missing = scan_freq_set_clone(data->freqs, BAND_FREQ_2_4_GHZ |
+							BAND_FREQ_5_GHZ |
+							BAND_FREQ_6_GHZ);
+	scan_freq_set_subtract(missing, cur->scan_freqs);
+
+	return scan_freq_set_isempty(missing);
+}
+
+/*
+ * If a queued or in-progress request covers everything the new one asks
+ * for, no need to scan again.  The new request still gets its own work
+ * item and id, but once it reaches the head of the queue it will be
+ * answered from the results the earlier request left in the kernel's
+ * BSS table, see scan_request_get_cached.
+ */
+static void scan_request_coalesce(struct scan_context *sc,
+					struct scan_request *sr,
+					const struct scan_parameters *params)
+{
+	struct scan_coalesce_data data = { .sr = sr };
+	struct scan_request *leader;
+
+	/* Anything special about the probe requests needs a real scan */
+	if (params->ssid || params->extra_ie_size || params->duration ||
+			params->duration_mandatory)
+		return;
+
+	data.freqs = scan_freq_set_clone(sr->scan_freqs, BAND_FREQ_2_4_GHZ |
+							BAND_FREQ_5_GHZ |
+							BAND_FREQ_6_GHZ);
+
+	/* Disabled frequencies are never scanned, ignore those */
+	if (!wiphy_constrain_freq_set(sc->wiphy, data.freqs))
+		goto done;
+
+	leader = l_queue_find(sc->requests, scan_request_subsumes, &data);
+	if (!leader)
+		goto done;
+
+	l_debug("Coalescing with scan request %u", leader->work.id);
+
+	sr->coalesce_time = leader->work_start_time ?: l_time_now();
+
+done:
+	scan_freq_set_free(data.freqs);
+}
+
 static uint32_t scan_common(uint64_t wdev_id, bool passive,
 				const struct scan_parameters *params,
 				int priority,
@@ -698,6 +1033,21 @@ static uint32_t scan_common(uint64_t wdev_id, bool passive,
 
 	scan_cmds_add(sr, sc, passive, params);
 
+	/*
+	 * Directed scans look for something specific which a previous scan
+	 * might not have found, always perform those.  For everything else
+	 * the scan cache is checked once the request reaches the head of the
+	 * radio work queue.  If a request covering the same frequencies is
+	 * already queued or in progress, this one will then be served from
+	 * its results instead of scanning again.
+	 */
+	if (params->max_age && !params->ssid)
+		sr->max_age = minsize(params->max_age, SCAN_CACHE_MAX_AGE) *
+							L_USEC_PER_MSEC;
+
+	sr->shareable = !params->ssid;
+	scan_request_coalesce(sc, sr, params);
+
 	/*
 	 * sr->work isn't initialized yet, it will be done by
 	 * wiphy_radio_work_insert().  Pass the priority as user_data instead
@@ -963,18 +1313,116 @@ static void scan_periodic_triggered(int err, void *user_data)
 		sc->sp.trigger(0, sc->sp.userdata);
 }
 
+static int scan_periodic_bss_compare(const void *a, const void *b)
+{
+	const struct scan_periodic_bss *bss_a = a;
+	const struct scan_periodic_bss *bss_b = b;
+
+	if (bss_a->addr == bss_b->addr)
+		return 0;
+
+	return bss_a->addr < bss_b->addr ? -1 : 1;
+}
+
+static void scan_periodic_snapshot_free(struct scan_context *sc)
+{
+	l_free(sc->sp.snapshot);
+	sc->sp.snapshot = NULL;
+	sc->sp.snapshot_len = 0;
+}
+
+/*
+ * Compares the results of a periodic scan with the last full one to guess
+ * whether the device is moving.  A moving device resets the scan interval
+ * so that networks coming into range are found sooner, a stationary one
+ * keeps backing off and only scans a subset of the channels.
+ */
+static void scan_periodic_adapt(struct scan_context *sc,
+				struct l_queue *bss_list)
+{
+	unsigned int n = l_queue_length(bss_list);
+	_auto_(l_free) struct scan_periodic_bss *current = NULL;
+	const struct l_queue_entry *entry;
+	unsigned int i = 0;
+	unsigned int j = 0;
+	unsigned int new_bss = 0;
+	unsigned int common = 0;
+	uint64_t signal_delta = 0;
+	bool moving;
+
+	current = l_new(struct scan_periodic_bss, n + 1);
+
+	for (entry = l_queue_get_entries(bss_list); entry;
+						entry = entry->next) {
+		const struct scan_bss *bss = entry->data;
+
+		current[i].addr = l_get_be64(bss->addr) >> 16;
+		current[i++].signal_strength = bss->signal_strength;
+	}
+
+	qsort(current, n, sizeof(*current), scan_periodic_bss_compare);
+
+	for (i = 0; i < n; i++) {
+		while (j < sc->sp.snapshot_len &&
+				sc->sp.snapshot[j].addr < current[i].addr)
+			j++;
+
+		if (j < sc->sp.snapshot_len &&
+				sc->sp.snapshot[j].addr == current[i].addr) {
+			signal_delta += abs(current[i].signal_strength -
+					sc->sp.snapshot[j].signal_strength);
+			common++;
+		} else
+			new_bss++;
+	}
+
+	moving = sc->sp.snapshot &&
+			(new_bss >= SCAN_PERIODIC_NEW_BSS_THRESHOLD ||
+			(common && signal_delta / common >=
+				SCAN_PERIODIC_SIGNAL_DELTA_THRESHOLD));
+
+	l_debug("%u new BSSes, %u seen before, %s", new_bss, common,
+			moving ? "moving" : "stationary");
+
+	if (moving) {
+		sc->sp.interval = SCAN_INIT_INTERVAL;
+		sc->sp.stable_count = 0;
+	} else if (sc->sp.snapshot)
+		sc->sp.stable_count++;
+
+	/* Only full scans give a complete picture of the environment */
+	if (sc->sp.partial)
+		return;
+
+	l_free(sc->sp.snapshot);
+	sc->sp.snapshot = l_steal_ptr(current);
+	sc->sp.snapshot_len = n;
+}
+
 static bool scan_periodic_notify(int err, struct l_queue *bss_list,
 					const struct scan_freq_set *freqs,
 					void *user_data)
 {
 	struct scan_context *sc = user_data;
+	bool new_owner = false;
+
+	if (SCAN_PERIODIC_ADAPTIVE && !err)
+		scan_periodic_adapt(sc, bss_list);
 
 	scan_periodic_rearm(sc);
 
 	if (sc->sp.callback)
-		return sc->sp.callback(err, bss_list, freqs, sc->sp.userdata);
+		new_owner = sc->sp.callback(err, bss_list, freqs,
+						sc->sp.userdata);
 
-	return false;
+	/*
+	 * Unless the callback stopped the periodic scan, try to offload the
+	 * following ones to the firmware
+	 */
+	if (sc->sp.timeout && scan_sched_scan_start(sc))
+		l_timeout_remove(sc->sp.timeout);
+
+	return new_owner;
 }
 
 static void scan_periodic_destroy(void *user_data)
@@ -984,10 +1432,10 @@ static void scan_periodic_destroy(void *user_data)
 	sc->sp.id = 0;
 }
 
-static struct scan_freq_set *scan_periodic_get_freqs(struct scan_context *sc)
+static struct scan_freq_set *scan_periodic_get_all_freqs(
+						struct scan_context *sc)
 {
 	uint32_t band_mask = 0;
-	struct scan_freq_set *freqs;
 	const struct scan_freq_set *supported =
 					wiphy_get_supported_freqs(sc->wiphy);
 
@@ -998,7 +1446,32 @@ static struct scan_freq_set *scan_periodic_get_freqs(struct scan_context *sc)
 	if (RANK_6G_FACTOR)
 		band_mask |= BAND_FREQ_6_GHZ;
 
-	freqs = scan_freq_set_clone(supported, band_mask);
+	return scan_freq_set_clone(supported, band_mask);
+}
+
+static struct scan_freq_set *scan_periodic_get_freqs(struct scan_context *sc)
+{
+	struct scan_freq_set *freqs = scan_periodic_get_all_freqs(sc);
+
+	sc->sp.partial = false;
+
+	if (SCAN_PERIODIC_ADAPTIVE && sc->sp.stable_count %
+			SCAN_PERIODIC_FULL_SCAN_RATIO) {
+		struct scan_freq_set *known =
+				known_networks_get_recent_frequencies(5);
+
+		if (known) {
+			scan_freq_set_constrain(known, freqs);
+
+			if (!scan_freq_set_isempty(known)) {
+				scan_freq_set_free(freqs);
+				freqs = known;
+				sc->sp.partial = true;
+			} else
+				scan_freq_set_free(known);
+		}
+	}
+
 	if (scan_freq_set_isempty(freqs)) {
 		scan_freq_set_free(freqs);
 		freqs = NULL;
@@ -1101,6 +1574,8 @@ bool scan_periodic_stop(uint64_t wdev_id)
 	if (sc->sp.timeout)
 		l_timeout_remove(sc->sp.timeout);
 
+	scan_sched_scan_stop(sc);
+
 	if (sc->sp.id) {
 		scan_cancel(wdev_id, sc->sp.id);
 		sc->sp.id = 0;
@@ -1111,10 +1586,32 @@ bool scan_periodic_stop(uint64_t wdev_id)
 	sc->sp.callback = NULL;
 	sc->sp.userdata = NULL;
 	sc->sp.needs_active_scan = false;
+	sc->sp.stable_count = 0;
+	scan_periodic_snapshot_free(sc);
 
 	return true;
 }
 
+void scan_stats_foreach(uint64_t wdev_id, scan_stats_func_t func,
+				void *user_data)
+{
+	struct scan_context *sc;
+	unsigned int i;
+
+	sc = l_queue_find(scan_contexts, scan_context_match, &wdev_id);
+	if (!sc)
+		return;
+
+	/* Oldest first */
+	for (i = 0; i < sc->stats_count; i++) {
+		unsigned int idx = (sc->stats_next + SCAN_STATS_HISTORY -
+					sc->stats_count + i) %
+					SCAN_STATS_HISTORY;
+
+		func(&sc->stats[idx], user_data);
+	}
+}
+
 uint64_t scan_get_triggered_time(uint64_t wdev_id, uint32_t id)
 {
 	struct scan_context *sc;
@@ -1125,7 +1622,7 @@ uint64_t scan_get_triggered_time(uint64_t wdev_id, uint32_t id)
 		return 0;
 
 	sr = l_queue_find(sc->requests, scan_request_match, L_UINT_TO_PTR(id));
-	if (!sr || !sr->triggered)
+	if (!sr || !(sr->triggered || sr->cached))
 		return 0;
 
 	return sr->start_time_tsf;
@@ -1147,30 +1644,646 @@ static void scan_periodic_timeout(struct l_timeout *timeout, void *user_data)
 		return;
 	}
 
-	sc->sp.interval *= 2;
-	if (sc->sp.interval > SCAN_MAX_INTERVAL)
-		sc->sp.interval = SCAN_MAX_INTERVAL;
+	sc->sp.interval *= 2;
+	if (sc->sp.interval > SCAN_MAX_INTERVAL)
+		sc->sp.interval = SCAN_MAX_INTERVAL;
+
+	scan_periodic_queue(sc);
+}
+
+static void scan_periodic_timeout_destroy(void *user_data)
+{
+	struct scan_context *sc = user_data;
+
+	sc->sp.timeout = NULL;
+}
+
+static void scan_periodic_rearm(struct scan_context *sc)
+{
+	l_debug("Arming periodic scan timer: %u", sc->sp.interval);
+
+	if (sc->sp.timeout)
+		l_timeout_modify(sc->sp.timeout, sc->sp.interval);
+	else
+		sc->sp.timeout = l_timeout_create(sc->sp.interval,
+						scan_periodic_timeout, sc,
+						scan_periodic_timeout_destroy);
+}
+
+struct scan_sched_scan_data {
+	struct l_queue *match_ssids;
+	struct l_queue *hidden_ssids;
+	bool unknown_freqs:1;
+	bool unsupported:1;
+};
+
+static bool scan_sched_scan_ssid_match(const void *a, const void *b)
+{
+	return !strcmp(a, b);
+}
+
+static bool scan_sched_scan_add_network(const struct network_info *network,
+					void *user_data)
+{
+	struct scan_sched_scan_data *data = user_data;
+
+	if (!network->config.is_autoconnectable)
+		return true;
+
+	/* Hotspot networks can't be matched by their SSID */
+	if (network->is_hotspot) {
+		data->unsupported = true;
+		return false;
+	}
+
+	if (l_queue_isempty(network->known_frequencies))
+		data->unknown_freqs = true;
+
+	if (l_queue_find(data->match_ssids, scan_sched_scan_ssid_match,
+				network->ssid))
+		return true;
+
+	l_queue_push_tail(data->match_ssids, (void *) network->ssid);
+
+	if (network->config.is_hidden)
+		l_queue_push_tail(data->hidden_ssids, (void *) network->ssid);
+
+	return true;
+}
+
+static void scan_build_attr_sched_scan_plans(struct l_genl_msg *msg,
+						struct scan_context *sc)
+{
+	uint32_t max_plans = wiphy_get_max_sched_scan_plans(sc->wiphy);
+	uint32_t max_interval =
+			wiphy_get_max_sched_scan_plan_interval(sc->wiphy);
+	uint32_t interval = sc->sp.interval;
+	uint32_t iterations = 1;
+	uint32_t i;
+
+	if (max_interval && interval > max_interval)
+		interval = max_interval;
+
+	if (!max_plans) {
+		uint32_t interval_ms = interval * 1000;
+
+		l_genl_msg_append_attr(msg, NL80211_ATTR_SCHED_SCAN_INTERVAL,
+					4, &interval_ms);
+		return;
+	}
+
+	/* Plans other than the last one need a number of iterations */
+	if (!wiphy_get_max_sched_scan_plan_iterations(sc->wiphy))
+		max_plans = 1;
+
+	/*
+	 * Mirror the periodic scan backoff: double the interval after each
+	 * scan until SCAN_MAX_INTERVAL, then keep scanning at that interval.
+	 */
+	l_genl_msg_enter_nested(msg, NL80211_ATTR_SCHED_SCAN_PLANS);
+
+	for (i = 1; i <= max_plans; i++) {
+		bool last = i == max_plans || interval >= SCAN_MAX_INTERVAL ||
+				(max_interval && interval >= max_interval);
+
+		l_genl_msg_enter_nested(msg, i);
+		l_genl_msg_append_attr(msg, NL80211_SCHED_SCAN_PLAN_INTERVAL,
+					4, &interval);
+
+		if (!last)
+			l_genl_msg_append_attr(msg,
+					NL80211_SCHED_SCAN_PLAN_ITERATIONS,
+					4, &iterations);
+
+		l_genl_msg_leave_nested(msg);
+
+		if (last)
+			break;
+
+		interval = minsize(interval * 2, SCAN_MAX_INTERVAL);
+
+		if (max_interval && interval > max_interval)
+			interval = max_interval;
+	}
+
+	l_genl_msg_leave_nested(msg);
+}
+
+static struct l_genl_msg *scan_build_sched_scan_cmd(struct scan_context *sc,
+					struct scan_sched_scan_data *data,
+					const struct scan_freq_set *freqs)
+{
+	struct l_genl_msg *msg;
+	const struct l_queue_entry *entry;
+	int32_t rssi = SCAN_SCHED_SCAN_RSSI_THRESHOLD;
+	uint32_t flags = 0;
+	uint32_t i;
+
+	msg = l_genl_msg_new(NL80211_CMD_START_SCHED_SCAN);
+
+	l_genl_msg_append_attr(msg, NL80211_ATTR_WDEV, 8, &sc->wdev_id);
+
+	scan_build_attr_scan_frequencies(msg, freqs);
+
+	/* Probe for the hidden known networks and a wildcard SSID */
+	l_genl_msg_enter_nested(msg, NL80211_ATTR_SCAN_SSIDS);
+
+	for (entry = l_queue_get_entries(data->hidden_ssids); entry;
+						entry = entry->next)
+		l_genl_msg_append_attr(msg, NL80211_ATTR_SSID,
+					strlen(entry->data), entry->data);
+
+	l_genl_msg_append_attr(msg, NL80211_ATTR_SSID, 0, NULL);
+	l_genl_msg_leave_nested(msg);
+
+	l_genl_msg_enter_nested(msg, NL80211_ATTR_SCHED_SCAN_MATCH);
+
+	for (entry = l_queue_get_entries(data->match_ssids), i = 1; entry;
+						entry = entry->next, i++) {
+		l_genl_msg_enter_nested(msg, i);
+		l_genl_msg_append_attr(msg, NL80211_SCHED_SCAN_MATCH_ATTR_SSID,
+					strlen(entry->data), entry->data);
+		l_genl_msg_append_attr(msg, NL80211_SCHED_SCAN_MATCH_ATTR_RSSI,
+					4, &rssi);
+		l_genl_msg_leave_nested(msg);
+	}
+
+	l_genl_msg_leave_nested(msg);
+
+	scan_build_attr_sched_scan_plans(msg, sc);
+
+	if (wiphy_has_feature(sc->wiphy,
+				NL80211_FEATURE_SCHED_SCAN_RANDOM_MAC_ADDR) &&
+			!scan_mac_address_randomization_is_disabled())
+		flags |= NL80211_SCAN_FLAG_RANDOM_ADDR;
+
+	if (wiphy_has_ext_feature(sc->wiphy,
+					NL80211_EXT_FEATURE_SCAN_RANDOM_SN))
+		flags |= NL80211_SCAN_FLAG_RANDOM_SN;
+
+	if (flags)
+		l_genl_msg_append_attr(msg, NL80211_ATTR_SCAN_FLAGS, 4, &flags);
+
+	return msg;
+}
+
+static void scan_sched_scan_fallback(struct scan_context *sc)
+{
+	sc->sp.sched_scan = false;
+	scan_freq_set_free(sc->sp.sched_scan_freqs);
+	sc->sp.sched_scan_freqs = NULL;
+
+	/* Resume the periodic scans where the scheduled scan left off */
+	scan_periodic_rearm(sc);
+}
+
+static void scan_sched_scan_started(struct l_genl_msg *msg, void *user_data)
+{
+	struct scan_context *sc = user_data;
+	int err = l_genl_msg_get_error(msg);
+
+	sc->sp.sched_scan_cmd_id = 0;
+
+	if (err >= 0) {
+		l_debug("Scheduled scan started for wdev %" PRIx64,
+				sc->wdev_id);
+		return;
+	}
+
+	l_debug("START_SCHED_SCAN failed: %s(%d), using periodic scans",
+			strerror(-err), -err);
+
+	if (err != -EBUSY)
+		sc->sched_scan_unsupported = true;
+
+	scan_sched_scan_fallback(sc);
+}
+
+/*
+ * Offload periodic scanning to the firmware, matching on the SSIDs of the
+ * known networks that can be autoconnected to.  Returns false if the
+ * scheduled scan can't cover all of them, periodic scans are used then.
+ */
+static bool scan_sched_scan_start(struct scan_context *sc)
+{
+	struct scan_sched_scan_data data = {};
+	struct scan_freq_set *freqs = NULL;
+	struct l_genl_msg *msg;
+	bool ret = false;
+
+	if (sc->sp.sched_scan)
+		return true;
+
+	if (SCAN_SCHED_SCAN_DISABLED || sc->sched_scan_unsupported ||
+			!wiphy_supports_sched_scan(sc->wiphy))
+		return false;
+
+	data.match_ssids = l_queue_new();
+	data.hidden_ssids = l_queue_new();
+	known_networks_foreach(scan_sched_scan_add_network, &data);
+
+	if (data.unsupported || l_queue_isempty(data.match_ssids))
+		goto done;
+
+	if (l_queue_length(data.match_ssids) >
+			wiphy_get_max_match_sets(sc->wiphy) ||
+			l_queue_length(data.hidden_ssids) + 1 >
+			wiphy_get_max_num_sched_scan_ssids(sc->wiphy))
+		goto done;
+
+	/*
+	 * Only scan the frequencies the known networks were seen on before,
+	 * unless one of them has never been seen at all
+	 */
+	freqs = scan_periodic_get_all_freqs(sc);
+
+	if (!data.unknown_freqs) {
+		struct scan_freq_set *known =
+			known_networks_get_recent_frequencies(UINT8_MAX);
+
+		scan_freq_set_constrain(known, freqs);
+
+		if (!scan_freq_set_isempty(known)) {
+			scan_freq_set_free(freqs);
+			freqs = known;
+		} else
+			scan_freq_set_free(known);
+	}
+
+	if (scan_freq_set_isempty(freqs))
+		goto done;
+
+	msg = scan_build_sched_scan_cmd(sc, &data, freqs);
+	sc->sp.sched_scan_cmd_id = l_genl_family_send(nl80211, msg,
+						scan_sched_scan_started,
+						sc, NULL);
+	if (!sc->sp.sched_scan_cmd_id) {
+		l_genl_msg_unref(msg);
+		goto done;
+	}
+
+	l_debug("Starting scheduled scan for wdev %" PRIx64 " matching %u "
+			"networks", sc->wdev_id,
+			l_queue_length(data.match_ssids));
+
+	sc->sp.sched_scan = true;
+	sc->sp.sched_scan_freqs = l_steal_ptr(freqs);
+	ret = true;
+
+done:
+	scan_freq_set_free(freqs);
+	l_queue_destroy(data.match_ssids, NULL);
+	l_queue_destroy(data.hidden_ssids, NULL);
+
+	return ret;
+}
+
+static void scan_sched_scan_stop(struct scan_context *sc)
+{
+	struct l_genl_msg *msg;
+
+	if (!sc->sp.sched_scan)
+		return;
+
+	l_debug("Stopping scheduled scan for wdev %" PRIx64, sc->wdev_id);
+
+	if (sc->sp.sched_scan_cmd_id) {
+		l_genl_family_cancel(nl80211, sc->sp.sched_scan_cmd_id);
+		sc->sp.sched_scan_cmd_id = 0;
+	}
+
+	sc->sp.sched_scan = false;
+	scan_freq_set_free(sc->sp.sched_scan_freqs);
+	sc->sp.sched_scan_freqs = NULL;
+
+	msg = l_genl_msg_new_sized(NL80211_CMD_STOP_SCHED_SCAN, 16);
+	l_genl_msg_append_attr(msg, NL80211_ATTR_WDEV, 8, &sc->wdev_id);
+
+	if (!l_genl_family_send(nl80211, msg, NULL, NULL, NULL))
+		l_genl_msg_unref(msg);
+}
+
+struct scan_cache_check_data {
+	struct scan_context *sc;
+	uint64_t cutoff;
+	bool active;
+	bool fresh;
+};
+
+static void scan_cache_check_freq(uint32_t freq, void *user_data)
+{
+	struct scan_cache_check_data *data = user_data;
+	const struct scan_freq_age *age;
+	uint64_t last;
+
+	if (!data->fresh)
+		return;
+
+	age = l_hashmap_lookup(data->sc->freq_ages, L_UINT_TO_PTR(freq));
+	if (!age) {
+		data->fresh = false;
+		return;
+	}
+
+	last = data->active ? age->active : age->any;
+
+	if (!last || l_time_before(last, data->cutoff))
+		data->fresh = false;
+}
+
+static bool scan_cache_is_fresh(struct scan_context *sc,
+				struct scan_request *sr, uint64_t cutoff)
+{
+	struct scan_cache_check_data data = {
+		.sc = sc,
+		.cutoff = cutoff,
+		.active = !sr->passive,
+		.fresh = true,
+	};
+	_auto_(scan_freq_set_free) struct scan_freq_set *freqs =
+				scan_freq_set_clone(sr->scan_freqs,
+						BAND_FREQ_2_4_GHZ |
+						BAND_FREQ_5_GHZ |
+						BAND_FREQ_6_GHZ);
+
+	/* Disabled frequencies are never scanned, ignore those */
+	if (!wiphy_constrain_freq_set(sc->wiphy, freqs))
+		return false;
+
+	scan_freq_set_foreach(freqs, scan_cache_check_freq, &data);
+
+	return data.fresh;
+}
+
+struct scan_cache_update_data {
+	struct scan_context *sc;
+	uint64_t time;
+	bool active;
+};
+
+static void scan_cache_update_freq(uint32_t freq, void *user_data)
+{
+	struct scan_cache_update_data *data = user_data;
+	struct scan_freq_age *age;
+
+	age = l_hashmap_lookup(data->sc->freq_ages, L_UINT_TO_PTR(freq));
+	if (!age) {
+		age = l_new(struct scan_freq_age, 1);
+		l_hashmap_insert(data->sc->freq_ages, L_UINT_TO_PTR(freq), age);
+	}
+
+	age->any = data->time;
+
+	if (data->active)
+		age->active = data->time;
+}
+
+static void scan_cache_update(struct scan_context *sc,
+				const struct scan_freq_set *freqs,
+				uint64_t time, bool active)
+{
+	struct scan_cache_update_data data = {
+		.sc = sc,
+		.time = time,
+		.active = active,
+	};
+
+	if (freqs)
+		scan_freq_set_foreach(freqs, scan_cache_update_freq, &data);
+}
+
+static void scan_colocated_expire(struct scan_context *sc, uint64_t now)
+{
+	struct scan_colocated_ap *ap;
+
+	while ((ap = l_queue_peek_head(sc->colocated))) {
+		if (l_time_before(now, l_time_offset(ap->last_seen,
+				SCAN_COLOCATED_MAX_AGE * L_USEC_PER_SEC)))
+			break;
+
+		l_free(l_queue_pop_head(sc->colocated));
+	}
+}
+
+static bool scan_colocated_ap_match(const void *a, const void *b)
+{
+	const struct scan_colocated_ap *ap = a;
+	const struct scan_colocated_ap *key = b;
+
+	if (ap->frequency != key->frequency ||
+			ap->bssid_present != key->bssid_present)
+		return false;
+
+	if (key->bssid_present)
+		return !memcmp(ap->bssid, key->bssid, 6);
+
+	return ap->short_ssid == key->short_ssid;
+}
+
+struct scan_colocated_update_data {
+	struct scan_context *sc;
+	const struct scan_bss *bss;
+	uint64_t time;
+};
+
+static void scan_colocated_update_ap(const struct ie_rnr_info *info,
+					void *user_data)
+{
+	struct scan_colocated_update_data *data = user_data;
+	const struct scan_bss *bss = data->bss;
+	struct scan_colocated_ap key = {};
+	struct scan_colocated_ap *ap;
+	enum band_freq band;
+	int freq;
+
+	freq = oci_to_frequency(info->oper_class, info->channel);
+	if (freq <= 0 || !band_freq_to_channel(freq, &band) ||
+			band != BAND_FREQ_6_GHZ)
+		return;
+
+	key.frequency = freq;
+
+	if (info->bssid_present) {
+		memcpy(key.bssid, info->bssid, 6);
+		key.bssid_present = true;
+	}
+
+	if (info->short_ssid_present) {
+		key.short_ssid = info->short_ssid;
+		key.short_ssid_present = true;
+	} else if (info->bss_params & IE_RNR_BSS_PARAM_SAME_SSID &&
+			!util_ssid_is_hidden(bss->ssid_len, bss->ssid)) {
+		key.short_ssid = util_ssid_short(bss->ssid_len, bss->ssid);
+		key.short_ssid_present = true;
+	}
+
+	/* Nothing a probe could be directed at */
+	if (!key.bssid_present && !key.short_ssid_present)
+		return;
+
+	ap = l_queue_remove_if(data->sc->colocated, scan_colocated_ap_match,
+				&key);
+	if (ap) {
+		key.next_probe = ap->next_probe;
+		key.probes_unanswered = ap->probes_unanswered;
+	} else if (l_queue_length(data->sc->colocated) >=
+						SCAN_COLOCATED_MAX_APS)
+		ap = l_queue_pop_head(data->sc->colocated);
+
+	if (!ap)
+		ap = l_new(struct scan_colocated_ap, 1);
+
+	*ap = key;
+	ap->last_seen = data->time;
+	l_queue_push_tail(data->sc->colocated, ap);
+}
+
+static void scan_colocated_update(struct scan_context *sc,
+					struct l_queue *bss_list, uint64_t time)
+{
+	struct scan_colocated_update_data data = {
+		.sc = sc,
+		.time = time,
+	};
+	const struct l_queue_entry *entry;
+
+	for (entry = l_queue_get_entries(bss_list); entry;
+						entry = entry->next) {
+		const struct scan_bss *bss = entry->data;
+
+		if (!bss->rnr)
+			continue;
+
+		data.bss = bss;
+		ie_parse_reduced_neighbor_report(bss->rnr + 2, bss->rnr[1],
+						scan_colocated_update_ap,
+						&data);
+	}
+
+	scan_colocated_expire(sc, time);
+}
+
+static bool scan_colocated_ap_answered(const struct scan_colocated_ap *ap,
+					struct l_queue *bss_list)
+{
+	const struct l_queue_entry *entry;
+
+	for (entry = l_queue_get_entries(bss_list); entry;
+						entry = entry->next) {
+		const struct scan_bss *bss = entry->data;
+
+		if (bss->frequency != ap->frequency)
+			continue;
+
+		if (ap->bssid_present) {
+			if (!memcmp(bss->addr, ap->bssid, 6))
+				return true;
+
+			continue;
+		}
+
+		if (util_ssid_short(bss->ssid_len, bss->ssid) ==
+				ap->short_ssid)
+			return true;
+	}
+
+	return false;
+}
+
+/* Called with the results of an active scan of @freqs */
+static void scan_colocated_probed(struct scan_context *sc,
+					struct l_queue *bss_list,
+					const struct scan_freq_set *freqs,
+					uint64_t time)
+{
+	const struct l_queue_entry *entry;
+
+	for (entry = l_queue_get_entries(sc->colocated); entry;
+						entry = entry->next) {
+		struct scan_colocated_ap *ap = entry->data;
+		unsigned int delay = SCAN_COLOCATED_RESCAN_DELAY;
+
+		if (!scan_freq_set_contains(freqs, ap->frequency))
+			continue;
+
+		if (scan_colocated_ap_answered(ap, bss_list))
+			ap->probes_unanswered = 0;
+		else if (ap->probes_unanswered++)
+			delay <<= minsize(ap->probes_unanswered - 1, 5U);
+
+		if (delay > SCAN_COLOCATED_BACKOFF_MAX)
+			delay = SCAN_COLOCATED_BACKOFF_MAX;
+
+		ap->next_probe = l_time_offset(time, delay * L_USEC_PER_SEC);
+	}
+}
+
+/*
+ * Invokes @func for each co-located 6 GHz AP remembered, except those
+ * whose channel has been actively scanned recently
+ */
+void scan_colocated_6ghz_foreach(uint64_t wdev_id, scan_colocated_func_t func,
+					void *user_data)
+{
+	struct scan_context *sc;
+	const struct l_queue_entry *entry;
+	uint64_t now;
+
+	sc = l_queue_find(scan_contexts, scan_context_match, &wdev_id);
+	if (!sc)
+		return;
+
+	now = l_time_now();
+	scan_colocated_expire(sc, now);
+
+	for (entry = l_queue_get_entries(sc->colocated); entry;
+						entry = entry->next) {
+		const struct scan_colocated_ap *ap = entry->data;
+
+		if (l_time_before(now, ap->next_probe))
+			continue;
 
-	scan_periodic_queue(sc);
+		func(ap, user_data);
+	}
 }
 
-static void scan_periodic_timeout_destroy(void *user_data)
+static void scan_get_results(struct scan_context *sc, struct scan_request *sr,
+				struct scan_freq_set *freqs);
+
+static bool scan_request_get_cached(struct scan_context *sc,
+					struct scan_request *sr)
 {
-	struct scan_context *sc = user_data;
+	uint64_t now = l_time_now();
+	uint64_t cutoff = 0;
 
-	sc->sp.timeout = NULL;
-}
+	if (sr->started || sc->get_scan_cmd_id)
+		return false;
 
-static void scan_periodic_rearm(struct scan_context *sc)
-{
-	l_debug("Arming periodic scan timer: %u", sc->sp.interval);
+	if (sr->max_age)
+		cutoff = now > sr->max_age ? now - sr->max_age : 1;
 
-	if (sc->sp.timeout)
-		l_timeout_modify(sc->sp.timeout, sc->sp.interval);
-	else
-		sc->sp.timeout = l_timeout_create(sc->sp.interval,
-						scan_periodic_timeout, sc,
-						scan_periodic_timeout_destroy);
+	/* The earlier request's results might be older than max_age */
+	if (sr->coalesce_time && (!cutoff ||
+				l_time_before(sr->coalesce_time, cutoff)))
+		cutoff = sr->coalesce_time;
+
+	if (!cutoff || !scan_cache_is_fresh(sc, sr, cutoff))
+		return false;
+
+	l_debug("Serving scan request %u from cache", sr->work.id);
+
+	sr->cached = true;
+	sr->cache_cutoff = cutoff;
+	sr->start_time_tsf = sc->cache_start_time_tsf;
+
+	scan_get_results(sc, sr, sr->scan_freqs);
+
+	if (sr->trigger) {
+		sr->trigger(0, sr->userdata);
+		sr->trigger = NULL;
+	}
+
+	return true;
 }
 
 static bool start_next_scan_request(struct wiphy_radio_work_item *item)
@@ -1179,9 +2292,25 @@ static bool start_next_scan_request(struct wiphy_radio_work_item *item)
 						struct scan_request, work);
 	struct scan_context *sc = sr->sc;
 
+	if (!sr->work_start_time)
+		sr->work_start_time = l_time_now();
+
+	/* Results requested from the cache, nothing else to do */
+	if (sr->cached || scan_request_get_cached(sc, sr))
+		return false;
+
 	if (sc->state != SCAN_STATE_NOT_RUNNING)
 		return false;
 
+	/*
+	 * Not all drivers can run a regular scan next to a scheduled one,
+	 * go back to periodic scans until the next one completes.
+	 */
+	if (sc->sp.sched_scan) {
+		scan_sched_scan_stop(sc);
+		scan_periodic_rearm(sc);
+	}
+
 	if (!scan_request_send_trigger(sc, sr))
 		return false;
 
@@ -1198,12 +2327,12 @@ static void scan_parse_vendor_specific(struct scan_bss *bss, const void *data,
 	bool dgaf_disable;
 
 	if (!bss->wpa && is_ie_wpa_ie(data, len)) {
-		bss->wpa = l_memdup(data - 2, len + 2);
+		bss->wpa = (uint8_t *) data - 2;
 		return;
 	}
 
 	if (!bss->osen && is_ie_wfa_ie(data, len, IE_WFA_OI_OSEN)) {
-		bss->osen = l_memdup(data - 2, len + 2);
+		bss->osen = (uint8_t *) data - 2;
 		return;
 	}
 
@@ -1219,18 +2348,19 @@ static void scan_parse_vendor_specific(struct scan_bss *bss, const void *data,
 	}
 
 	if (is_ie_wfa_ie(data, len, IE_WFA_OI_OWE_TRANSITION)) {
-		_auto_(l_free) struct ie_owe_transition_info *owe_trans =
-				l_new(struct ie_owe_transition_info, 1);
+		struct ie_owe_transition_info owe_trans;
 
-		if (ie_parse_owe_transition(data - 2, len + 2, owe_trans) < 0)
+		if (ie_parse_owe_transition(data - 2, len + 2, &owe_trans) < 0)
 			return;
 
-		if (owe_trans->oper_class &&
-				oci_to_frequency(owe_trans->oper_class,
-						owe_trans->channel) < 0)
+		if (owe_trans.oper_class &&
+				oci_to_frequency(owe_trans.oper_class,
+						owe_trans.channel) < 0)
 			return;
 
-		bss->owe_trans = l_steal_ptr(owe_trans);
+		scan_pool_release(SCAN_POOL_OWE_TRANS, bss->owe_trans);
+		bss->owe_trans = scan_pool_alloc(SCAN_POOL_OWE_TRANS);
+		memcpy(bss->owe_trans, &owe_trans, sizeof(owe_trans));
 		return;
 	}
 
@@ -1294,6 +2424,44 @@ static bool scan_parse_advertisement_protocol(struct scan_bss *bss,
 	return true;
 }
 
+/*
+ * While parsing, the rsne, rsnxe, wpa, osen, rc_ie and rnr members point
+ * directly into the frame being parsed.  Copy all of them into a single
+ * buffer owned by the scan_bss instead of allocating each one separately.
+ */
+static void scan_bss_store_ies(struct scan_bss *bss)
+{
+	uint8_t **ies[] = {
+		&bss->rsne, &bss->rsnxe, &bss->wpa, &bss->osen, &bss->rc_ie,
+		&bss->rnr,
+	};
+	size_t total = 0;
+	uint8_t *pos;
+	unsigned int i;
+
+	for (i = 0; i < L_ARRAY_SIZE(ies); i++)
+		if (*ies[i])
+			total += (*ies[i])[1] + 2;
+
+	if (!total)
+		return;
+
+	bss->ie_buf = l_malloc(total);
+	pos = bss->ie_buf;
+
+	for (i = 0; i < L_ARRAY_SIZE(ies); i++) {
+		size_t len;
+
+		if (!*ies[i])
+			continue;
+
+		len = (*ies[i])[1] + 2;
+		memcpy(pos, *ies[i], len);
+		*ies[i] = pos;
+		pos += len;
+	}
+}
+
 static bool scan_parse_bss_information_elements(struct scan_bss *bss,
 					const void *data, uint16_t len)
 {
@@ -1316,17 +2484,15 @@ static bool scan_parse_bss_information_elements(struct scan_bss *bss,
 			break;
 		case IE_TYPE_RSN:
 			if (!bss->rsne)
-				bss->rsne = l_memdup(iter.data - 2,
-								iter.len + 2);
+				bss->rsne = (uint8_t *) iter.data - 2;
 			break;
 		case IE_TYPE_RSNX:
 			if (!bss->rsnxe)
-				bss->rsnxe = l_memdup(iter.data - 2,
-								iter.len + 2);
+				bss->rsnxe = (uint8_t *) iter.data - 2;
 			break;
 		case IE_TYPE_BSS_LOAD:
-			if (ie_parse_bss_load(&iter, NULL, &bss->utilization,
-						NULL) < 0)
+			if (ie_parse_bss_load(&iter, &bss->sta_count,
+						&bss->utilization, NULL) < 0)
 				l_warn("Unable to parse BSS Load IE for "
 					MAC, MAC_STR(bss->addr));
 
@@ -1388,7 +2554,12 @@ static bool scan_parse_bss_information_elements(struct scan_bss *bss,
 			if (iter.len < 2)
 				return false;
 
-			bss->rc_ie = l_memdup(iter.data - 2, iter.len + 2);
+			bss->rc_ie = (uint8_t *) iter.data - 2;
+
+			break;
+		case IE_TYPE_REDUCED_NEIGHBOR_REPORT:
+			if (!bss->rnr)
+				bss->rnr = (uint8_t *) iter.data - 2;
 
 			break;
 
@@ -1425,27 +2596,33 @@ static bool scan_parse_bss_information_elements(struct scan_bss *bss,
 		}
 	}
 
+	scan_bss_store_ies(bss);
+
 	bss->wsc = ie_tlv_extract_wsc_payload(data, len, &bss->wsc_size);
 
 	switch (bss->source_frame) {
 	case SCAN_BSS_PROBE_RESP:
-		bss->p2p_probe_resp_info = l_new(struct p2p_probe_resp, 1);
+		bss->p2p_probe_resp_info =
+				scan_pool_alloc(SCAN_POOL_P2P_PROBE_RESP);
 
 		if (p2p_parse_probe_resp(data, len, bss->p2p_probe_resp_info) ==
 				0)
 			break;
 
-		l_free(bss->p2p_probe_resp_info);
+		scan_pool_release(SCAN_POOL_P2P_PROBE_RESP,
+					bss->p2p_probe_resp_info);
 		bss->p2p_probe_resp_info = NULL;
 		break;
 	case SCAN_BSS_PROBE_REQ:
-		bss->p2p_probe_req_info = l_new(struct p2p_probe_req, 1);
+		bss->p2p_probe_req_info =
+				scan_pool_alloc(SCAN_POOL_P2P_PROBE_REQ);
 
 		if (p2p_parse_probe_req(data, len, bss->p2p_probe_req_info) ==
 				0)
 			break;
 
-		l_free(bss->p2p_probe_req_info);
+		scan_pool_release(SCAN_POOL_P2P_PROBE_REQ,
+					bss->p2p_probe_req_info);
 		bss->p2p_probe_req_info = NULL;
 		break;
 	case SCAN_BSS_BEACON:
@@ -1463,14 +2640,17 @@ static bool scan_parse_bss_information_elements(struct scan_bss *bss,
 
 		r = p2p_parse_beacon(data, len, &info);
 		if (r == 0) {
-			bss->p2p_beacon_info = l_memdup(&info, sizeof(info));
+			bss->p2p_beacon_info =
+					scan_pool_alloc(SCAN_POOL_P2P_BEACON);
+			memcpy(bss->p2p_beacon_info, &info, sizeof(info));
 			break;
 		}
 
 		if (r == -ENOENT)
 			break;
 
-		bss->p2p_probe_resp_info = l_new(struct p2p_probe_resp, 1);
+		bss->p2p_probe_resp_info =
+				scan_pool_alloc(SCAN_POOL_P2P_PROBE_RESP);
 
 		if (p2p_parse_probe_resp(data, len, bss->p2p_probe_resp_info) ==
 				0) {
@@ -1478,7 +2658,8 @@ static bool scan_parse_bss_information_elements(struct scan_bss *bss,
 			break;
 		}
 
-		l_free(bss->p2p_probe_resp_info);
+		scan_pool_release(SCAN_POOL_P2P_PROBE_RESP,
+					bss->p2p_probe_resp_info);
 		bss->p2p_probe_resp_info = NULL;
 		break;
 	}
@@ -1505,9 +2686,77 @@ static int32_t signal_unspec_to_mbm(uint8_t strength)
 	return ((int32_t)strength * 100) - 10000;
 }
 
-static struct scan_bss *scan_parse_attr_bss(struct l_genl_attr *attr,
+struct scan_nontransmitted_data {
+	const struct scan_bss *transmitted;
+	struct wiphy *wiphy;
+	struct l_queue *list;
+};
+
+static void scan_add_nontransmitted_bss(const uint8_t *bssid,
+					uint16_t capability,
+					const uint8_t *ies, size_t ies_len,
+					void *user_data)
+{
+	struct scan_nontransmitted_data *data = user_data;
+	const struct scan_bss *transmitted = data->transmitted;
+	struct scan_bss *bss;
+	int ret;
+
+	bss = scan_pool_alloc(SCAN_POOL_BSS);
+	bss->utilization = 127;
+	bss->source_frame = transmitted->source_frame;
+	memcpy(bss->addr, bssid, sizeof(bss->addr));
+	bss->capability = capability;
+	bss->frequency = transmitted->frequency;
+	bss->signal_strength = transmitted->signal_strength;
+	bss->parent_tsf = transmitted->parent_tsf;
+	bss->data_rate = 2000000;
+
+	if (!scan_parse_bss_information_elements(bss, ies, ies_len)) {
+		scan_bss_free(bss);
+		return;
+	}
+
+	ret = wiphy_estimate_data_rate(data->wiphy, ies, ies_len, bss,
+					&bss->data_rate);
+	if (ret < 0 && ret != -ENETUNREACH)
+		l_warn("wiphy_estimate_data_rate() failed");
+
+	if (!data->list)
+		data->list = l_queue_new();
+
+	l_queue_push_tail(data->list, bss);
+}
+
+/*
+ * The transmitted BSS of a Multiple BSSID set describes all the other
+ * (nontransmitted) BSSes in its Beacons and Probe Responses.  Not every
+ * driver has cfg80211 expand these, so build the scan_bss entries here in
+ * order to learn about every virtual AP from a single scan.
+ */
+static struct l_queue *scan_parse_multiple_bssid(const struct scan_bss *bss,
 						struct wiphy *wiphy,
-						uint32_t *out_seen_ms_ago)
+						const uint8_t *ies,
+						size_t ies_len)
+{
+	struct scan_nontransmitted_data data = {
+		.transmitted = bss,
+		.wiphy = wiphy,
+	};
+
+	if (ie_parse_multiple_bssid(ies, ies_len, bss->addr,
+					scan_add_nontransmitted_bss,
+					&data) < 0)
+		l_debug("Invalid Multiple BSSID element from "MAC,
+				MAC_STR(bss->addr));
+
+	return data.list;
+}
+
+static struct scan_bss *scan_parse_attr_bss(struct l_genl_attr *attr,
+					struct wiphy *wiphy,
+					uint32_t *out_seen_ms_ago,
+					struct l_queue **out_nontransmitted)
 {
 	uint16_t type, len;
 	const void *data;
@@ -1517,7 +2766,7 @@ static struct scan_bss *scan_parse_attr_bss(struct l_genl_attr *attr,
 	const uint8_t *beacon_ies = NULL;
 	size_t beacon_ies_len;
 
-	bss = l_new(struct scan_bss, 1);
+	bss = scan_pool_alloc(SCAN_POOL_BSS);
 	bss->utilization = 127;
 	bss->source_frame = SCAN_BSS_BEACON;
 
@@ -1610,6 +2859,11 @@ static struct scan_bss *scan_parse_attr_bss(struct l_genl_attr *attr,
 						&bss->data_rate);
 		if (ret < 0 && ret != -ENETUNREACH)
 			l_warn("wiphy_estimate_data_rate() failed");
+
+		if (out_nontransmitted)
+			*out_nontransmitted = scan_parse_multiple_bssid(bss,
+								wiphy, ies,
+								ies_len);
 	}
 
 	return bss;
@@ -1619,11 +2873,13 @@ fail:
 	return NULL;
 }
 
-static void scan_parse_attr_scan_frequencies(struct l_genl_attr *attr,
+static unsigned int scan_parse_attr_scan_frequencies(
+						struct l_genl_attr *attr,
 						struct scan_freq_set *set)
 {
 	uint16_t type, len;
 	const void *data;
+	unsigned int n = 0;
 
 	while (l_genl_attr_next(attr, &type, &len, &data)) {
 		uint32_t freq;
@@ -1633,12 +2889,16 @@ static void scan_parse_attr_scan_frequencies(struct l_genl_attr *attr,
 
 		freq = *((uint32_t *) data);
 		scan_freq_set_add(set, freq);
+		n++;
 	}
+
+	return n;
 }
 
 static struct scan_bss *scan_parse_result(struct l_genl_msg *msg,
-						struct wiphy *wiphy,
-						uint32_t *out_seen_ms_ago)
+					struct wiphy *wiphy,
+					uint32_t *out_seen_ms_ago,
+					struct l_queue **out_nontransmitted)
 {
 	struct l_genl_attr attr, nested;
 	uint16_t type;
@@ -1654,7 +2914,8 @@ static struct scan_bss *scan_parse_result(struct l_genl_msg *msg,
 				return NULL;
 
 			bss = scan_parse_attr_bss(&nested, wiphy,
-							out_seen_ms_ago);
+							out_seen_ms_ago,
+							out_nontransmitted);
 			break;
 		}
 	}
@@ -1662,12 +2923,31 @@ static struct scan_bss *scan_parse_result(struct l_genl_msg *msg,
 	return bss;
 }
 
+static uint16_t scan_rank_clamp(double rank)
+{
+	if (rank <= 0)
+		return 0;
+
+	if (rank > USHRT_MAX)
+		return USHRT_MAX;
+
+	return rank;
+}
+
+/*
+ * The rank is an estimate of the achievable data rate, scaled to 0..65535,
+ * adjusted by a number of user configurable factors:
+ *   - the band the BSS operates on,
+ *   - the channel utilization advertised in the BSS Load element,
+ *   - the number of associated stations advertised in the BSS Load element,
+ *   - whether the BSS is blacklisted (the only per-BSS connection history
+ *     iwd keeps).
+ * The signal strength trend between scans is applied separately by
+ * scan_bss_rank_update_signal_trend() since it needs the previous result.
+ */
 static void scan_bss_compute_rank(struct scan_bss *bss)
 {
-	static const double RANK_HIGH_UTILIZATION_FACTOR = 0.8;
-	static const double RANK_LOW_UTILIZATION_FACTOR = 1.2;
 	double rank;
-	uint32_t irank;
 	/*
 	 * Maximum rate is 9607.8Mbps (HE)
 	 */
@@ -1687,17 +2967,99 @@ static void scan_bss_compute_rank(struct scan_bss *bss)
 		rank *= RANK_6G_FACTOR;
 
 	/* Rank loaded APs lower and lightly loaded APs higher */
-	if (bss->utilization >= 192)
-		rank *= RANK_HIGH_UTILIZATION_FACTOR;
-	else if (bss->utilization <= 63)
-		rank *= RANK_LOW_UTILIZATION_FACTOR;
+	rank *= RANK_UTILIZATION_FACTOR[bss->utilization];
 
-	irank = rank;
+	if (RANK_STATION_COUNT_THRESHOLD &&
+			bss->sta_count >= RANK_STATION_COUNT_THRESHOLD)
+		rank *= RANK_STATION_COUNT_FACTOR;
 
-	if (irank > USHRT_MAX)
-		bss->rank = USHRT_MAX;
-	else
-		bss->rank = irank;
+	if (RANK_BLACKLIST_FACTOR != 1.0 && blacklist_contains_bss(bss->addr))
+		rank *= RANK_BLACKLIST_FACTOR;
+
+	bss->rank = scan_rank_clamp(rank);
+}
+
+/*
+ * Raises or lowers the rank of a BSS depending on whether its signal got
+ * stronger or weaker compared to @old, a previous scan result of the same
+ * BSS.  Changes are capped at 10dB.
+ */
+void scan_bss_rank_update_signal_trend(struct scan_bss *bss,
+					const struct scan_bss *old)
+{
+	int32_t delta;
+
+	if (!RANK_SIGNAL_TREND_WEIGHT)
+		return;
+
+	delta = bss->signal_strength - old->signal_strength;
+
+	if (delta > 1000)
+		delta = 1000;
+	else if (delta < -1000)
+		delta = -1000;
+
+	bss->rank = scan_rank_clamp(bss->rank *
+			(1.0 + RANK_SIGNAL_TREND_WEIGHT * delta / 1000.0));
+}
+
+static void scan_rank_load_config(const struct l_settings *config)
+{
+	static const uint32_t default_high_threshold = 192;
+	static const uint32_t default_low_threshold = 63;
+	uint32_t high_threshold;
+	uint32_t low_threshold;
+	double high_factor;
+	double low_factor;
+	unsigned int i;
+
+	RANK_2G_FACTOR = scan_get_band_rank_modifier(BAND_FREQ_2_4_GHZ);
+	RANK_5G_FACTOR = scan_get_band_rank_modifier(BAND_FREQ_5_GHZ);
+	RANK_6G_FACTOR = scan_get_band_rank_modifier(BAND_FREQ_6_GHZ);
+
+	if (!l_settings_get_uint(config, "Rank", "HighUtilizationThreshold",
+					&high_threshold) ||
+			high_threshold > 255)
+		high_threshold = default_high_threshold;
+
+	if (!l_settings_get_uint(config, "Rank", "LowUtilizationThreshold",
+					&low_threshold) ||
+			low_threshold >= high_threshold)
+		low_threshold = minsize(default_low_threshold,
+					high_threshold - 1);
+
+	if (!l_settings_get_double(config, "Rank", "HighUtilizationModifier",
+					&high_factor))
+		high_factor = 0.8;
+
+	if (!l_settings_get_double(config, "Rank", "LowUtilizationModifier",
+					&low_factor))
+		low_factor = 1.2;
+
+	for (i = 0; i < L_ARRAY_SIZE(RANK_UTILIZATION_FACTOR); i++) {
+		if (i >= high_threshold)
+			RANK_UTILIZATION_FACTOR[i] = high_factor;
+		else if (i <= low_threshold)
+			RANK_UTILIZATION_FACTOR[i] = low_factor;
+		else
+			RANK_UTILIZATION_FACTOR[i] = 1.0;
+	}
+
+	if (!l_settings_get_uint(config, "Rank", "StationCountThreshold",
+					&RANK_STATION_COUNT_THRESHOLD))
+		RANK_STATION_COUNT_THRESHOLD = 0;
+
+	if (!l_settings_get_double(config, "Rank", "StationCountModifier",
+					&RANK_STATION_COUNT_FACTOR))
+		RANK_STATION_COUNT_FACTOR = 1.0;
+
+	if (!l_settings_get_double(config, "Rank", "BlacklistModifier",
+					&RANK_BLACKLIST_FACTOR))
+		RANK_BLACKLIST_FACTOR = 1.0;
+
+	if (!l_settings_get_double(config, "Rank", "SignalTrendWeight",
+					&RANK_SIGNAL_TREND_WEIGHT))
+		RANK_SIGNAL_TREND_WEIGHT = 0.0;
 }
 
 struct scan_bss *scan_bss_new_from_probe_req(const struct mmpdu_header *mpdu,
@@ -1708,7 +3070,7 @@ struct scan_bss *scan_bss_new_from_probe_req(const struct mmpdu_header *mpdu,
 {
 	struct scan_bss *bss;
 
-	bss = l_new(struct scan_bss, 1);
+	bss = scan_pool_alloc(SCAN_POOL_BSS);
 	memcpy(bss->addr, mpdu->address_2, 6);
 	bss->utilization = 127;
 	bss->source_frame = SCAN_BSS_PROBE_REQ;
@@ -1725,16 +3087,52 @@ fail:
 	return NULL;
 }
 
+/*
+ * Recreates a BSS from information saved on an earlier connection, e.g. to
+ * reconnect before any scan results are available.  The IEs must include
+ * at least the SSID element.
+ */
+struct scan_bss *scan_bss_new_from_ies(struct wiphy *wiphy,
+					const uint8_t *addr,
+					uint32_t frequency,
+					uint16_t capability,
+					int32_t signal_strength,
+					const uint8_t *ies, size_t ies_len)
+{
+	struct scan_bss *bss;
+	int ret;
+
+	bss = scan_pool_alloc(SCAN_POOL_BSS);
+	memcpy(bss->addr, addr, 6);
+	bss->utilization = 127;
+	bss->source_frame = SCAN_BSS_BEACON;
+	bss->frequency = frequency;
+	bss->capability = capability;
+	bss->signal_strength = signal_strength;
+	bss->time_stamp = l_time_now();
+	bss->data_rate = 2000000;
+
+	if (!scan_parse_bss_information_elements(bss, ies, ies_len)) {
+		scan_bss_free(bss);
+		return NULL;
+	}
+
+	ret = wiphy_estimate_data_rate(wiphy, ies, ies_len, bss,
+					&bss->data_rate);
+	if (ret < 0 && ret != -ENETUNREACH)
+		l_warn("wiphy_estimate_data_rate() failed");
+
+	scan_bss_compute_rank(bss);
+
+	return bss;
+}
+
 void scan_bss_free(struct scan_bss *bss)
 {
-	l_free(bss->rsne);
-	l_free(bss->rsnxe);
-	l_free(bss->wpa);
+	l_free(bss->ie_buf);
 	l_free(bss->wsc);
-	l_free(bss->osen);
-	l_free(bss->rc_ie);
 	l_free(bss->wfd);
-	l_free(bss->owe_trans);
+	scan_pool_release(SCAN_POOL_OWE_TRANS, bss->owe_trans);
 
 	switch (bss->source_frame) {
 	case SCAN_BSS_PROBE_RESP:
@@ -1742,25 +3140,27 @@ void scan_bss_free(struct scan_bss *bss)
 			break;
 
 		p2p_clear_probe_resp(bss->p2p_probe_resp_info);
-		l_free(bss->p2p_probe_resp_info);
+		scan_pool_release(SCAN_POOL_P2P_PROBE_RESP,
+					bss->p2p_probe_resp_info);
 		break;
 	case SCAN_BSS_PROBE_REQ:
 		if (!bss->p2p_probe_req_info)
 			break;
 
 		p2p_clear_probe_req(bss->p2p_probe_req_info);
-		l_free(bss->p2p_probe_req_info);
+		scan_pool_release(SCAN_POOL_P2P_PROBE_REQ,
+					bss->p2p_probe_req_info);
 		break;
 	case SCAN_BSS_BEACON:
 		if (!bss->p2p_beacon_info)
 			break;
 
 		p2p_clear_beacon(bss->p2p_beacon_info);
-		l_free(bss->p2p_beacon_info);
+		scan_pool_release(SCAN_POOL_P2P_BEACON, bss->p2p_beacon_info);
 		break;
 	}
 
-	l_free(bss);
+	scan_pool_release(SCAN_POOL_BSS, bss);
 }
 
 int scan_bss_get_rsn_info(const struct scan_bss *bss, struct ie_rsn_info *info)
@@ -1827,11 +3227,53 @@ int scan_bss_rank_compare(const void *a, const void *b, void *user_data)
 	return (bss->rank > new_bss->rank) ? 1 : -1;
 }
 
+static int scan_bss_rank_sort_compare(const void *a, const void *b)
+{
+	const struct scan_bss *bss_a = *(const struct scan_bss **) a;
+	const struct scan_bss *bss_b = *(const struct scan_bss **) b;
+
+	if (bss_a->rank != bss_b->rank)
+		return (bss_a->rank > bss_b->rank) ? -1 : 1;
+
+	if (bss_a->signal_strength == bss_b->signal_strength)
+		return 0;
+
+	return (bss_a->signal_strength > bss_b->signal_strength) ? -1 : 1;
+}
+
+/*
+ * Sorts a list of scan_bss objects into the same order as repeated
+ * l_queue_insert calls with scan_bss_rank_compare would, but in a single
+ * O(n log n) pass.
+ */
+void scan_bss_list_sort(struct l_queue *bss_list)
+{
+	unsigned int n = l_queue_length(bss_list);
+	_auto_(l_free) struct scan_bss **array = NULL;
+	unsigned int i;
+
+	if (n < 2)
+		return;
+
+	array = l_new(struct scan_bss *, n);
+
+	for (i = 0; i < n; i++)
+		array[i] = l_queue_pop_head(bss_list);
+
+	qsort(array, n, sizeof(struct scan_bss *), scan_bss_rank_sort_compare);
+
+	for (i = 0; i < n; i++)
+		l_queue_push_tail(bss_list, array[i]);
+}
+
 static void get_scan_callback(struct l_genl_msg *msg, void *user_data)
 {
 	struct scan_results *results = user_data;
 	struct scan_context *sc = results->sc;
+	struct scan_request *sr = results->sr;
 	struct scan_bss *bss;
+	struct l_queue *nontransmitted = NULL;
+	const struct l_queue_entry *entry;
 	uint64_t wdev_id;
 	uint32_t seen_ms_ago = 0;
 
@@ -1844,7 +3286,8 @@ static void get_scan_callback(struct l_genl_msg *msg, void *user_data)
 		return;
 	}
 
-	bss = scan_parse_result(msg, sc->wiphy, &seen_ms_ago);
+	bss = scan_parse_result(msg, sc->wiphy, &seen_ms_ago,
+				&nontransmitted);
 	if (!bss)
 		return;
 
@@ -1852,8 +3295,72 @@ static void get_scan_callback(struct l_genl_msg *msg, void *user_data)
 		bss->time_stamp = results->time_stamp -
 					seen_ms_ago * L_USEC_PER_MSEC;
 
+	/* Only report what a fresh scan of the same frequencies would */
+	if (sr && sr->cached && (l_time_before(bss->time_stamp,
+							results->cutoff) ||
+			!scan_freq_set_contains(results->freqs,
+							bss->frequency))) {
+		l_queue_destroy(nontransmitted,
+				(l_queue_destroy_func_t) scan_bss_free);
+		scan_bss_free(bss);
+		return;
+	}
+
 	scan_bss_compute_rank(bss);
-	l_queue_insert(results->bss_list, bss, scan_bss_rank_compare, NULL);
+
+	/* Sorted once the dump is complete, see get_scan_done */
+	l_queue_push_tail(results->bss_list, bss);
+
+	/*
+	 * The kernel may still report some of these on its own later in the
+	 * dump, see scan_results_merge_nontransmitted
+	 */
+	for (entry = l_queue_get_entries(nontransmitted); entry;
+						entry = entry->next) {
+		struct scan_bss *nontx_bss = entry->data;
+
+		nontx_bss->time_stamp = bss->time_stamp;
+		scan_bss_compute_rank(nontx_bss);
+
+		if (!results->nontransmitted)
+			results->nontransmitted = l_queue_new();
+
+		l_queue_push_tail(results->nontransmitted, nontx_bss);
+	}
+
+	l_queue_destroy(nontransmitted, NULL);
+}
+
+static bool scan_bss_addr_match(const void *a, const void *b)
+{
+	const struct scan_bss *bss = a;
+
+	return !memcmp(bss->addr, b, sizeof(bss->addr));
+}
+
+/*
+ * Add the nontransmitted BSSes expanded by us, unless cfg80211 has
+ * already reported the same BSSID itself
+ */
+static void scan_results_merge_nontransmitted(struct scan_results *results)
+{
+	struct scan_bss *bss;
+
+	if (!results->nontransmitted)
+		return;
+
+	while ((bss = l_queue_pop_head(results->nontransmitted))) {
+		if (l_queue_find(results->bss_list, scan_bss_addr_match,
+					bss->addr)) {
+			scan_bss_free(bss);
+			continue;
+		}
+
+		l_queue_push_tail(results->bss_list, bss);
+	}
+
+	l_queue_destroy(results->nontransmitted, NULL);
+	results->nontransmitted = NULL;
 }
 
 static void discover_hidden_network_bsses(struct scan_context *sc,
@@ -1884,6 +3391,10 @@ static void scan_finished(struct scan_context *sc,
 	if (bss_list)
 		discover_hidden_network_bsses(sc, bss_list);
 
+	if (sr)
+		scan_request_record_stats(sc, sr, err,
+						l_queue_length(bss_list));
+
 	if (sr)
 		sr->in_callback = true;
 
@@ -1915,6 +3426,28 @@ static void get_scan_done(void *user)
 
 	sc->get_scan_cmd_id = 0;
 
+	if (!results->sr)
+		scan_cache_update(sc, results->freqs, results->time_stamp,
+					false);
+	else if (!results->sr->cached) {
+		struct scan_request *sr = results->sr;
+
+		scan_cache_update(sc, results->freqs, sr->work_start_time,
+					!sr->passive);
+
+		if (sr->start_time_tsf)
+			sc->cache_start_time_tsf = sr->start_time_tsf;
+	}
+
+	scan_results_merge_nontransmitted(results);
+	scan_bss_list_sort(results->bss_list);
+	scan_colocated_update(sc, results->bss_list, results->time_stamp);
+
+	if (results->sr && !results->sr->cached && !results->sr->passive &&
+			results->freqs)
+		scan_colocated_probed(sc, results->bss_list, results->freqs,
+					results->time_stamp);
+
 	if (!results->sr || !results->sr->canceled)
 		scan_finished(sc, 0, results->bss_list,
 						results->freqs, results->sr);
@@ -1941,6 +3474,9 @@ static void scan_get_results(struct scan_context *sc, struct scan_request *sr,
 	results->bss_list = l_queue_new();
 	results->freqs = freqs;
 
+	if (sr && sr->cached)
+		results->cutoff = sr->cache_cutoff;
+
 	scan_msg = l_genl_msg_new_sized(NL80211_CMD_GET_SCAN, 8);
 
 	l_genl_msg_append_attr(scan_msg, NL80211_ATTR_WDEV, 8,
@@ -2016,6 +3552,8 @@ static struct scan_context *scan_context_new(uint64_t wdev_id)
 	sc->wiphy = wiphy;
 	sc->state = SCAN_STATE_NOT_RUNNING;
 	sc->requests = l_queue_new();
+	sc->freq_ages = l_hashmap_new();
+	sc->colocated = l_queue_new();
 	sc->wiphy_watch_id = wiphy_state_watch_add(wiphy, scan_wiphy_watch,
 							sc, NULL);
 
@@ -2038,15 +3576,16 @@ static bool scan_parse_flush_flag_from_msg(struct l_genl_msg *msg)
 	return false;
 }
 
-static void scan_parse_result_frequencies(struct l_genl_msg *msg,
-					struct scan_freq_set *freqs)
+static unsigned int scan_parse_result_frequencies(struct l_genl_msg *msg,
+						struct scan_freq_set *freqs)
 {
 	struct l_genl_attr attr, nested;
 	uint16_t type, len;
 	const void *data;
+	unsigned int n = 0;
 
 	if (!l_genl_attr_init(&attr, msg))
-		return;
+		return 0;
 
 	while (l_genl_attr_next(&attr, &type, &len, &data)) {
 		switch (type) {
@@ -2056,10 +3595,12 @@ static void scan_parse_result_frequencies(struct l_genl_msg *msg,
 				break;
 			}
 
-			scan_parse_attr_scan_frequencies(&nested, freqs);
+			n += scan_parse_attr_scan_frequencies(&nested, freqs);
 			break;
 		}
 	}
+
+	return n;
 }
 
 static void scan_retry_pending(uint32_t wiphy_id)
@@ -2179,8 +3720,9 @@ static void scan_notify(struct l_genl_msg *msg, void *user_data)
 			if (l_queue_isempty(sr->cmds))
 				get_results = true;
 			else {
-				scan_parse_result_frequencies(msg,
-							sr->freqs_scanned);
+				scan_request_end_segment(sr,
+					scan_parse_result_frequencies(msg,
+							sr->freqs_scanned));
 				send_next = true;
 			}
 		} else {
@@ -2230,7 +3772,11 @@ static void scan_notify(struct l_genl_msg *msg, void *user_data)
 		else
 			freqs = sr->freqs_scanned;
 
-		scan_parse_result_frequencies(msg, freqs);
+		if (sr)
+			scan_request_end_segment(sr,
+				scan_parse_result_frequencies(msg, freqs));
+		else
+			scan_parse_result_frequencies(msg, freqs);
 
 		scan_get_results(sc, sr, freqs);
 
@@ -2274,6 +3820,26 @@ static void scan_notify(struct l_genl_msg *msg, void *user_data)
 		}
 
 		break;
+
+	case NL80211_CMD_SCHED_SCAN_RESULTS:
+		if (!sc->sp.sched_scan || sc->get_scan_cmd_id)
+			break;
+
+		scan_get_results(sc, NULL,
+				scan_freq_set_clone(sc->sp.sched_scan_freqs,
+							BAND_FREQ_2_4_GHZ |
+							BAND_FREQ_5_GHZ |
+							BAND_FREQ_6_GHZ));
+		break;
+
+	case NL80211_CMD_SCHED_SCAN_STOPPED:
+		/* Ignore the event for our own STOP_SCHED_SCAN */
+		if (!sc->sp.sched_scan)
+			break;
+
+		l_debug("Scheduled scan stopped by the driver");
+		scan_sched_scan_fallback(sc);
+		break;
 	}
 }
 
@@ -2287,6 +3853,10 @@ static void get_fw_scan_done(void *userdata)
 
 	sc->get_fw_scan_cmd_id = 0;
 
+	scan_results_merge_nontransmitted(results);
+	scan_bss_list_sort(results->bss_list);
+	scan_colocated_update(sc, results->bss_list, results->time_stamp);
+
 	if (sr->callback)
 		new_owner = sr->callback(err, results->bss_list, NULL,
 						sr->userdata);
@@ -2417,15 +3987,35 @@ bool scan_wdev_remove(uint64_t wdev_id)
 	return true;
 }
 
+static void scan_known_networks_changed(enum known_networks_event event,
+					const struct network_info *info,
+					void *user_data)
+{
+	const struct l_queue_entry *entry;
+
+	/*
+	 * The match sets of running scheduled scans may now be stale, go
+	 * back to periodic scans which then restart them.
+	 */
+	for (entry = l_queue_get_entries(scan_contexts); entry;
+						entry = entry->next) {
+		struct scan_context *sc = entry->data;
+
+		if (!sc->sp.sched_scan)
+			continue;
+
+		scan_sched_scan_stop(sc);
+		scan_periodic_rearm(sc);
+	}
+}
+
 static int scan_init(void)
 {
 	const struct l_settings *config = iwd_get_config();
 
 	scan_contexts = l_queue_new();
 
-	RANK_2G_FACTOR = scan_get_band_rank_modifier(BAND_FREQ_2_4_GHZ);
-	RANK_5G_FACTOR = scan_get_band_rank_modifier(BAND_FREQ_5_GHZ);
-	RANK_6G_FACTOR = scan_get_band_rank_modifier(BAND_FREQ_6_GHZ);
+	scan_rank_load_config(config);
 
 	if (!l_settings_get_uint(config, "Scan", "InitialPeriodicScanInterval",
 					&SCAN_INIT_INTERVAL))
@@ -2441,17 +4031,42 @@ static int scan_init(void)
 	if (SCAN_MAX_INTERVAL > UINT16_MAX)
 		SCAN_MAX_INTERVAL = UINT16_MAX;
 
+	if (!l_settings_get_bool(config, "Scan", "AdaptivePeriodicScan",
+					&SCAN_PERIODIC_ADAPTIVE))
+		SCAN_PERIODIC_ADAPTIVE = false;
+
+	if (!l_settings_get_bool(config, "Scan", "DisableScheduledScan",
+					&SCAN_SCHED_SCAN_DISABLED))
+		SCAN_SCHED_SCAN_DISABLED = false;
+
+	known_networks_watch = known_networks_watch_add(
+						scan_known_networks_changed,
+						NULL, NULL);
+
 	return 0;
 }
 
 static void scan_exit(void)
 {
+	unsigned int i;
+
+	known_networks_watch_remove(known_networks_watch);
+	known_networks_watch = 0;
+
 	l_queue_destroy(scan_contexts,
 				(l_queue_destroy_func_t) scan_context_free);
 	scan_contexts = NULL;
+
+	/* Objects still held by other modules are freed directly from now */
+	for (i = 0; i < L_ARRAY_SIZE(scan_pools); i++) {
+		scan_pool_flush(&scan_pools[i]);
+		scan_pools[i].max_cached = 0;
+	}
+
 	l_genl_family_free(nl80211);
 	nl80211 = NULL;
 }
 
 IWD_MODULE(scan, scan_init, scan_exit)
 IWD_MODULE_DEPENDS(scan, wiphy)
+IWD_MODULE_DEPENDS(scan, known_networks)
@@ -48,6 +48,7 @@ struct scan_bss {
 	uint32_t frequency;
 	int32_t signal_strength;
 	uint16_t capability;
+	uint8_t *ie_buf;	/* Storage for rsne, rsnxe, wpa, osen, rc_ie */
 	uint8_t *rsne;
 	uint8_t *rsnxe;
 	uint8_t *wpa;
@@ -65,12 +66,14 @@ struct scan_bss {
 	uint8_t ssid[32];
 	uint8_t ssid_len;
 	uint8_t utilization;
+	uint16_t sta_count;
 	uint8_t cc[3];
 	uint16_t rank;
 	uint64_t time_stamp;
 	uint64_t data_rate;
 	uint8_t hessid[6];
 	uint8_t *rc_ie;		/* Roaming consortium IE */
+	uint8_t *rnr;		/* Reduced Neighbor Report IE */
 	uint8_t hs20_version;
 	uint64_t parent_tsf;
 	uint8_t *wfd;		/* Concatenated WFD IEs */
@@ -105,6 +108,11 @@ struct scan_parameters {
 	const uint8_t *ssid;	/* Used for direct probe request */
 	size_t ssid_len;
 	const uint8_t *source_mac;
+	/*
+	 * If non-zero, results of previous scans no older than this many
+	 * milliseconds are acceptable, see scan_common
+	 */
+	uint32_t max_age;
 };
 
 typedef void (*scan_func_t)(struct l_genl_msg *msg, void *user_data);
@@ -114,6 +122,60 @@ typedef bool (*scan_notify_func_t)(int err, struct l_queue *bss_list,
 					void *userdata);
 typedef void (*scan_destroy_func_t)(void *userdata);
 
+struct scan_pool_stats {
+	const char *name;
+	size_t object_size;
+	unsigned int in_use;
+	unsigned int peak;
+	unsigned int cached;
+	uint64_t hits;
+	uint64_t misses;
+};
+
+typedef void (*scan_pool_stats_func_t)(const struct scan_pool_stats *stats,
+					void *user_data);
+
+#define SCAN_STATS_HISTORY		16
+#define SCAN_STATS_MAX_SEGMENTS		4
+
+/* One TRIGGER_SCAN / NEW_SCAN_RESULTS cycle of a scan request */
+struct scan_segment_stats {
+	uint32_t num_freqs;
+	uint64_t duration;		/* usecs */
+};
+
+struct scan_stats {
+	uint32_t id;
+	bool passive;
+	bool cached;			/* Served from the scan cache */
+	int result;
+	uint64_t queue_time;		/* usecs spent in radio work queue */
+	uint64_t latency;		/* usecs from request to results */
+	uint32_t num_bss;
+	uint32_t retries;
+	uint32_t num_segments;
+	struct scan_segment_stats segments[SCAN_STATS_MAX_SEGMENTS];
+};
+
+typedef void (*scan_stats_func_t)(const struct scan_stats *stats,
+					void *user_data);
+
+/* A 6 GHz AP advertised in the Reduced Neighbor Report of another BSS */
+struct scan_colocated_ap {
+	uint8_t bssid[6];
+	uint32_t frequency;
+	uint32_t short_ssid;
+	uint64_t last_seen;
+	/* Not worth probing before then, its channel was scanned recently */
+	uint64_t next_probe;
+	unsigned int probes_unanswered;
+	bool bssid_present : 1;
+	bool short_ssid_present : 1;
+};
+
+typedef void (*scan_colocated_func_t)(const struct scan_colocated_ap *ap,
+					void *user_data);
+
 static inline int scan_bss_addr_cmp(const struct scan_bss *a1,
 					const struct scan_bss *a2)
 {
@@ -157,13 +219,21 @@ void scan_periodic_start(uint64_t wdev_id, scan_trigger_func_t trigger,
 				scan_notify_func_t func, void *userdata);
 bool scan_periodic_stop(uint64_t wdev_id);
 
+void scan_stats_foreach(uint64_t wdev_id, scan_stats_func_t func,
+				void *user_data);
 uint64_t scan_get_triggered_time(uint64_t wdev_id, uint32_t id);
+void scan_colocated_6ghz_foreach(uint64_t wdev_id, scan_colocated_func_t func,
+					void *user_data);
 
 bool scan_get_firmware_scan(uint64_t wdev_id, scan_notify_func_t notify,
 				void *userdata, scan_destroy_func_t destroy);
 
 void scan_bss_free(struct scan_bss *bss);
+void scan_pool_stats_foreach(scan_pool_stats_func_t func, void *user_data);
 int scan_bss_rank_compare(const void *a, const void *b, void *user);
+void scan_bss_list_sort(struct l_queue *bss_list);
+void scan_bss_rank_update_signal_trend(struct scan_bss *bss,
+					const struct scan_bss *old);
 
 int scan_bss_get_rsn_info(const struct scan_bss *bss, struct ie_rsn_info *info);
 int scan_bss_get_security(const struct scan_bss *bss, enum security *security);
@@ -172,6 +242,12 @@ struct scan_bss *scan_bss_new_from_probe_req(const struct mmpdu_header *mpdu,
 						const uint8_t *body,
 						size_t body_len,
 						uint32_t frequency, int rssi);
+struct scan_bss *scan_bss_new_from_ies(struct wiphy *wiphy,
+					const uint8_t *addr,
+					uint32_t frequency,
+					uint16_t capability,
+					int32_t signal_strength,
+					const uint8_t *ies, size_t ies_len);
 
 double scan_get_band_rank_modifier(enum band_freq band);
 
@@ -63,6 +63,7 @@
 #include "src/eap.h"
 #include "src/eap-tls-common.h"
 #include "src/storage.h"
+#include "src/pmksa.h"
 
 static struct l_queue *station_list;
 static uint32_t netdev_watch;
@@ -74,6 +75,8 @@ static bool supports_ndisc_evict_nocarrier;
 static struct watchlist event_watches;
 static uint32_t known_networks_watch;
 static uint32_t allowed_bands;
+static bool pmksa_disabled;
+static struct l_settings *last_bss_state;
 
 struct station {
 	enum station_state state;
@@ -84,6 +87,7 @@ struct station {
 	struct network *connect_pending_network;
 	struct l_queue *autoconnect_list;
 	struct l_queue *bss_list;
+	struct l_hashmap *bss_index;
 	struct l_queue *hidden_bss_list_sorted;
 	struct l_hashmap *networks;
 	struct l_queue *networks_sorted;
@@ -97,6 +101,8 @@ struct station {
 	uint32_t quick_scan_id;
 	uint32_t hidden_network_scan_id;
 	struct l_queue *owe_hidden_scan_ids;
+	/* Targeted scans for 6 GHz APs learned from Reduced Neighbor Reports */
+	struct l_queue *colocated_scan_ids;
 
 	/* Roaming related members */
 	struct timespec roam_min_time;
@@ -116,7 +122,7 @@ struct station {
 	struct l_queue *roam_bss_list;
 
 	/* Frequencies split into subsets by priority */
-	struct scan_freq_set *scan_freqs_order[3];
+	struct scan_freq_set *scan_freqs_order[4];
 	unsigned int dbus_scan_subset_idx;
 
 	uint32_t wiphy_watch;
@@ -125,6 +131,10 @@ struct station {
 
 	uint64_t last_roam_scan;
 
+	/* Duration (us) and size of the last scan result merge */
+	uint64_t scan_merge_time;
+	unsigned int scan_merge_bss_count;
+
 	bool preparing_roam : 1;
 	bool roam_scan_full : 1;
 	bool signal_low : 1;
@@ -133,6 +143,8 @@ struct station {
 	bool autoconnect : 1;
 	bool autoconnect_can_start : 1;
 	bool netconfig_after_roam : 1;
+	bool pmksa_offered : 1;
+	bool fast_reconnect_tried : 1;
 };
 
 struct anqp_entry {
@@ -311,6 +323,9 @@ static void station_autoconnect_start(struct station *station)
 	if (!l_queue_isempty(station->owe_hidden_scan_ids))
 		return;
 
+	if (!l_queue_isempty(station->colocated_scan_ids))
+		return;
+
 	if (L_WARN_ON(station->autoconnect_list))
 		l_queue_destroy(station->autoconnect_list, NULL);
 
@@ -398,31 +413,16 @@ static int bss_signal_strength_compare(const void *a, const void *b, void *user)
 }
 
 /*
- * Returns the network object the BSS was added to or NULL if ignored.
+ * Looks up, or creates and registers, the network object a non-hidden BSS
+ * belongs to.  Returns NULL if the BSS should be ignored.
  */
-static struct network *station_add_seen_bss(struct station *station,
-						struct scan_bss *bss)
+static struct network *station_get_bss_network(struct station *station,
+						const struct scan_bss *bss)
 {
 	struct network *network;
 	enum security security;
 	const char *path;
 	char ssid[33];
-	uint32_t kbps100 = DIV_ROUND_CLOSEST(bss->data_rate, 100000);
-
-	l_debug("Processing BSS '%s' with SSID: %s, freq: %u, rank: %u, "
-			"strength: %i, data_rate: %u.%u",
-			util_address_to_string(bss->addr),
-			util_ssid_to_utf8(bss->ssid_len, bss->ssid),
-			bss->frequency, bss->rank, bss->signal_strength,
-			kbps100 / 10, kbps100 % 10);
-
-	if (util_ssid_is_hidden(bss->ssid_len, bss->ssid)) {
-		l_debug("BSS has hidden SSID");
-
-		l_queue_insert(station->hidden_bss_list_sorted, bss,
-					bss_signal_strength_compare, NULL);
-		return NULL;
-	}
 
 	memcpy(ssid, bss->ssid, bss->ssid_len);
 	ssid[bss->ssid_len] = '\0';
@@ -489,6 +489,37 @@ static struct network *station_add_seen_bss(struct station *station,
 			network_get_ssid(network), security_to_str(security));
 	}
 
+	return network;
+}
+
+/*
+ * Returns the network object the BSS was added to or NULL if ignored.
+ */
+static struct network *station_add_seen_bss(struct station *station,
+						struct scan_bss *bss)
+{
+	struct network *network;
+	uint32_t kbps100 = DIV_ROUND_CLOSEST(bss->data_rate, 100000);
+
+	l_debug("Processing BSS '%s' with SSID: %s, freq: %u, rank: %u, "
+			"strength: %i, data_rate: %u.%u",
+			util_address_to_string(bss->addr),
+			util_ssid_to_utf8(bss->ssid_len, bss->ssid),
+			bss->frequency, bss->rank, bss->signal_strength,
+			kbps100 / 10, kbps100 % 10);
+
+	if (util_ssid_is_hidden(bss->ssid_len, bss->ssid)) {
+		l_debug("BSS has hidden SSID");
+
+		l_queue_insert(station->hidden_bss_list_sorted, bss,
+					bss_signal_strength_compare, NULL);
+		return NULL;
+	}
+
+	network = station_get_bss_network(station, bss);
+	if (!network)
+		return NULL;
+
 	network_bss_add(network, bss);
 
 	return network;
@@ -508,7 +539,74 @@ static bool bss_match(const void *a, const void *b)
 	return !memcmp(bss_a->ssid, bss_b->ssid, bss_a->ssid_len);
 }
 
+/*
+ * station->bss_index maps scan_bss objects by BSSID + SSID (the same key as
+ * bss_match) so that merging scan results doesn't need to walk bss_list for
+ * every incoming BSS.  The scan_bss itself is used as the key.
+ */
+static unsigned int bss_index_hash(const void *p)
+{
+	const struct scan_bss *bss = p;
+
+	return util_hash_bytes(util_address_hash(bss->addr),
+				bss->ssid, bss->ssid_len);
+}
+
+static int bss_index_compare(const void *a, const void *b)
+{
+	return bss_match(a, b) ? 0 : 1;
+}
+
+static struct l_hashmap *bss_index_new(void)
+{
+	struct l_hashmap *index = l_hashmap_new();
+
+	l_hashmap_set_hash_function(index, bss_index_hash);
+	l_hashmap_set_compare_function(index, bss_index_compare);
+
+	return index;
+}
+
+static void bss_index_add(struct l_hashmap *index, struct scan_bss *bss)
+{
+	/* Duplicates keep the first entry, it was ranked first */
+	if (l_hashmap_lookup(index, bss))
+		return;
+
+	l_hashmap_insert(index, bss, bss);
+}
+
+static void bss_index_remove(struct l_hashmap *index, struct scan_bss *bss)
+{
+	/* Only drop the entry if it refers to this exact object */
+	if (l_hashmap_lookup(index, bss) == bss)
+		l_hashmap_remove(index, bss);
+}
+
+static void station_bss_list_add(struct station *station, struct scan_bss *bss)
+{
+	l_queue_push_tail(station->bss_list, bss);
+	bss_index_add(station->bss_index, bss);
+}
+
+/*
+ * The lookup goes through the index, but bss_list is a singly linked
+ * l_queue so unlinking the old entry is still linear.  This is only used
+ * when roaming, once per roam, not per scan result.
+ */
+static struct scan_bss *station_bss_list_remove(struct station *station,
+						const struct scan_bss *bss)
+{
+	struct scan_bss *old = l_hashmap_remove(station->bss_index, bss);
+
+	if (old)
+		l_queue_remove(station->bss_list, old);
+
+	return old;
+}
+
 struct bss_expiration_data {
+	struct l_hashmap *index;
 	struct scan_bss *connected_bss;
 	uint64_t now;
 	const struct scan_freq_set *freqs;
@@ -533,6 +631,7 @@ static bool bss_free_if_expired(void *data, void *user_data)
 			bss->time_stamp + SCAN_RESULT_BSS_RETENTION_TIME))
 		return false;
 
+	bss_index_remove(expiration_data->index, bss);
 	bss_free(bss);
 
 	return true;
@@ -542,6 +641,7 @@ static void station_bss_list_remove_expired_bsses(struct station *station,
 					const struct scan_freq_set *freqs)
 {
 	struct bss_expiration_data data = {
+		.index = station->bss_index,
 		.now = l_time_now(),
 		.connected_bss = station->connected_bss,
 		.freqs = freqs,
@@ -790,7 +890,7 @@ static bool station_owe_transition_results(int err, struct l_queue *bss_list,
 		l_debug("Adding OWE transition network "MAC" to %s",
 				MAC_STR(bss->addr), network_get_ssid(network));
 
-		l_queue_push_tail(station->bss_list, bss);
+		station_bss_list_add(station, bss);
 		network_bss_add(network, bss);
 
 		continue;
@@ -917,6 +1017,8 @@ void station_set_scan_results(struct station *station,
 {
 	const struct l_queue_entry *bss_entry;
 	struct network *network;
+	struct l_hashmap *new_index;
+	uint64_t start = l_time_now();
 
 	l_queue_foreach_remove(new_bss_list, bss_free_if_ssid_not_utf8, NULL);
 
@@ -930,13 +1032,21 @@ void station_set_scan_results(struct station *station,
 
 	station_bss_list_remove_expired_bsses(station, freqs);
 
+	new_index = bss_index_new();
+
+	for (bss_entry = l_queue_get_entries(new_bss_list); bss_entry;
+						bss_entry = bss_entry->next)
+		bss_index_add(new_index, bss_entry->data);
+
 	for (bss_entry = l_queue_get_entries(station->bss_list); bss_entry;
 						bss_entry = bss_entry->next) {
 		struct scan_bss *old_bss = bss_entry->data;
 		struct scan_bss *new_bss;
 
-		new_bss = l_queue_find(new_bss_list, bss_match, old_bss);
+		new_bss = l_hashmap_lookup(new_index, old_bss);
 		if (new_bss) {
+			scan_bss_rank_update_signal_trend(new_bss, old_bss);
+
 			if (old_bss == station->connected_bss)
 				station->connected_bss = new_bss;
 
@@ -951,9 +1061,17 @@ void station_set_scan_results(struct station *station,
 		}
 
 		l_queue_push_tail(new_bss_list, old_bss);
+		bss_index_add(new_index, old_bss);
 	}
 
 	l_queue_destroy(station->bss_list, NULL);
+	l_hashmap_destroy(station->bss_index, NULL);
+
+	/*
+	 * Sort once so that every network's BSS list can be built by simply
+	 * appending in rank order
+	 */
+	scan_bss_list_sort(new_bss_list);
 
 	for (bss_entry = l_queue_get_entries(new_bss_list); bss_entry;
 						bss_entry = bss_entry->next) {
@@ -971,6 +1089,13 @@ void station_set_scan_results(struct station *station,
 	}
 
 	station->bss_list = new_bss_list;
+	station->bss_index = new_index;
+
+	station->scan_merge_time = l_time_diff(start, l_time_now());
+	station->scan_merge_bss_count = l_queue_length(new_bss_list);
+
+	l_debug("Merged %u BSSes in %" PRIu64 " us",
+			station->scan_merge_bss_count, station->scan_merge_time);
 
 	l_hashmap_foreach_remove(station->networks, process_network, station);
 
@@ -1016,10 +1141,15 @@ static void station_handshake_event(struct handshake_state *hs,
 		break;
 	}
 	case HANDSHAKE_EVENT_COMPLETE:
+		if (!pmksa_disabled)
+			handshake_state_cache_pmksa(hs);
+
+		break;
 	case HANDSHAKE_EVENT_SETTING_KEYS_FAILED:
 	case HANDSHAKE_EVENT_EAP_NOTIFY:
 	case HANDSHAKE_EVENT_P2P_IP_REQUEST:
 	case HANDSHAKE_EVENT_REKEY_COMPLETE:
+	case HANDSHAKE_EVENT_GROUP_REKEY_COMPLETE:
 		/*
 		 * currently we don't care about any other events. The
 		 * netdev_connect_cb will notify us when the connection is
@@ -1236,6 +1366,62 @@ not_supported:
 	return -ENOTSUP;
 }
 
+/*
+ * If we hold a PMKSA for this BSS, advertise its PMKID in our RSNE so that
+ * the authenticator may skip straight to the 4-Way Handshake instead of a
+ * full EAP or SAE authentication.
+ */
+static void station_handshake_setup_pmksa(struct station *station,
+						struct handshake_state *hs,
+						struct scan_bss *bss)
+{
+	const uint8_t *spa = hs->spa;
+	struct ie_rsn_info info;
+	uint8_t rsne_buf[256];
+	struct pmksa *pmksa;
+
+	if (pmksa_disabled)
+		return;
+
+	if (!(hs->akm_suite & HANDSHAKE_PMKSA_AKMS) || hs->wpa_ie ||
+			hs->osen_ie)
+		return;
+
+	/* Offloading drivers manage PMKSAs on their own */
+	if (wiphy_can_offload(station->wiphy))
+		return;
+
+	/* Only set at this point if the address is being randomized */
+	if (l_memeqzero(spa, 6))
+		spa = netdev_get_address(station->netdev);
+
+	pmksa = pmksa_cache_get(spa, bss->addr, hs->ssid, hs->ssid_len,
+				hs->akm_suite);
+	if (!pmksa)
+		return;
+
+	if (ie_parse_rsne_from_data(hs->supplicant_ie,
+					hs->supplicant_ie[1] + 2, &info) < 0)
+		goto fail;
+
+	info.num_pmkids = 1;
+	info.pmkids = pmksa->pmkid;
+
+	if (!ie_build_rsne(&info, rsne_buf))
+		goto fail;
+
+	if (!handshake_state_set_supplicant_ie(hs, rsne_buf))
+		goto fail;
+
+	l_debug("Using cached PMKSA for "MAC, MAC_STR(bss->addr));
+
+	handshake_state_set_pmksa(hs, pmksa);
+	return;
+
+fail:
+	pmksa_cache_free(pmksa);
+}
+
 static struct handshake_state *station_handshake_setup(struct station *station,
 							struct network *network,
 							struct scan_bss *bss)
@@ -1259,6 +1445,8 @@ static struct handshake_state *station_handshake_setup(struct station *station,
 	if (network_handshake_setup(network, bss, hs) < 0)
 		goto not_supported;
 
+	station_handshake_setup_pmksa(station, hs, bss);
+
 	vendor_ies = network_info_get_extra_ies(info, bss, &iov_elems);
 	handshake_state_set_vendor_ies(hs, vendor_ies, iov_elems);
 
@@ -1279,6 +1467,8 @@ not_supported:
 	return NULL;
 }
 
+static void station_process_colocated_6ghz(struct station *station);
+
 static bool new_scan_results(int err, struct l_queue *bss_list,
 				const struct scan_freq_set *freqs,
 				void *userdata)
@@ -1293,6 +1483,7 @@ static bool new_scan_results(int err, struct l_queue *bss_list,
 	station_set_scan_results(station, bss_list, freqs, false);
 
 	station_process_owe_transition_networks(station);
+	station_process_colocated_6ghz(station);
 
 	station->autoconnect_can_start = true;
 	station_autoconnect_start(station);
@@ -1343,6 +1534,7 @@ static struct scan_freq_set *station_get_allowed_freqs(struct station *station)
 
 static uint32_t station_scan_trigger(struct station *station,
 					struct scan_freq_set *freqs,
+					uint32_t max_age,
 					scan_trigger_func_t triggered,
 					scan_notify_func_t notify,
 					scan_destroy_func_t destroy)
@@ -1353,6 +1545,7 @@ static uint32_t station_scan_trigger(struct station *station,
 	memset(&params, 0, sizeof(params));
 	params.flush = true;
 	params.freqs = freqs;
+	params.max_age = max_age;
 
 	if (wiphy_can_randomize_mac_addr(station->wiphy) ||
 			station->connected_bss ||
@@ -1369,6 +1562,216 @@ static uint32_t station_scan_trigger(struct station *station,
 					station, destroy);
 }
 
+struct station_colocated_data {
+	struct station *station;
+	struct scan_freq_set *allowed;
+	/* struct station_colocated_target, one per known network */
+	struct l_queue *targets;
+};
+
+struct station_colocated_target {
+	const struct network_info *info;
+	struct scan_freq_set *freqs;
+};
+
+struct station_short_ssid_match {
+	uint32_t short_ssid;
+	const struct network_info *info;
+};
+
+static bool station_known_network_short_ssid_match(
+					const struct network_info *info,
+					void *user_data)
+{
+	struct station_short_ssid_match *match = user_data;
+
+	if (info->is_hotspot)
+		return true;
+
+	if (util_ssid_short(strlen(info->ssid),
+				(const uint8_t *) info->ssid) !=
+			match->short_ssid)
+		return true;
+
+	match->info = info;
+	return false;
+}
+
+static bool station_colocated_target_match(const void *a, const void *b)
+{
+	const struct station_colocated_target *target = a;
+
+	return target->info == b;
+}
+
+static void station_colocated_target_free(void *data)
+{
+	struct station_colocated_target *target = data;
+
+	scan_freq_set_free(target->freqs);
+	l_free(target);
+}
+
+static void station_add_colocated_ap(const struct scan_colocated_ap *ap,
+					void *user_data)
+{
+	struct station_colocated_data *data = user_data;
+	struct station_short_ssid_match match = {};
+	struct station_colocated_target *target;
+	const struct l_queue_entry *entry;
+
+	if (!ap->short_ssid_present ||
+			!scan_freq_set_contains(data->allowed, ap->frequency))
+		return;
+
+	/* Already found by the last scan */
+	if (ap->bssid_present)
+		for (entry = l_queue_get_entries(data->station->bss_list);
+					entry; entry = entry->next) {
+			const struct scan_bss *bss = entry->data;
+
+			if (!memcmp(bss->addr, ap->bssid, 6))
+				return;
+		}
+
+	match.short_ssid = ap->short_ssid;
+	known_networks_foreach(station_known_network_short_ssid_match, &match);
+
+	if (!match.info)
+		return;
+
+	target = l_queue_find(data->targets, station_colocated_target_match,
+				match.info);
+	if (!target) {
+		target = l_new(struct station_colocated_target, 1);
+		target->info = match.info;
+		target->freqs = scan_freq_set_new();
+		l_queue_push_tail(data->targets, target);
+	}
+
+	scan_freq_set_add(target->freqs, ap->frequency);
+}
+
+/*
+ * Returns the 6 GHz channels of the known networks' APs advertised in the
+ * Reduced Neighbor Reports of the BSSes seen on the other bands, grouped
+ * per known network, or NULL if there are none
+ */
+static struct l_queue *station_get_colocated_6ghz_targets(
+							struct station *station)
+{
+	struct station_colocated_data data = { .station = station };
+
+	if (!(allowed_bands & BAND_FREQ_6_GHZ) ||
+			wiphy_band_is_disabled(station->wiphy,
+						BAND_FREQ_6_GHZ) == 1)
+		return NULL;
+
+	data.allowed = station_get_allowed_freqs(station);
+	if (!data.allowed)
+		return NULL;
+
+	data.targets = l_queue_new();
+	scan_colocated_6ghz_foreach(netdev_get_wdev_id(station->netdev),
+					station_add_colocated_ap, &data);
+	scan_freq_set_free(data.allowed);
+
+	if (l_queue_isempty(data.targets)) {
+		l_queue_destroy(data.targets, NULL);
+		return NULL;
+	}
+
+	return data.targets;
+}
+
+static bool station_colocated_scan_results(int err, struct l_queue *bss_list,
+					const struct scan_freq_set *freqs,
+					void *userdata)
+{
+	struct station *station = userdata;
+	bool can_start = station->autoconnect_can_start;
+
+	station_property_set_scanning(station, false);
+
+	l_queue_pop_head(station->colocated_scan_ids);
+
+	if (!err) {
+		l_debug("Found %u BSSes on co-located 6 GHz channels",
+				l_queue_length(bss_list));
+
+		station_set_scan_results(station, bss_list, freqs, false);
+		station->autoconnect_can_start = can_start;
+	}
+
+	station_autoconnect_start(station);
+
+	return err == 0;
+}
+
+static void station_colocated_scan_triggered(int err, void *user_data)
+{
+	struct station *station = user_data;
+
+	if (err < 0) {
+		l_debug("Co-located 6 GHz scan trigger failed: %i", err);
+
+		l_queue_pop_head(station->colocated_scan_ids);
+		station_autoconnect_start(station);
+		return;
+	}
+
+	l_debug("Co-located 6 GHz scan triggered");
+
+	station_property_set_scanning(station, true);
+}
+
+/*
+ * Rather than waiting for a full sweep of the 6 GHz band, directly probe
+ * the channels the APs of known networks were advertised on by the BSSes
+ * seen on the 2.4 and 5 GHz bands.  APs whose channel was just scanned, or
+ * which didn't answer recent probes, are left out by scan.c.
+ */
+static void station_process_colocated_6ghz(struct station *station)
+{
+	struct l_queue *targets;
+	struct station_colocated_target *target;
+
+	if (!l_queue_isempty(station->colocated_scan_ids))
+		return;
+
+	targets = station_get_colocated_6ghz_targets(station);
+	if (!targets)
+		return;
+
+	while ((target = l_queue_pop_head(targets))) {
+		struct scan_parameters params = {
+			.freqs = target->freqs,
+			.ssid = (const uint8_t *) target->info->ssid,
+			.ssid_len = strlen(target->info->ssid),
+			.randomize_mac_addr_hint = !station->connected_bss,
+		};
+		uint32_t id;
+
+		id = scan_active_full(netdev_get_wdev_id(station->netdev),
+					&params,
+					station_colocated_scan_triggered,
+					station_colocated_scan_results,
+					station, NULL);
+		station_colocated_target_free(target);
+
+		if (!id)
+			continue;
+
+		if (!station->colocated_scan_ids)
+			station->colocated_scan_ids = l_queue_new();
+
+		l_queue_push_tail(station->colocated_scan_ids,
+					L_UINT_TO_PTR(id));
+	}
+
+	l_queue_destroy(targets, NULL);
+}
+
 static bool station_quick_scan_results(int err, struct l_queue *bss_list,
 					const struct scan_freq_set *freqs,
 					void *userdata)
@@ -1383,6 +1786,7 @@ static bool station_quick_scan_results(int err, struct l_queue *bss_list,
 	station_set_scan_results(station, bss_list, freqs, false);
 
 	station_process_owe_transition_networks(station);
+	station_process_colocated_6ghz(station);
 
 	station->autoconnect_can_start = true;
 	station_autoconnect_start(station);
@@ -1423,10 +1827,16 @@ static void station_quick_scan_destroy(void *userdata)
 	station->quick_scan_id = 0;
 }
 
+/* Learned channels added to the quick scan */
+#define STATION_LEARNED_QUICK_SCAN_MAX	3
+
 static int station_quick_scan_trigger(struct station *station)
 {
 	_auto_(scan_freq_set_free) struct scan_freq_set *known_freq_set = NULL;
 	_auto_(scan_freq_set_free) struct scan_freq_set *allowed = NULL;
+	struct scan_freq_set *learned;
+	struct l_queue *colocated;
+	struct station_colocated_target *target;
 	bool known_6ghz;
 
 	if (wiphy_regdom_is_updating(station->wiphy)) {
@@ -1454,17 +1864,38 @@ static int station_quick_scan_trigger(struct station *station)
 			known_6ghz)
 		return -ENOTSUP;
 
+	/*
+	 * Also cover the channels known networks are usually found on here,
+	 * in case the network in range isn't one of the most recently used
+	 */
+	learned = known_networks_get_learned_frequencies(
+					STATION_LEARNED_QUICK_SCAN_MAX);
+	if (learned) {
+		scan_freq_set_merge(known_freq_set, learned);
+		scan_freq_set_free(learned);
+	}
+
 	allowed = station_get_allowed_freqs(station);
 	if (L_WARN_ON(!allowed))
 		return -ENOTSUP;
 
+	/* Include 6 GHz APs of known networks learned from earlier scans */
+	colocated = station_get_colocated_6ghz_targets(station);
+
+	while ((target = l_queue_pop_head(colocated))) {
+		scan_freq_set_merge(known_freq_set, target->freqs);
+		station_colocated_target_free(target);
+	}
+
+	l_queue_destroy(colocated, NULL);
+
 	scan_freq_set_constrain(known_freq_set, allowed);
 
 	if (scan_freq_set_isempty(known_freq_set))
 		return -ENOTSUP;
 
 	station->quick_scan_id = station_scan_trigger(station,
-						known_freq_set,
+						known_freq_set, 0,
 						station_quick_scan_triggered,
 						station_quick_scan_results,
 						station_quick_scan_destroy);
@@ -1501,48 +1932,320 @@ static const char *station_state_to_string(enum station_state state)
 		return "connecting (netconfig)";
 	}
 
-	return "invalid";
-}
+	return "invalid";
+}
+
+static void station_set_evict_nocarrier(struct station *station, bool value)
+{
+	char *v = value ? "1" : "0";
+
+	if (supports_arp_evict_nocarrier)
+		sysfs_write_ipv4_setting(netdev_get_name(station->netdev),
+					"arp_evict_nocarrier", v);
+
+	if (supports_ndisc_evict_nocarrier)
+		sysfs_write_ipv6_setting(netdev_get_name(station->netdev),
+					"ndisc_evict_nocarrier", v);
+}
+
+/*
+ * Handles dropping ARP (IPv4) and neighbor advertisements (IPv6) settings.
+ */
+static void station_set_drop_neighbor_discovery(struct station *station,
+						bool value)
+{
+	char *v = value ? "1" : "0";
+
+	sysfs_write_ipv4_setting(netdev_get_name(station->netdev),
+				"drop_gratuitous_arp", v);
+	sysfs_write_ipv6_setting(netdev_get_name(station->netdev),
+				"drop_unsolicited_na", v);
+}
+
+static void station_set_drop_unicast_l2_multicast(struct station *station,
+							bool value)
+{
+	char *v = value ? "1" : "0";
+
+	sysfs_write_ipv4_setting(netdev_get_name(station->netdev),
+				"drop_unicast_in_l2_multicast", v);
+	sysfs_write_ipv6_setting(netdev_get_name(station->netdev),
+				"drop_unicast_in_l2_multicast", v);
+}
+
+static void station_signal_agent_notify(struct station *station);
+
+/* How long the last connected BSS is trusted for a fast reconnect (s) */
+#define STATION_LAST_BSS_MAX_AGE	(7 * 24 * 3600)
+/* How often the Timestamp of an otherwise unchanged entry is refreshed */
+#define STATION_LAST_BSS_REFRESH	(24 * 3600)
+
+static bool station_last_bss_unchanged(const char *group, const char *bssid,
+					unsigned int frequency, const char *hex)
+{
+	const char *value;
+	unsigned int stored_frequency;
+	uint64_t timestamp;
+	uint64_t now = time(NULL);
+
+	value = l_settings_get_value(last_bss_state, group, "BSSID");
+	if (!value || strcmp(value, bssid))
+		return false;
+
+	value = l_settings_get_value(last_bss_state, group, "IEs");
+	if (!value || strcmp(value, hex))
+		return false;
+
+	if (!l_settings_get_uint(last_bss_state, group, "Frequency",
+					&stored_frequency) ||
+			stored_frequency != frequency)
+		return false;
+
+	if (!l_settings_get_uint64(last_bss_state, group, "Timestamp",
+					&timestamp))
+		return false;
+
+	return timestamp <= now && now - timestamp < STATION_LAST_BSS_REFRESH;
+}
+
+/*
+ * Saves the BSS just connected to, with the elements scan_bss keeps, so
+ * that the next startup or resume can reconnect without scanning first.
+ * Reconnecting or roaming back to the same BSS doesn't rewrite the file.
+ */
+static void station_save_last_bss(struct station *station)
+{
+	const struct scan_bss *bss = station->connected_bss;
+	struct network *network = station->connected_network;
+	const char *group = netdev_get_name(station->netdev);
+	const uint8_t *ies[] = {
+		bss->rsne, bss->rsnxe, bss->wpa, bss->osen, bss->rc_ie,
+	};
+	uint8_t buf[2 + 32 + 5 + L_ARRAY_SIZE(ies) * 257];
+	_auto_(l_free) char *hex = NULL;
+	size_t len = 0;
+	unsigned int i;
+
+	/* OWE transition BSSes are looked up by another SSID, don't bother */
+	if (!last_bss_state || bss->owe_trans)
+		return;
+
+	buf[len++] = IE_TYPE_SSID;
+	buf[len++] = bss->ssid_len;
+	memcpy(buf + len, bss->ssid, bss->ssid_len);
+	len += bss->ssid_len;
+
+	if (bss->mde_present) {
+		buf[len++] = IE_TYPE_MOBILITY_DOMAIN;
+		buf[len++] = 3;
+		memcpy(buf + len, bss->mde, 3);
+		len += 3;
+	}
+
+	for (i = 0; i < L_ARRAY_SIZE(ies); i++) {
+		if (!ies[i])
+			continue;
+
+		memcpy(buf + len, ies[i], ies[i][1] + 2);
+		len += ies[i][1] + 2;
+	}
+
+	hex = l_util_hexstring(buf, len);
+
+	if (station_last_bss_unchanged(group, util_address_to_string(bss->addr),
+					bss->frequency, hex))
+		return;
+
+	l_settings_remove_group(last_bss_state, group);
+	l_settings_set_string(last_bss_state, group, "SSID",
+				network_get_ssid(network));
+	l_settings_set_string(last_bss_state, group, "Security",
+			security_to_str(network_get_security(network)));
+	l_settings_set_string(last_bss_state, group, "BSSID",
+				util_address_to_string(bss->addr));
+	l_settings_set_uint(last_bss_state, group, "Frequency",
+				bss->frequency);
+	l_settings_set_uint(last_bss_state, group, "Capability",
+				bss->capability);
+	l_settings_set_int(last_bss_state, group, "SignalStrength",
+				bss->signal_strength);
+	l_settings_set_uint64(last_bss_state, group, "Timestamp", time(NULL));
+	l_settings_set_string(last_bss_state, group, "IEs", hex);
+
+	storage_last_bss_sync(last_bss_state);
+}
+
+static struct scan_bss *station_load_last_bss(struct station *station)
+{
+	const char *group = netdev_get_name(station->netdev);
+	_auto_(l_free) char *ssid = NULL;
+	_auto_(l_free) char *bssid = NULL;
+	_auto_(l_free) char *hex = NULL;
+	_auto_(l_free) uint8_t *ies = NULL;
+	_auto_(scan_freq_set_free) struct scan_freq_set *allowed = NULL;
+	size_t ies_len;
+	uint8_t addr[6];
+	unsigned int frequency;
+	unsigned int capability;
+	int signal_strength;
+	uint64_t timestamp;
+	uint64_t now = time(NULL);
+	struct scan_bss *bss;
+
+	if (!last_bss_state || !l_settings_has_group(last_bss_state, group))
+		return NULL;
+
+	if (!l_settings_get_uint64(last_bss_state, group, "Timestamp",
+					&timestamp) ||
+			timestamp > now ||
+			now - timestamp > STATION_LAST_BSS_MAX_AGE)
+		return NULL;
+
+	ssid = l_settings_get_string(last_bss_state, group, "SSID");
+	bssid = l_settings_get_string(last_bss_state, group, "BSSID");
+	hex = l_settings_get_string(last_bss_state, group, "IEs");
+
+	if (!ssid || !bssid || !hex || !util_string_to_address(bssid, addr))
+		return NULL;
+
+	if (!l_settings_get_uint(last_bss_state, group, "Frequency",
+					&frequency) ||
+			!l_settings_get_uint(last_bss_state, group,
+						"Capability", &capability) ||
+			!l_settings_get_int(last_bss_state, group,
+						"SignalStrength",
+						&signal_strength))
+		return NULL;
+
+	allowed = station_get_allowed_freqs(station);
+	if (!allowed || !scan_freq_set_contains(allowed, frequency))
+		return NULL;
+
+	ies = l_util_from_hexstring(hex, &ies_len);
+	if (!ies)
+		return NULL;
+
+	bss = scan_bss_new_from_ies(station->wiphy, addr, frequency,
+					capability, signal_strength,
+					ies, ies_len);
+	if (!bss)
+		return NULL;
+
+	if (bss->ssid_len != strlen(ssid) ||
+			memcmp(bss->ssid, ssid, bss->ssid_len)) {
+		scan_bss_free(bss);
+		return NULL;
+	}
+
+	return bss;
+}
+
+static void station_forget_last_bss(const struct network_info *info)
+{
+	char **groups;
+	unsigned int i;
+	bool changed = false;
+
+	if (!last_bss_state)
+		return;
+
+	groups = l_settings_get_groups(last_bss_state);
+
+	for (i = 0; groups[i]; i++) {
+		const char *ssid = l_settings_get_value(last_bss_state,
+							groups[i], "SSID");
+		const char *security = l_settings_get_value(last_bss_state,
+							groups[i], "Security");
+
+		if (!ssid || strcmp(ssid, info->ssid) || !security ||
+				strcmp(security, security_to_str(info->type)))
+			continue;
+
+		l_settings_remove_group(last_bss_state, groups[i]);
+		changed = true;
+	}
+
+	l_strv_free(groups);
+
+	if (changed)
+		storage_last_bss_sync(last_bss_state);
+}
+
+/*
+ * Connects straight to the BSS we were last connected to.  The kernel
+ * won't have it in its BSS cache yet, netdev takes care of that with a
+ * directed probe on the BSS's channel before authenticating.
+ */
+static int station_connect_last_bss(struct station *station)
+{
+	struct scan_bss *bss = station_load_last_bss(station);
+	struct network *network;
+	int r;
+
+	if (!bss)
+		return -ENOENT;
+
+	l_debug("Fast reconnect to %s, freq: %u",
+			util_address_to_string(bss->addr), bss->frequency);
+
+	network = station_get_bss_network(station, bss);
+	if (!network) {
+		scan_bss_free(bss);
+		return -ENOENT;
+	}
+
+	station_bss_list_add(station, bss);
+	network_bss_add(network, bss);
 
-static void station_set_evict_nocarrier(struct station *station, bool value)
-{
-	char *v = value ? "1" : "0";
+	r = network_autoconnect(network, bss);
+	if (r == 0)
+		return 0;
 
-	if (supports_arp_evict_nocarrier)
-		sysfs_write_ipv4_setting(netdev_get_name(station->netdev),
-					"arp_evict_nocarrier", v);
+	l_debug("Fast reconnect failed: %s (%d)", strerror(-r), -r);
 
-	if (supports_ndisc_evict_nocarrier)
-		sysfs_write_ipv6_setting(netdev_get_name(station->netdev),
-					"ndisc_evict_nocarrier", v);
+	/*
+	 * Don't leave the stored BSS, with its stale signal strength, around
+	 * for the quick scan results to be merged with
+	 */
+	network_bss_remove(network, bss);
+
+	if (network_bss_list_isempty(network)) {
+		l_hashmap_remove(station->networks, network_get_path(network));
+		network_remove(network, -ERANGE);
+	}
+
+	bss_index_remove(station->bss_index, bss);
+	l_queue_remove(station->bss_list, bss);
+	scan_bss_free(bss);
+
+	return r;
 }
 
 /*
- * Handles dropping ARP (IPv4) and neighbor advertisements (IPv6) settings.
+ * The quick scan is queued behind the connection attempt, which has a
+ * higher radio work priority, so that autoconnect can go on with its
+ * results if the fast reconnect fails
  */
-static void station_set_drop_neighbor_discovery(struct station *station,
-						bool value)
+static void station_fast_reconnect(struct station *station)
 {
-	char *v = value ? "1" : "0";
+	const char *group = netdev_get_name(station->netdev);
+	int ret;
 
-	sysfs_write_ipv4_setting(netdev_get_name(station->netdev),
-				"drop_gratuitous_arp", v);
-	sysfs_write_ipv6_setting(netdev_get_name(station->netdev),
-				"drop_unsolicited_na", v);
-}
+	ret = station_connect_last_bss(station);
 
-static void station_set_drop_unicast_l2_multicast(struct station *station,
-							bool value)
-{
-	char *v = value ? "1" : "0";
+	/* Don't retry a stored BSS we couldn't use until the next connection */
+	if (ret < 0 && ret != -ENOENT && ret != -EALREADY) {
+		l_settings_remove_group(last_bss_state, group);
+		storage_last_bss_sync(last_bss_state);
+	}
 
-	sysfs_write_ipv4_setting(netdev_get_name(station->netdev),
-				"drop_unicast_in_l2_multicast", v);
-	sysfs_write_ipv6_setting(netdev_get_name(station->netdev),
-				"drop_unicast_in_l2_multicast", v);
-}
+	ret = station_quick_scan_trigger(station);
+	if (ret == 0 || ret == -EAGAIN)
+		return;
 
-static void station_signal_agent_notify(struct station *station);
+	if (station->state == STATION_STATE_AUTOCONNECT_QUICK)
+		station_enter_state(station, STATION_STATE_AUTOCONNECT_FULL);
+}
 
 static void station_enter_state(struct station *station,
 						enum station_state state)
@@ -1550,6 +2253,7 @@ static void station_enter_state(struct station *station,
 	uint64_t id = netdev_get_wdev_id(station->netdev);
 	struct l_dbus *dbus = dbus_get_bus();
 	bool disconnected;
+	bool fast_reconnect = false;
 	int ret;
 
 	l_debug("Old State: %s, new state: %s",
@@ -1569,6 +2273,19 @@ static void station_enter_state(struct station *station,
 
 	switch (state) {
 	case STATION_STATE_AUTOCONNECT_QUICK:
+		/* Fast reconnect failed, the quick scan is still to come */
+		if (station->quick_scan_id)
+			break;
+
+		/* Attempted once the state change has been notified */
+		if (!station->fast_reconnect_tried && last_bss_state &&
+				l_settings_has_group(last_bss_state,
+					netdev_get_name(station->netdev))) {
+			station->fast_reconnect_tried = true;
+			fast_reconnect = true;
+			break;
+		}
+
 		ret = station_quick_scan_trigger(station);
 		if (ret == 0 || ret == -EAGAIN)
 			break;
@@ -1648,6 +2365,9 @@ static void station_enter_state(struct station *station,
 
 	WATCHLIST_NOTIFY(&station->state_watches,
 				station_state_watch_func_t, station->state);
+
+	if (fast_reconnect)
+		station_fast_reconnect(station);
 }
 
 enum station_state station_get_state(struct station *station)
@@ -2018,7 +2738,8 @@ static void station_disconnect_on_error_cb(struct netdev *netdev, bool success,
 	if (continue_autoconnect) {
 		if (station_autoconnect_next(station) < 0) {
 			l_debug("Nothing left on autoconnect list");
-			station_enter_state(station,
+			station_enter_state(station, station->quick_scan_id ?
+					STATION_STATE_AUTOCONNECT_QUICK :
 					STATION_STATE_AUTOCONNECT_FULL);
 		}
 
@@ -2102,6 +2823,8 @@ static void station_roamed(struct station *station)
 		station->roam_freqs = NULL;
 	}
 
+	station_save_last_bss(station);
+
 	if (station->connected_bss->cap_rm_neighbor_report) {
 		if (netdev_neighbor_report_req(station->netdev,
 					station_early_neighbor_report_cb) < 0)
@@ -2563,11 +3286,10 @@ static void station_update_roam_bss(struct station *station,
 					struct scan_bss *bss)
 {
 	struct network *network = station->connected_network;
-	struct scan_bss *old =
-		l_queue_remove_if(station->bss_list, bss_match, bss);
+	struct scan_bss *old = station_bss_list_remove(station, bss);
 
 	network_bss_update(network, bss);
-	l_queue_push_tail(station->bss_list, bss);
+	station_bss_list_add(station, bss);
 
 	if (old)
 		scan_bss_free(old);
@@ -3076,13 +3798,14 @@ static void station_event_roamed(struct station *station, struct scan_bss *new)
 	network_bss_update(station->connected_network, new);
 
 	/* Remove new BSS if it exists in past scan results */
-	stale = l_queue_remove_if(station->bss_list, bss_match, new);
+	stale = station_bss_list_remove(station, new);
 	if (stale)
 		scan_bss_free(stale);
 
 	station->connected_bss = new;
 
 	l_queue_insert(station->bss_list, new, scan_bss_rank_compare, NULL);
+	bss_index_add(station->bss_index, new);
 
 	station_roamed(station);
 }
@@ -3177,6 +3900,30 @@ try_next:
 static bool station_retry_with_status(struct station *station,
 					uint16_t status_code)
 {
+	/*
+	 * IEEE 802.11-2020 12.6.10.3 Cached PMKSAs and RSNA key management
+	 *
+	 * "If SAE authentication was used to establish the PMKSA, then the AP
+	 * shall reject (re)association by sending a (Re)Association Response
+	 * frame with status code STATUS_INVALID_PMKID. Note that this allows
+	 * the non-AP STA to fall back to full SAE authentication to establish
+	 * another PMKSA"
+	 *
+	 * The stale PMKSA was already taken out of the cache, so simply retry
+	 * the same BSS.
+	 */
+	if (status_code == MMPDU_STATUS_CODE_INVALID_PMKID &&
+			station->pmksa_offered) {
+		l_debug("PMKSA rejected by "MAC", retrying full authentication",
+				MAC_STR(station->connected_bss->addr));
+
+		if (__station_connect_network(station,
+					station->connected_network,
+					station->connected_bss,
+					station->state) == 0)
+			return true;
+	}
+
 	/*
 	 * Certain Auth/Assoc failures should not cause a timeout blacklist.
 	 * In these cases we want to only temporarily blacklist the BSS until
@@ -3219,7 +3966,18 @@ static void station_connect_ok(struct station *station)
 			l_warn("Could not request neighbor report");
 	}
 
+	/* Quick scan queued behind a fast reconnect is no longer needed */
+	if (station->quick_scan_id) {
+		scan_cancel(netdev_get_wdev_id(station->netdev),
+				station->quick_scan_id);
+		station->quick_scan_id = 0;
+		station_property_set_scanning(station, false);
+	}
+
+	station->fast_reconnect_tried = false;
+
 	network_connected(station->connected_network);
+	station_save_last_bss(station);
 
 	if (station->netconfig) {
 		if (hs->fils_ip_req_ie && hs->fils_ip_resp_ie) {
@@ -3322,7 +4080,8 @@ static void station_connect_cb(struct netdev *netdev, enum netdev_result result,
 	if (continue_autoconnect) {
 		if (station_autoconnect_next(station) < 0) {
 			l_debug("Nothing left on autoconnect list");
-			station_enter_state(station,
+			station_enter_state(station, station->quick_scan_id ?
+					STATION_STATE_AUTOCONNECT_QUICK :
 					STATION_STATE_AUTOCONNECT_FULL);
 		}
 
@@ -3496,6 +4255,7 @@ int __station_connect_network(struct station *station, struct network *network,
 
 	station->connected_bss = bss;
 	station->connected_network = network;
+	station->pmksa_offered = hs->have_pmksa;
 
 	if (station->state != state)
 		station_enter_state(station, state);
@@ -3658,7 +4418,7 @@ static bool station_hidden_network_scan_results(int err,
 		bss->time_stamp = 0;
 
 		if (station_add_seen_bss(station, bss)) {
-			l_queue_push_tail(station->bss_list, bss);
+			station_bss_list_add(station, bss);
 
 			continue;
 		}
@@ -4021,6 +4781,14 @@ static void station_dbus_scan_triggered(int err, void *user_data)
 }
 
 static bool station_dbus_scan_subset(struct station *station);
+static void station_free_scan_freq_subsets(struct station *station);
+static void station_fill_scan_freq_subsets(struct station *station);
+
+/*
+ * Scan() calls arriving in quick succession, e.g. from several network
+ * management clients, are answered from results this recent (in ms)
+ */
+#define STATION_DBUS_SCAN_MAX_AGE	3000
 
 static bool station_dbus_scan_results(int err, struct l_queue *bss_list,
 					const struct scan_freq_set *freqs,
@@ -4041,8 +4809,10 @@ static bool station_dbus_scan_results(int err, struct l_queue *bss_list,
 
 	station_set_scan_results(station, bss_list, freqs, false);
 
-	if (last_subset || !station_dbus_scan_subset(station))
+	if (last_subset || !station_dbus_scan_subset(station)) {
 		station_dbus_scan_done(station, true);
+		station_process_colocated_6ghz(station);
+	}
 
 	return true;
 }
@@ -4053,6 +4823,7 @@ static bool station_dbus_scan_subset(struct station *station)
 
 	station->dbus_scan_id = station_scan_trigger(station,
 						station->scan_freqs_order[idx],
+						STATION_DBUS_SCAN_MAX_AGE,
 						station_dbus_scan_triggered,
 						station_dbus_scan_results,
 						NULL);
@@ -4077,6 +4848,9 @@ static struct l_dbus_message *station_dbus_scan(struct l_dbus *dbus,
 				station_is_roaming(station))
 		return dbus_error_busy(message);
 
+	/* Follow what was learned about the channels since the last scan */
+	station_free_scan_freq_subsets(station);
+	station_fill_scan_freq_subsets(station);
 	station->dbus_scan_subset_idx = 0;
 
 	if (!station_dbus_scan_subset(station))
@@ -4403,67 +5177,101 @@ int station_hide_network(struct station *station, struct network *network)
 	return 0;
 }
 
-static void station_add_2_4ghz_freq(uint32_t freq, void *user_data)
+/* Learned channels scanned first by Scan(), besides the social channels */
+#define STATION_LEARNED_SUBSET_MAX	6
+struct station_band_subset {
+	struct scan_freq_set *freqs;
+	uint32_t hits;
+};
+
+static void station_add_channel_hits(uint32_t freq, void *user_data)
+{
+	uint32_t *hits = user_data;
+
+	*hits += known_networks_get_channel_hits(freq);
+}
+
+static void station_free_scan_freq_subsets(struct station *station)
 {
-	struct scan_freq_set *set = user_data;
+	unsigned int i;
 
-	/* exclude social channels added in initial scan request */
-	if (freq < 3000 && freq != 2412 && freq != 2437 && freq != 2462)
-		scan_freq_set_add(set, freq);
+	for (i = 0; i < L_ARRAY_SIZE(station->scan_freqs_order); i++) {
+		scan_freq_set_free(station->scan_freqs_order[i]);
+		station->scan_freqs_order[i] = NULL;
+	}
 }
 
 static void station_fill_scan_freq_subsets(struct station *station)
 {
+	static const uint32_t band_order[] = {
+		BAND_FREQ_5_GHZ, BAND_FREQ_6_GHZ, BAND_FREQ_2_4_GHZ,
+	};
 	const struct scan_freq_set *supported =
 				wiphy_get_supported_freqs(station->wiphy);
+	_auto_(scan_freq_set_free) struct scan_freq_set *allowed =
+				scan_freq_set_clone(supported, allowed_bands);
+	struct station_band_subset bands[L_ARRAY_SIZE(band_order)];
+	struct scan_freq_set *first = scan_freq_set_new();
+	struct scan_freq_set *learned;
 	unsigned int subset_idx = 0;
+	unsigned int n_bands = 0;
+	unsigned int i;
 
 	/*
-	 * Scan the 2.4GHz "social channels" first, 5GHz second, if supported,
-	 * all other 2.4GHz channels last.  To be refined as needed.
+	 * Scan the 2.4GHz "social channels" first, together with the channels
+	 * known networks were most often found on at this site.  The rest of
+	 * each band follows as a separate subset, the bands where known
+	 * networks were found the most going first.
 	 */
 	if (allowed_bands & BAND_FREQ_2_4_GHZ) {
-		station->scan_freqs_order[subset_idx] = scan_freq_set_new();
-		scan_freq_set_add(station->scan_freqs_order[subset_idx], 2412);
-		scan_freq_set_add(station->scan_freqs_order[subset_idx], 2437);
-		scan_freq_set_add(station->scan_freqs_order[subset_idx], 2462);
-		subset_idx++;
+		scan_freq_set_add(first, 2412);
+		scan_freq_set_add(first, 2437);
+		scan_freq_set_add(first, 2462);
 	}
 
-	/*
-	 * TODO: It may might sense to split up 5 and 6ghz into separate subsets
-	 *       since the channel set is so large.
-	 */
-	if (allowed_bands & (BAND_FREQ_5_GHZ | BAND_FREQ_6_GHZ)) {
-		uint32_t mask = allowed_bands &
-					(BAND_FREQ_5_GHZ | BAND_FREQ_6_GHZ);
-		struct scan_freq_set *set = scan_freq_set_clone(supported,
-								mask);
+	learned = known_networks_get_learned_frequencies(
+						STATION_LEARNED_SUBSET_MAX);
+	if (learned) {
+		scan_freq_set_merge(first, learned);
+		scan_freq_set_free(learned);
+	}
+
+	scan_freq_set_constrain(first, allowed);
+
+	for (i = 0; i < L_ARRAY_SIZE(band_order); i++) {
+		struct scan_freq_set *set;
+		uint32_t hits = 0;
+		unsigned int j;
+
+		if (!(allowed_bands & band_order[i]))
+			continue;
+
+		set = scan_freq_set_clone(supported, band_order[i]);
+		scan_freq_set_subtract(set, first);
 
-		/* 5/6ghz didn't add any frequencies */
 		if (scan_freq_set_isempty(set)) {
 			scan_freq_set_free(set);
-		} else
-			station->scan_freqs_order[subset_idx++] = set;
-	}
+			continue;
+		}
 
-	/* Add remaining 2.4ghz channels to subset */
-	if (allowed_bands & BAND_FREQ_2_4_GHZ) {
-		station->scan_freqs_order[subset_idx] = scan_freq_set_new();
-		scan_freq_set_foreach(supported, station_add_2_4ghz_freq,
-					station->scan_freqs_order[subset_idx]);
+		scan_freq_set_foreach(set, station_add_channel_hits, &hits);
+
+		/* Insertion sort, ties keep the default band order */
+		for (j = n_bands; j && bands[j - 1].hits < hits; j--)
+			bands[j] = bands[j - 1];
+
+		bands[j].freqs = set;
+		bands[j].hits = hits;
+		n_bands++;
 	}
 
-	/*
-	 * This has the unintended consequence of allowing DBus scans to
-	 * scan the entire spectrum rather than cause IWD to be completely
-	 * non-functional. Rather than prevent DBus scans from working at all
-	 * print a warning here.
-	 */
-	if (station->scan_freqs_order[0] == NULL)
-		l_warn("All supported bands were disabled by user! IWD will not"
-			" function as expected");
+	if (scan_freq_set_isempty(first))
+		scan_freq_set_free(first);
+	else
+		station->scan_freqs_order[subset_idx++] = first;
 
+	for (i = 0; i < n_bands; i++)
+		station->scan_freqs_order[subset_idx++] = bands[i].freqs;
 }
 
 static void station_wiphy_watch(struct wiphy *wiphy,
@@ -4505,6 +5313,7 @@ static struct station *station_create(struct netdev *netdev)
 	watchlist_init(&station->state_watches, NULL);
 
 	station->bss_list = l_queue_new();
+	station->bss_index = bss_index_new();
 	station->hidden_bss_list_sorted = l_queue_new();
 	station->networks = l_hashmap_new();
 	l_hashmap_set_hash_function(station->networks, l_str_hash);
@@ -4531,6 +5340,16 @@ static struct station *station_create(struct netdev *netdev)
 
 	station_fill_scan_freq_subsets(station);
 
+	/*
+	 * This has the unintended consequence of allowing DBus scans to
+	 * scan the entire spectrum rather than cause IWD to be completely
+	 * non-functional. Rather than prevent DBus scans from working at all
+	 * print a warning here.
+	 */
+	if (station->scan_freqs_order[0] == NULL)
+		l_warn("All supported bands were disabled by user! IWD will not"
+			" function as expected");
+
 	if (iwd_is_developer_mode()) {
 		l_dbus_object_add_interface(dbus,
 					netdev_get_path(station->netdev),
@@ -4612,10 +5431,21 @@ static void station_free(struct station *station)
 		l_queue_destroy(station->owe_hidden_scan_ids, NULL);
 	}
 
+	if (station->colocated_scan_ids) {
+		void *ptr;
+
+		while ((ptr = l_queue_pop_head(station->colocated_scan_ids)))
+			scan_cancel(netdev_get_wdev_id(station->netdev),
+					L_PTR_TO_UINT(ptr));
+
+		l_queue_destroy(station->colocated_scan_ids, NULL);
+	}
+
 	station_roam_state_clear(station);
 
 	l_queue_destroy(station->networks_sorted, NULL);
 	l_hashmap_destroy(station->networks, network_free);
+	l_hashmap_destroy(station->bss_index, NULL);
 	l_queue_destroy(station->bss_list, bss_free);
 	l_queue_destroy(station->hidden_bss_list_sorted, NULL);
 	l_queue_destroy(station->autoconnect_list, NULL);
@@ -4624,11 +5454,7 @@ static void station_free(struct station *station)
 
 	l_queue_destroy(station->anqp_pending, remove_anqp);
 
-	scan_freq_set_free(station->scan_freqs_order[0]);
-	scan_freq_set_free(station->scan_freqs_order[1]);
-
-	if (station->scan_freqs_order[2])
-		scan_freq_set_free(station->scan_freqs_order[2]);
+	station_free_scan_freq_subsets(station);
 
 	wiphy_state_watch_remove(station->wiphy, station->wiphy_watch);
 
@@ -5064,7 +5890,7 @@ static struct l_dbus_message *station_debug_scan(struct l_dbus *dbus,
 		l_debug("added frequency %u", freqs[i]);
 	}
 
-	station->dbus_scan_id = station_scan_trigger(station, freq_set,
+	station->dbus_scan_id = station_scan_trigger(station, freq_set, 0,
 						station_debug_scan_triggered,
 						station_debug_scan_results,
 						NULL);
@@ -5203,6 +6029,188 @@ done:
 	return reply;
 }
 
+static struct l_dbus_message *station_debug_get_scan_statistics(
+						struct l_dbus *dbus,
+						struct l_dbus_message *message,
+						void *user_data)
+{
+	struct station *station = user_data;
+	struct l_dbus_message *reply =
+				l_dbus_message_new_method_return(message);
+	struct l_dbus_message_builder *builder =
+				l_dbus_message_builder_new(reply);
+	uint32_t networks = l_queue_length(station->networks_sorted);
+
+	l_dbus_message_builder_enter_array(builder, "{sv}");
+
+	dbus_append_dict_basic(builder, "MergeTime", 't',
+					&station->scan_merge_time);
+	dbus_append_dict_basic(builder, "BSSCount", 'u',
+					&station->scan_merge_bss_count);
+	dbus_append_dict_basic(builder, "NetworkCount", 'u', &networks);
+
+	l_dbus_message_builder_leave_array(builder);
+
+	l_dbus_message_builder_finalize(builder);
+	l_dbus_message_builder_destroy(builder);
+
+	return reply;
+}
+
+static void station_append_scan_stats(const struct scan_stats *stats,
+					void *user_data)
+{
+	struct l_dbus_message_builder *builder = user_data;
+	uint32_t i;
+
+	l_dbus_message_builder_enter_array(builder, "{sv}");
+
+	dbus_append_dict_basic(builder, "Id", 'u', &stats->id);
+	dbus_append_dict_basic(builder, "Passive", 'b', &stats->passive);
+	dbus_append_dict_basic(builder, "Cached", 'b', &stats->cached);
+	dbus_append_dict_basic(builder, "Result", 'i', &stats->result);
+	dbus_append_dict_basic(builder, "QueueTime", 't', &stats->queue_time);
+	dbus_append_dict_basic(builder, "Latency", 't', &stats->latency);
+	dbus_append_dict_basic(builder, "BSSCount", 'u', &stats->num_bss);
+	dbus_append_dict_basic(builder, "Retries", 'u', &stats->retries);
+
+	l_dbus_message_builder_enter_dict(builder, "sv");
+	l_dbus_message_builder_append_basic(builder, 's', "Segments");
+	l_dbus_message_builder_enter_variant(builder, "a(ut)");
+	l_dbus_message_builder_enter_array(builder, "(ut)");
+
+	for (i = 0; i < stats->num_segments; i++) {
+		l_dbus_message_builder_enter_struct(builder, "ut");
+		l_dbus_message_builder_append_basic(builder, 'u',
+					&stats->segments[i].num_freqs);
+		l_dbus_message_builder_append_basic(builder, 't',
+					&stats->segments[i].duration);
+		l_dbus_message_builder_leave_struct(builder);
+	}
+
+	l_dbus_message_builder_leave_array(builder);
+	l_dbus_message_builder_leave_variant(builder);
+	l_dbus_message_builder_leave_dict(builder);
+
+	l_dbus_message_builder_leave_array(builder);
+}
+
+static struct l_dbus_message *station_debug_get_scan_history(
+						struct l_dbus *dbus,
+						struct l_dbus_message *message,
+						void *user_data)
+{
+	struct station *station = user_data;
+	struct l_dbus_message *reply =
+				l_dbus_message_new_method_return(message);
+	struct l_dbus_message_builder *builder =
+				l_dbus_message_builder_new(reply);
+
+	l_dbus_message_builder_enter_array(builder, "a{sv}");
+	scan_stats_foreach(netdev_get_wdev_id(station->netdev),
+				station_append_scan_stats, builder);
+	l_dbus_message_builder_leave_array(builder);
+
+	l_dbus_message_builder_finalize(builder);
+	l_dbus_message_builder_destroy(builder);
+
+	return reply;
+}
+
+static void station_append_scan_pool(const struct scan_pool_stats *stats,
+					void *user_data)
+{
+	struct l_dbus_message_builder *builder = user_data;
+	uint32_t object_size = stats->object_size;
+
+	l_dbus_message_builder_enter_dict(builder, "sa{sv}");
+	l_dbus_message_builder_append_basic(builder, 's', stats->name);
+	l_dbus_message_builder_enter_array(builder, "{sv}");
+
+	dbus_append_dict_basic(builder, "ObjectSize", 'u', &object_size);
+	dbus_append_dict_basic(builder, "InUse", 'u', &stats->in_use);
+	dbus_append_dict_basic(builder, "Peak", 'u', &stats->peak);
+	dbus_append_dict_basic(builder, "Cached", 'u', &stats->cached);
+	dbus_append_dict_basic(builder, "Hits", 't', &stats->hits);
+	dbus_append_dict_basic(builder, "Misses", 't', &stats->misses);
+
+	l_dbus_message_builder_leave_array(builder);
+	l_dbus_message_builder_leave_dict(builder);
+}
+
+static struct l_dbus_message *station_debug_get_scan_pools(
+						struct l_dbus *dbus,
+						struct l_dbus_message *message,
+						void *user_data)
+{
+	struct l_dbus_message *reply =
+				l_dbus_message_new_method_return(message);
+	struct l_dbus_message_builder *builder =
+				l_dbus_message_builder_new(reply);
+
+	l_dbus_message_builder_enter_array(builder, "{sa{sv}}");
+	scan_pool_stats_foreach(station_append_scan_pool, builder);
+	l_dbus_message_builder_leave_array(builder);
+
+	l_dbus_message_builder_finalize(builder);
+	l_dbus_message_builder_destroy(builder);
+
+	return reply;
+}
+
+static void station_append_pmksa(const struct pmksa *pmksa, void *user_data)
+{
+	struct l_dbus_message_builder *builder = user_data;
+	uint64_t now = l_time_now();
+	uint32_t expires_in = 0;
+	_auto_(l_free) char *pmkid = l_util_hexstring(pmksa->pmkid, 16);
+
+	if (l_time_after(pmksa->expiration, now))
+		expires_in = l_time_to_secs(l_time_diff(pmksa->expiration, now));
+
+	l_dbus_message_builder_enter_array(builder, "{sv}");
+
+	dbus_append_dict_basic(builder, "Address", 's',
+				util_address_to_string(pmksa->aa));
+	station_append_byte_array(builder, "SSID", pmksa->ssid,
+					pmksa->ssid_len);
+	dbus_append_dict_basic(builder, "AKM", 'u', &pmksa->akm);
+	dbus_append_dict_basic(builder, "PMKID", 's', pmkid);
+	dbus_append_dict_basic(builder, "ExpiresIn", 'u', &expires_in);
+
+	l_dbus_message_builder_leave_array(builder);
+}
+
+static struct l_dbus_message *station_debug_get_pmksa_cache(
+						struct l_dbus *dbus,
+						struct l_dbus_message *message,
+						void *user_data)
+{
+	struct l_dbus_message *reply =
+				l_dbus_message_new_method_return(message);
+	struct l_dbus_message_builder *builder =
+				l_dbus_message_builder_new(reply);
+
+	l_dbus_message_builder_enter_array(builder, "a{sv}");
+	pmksa_cache_foreach(station_append_pmksa, builder);
+	l_dbus_message_builder_leave_array(builder);
+
+	l_dbus_message_builder_finalize(builder);
+	l_dbus_message_builder_destroy(builder);
+
+	return reply;
+}
+
+static struct l_dbus_message *station_debug_flush_pmksa_cache(
+						struct l_dbus *dbus,
+						struct l_dbus_message *message,
+						void *user_data)
+{
+	l_debug("Flushed %d PMKSA cache entries", pmksa_cache_flush());
+
+	return l_dbus_message_new_method_return(message);
+}
+
 static void station_setup_debug_interface(
 					struct l_dbus_interface *interface)
 {
@@ -5218,6 +6226,20 @@ static void station_setup_debug_interface(
 	l_dbus_interface_method(interface, "GetNetworks", 0,
 				station_debug_get_networks, "a{oaa{sv}}", "",
 				"networks");
+	l_dbus_interface_method(interface, "GetScanStatistics", 0,
+				station_debug_get_scan_statistics, "a{sv}", "",
+				"statistics");
+	l_dbus_interface_method(interface, "GetScanHistory", 0,
+				station_debug_get_scan_history, "aa{sv}", "",
+				"scans");
+	l_dbus_interface_method(interface, "GetScanPools", 0,
+				station_debug_get_scan_pools, "a{sa{sv}}", "",
+				"pools");
+	l_dbus_interface_method(interface, "GetPmksaCache", 0,
+				station_debug_get_pmksa_cache, "aa{sv}", "",
+				"entries");
+	l_dbus_interface_method(interface, "FlushPmksaCache", 0,
+				station_debug_flush_pmksa_cache, "", "");
 
 	l_dbus_interface_signal(interface, "Event", 0, "sav", "name", "data");
 
@@ -5294,6 +6316,8 @@ static void station_known_networks_changed(enum known_networks_event event,
 	if (event != KNOWN_NETWORKS_EVENT_REMOVED)
 		return;
 
+	station_forget_last_bss(info);
+
 	if (info->type != SECURITY_8021X)
 		return;
 
@@ -5356,6 +6380,12 @@ static int station_init(void)
 				&anqp_disabled))
 		anqp_disabled = true;
 
+	if (!l_settings_get_bool(iwd_get_config(), "General", "DisablePMKSA",
+				&pmksa_disabled))
+		pmksa_disabled = false;
+
+	__pmksa_set_config(iwd_get_config());
+
 	if (!netconfig_enabled())
 		l_info("station: Network configuration is disabled.");
 
@@ -5368,6 +6398,7 @@ static int station_init(void)
 
 	eap_tls_set_session_cache_ops(storage_eap_tls_cache_load,
 					storage_eap_tls_cache_sync);
+	last_bss_state = storage_last_bss_load();
 	known_networks_watch = known_networks_watch_add(
 						station_known_networks_changed,
 						NULL, NULL);
@@ -5389,6 +6420,8 @@ static void station_exit(void)
 	watchlist_destroy(&event_watches);
 	known_networks_watch_remove(known_networks_watch);
 	known_networks_watch = 0;
+	l_settings_free(last_bss_state);
+	last_bss_state = NULL;
 }
 
 IWD_MODULE(station, station_init, station_exit)
@@ -5397,3 +6430,4 @@ IWD_MODULE_DEPENDS(station, netdev);
 IWD_MODULE_DEPENDS(station, netconfig);
 IWD_MODULE_DEPENDS(station, frame_xchg);
 IWD_MODULE_DEPENDS(station, wiphy);
+IWD_MODULE_DEPENDS(station, pmksa);
@@ -54,6 +54,7 @@
 
 #define KNOWN_FREQ_FILENAME ".known_network.freq"
 #define EAP_TLS_CACHE_FILENAME ".eap-tls-session-cache"
+#define LAST_BSS_FILENAME ".last_bss"
 
 static char *storage_path = NULL;
 static char *storage_hotspot_path = NULL;
@@ -702,6 +703,29 @@ void storage_known_frequencies_sync(struct l_settings *known_freqs)
 	l_free(known_freq_file_path);
 }
 
+struct l_settings *storage_last_bss_load(void)
+{
+	_auto_(l_free) char *path =
+		storage_get_path("/%s", LAST_BSS_FILENAME);
+	struct l_settings *last_bss = l_settings_new();
+
+	if (!l_settings_load_from_file(last_bss, path))
+		l_debug("No last BSS state loaded from %s", path);
+
+	return last_bss;
+}
+
+void storage_last_bss_sync(const struct l_settings *last_bss)
+{
+	_auto_(l_free) char *path =
+		storage_get_path("/%s", LAST_BSS_FILENAME);
+	_auto_(l_free) char *data = NULL;
+	size_t len;
+
+	data = l_settings_to_data(last_bss, &len);
+	write_file(data, len, false, "%s", path);
+}
+
 struct l_settings *storage_eap_tls_cache_load(void)
 {
 	_auto_(l_free) char *path =
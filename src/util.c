@@ -106,6 +106,26 @@ bool util_ssid_is_hidden(size_t len, const uint8_t *ssid)
 	return l_memeqzero(ssid, len);
 }
 
+/*
+ * The Short SSID is the CRC-32 of the SSID, computed the same way as the
+ * FCS (IEEE 802.11-2020 Section 9.4.2.170.2)
+ */
+uint32_t util_ssid_short(size_t len, const uint8_t *ssid)
+{
+	uint32_t crc = 0xffffffff;
+	size_t i;
+	int j;
+
+	for (i = 0; i < len; i++) {
+		crc ^= ssid[i];
+
+		for (j = 0; j < 8; j++)
+			crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+	}
+
+	return ~crc;
+}
+
 const char *util_address_to_string(const uint8_t *addr)
 {
 	static char str[18];
@@ -116,6 +136,26 @@ const char *util_address_to_string(const uint8_t *addr)
 	return str;
 }
 
+/*
+ * 32-bit FNV-1a, for hashmaps keyed by addresses and the like.  @hash is
+ * UTIL_HASH_INIT or the result of a previous call, to hash several fields.
+ */
+unsigned int util_hash_bytes(unsigned int hash, const void *data, size_t len)
+{
+	const uint8_t *bytes = data;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		hash = (hash ^ bytes[i]) * 16777619u;
+
+	return hash;
+}
+
+unsigned int util_address_hash(const uint8_t *addr)
+{
+	return util_hash_bytes(UTIL_HASH_INIT, addr, 6);
+}
+
 bool util_string_to_address(const char *str, uint8_t *out_addr)
 {
 	unsigned int i;
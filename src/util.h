@@ -39,12 +39,18 @@
 const char *util_ssid_to_utf8(size_t len, const uint8_t *ssid);
 bool util_ssid_is_utf8(size_t len, const uint8_t *ssid);
 bool util_ssid_is_hidden(size_t len, const uint8_t *ssid);
+uint32_t util_ssid_short(size_t len, const uint8_t *ssid);
 const char *util_address_to_string(const uint8_t *addr);
 bool util_string_to_address(const char *str, uint8_t *addr);
 bool util_is_group_address(const uint8_t *addr);
 bool util_is_broadcast_address(const uint8_t *addr);
 bool util_is_valid_sta_address(const uint8_t *addr);
 
+#define UTIL_HASH_INIT 2166136261u
+
+unsigned int util_hash_bytes(unsigned int hash, const void *data, size_t len);
+unsigned int util_address_hash(const uint8_t *addr);
+
 const char *util_get_domain(const char *identity);
 const char *util_get_username(const char *identity);
 
@@ -112,6 +112,11 @@ struct wiphy {
 	uint32_t feature_flags;
 	uint8_t ext_features[(NUM_NL80211_EXT_FEATURES + 7) / 8];
 	uint8_t max_num_ssids_per_scan;
+	uint8_t max_num_sched_scan_ssids;
+	uint8_t max_match_sets;
+	uint32_t max_sched_scan_plans;
+	uint32_t max_sched_scan_plan_interval;
+	uint32_t max_sched_scan_plan_iterations;
 	uint32_t max_roc_duration;
 	uint16_t max_scan_ie_len;
 	uint16_t supported_iftypes;
@@ -661,6 +666,36 @@ uint16_t wiphy_get_max_scan_ie_len(struct wiphy *wiphy)
 	return wiphy->max_scan_ie_len;
 }
 
+bool wiphy_supports_sched_scan(struct wiphy *wiphy)
+{
+	return wiphy->support_scheduled_scan;
+}
+
+uint8_t wiphy_get_max_num_sched_scan_ssids(struct wiphy *wiphy)
+{
+	return wiphy->max_num_sched_scan_ssids;
+}
+
+uint8_t wiphy_get_max_match_sets(struct wiphy *wiphy)
+{
+	return wiphy->max_match_sets;
+}
+
+uint32_t wiphy_get_max_sched_scan_plans(struct wiphy *wiphy)
+{
+	return wiphy->max_sched_scan_plans;
+}
+
+uint32_t wiphy_get_max_sched_scan_plan_interval(struct wiphy *wiphy)
+{
+	return wiphy->max_sched_scan_plan_interval;
+}
+
+uint32_t wiphy_get_max_sched_scan_plan_iterations(struct wiphy *wiphy)
+{
+	return wiphy->max_sched_scan_plan_iterations;
+}
+
 uint32_t wiphy_get_max_roc_duration(struct wiphy *wiphy)
 {
 	return wiphy->max_roc_duration;
@@ -1848,6 +1883,44 @@ static void wiphy_parse_attributes(struct wiphy *wiphy,
 			else
 				wiphy->max_scan_ie_len = *((uint16_t *) data);
 			break;
+		case NL80211_ATTR_MAX_NUM_SCHED_SCAN_SSIDS:
+			if (len != sizeof(uint8_t))
+				l_warn("Invalid MAX_NUM_SCHED_SCAN_SSIDS "
+					"attribute");
+			else
+				wiphy->max_num_sched_scan_ssids =
+							*((uint8_t *) data);
+			break;
+		case NL80211_ATTR_MAX_MATCH_SETS:
+			if (len != sizeof(uint8_t))
+				l_warn("Invalid MAX_MATCH_SETS attribute");
+			else
+				wiphy->max_match_sets = *((uint8_t *) data);
+			break;
+		case NL80211_ATTR_MAX_NUM_SCHED_SCAN_PLANS:
+			if (len != sizeof(uint32_t))
+				l_warn("Invalid MAX_NUM_SCHED_SCAN_PLANS "
+					"attribute");
+			else
+				wiphy->max_sched_scan_plans =
+							*((uint32_t *) data);
+			break;
+		case NL80211_ATTR_MAX_SCAN_PLAN_INTERVAL:
+			if (len != sizeof(uint32_t))
+				l_warn("Invalid MAX_SCAN_PLAN_INTERVAL "
+					"attribute");
+			else
+				wiphy->max_sched_scan_plan_interval =
+							*((uint32_t *) data);
+			break;
+		case NL80211_ATTR_MAX_SCAN_PLAN_ITERATIONS:
+			if (len != sizeof(uint32_t))
+				l_warn("Invalid MAX_SCAN_PLAN_ITERATIONS "
+					"attribute");
+			else
+				wiphy->max_sched_scan_plan_iterations =
+							*((uint32_t *) data);
+			break;
 		case NL80211_ATTR_SUPPORTED_IFTYPES:
 			if (l_genl_attr_recurse(&attr, &nested))
 				parse_supported_iftypes(wiphy, &nested);
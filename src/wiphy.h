@@ -122,6 +122,12 @@ bool wiphy_has_feature(struct wiphy *wiphy, uint32_t feature);
 bool wiphy_has_ext_feature(struct wiphy *wiphy, uint32_t feature);
 uint8_t wiphy_get_max_num_ssids_per_scan(struct wiphy *wiphy);
 uint16_t wiphy_get_max_scan_ie_len(struct wiphy *wiphy);
+bool wiphy_supports_sched_scan(struct wiphy *wiphy);
+uint8_t wiphy_get_max_num_sched_scan_ssids(struct wiphy *wiphy);
+uint8_t wiphy_get_max_match_sets(struct wiphy *wiphy);
+uint32_t wiphy_get_max_sched_scan_plans(struct wiphy *wiphy);
+uint32_t wiphy_get_max_sched_scan_plan_interval(struct wiphy *wiphy);
+uint32_t wiphy_get_max_sched_scan_plan_iterations(struct wiphy *wiphy);
 uint32_t wiphy_get_max_roc_duration(struct wiphy *wiphy);
 bool wiphy_supports_iftype(struct wiphy *wiphy, uint32_t iftype);
 const uint8_t *wiphy_get_supported_rates(struct wiphy *wiphy,
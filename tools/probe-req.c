@@ -26,11 +26,16 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <signal.h>
+#include <getopt.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
 #include <net/if.h>
 #include <netinet/in.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
 #include <unistd.h>
 
 #include <ell/ell.h>
@@ -39,6 +44,7 @@
 
 #include "src/mpdu.h"
 #include "src/nl80211util.h"
+#include "src/util.h"
 
 static struct l_genl *genl;
 static struct l_genl_family *nl80211;
@@ -209,6 +215,578 @@ static void get_interface_done(void *user_data)
 	}
 }
 
+/*
+ * Load generator mode: inject Probe, Authentication and Association
+ * Requests from many source addresses through a monitor interface, e.g.
+ * one added to a mac80211_hwsim radio on the AP's channel, and time the
+ * responses received on the same interface.  nl80211 CMD_FRAME can't be
+ * used for this since it only allows our own address as the TA.
+ */
+#define LOAD_TICK_MS		5
+#define LOAD_MAX_STAS		65536
+
+enum load_frame {
+	LOAD_FRAME_PROBE,
+	LOAD_FRAME_AUTH,
+	LOAD_FRAME_ASSOC,
+	LOAD_FRAME_COUNT,
+};
+
+enum load_step {
+	LOAD_STEP_IDLE,
+	LOAD_STEP_PROBE,
+	LOAD_STEP_AUTH,
+	LOAD_STEP_ASSOC_AUTH,
+	LOAD_STEP_ASSOC,
+};
+
+struct load_stats {
+	const char *name;
+	unsigned int sent;
+	unsigned int answered;
+	unsigned int failed;
+	unsigned int lost;
+	uint32_t *samples;
+	unsigned int n_samples;
+	unsigned int samples_size;
+};
+
+struct load_sta {
+	uint8_t addr[6];
+	enum load_frame frame;
+	enum load_step step;
+	uint64_t sent_time;
+};
+
+static const char *load_ifname;
+static unsigned int load_rate = 100;
+static unsigned int load_duration = 10;
+static unsigned int load_n_stas = 256;
+static unsigned int load_timeout_ms = 1000;
+static uint8_t load_bssid[6];
+static bool load_have_bssid;
+static const char *load_ssid;
+static bool load_keep;
+static enum load_frame load_frames[LOAD_FRAME_COUNT];
+static unsigned int load_n_frames;
+
+static struct l_io *load_io;
+static struct l_timeout *load_timer;
+static struct load_sta *load_stas;
+static struct load_stats load_stats[LOAD_FRAME_COUNT] = {
+	[LOAD_FRAME_PROBE] = { .name = "probe" },
+	[LOAD_FRAME_AUTH] = { .name = "auth" },
+	[LOAD_FRAME_ASSOC] = { .name = "assoc" },
+};
+static uint64_t load_start_time;
+static uint64_t load_total;
+static unsigned int load_tx_errors;
+static uint16_t load_seq;
+static bool load_draining;
+
+static const uint8_t load_rates_ies[] = {
+	/* Supported Rates */
+	0x01, 0x08, 0x82, 0x84, 0x8b, 0x96, 0x0c, 0x12, 0x18, 0x24,
+	/* Extended Supported Rates */
+	0x32, 0x04, 0x30, 0x48, 0x60, 0x6c,
+};
+
+static const uint8_t load_rsne[] = {
+	/* RSN, WPA2-PSK, CCMP */
+	0x30, 0x14, 0x01, 0x00, 0x00, 0x0f, 0xac, 0x04, 0x01, 0x00,
+	0x00, 0x0f, 0xac, 0x04, 0x01, 0x00, 0x00, 0x0f, 0xac, 0x02,
+	0x00, 0x00,
+};
+
+static bool load_tx(uint8_t *frame, size_t len)
+{
+	/* Minimal radiotap header: version 0, length 8, no fields present */
+	uint8_t buf[8 + len];
+
+	memset(buf, 0, 8);
+	buf[2] = 8;
+	memcpy(buf + 8, frame, len);
+
+	if (send(l_io_get_fd(load_io), buf, sizeof(buf), 0) < 0) {
+		load_tx_errors++;
+		return false;
+	}
+
+	return true;
+}
+
+static size_t load_build_header(uint8_t *buf,
+					enum mpdu_management_subtype subtype,
+					const uint8_t *da, const uint8_t *sa,
+					const uint8_t *bssid)
+{
+	struct mmpdu_header *hdr = (void *) buf;
+
+	memset(hdr, 0, 24);
+	hdr->fc.protocol_version = 0;
+	hdr->fc.type = MPDU_TYPE_MANAGEMENT;
+	hdr->fc.subtype = subtype;
+	memcpy(hdr->address_1, da, 6);
+	memcpy(hdr->address_2, sa, 6);
+	memcpy(hdr->address_3, bssid, 6);
+	hdr->sequence_number_low = load_seq & 0xf;
+	hdr->sequence_number_high = (load_seq >> 4) & 0xff;
+	load_seq++;
+
+	return 24;
+}
+
+static size_t load_put_ssid(uint8_t *buf)
+{
+	size_t ssid_len = load_ssid ? strlen(load_ssid) : 0;
+
+	buf[0] = 0x00;
+	buf[1] = ssid_len;
+	memcpy(buf + 2, load_ssid, ssid_len);
+
+	return 2 + ssid_len;
+}
+
+static bool load_send_probe(struct load_sta *sta)
+{
+	static const uint8_t bcast_addr[6] =
+		{ 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+	uint8_t buf[256];
+	size_t len;
+
+	len = load_build_header(buf, MPDU_MANAGEMENT_SUBTYPE_PROBE_REQUEST,
+				bcast_addr, sta->addr, bcast_addr);
+	len += load_put_ssid(buf + len);
+	memcpy(buf + len, load_rates_ies, sizeof(load_rates_ies));
+	len += sizeof(load_rates_ies);
+
+	return load_tx(buf, len);
+}
+
+static bool load_send_auth(struct load_sta *sta)
+{
+	uint8_t buf[64];
+	struct mmpdu_authentication *auth;
+	size_t len;
+
+	len = load_build_header(buf, MPDU_MANAGEMENT_SUBTYPE_AUTHENTICATION,
+				load_bssid, sta->addr, load_bssid);
+	auth = (void *) buf + len;
+	auth->algorithm = L_CPU_TO_LE16(MMPDU_AUTH_ALGO_OPEN_SYSTEM);
+	auth->transaction_sequence = L_CPU_TO_LE16(1);
+	auth->status = 0;
+	len += sizeof(*auth);
+
+	return load_tx(buf, len);
+}
+
+static bool load_send_assoc(struct load_sta *sta)
+{
+	uint8_t buf[256];
+	struct mmpdu_association_request *req;
+	size_t len;
+
+	len = load_build_header(buf,
+				MPDU_MANAGEMENT_SUBTYPE_ASSOCIATION_REQUEST,
+				load_bssid, sta->addr, load_bssid);
+	req = (void *) buf + len;
+	memset(&req->capability, 0, sizeof(req->capability));
+	req->capability.ess = true;
+	req->capability.privacy = true;
+	req->listen_interval = L_CPU_TO_LE16(10);
+	len += sizeof(*req);
+	len += load_put_ssid(buf + len);
+	memcpy(buf + len, load_rates_ies, sizeof(load_rates_ies));
+	len += sizeof(load_rates_ies);
+	memcpy(buf + len, load_rsne, sizeof(load_rsne));
+	len += sizeof(load_rsne);
+
+	return load_tx(buf, len);
+}
+
+static void load_send_deauth(struct load_sta *sta)
+{
+	uint8_t buf[64];
+	struct mmpdu_deauthentication *deauth;
+	size_t len;
+
+	len = load_build_header(buf,
+				MPDU_MANAGEMENT_SUBTYPE_DEAUTHENTICATION,
+				load_bssid, sta->addr, load_bssid);
+	deauth = (void *) buf + len;
+	deauth->reason_code =
+		L_CPU_TO_LE16(MMPDU_REASON_CODE_DEAUTH_LEAVING);
+	len += sizeof(*deauth);
+
+	load_tx(buf, len);
+}
+
+static void load_record(struct load_sta *sta, uint64_t now, bool success)
+{
+	struct load_stats *stats = &load_stats[sta->frame];
+
+	if (stats->n_samples == stats->samples_size) {
+		stats->samples_size = stats->samples_size * 2 + 1024;
+		stats->samples = l_realloc(stats->samples,
+					stats->samples_size * sizeof(uint32_t));
+	}
+
+	stats->samples[stats->n_samples++] = now - sta->sent_time;
+	stats->answered++;
+
+	if (!success)
+		stats->failed++;
+
+	sta->step = LOAD_STEP_IDLE;
+}
+
+static void load_send_next(uint64_t now)
+{
+	struct load_sta *sta = &load_stas[load_total % load_n_stas];
+	enum load_frame frame = load_frames[load_total % load_n_frames];
+	bool sent;
+
+	load_total++;
+
+	/* No response before the address came up again */
+	if (sta->step != LOAD_STEP_IDLE)
+		load_stats[sta->frame].lost++;
+
+	sta->frame = frame;
+	sta->sent_time = now;
+
+	switch (frame) {
+	case LOAD_FRAME_PROBE:
+		sta->step = LOAD_STEP_PROBE;
+		sent = load_send_probe(sta);
+		break;
+	case LOAD_FRAME_AUTH:
+		sta->step = LOAD_STEP_AUTH;
+		sent = load_send_auth(sta);
+		break;
+	case LOAD_FRAME_ASSOC:
+	default:
+		sta->step = LOAD_STEP_ASSOC_AUTH;
+		sent = load_send_auth(sta);
+		break;
+	}
+
+	load_stats[frame].sent++;
+
+	if (!sent) {
+		load_stats[frame].lost++;
+		sta->step = LOAD_STEP_IDLE;
+	}
+}
+
+static struct load_sta *load_find_sta(const uint8_t *addr)
+{
+	unsigned int idx;
+
+	if (memcmp(addr, load_stas[0].addr, 3))
+		return NULL;
+
+	idx = (addr[3] << 16) | (addr[4] << 8) | addr[5];
+	if (idx >= load_n_stas)
+		return NULL;
+
+	return &load_stas[idx];
+}
+
+static void load_rx_mgmt(const struct mmpdu_header *hdr, size_t len,
+				uint64_t now)
+{
+	struct load_sta *sta = load_find_sta(hdr->address_1);
+	const void *body = mmpdu_body(hdr);
+	size_t body_len = len - mmpdu_header_len(hdr);
+	const struct mmpdu_authentication *auth = body;
+	const struct mmpdu_association_response *resp = body;
+	uint16_t status;
+
+	if (!sta || sta->step == LOAD_STEP_IDLE)
+		return;
+
+	if (load_have_bssid && memcmp(hdr->address_2, load_bssid, 6))
+		return;
+
+	switch (hdr->fc.subtype) {
+	case MPDU_MANAGEMENT_SUBTYPE_PROBE_RESPONSE:
+		if (sta->step == LOAD_STEP_PROBE)
+			load_record(sta, now, true);
+
+		break;
+	case MPDU_MANAGEMENT_SUBTYPE_AUTHENTICATION:
+		if (body_len < sizeof(*auth) ||
+				L_LE16_TO_CPU(auth->transaction_sequence) != 2)
+			break;
+
+		status = L_LE16_TO_CPU(auth->status);
+
+		if (sta->step == LOAD_STEP_AUTH)
+			load_record(sta, now, status == 0);
+		else if (sta->step == LOAD_STEP_ASSOC_AUTH) {
+			if (status) {
+				load_record(sta, now, false);
+				break;
+			}
+
+			/* Time the Association alone */
+			sta->step = LOAD_STEP_ASSOC;
+			sta->sent_time = now;
+
+			if (!load_send_assoc(sta)) {
+				load_stats[sta->frame].lost++;
+				sta->step = LOAD_STEP_IDLE;
+			}
+		}
+
+		break;
+	case MPDU_MANAGEMENT_SUBTYPE_ASSOCIATION_RESPONSE:
+		if (body_len < sizeof(*resp) || sta->step != LOAD_STEP_ASSOC)
+			break;
+
+		status = L_LE16_TO_CPU(resp->status_code);
+		load_record(sta, now, status == 0);
+
+		if (!status && !load_keep)
+			load_send_deauth(sta);
+
+		break;
+	default:
+		break;
+	}
+}
+
+static bool load_rx(struct l_io *io, void *user_data)
+{
+	uint8_t buf[4096];
+	const struct mmpdu_header *hdr;
+	uint64_t now = l_time_now();
+	ssize_t len;
+	uint32_t present;
+	size_t rt_len;
+	size_t offset;
+	uint8_t flags = 0;
+
+	len = recv(l_io_get_fd(io), buf, sizeof(buf), 0);
+	if (len < 8)
+		return true;
+
+	rt_len = l_get_le16(buf + 2);
+	if (buf[0] != 0 || rt_len > (size_t) len)
+		return true;
+
+	/* Find the Flags field to know whether the frame includes an FCS */
+	offset = 4;
+	do {
+		if (offset + 4 > rt_len)
+			return true;
+
+		present = l_get_le32(buf + offset);
+		offset += 4;
+	} while (present & (1u << 31));
+
+	present = l_get_le32(buf + 4);
+
+	if (present & (1 << 0))		/* TSFT */
+		offset = align_len(offset, 8) + 8;
+
+	if ((present & (1 << 1)) && offset < rt_len)	/* Flags */
+		flags = buf[offset];
+
+	if (flags & 0x10)		/* Frame includes FCS */
+		len -= 4;
+
+	hdr = mpdu_validate(buf + rt_len, len - rt_len);
+	if (!hdr)
+		return true;
+
+	load_rx_mgmt(hdr, len - rt_len, now);
+	return true;
+}
+
+static int load_sample_compare(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *) a;
+	uint32_t y = *(const uint32_t *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double load_percentile_ms(const struct load_stats *stats,
+					unsigned int percent)
+{
+	if (!stats->n_samples)
+		return 0;
+
+	return stats->samples[(stats->n_samples - 1) * percent / 100] /
+									1000.0;
+}
+
+static void load_finish(void)
+{
+	unsigned int i;
+
+	l_timeout_remove(load_timer);
+	load_timer = NULL;
+
+	for (i = 0; i < load_n_stas; i++)
+		if (load_stas[i].step != LOAD_STEP_IDLE) {
+			load_stats[load_stas[i].frame].lost++;
+			load_stas[i].step = LOAD_STEP_IDLE;
+		}
+
+	printf("%-6s %8s %8s %8s %7s %9s %9s %9s %9s\n", "Frame", "Sent",
+		"Answered", "Failed", "Loss", "p50 ms", "p90 ms", "p99 ms",
+		"Max ms");
+
+	for (i = 0; i < LOAD_FRAME_COUNT; i++) {
+		struct load_stats *stats = &load_stats[i];
+
+		if (!stats->sent)
+			continue;
+
+		qsort(stats->samples, stats->n_samples, sizeof(uint32_t),
+			load_sample_compare);
+
+		printf("%-6s %8u %8u %8u %6.2f%% %9.2f %9.2f %9.2f %9.2f\n",
+			stats->name, stats->sent, stats->answered,
+			stats->failed, stats->lost * 100.0 / stats->sent,
+			load_percentile_ms(stats, 50),
+			load_percentile_ms(stats, 90),
+			load_percentile_ms(stats, 99),
+			load_percentile_ms(stats, 100));
+	}
+
+	if (load_tx_errors)
+		printf("%u frames failed to be injected\n", load_tx_errors);
+
+	exit_status = EXIT_SUCCESS;
+	l_main_quit();
+}
+
+static void load_tick(struct l_timeout *timeout, void *user_data)
+{
+	uint64_t now = l_time_now();
+	uint64_t elapsed = l_time_diff(load_start_time, now);
+	uint64_t due;
+
+	if (load_draining) {
+		load_finish();
+		return;
+	}
+
+	if (elapsed >= load_duration * L_USEC_PER_SEC) {
+		/* Give the last requests a chance to be answered */
+		load_draining = true;
+		l_timeout_modify_ms(timeout, load_timeout_ms);
+		return;
+	}
+
+	due = elapsed * load_rate / L_USEC_PER_SEC;
+
+	while (load_total < due)
+		load_send_next(now);
+
+	l_timeout_modify_ms(timeout, LOAD_TICK_MS);
+}
+
+static bool load_start(void)
+{
+	struct sockaddr_ll sll;
+	uint8_t prefix[2];
+	unsigned int i;
+	int fd;
+
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_protocol = htons(ETH_P_ALL);
+	sll.sll_ifindex = if_nametoindex(load_ifname);
+
+	if (!sll.sll_ifindex) {
+		l_error("Unknown interface %s", load_ifname);
+		return false;
+	}
+
+	fd = socket(PF_PACKET, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK,
+			htons(ETH_P_ALL));
+	if (fd < 0) {
+		l_error("socket(PF_PACKET): %s", strerror(errno));
+		return false;
+	}
+
+	if (bind(fd, (struct sockaddr *) &sll, sizeof(sll)) < 0) {
+		l_error("bind(%s): %s", load_ifname, strerror(errno));
+		close(fd);
+		return false;
+	}
+
+	load_io = l_io_new(fd);
+	l_io_set_close_on_destroy(load_io, true);
+	l_io_set_read_handler(load_io, load_rx, NULL, NULL);
+
+	/* Locally administered addresses, the index in the last 3 bytes */
+	l_getrandom(prefix, sizeof(prefix));
+	load_stas = l_new(struct load_sta, load_n_stas);
+
+	for (i = 0; i < load_n_stas; i++) {
+		load_stas[i].addr[0] = 0x02;
+		load_stas[i].addr[1] = prefix[0];
+		load_stas[i].addr[2] = prefix[1];
+		load_stas[i].addr[3] = i >> 16;
+		load_stas[i].addr[4] = i >> 8;
+		load_stas[i].addr[5] = i;
+	}
+
+	l_info("Sending %u frames/s for %us from %u addresses on %s",
+		load_rate, load_duration, load_n_stas, load_ifname);
+
+	load_start_time = l_time_now();
+	load_timer = l_timeout_create_ms(LOAD_TICK_MS, load_tick, NULL, NULL);
+
+	return true;
+}
+
+static void load_cleanup(void)
+{
+	unsigned int i;
+
+	l_timeout_remove(load_timer);
+	l_io_destroy(load_io);
+	l_free(load_stas);
+
+	for (i = 0; i < LOAD_FRAME_COUNT; i++)
+		l_free(load_stats[i].samples);
+}
+
+static bool load_parse_frames(const char *str)
+{
+	_auto_(l_strv_free) char **types = l_strsplit(str, ',');
+	unsigned int i;
+
+	load_n_frames = 0;
+
+	for (i = 0; types[i]; i++) {
+		enum load_frame frame;
+
+		if (load_n_frames == LOAD_FRAME_COUNT)
+			return false;
+
+		if (!strcmp(types[i], "probe"))
+			frame = LOAD_FRAME_PROBE;
+		else if (!strcmp(types[i], "auth"))
+			frame = LOAD_FRAME_AUTH;
+		else if (!strcmp(types[i], "assoc"))
+			frame = LOAD_FRAME_ASSOC;
+		else
+			return false;
+
+		load_frames[load_n_frames++] = frame;
+	}
+
+	return load_n_frames > 0;
+}
+
 static void dump_interfaces(void)
 {
 	struct l_genl_msg *msg;
@@ -247,23 +825,150 @@ quit:
 	l_main_quit();
 }
 
-int main(int argc, char *argv[])
+static void signal_handler(uint32_t signo, void *user_data)
 {
-	if (argc >= 2) {
-		char *endp;
+	switch (signo) {
+	case SIGINT:
+	case SIGTERM:
+		if (load_timer)
+			load_finish();
+		else
+			l_main_quit();
+
+		break;
+	}
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [<frequency>]\n"
+		"       %s -i <monitor ifname> [options]\n\n"
+		"Send out a broadcast Probe Request frame.  A wireless "
+		"interface must be UP.  If a frequency is not given, the "
+		"frame is transmitted on the current channel.\n\n"
+		"With -i, inject requests from many random source addresses "
+		"through a monitor interface on the AP's channel and report "
+		"the response latencies and loss.\n\n"
+		"Options:\n"
+		"\t-i, --interface <ifname>  Monitor interface to use\n"
+		"\t-b, --bssid <addr>        AP address, required for "
+							"auth and assoc\n"
+		"\t-s, --ssid <ssid>         SSID to probe for and "
+							"associate with\n"
+		"\t-t, --type <types>        Comma separated list of "
+							"probe, auth, assoc\n"
+		"\t-r, --rate <n>            Requests per second "
+							"(default 100)\n"
+		"\t-d, --duration <secs>     Test duration (default 10)\n"
+		"\t-m, --macs <n>            Source addresses to use "
+							"(default 256)\n"
+		"\t-w, --timeout <ms>        Response timeout "
+							"(default 1000)\n"
+		"\t-k, --keep                Don't deauthenticate after "
+							"association\n"
+		"\t-h, --help                Show help options\n",
+		prog, prog);
+}
 
-		if (!strcmp(argv[1], "-h")) {
-			fprintf(stderr,
-				"Usage: %s [<frequency>]\n\n"
-				"Send out a broadcast Probe Request frame.  "
-				"A wireless interface must be UP.  If a "
-				"frequency is not given, the frame is "
-				"transmitted on the current channel.\n",
-				argv[0]);
+static const struct option main_options[] = {
+	{ "interface",	required_argument,	NULL, 'i' },
+	{ "bssid",	required_argument,	NULL, 'b' },
+	{ "ssid",	required_argument,	NULL, 's' },
+	{ "type",	required_argument,	NULL, 't' },
+	{ "rate",	required_argument,	NULL, 'r' },
+	{ "duration",	required_argument,	NULL, 'd' },
+	{ "macs",	required_argument,	NULL, 'm' },
+	{ "timeout",	required_argument,	NULL, 'w' },
+	{ "keep",	no_argument,		NULL, 'k' },
+	{ "help",	no_argument,		NULL, 'h' },
+	{ }
+};
+
+int main(int argc, char *argv[])
+{
+	load_frames[0] = LOAD_FRAME_PROBE;
+	load_n_frames = 1;
+
+	for (;;) {
+		int opt;
+
+		opt = getopt_long(argc, argv, "i:b:s:t:r:d:m:w:kh",
+						main_options, NULL);
+		if (opt < 0)
+			break;
+
+		switch (opt) {
+		case 'i':
+			load_ifname = optarg;
+			break;
+		case 'b':
+			if (!util_string_to_address(optarg, load_bssid)) {
+				fprintf(stderr, "Invalid BSSID %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+
+			load_have_bssid = true;
+			break;
+		case 's':
+			if (strlen(optarg) > 32) {
+				fprintf(stderr, "SSID too long\n");
+				return EXIT_FAILURE;
+			}
+
+			load_ssid = optarg;
+			break;
+		case 't':
+			if (!load_parse_frames(optarg)) {
+				fprintf(stderr, "Invalid types %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+
+			break;
+		case 'r':
+			load_rate = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			load_duration = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			load_n_stas = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			load_timeout_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 'k':
+			load_keep = true;
+			break;
+		case 'h':
+			usage(argv[0]);
 			return EXIT_SUCCESS;
+		default:
+			return EXIT_FAILURE;
 		}
+	}
 
-		freq = strtol(argv[1], &endp, 0);
+	if (load_ifname) {
+		unsigned int i;
+
+		if (!load_rate || !load_duration || !load_n_stas ||
+				load_n_stas > LOAD_MAX_STAS) {
+			fprintf(stderr, "Invalid rate, duration or number "
+					"of addresses\n");
+			return EXIT_FAILURE;
+		}
+
+		for (i = 0; i < load_n_frames; i++)
+			if (load_frames[i] != LOAD_FRAME_PROBE &&
+					(!load_have_bssid || !load_ssid)) {
+				fprintf(stderr, "auth and assoc need "
+						"--bssid and --ssid\n");
+				return EXIT_FAILURE;
+			}
+	} else if (optind < argc) {
+		char *endp;
+
+		freq = strtol(argv[optind], &endp, 0);
 
 		if (*endp != '\0') {
 			fprintf(stderr, "Can't parse '%s'\n", endp);
@@ -277,6 +982,14 @@ int main(int argc, char *argv[])
 	l_log_set_stderr();
 	exit_status = EXIT_FAILURE;
 
+	if (load_ifname) {
+		if (load_start())
+			l_main_run_with_signal(signal_handler, NULL);
+
+		load_cleanup();
+		goto done;
+	}
+
 	genl = l_genl_new();
 	if (!genl) {
 		l_error("Failed to initialize generic netlink");
@@ -290,7 +1003,7 @@ int main(int argc, char *argv[])
 		goto done;
 	}
 
-	l_main_run();
+	l_main_run_with_signal(signal_handler, NULL);
 
 	l_genl_family_free(nl80211);
 	l_genl_unref(genl);
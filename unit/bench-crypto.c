@@ -0,0 +1,332 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2024  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <getopt.h>
+#include <time.h>
+#include <ell/ell.h>
+
+#include "src/crypto.h"
+
+/*
+ * Microbenchmark of the crypto primitives used when connecting and roaming,
+ * reporting the throughput and latency percentiles of each.  Build with
+ * 'make bench-crypto', optionally giving the names of the benchmarks to run.
+ */
+
+#define BENCH_MAX_SAMPLES 100000
+
+static const uint8_t key[32] = {
+	0x0d, 0xc0, 0xd6, 0xeb, 0x90, 0x55, 0x5e, 0xd6,
+	0x41, 0x97, 0x56, 0xb9, 0xa1, 0x5e, 0xc3, 0xe3,
+	0x20, 0x9b, 0x63, 0xdf, 0x70, 0x7d, 0xd5, 0x08,
+	0xd1, 0x45, 0x81, 0xf8, 0x98, 0x27, 0x21, 0xaf,
+};
+static const uint8_t aa[6] = { 0xa0, 0xa1, 0xa1, 0xa3, 0xa4, 0xa5 };
+static const uint8_t spa[6] = { 0xb0, 0xb1, 0xb2, 0xb3, 0xb4, 0xb5 };
+static uint8_t anonce[32];
+static uint8_t snonce[32];
+static uint8_t data[256];
+static uint8_t wrapped[40];
+static struct l_ecc_point *pt;
+
+static void bench_psk(void)
+{
+	uint8_t psk[32];
+
+	assert(!crypto_psk_from_passphrase("ThisIsAPassword",
+						(const uint8_t *) "ThisIsASSID",
+						11, psk));
+}
+
+static void bench_psk_batch(void)
+{
+	struct crypto_psk_derivation reqs[4];
+	unsigned int i;
+
+	for (i = 0; i < L_ARRAY_SIZE(reqs); i++) {
+		reqs[i].passphrase = "ThisIsAPassword";
+		reqs[i].ssid = (const uint8_t *) "ThisIsASSID";
+		reqs[i].ssid_len = 11;
+	}
+
+	crypto_psk_from_passphrase_batch(reqs, L_ARRAY_SIZE(reqs));
+
+	for (i = 0; i < L_ARRAY_SIZE(reqs); i++)
+		assert(!reqs[i].err);
+}
+
+static void bench_ptk(void)
+{
+	uint8_t ptk[48];
+
+	assert(crypto_derive_pairwise_ptk(key, 32, aa, spa, anonce, snonce,
+						ptk, sizeof(ptk),
+						L_CHECKSUM_SHA1));
+}
+
+static void bench_prf_sha1(void)
+{
+	uint8_t out[48];
+
+	assert(prf_sha1(key, 32, "Pairwise key expansion", 22,
+				data, 76, out, sizeof(out)));
+}
+
+static void bench_kdf_sha256(void)
+{
+	uint8_t out[48];
+
+	assert(kdf_sha256(key, 32, "Pairwise key expansion", 22,
+				data, 76, out, sizeof(out)));
+}
+
+static void bench_hkdf_expand(void)
+{
+	uint8_t out[32];
+
+	assert(hkdf_expand(L_CHECKSUM_SHA256, key, 32, "SAE KCK and PMK",
+				out, sizeof(out)));
+}
+
+static void bench_aes_unwrap(void)
+{
+	uint8_t out[32];
+
+	assert(aes_unwrap(key, 16, wrapped, sizeof(wrapped), out));
+}
+
+static void bench_cmac_aes(void)
+{
+	uint8_t mic[16];
+
+	assert(cmac_aes(key, 16, data, 121, mic, sizeof(mic)));
+}
+
+static void bench_aes_siv_encrypt(void)
+{
+	struct iovec ad[2] = {
+		{ .iov_base = (void *) aa, .iov_len = 6 },
+		{ .iov_base = (void *) spa, .iov_len = 6 },
+	};
+	uint8_t out[128 + 16];
+
+	assert(aes_siv_encrypt(key, 32, data, 128, ad, 2, out));
+}
+
+static void bench_sae_pt(void)
+{
+	struct l_ecc_point *p = crypto_derive_sae_pt_ecc(19, "ThisIsASSID",
+							"ThisIsAPassword",
+							NULL);
+
+	assert(p);
+	l_ecc_point_free(p);
+}
+
+static void bench_sae_pwe(void)
+{
+	struct l_ecc_point *pwe = crypto_derive_sae_pwe_from_pt_ecc(aa, spa,
+									pt);
+
+	assert(pwe);
+	l_ecc_point_free(pwe);
+}
+
+static void bench_ft_ptk(void)
+{
+	uint8_t ptk[48];
+	uint8_t ptk_name[16];
+
+	assert(crypto_derive_ft_ptk(key, data, aa, spa, anonce, snonce,
+					false, ptk, sizeof(ptk), ptk_name));
+}
+
+static const struct bench {
+	const char *name;
+	void (*func)(void);
+} benches[] = {
+	{ "crypto_psk_from_passphrase",		bench_psk },
+	{ "crypto_psk_from_passphrase_batch/4",	bench_psk_batch },
+	{ "crypto_derive_pairwise_ptk",		bench_ptk },
+	{ "prf_sha1",				bench_prf_sha1 },
+	{ "kdf_sha256",				bench_kdf_sha256 },
+	{ "hkdf_expand",			bench_hkdf_expand },
+	{ "aes_unwrap",				bench_aes_unwrap },
+	{ "cmac_aes",				bench_cmac_aes },
+	{ "aes_siv_encrypt",			bench_aes_siv_encrypt },
+	{ "crypto_derive_sae_pt_ecc",		bench_sae_pt },
+	{ "crypto_derive_sae_pwe_from_pt_ecc",	bench_sae_pwe },
+	{ "crypto_derive_ft_ptk",		bench_ft_ptk },
+	{ }
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int sample_compare(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *) a;
+	uint64_t y = *(const uint64_t *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double percentile_us(const uint64_t *samples, unsigned int n,
+				unsigned int percent)
+{
+	unsigned int i = (n - 1) * percent / 100;
+
+	return samples[i] / 1000.0;
+}
+
+static void bench_run(const struct bench *bench, uint64_t duration_ns,
+			uint64_t *samples)
+{
+	uint64_t start = now_ns();
+	uint64_t total = 0;
+	uint64_t t;
+	unsigned int n = 0;
+
+	/* Warm up, e.g. the AF_ALG sockets and CPU feature checks */
+	bench->func();
+
+	do {
+		t = now_ns();
+		bench->func();
+		samples[n] = now_ns() - t;
+		total += samples[n++];
+	} while (n < BENCH_MAX_SAMPLES && now_ns() - start < duration_ns);
+
+	qsort(samples, n, sizeof(uint64_t), sample_compare);
+
+	printf("%-36s %8u %12.1f %9.2f %9.2f %9.2f %9.2f\n", bench->name, n,
+		n * 1000000000.0 / total, percentile_us(samples, n, 50),
+		percentile_us(samples, n, 90), percentile_us(samples, n, 99),
+		samples[n - 1] / 1000.0);
+}
+
+static bool bench_selected(const char *name, int argc, char *argv[])
+{
+	int i;
+
+	if (!argc)
+		return true;
+
+	for (i = 0; i < argc; i++)
+		if (!strcmp(argv[i], name))
+			return true;
+
+	return false;
+}
+
+static void usage(void)
+{
+	const struct bench *bench;
+
+	printf("bench-crypto - Crypto primitives microbenchmark\n"
+		"Usage:\n");
+	printf("\tbench-crypto [options] [benchmark ...]\n");
+	printf("Options:\n"
+		"\t-d, --duration <ms>    Time spent on each benchmark\n"
+		"\t-h, --help             Show help options\n");
+	printf("Benchmarks:\n");
+
+	for (bench = benches; bench->name; bench++)
+		printf("\t%s\n", bench->name);
+}
+
+static const struct option main_options[] = {
+	{ "duration",	required_argument, NULL, 'd' },
+	{ "help",	no_argument,       NULL, 'h' },
+	{ }
+};
+
+int main(int argc, char *argv[])
+{
+	const struct bench *bench;
+	uint64_t duration_ms = 1000;
+	uint64_t *samples;
+	uint8_t plain[32];
+	unsigned int i;
+
+	for (;;) {
+		int opt;
+
+		opt = getopt_long(argc, argv, "d:h", main_options, NULL);
+		if (opt < 0)
+			break;
+
+		switch (opt) {
+		case 'd':
+			duration_ms = strtoull(optarg, NULL, 10);
+			break;
+		case 'h':
+			usage();
+			return EXIT_SUCCESS;
+		default:
+			return EXIT_FAILURE;
+		}
+	}
+
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = i;
+
+	for (i = 0; i < sizeof(anonce); i++) {
+		anonce[i] = 0xe0 + i;
+		snonce[i] = 0xc0 + i;
+	}
+
+	memset(plain, 0x5a, sizeof(plain));
+	assert(aes_wrap(key, plain, sizeof(plain), wrapped));
+
+	pt = crypto_derive_sae_pt_ecc(19, "ThisIsASSID", "ThisIsAPassword",
+					NULL);
+	assert(pt);
+
+	samples = l_new(uint64_t, BENCH_MAX_SAMPLES);
+
+	printf("%-36s %8s %12s %9s %9s %9s %9s\n", "Benchmark", "Runs",
+		"Ops/sec", "p50 us", "p90 us", "p99 us", "Max us");
+
+	for (bench = benches; bench->name; bench++)
+		if (bench_selected(bench->name, argc - optind, argv + optind))
+			bench_run(bench, duration_ms * 1000000ULL, samples);
+
+	l_free(samples);
+	l_ecc_point_free(pt);
+
+	return EXIT_SUCCESS;
+}
@@ -26,6 +26,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
 #include <assert.h>
 #include <ell/ell.h>
 
@@ -102,6 +103,97 @@ static void psk_test(const void *data)
 	assert(strcmp(test->psk, psk) == 0);
 }
 
+static void psk_batch_test(const void *data)
+{
+	static const struct psk_data *tests[] = {
+		&psk_test_case_1, &psk_test_case_2, &psk_test_case_3,
+	};
+	struct crypto_psk_derivation reqs[2 * L_ARRAY_SIZE(tests) + 2] = {};
+	char psk[65];
+	unsigned int i;
+	unsigned int j;
+	unsigned int n = 0;
+
+	/* Each test vector twice, to have some batches span lane groups */
+	for (i = 0; i < 2 * L_ARRAY_SIZE(tests); i++) {
+		const struct psk_data *test = tests[i % L_ARRAY_SIZE(tests)];
+
+		reqs[n].passphrase = test->passphrase;
+		reqs[n].ssid = test->ssid;
+		reqs[n++].ssid_len = test->ssid_len;
+	}
+
+	/* Invalid entries don't prevent the others from being derived */
+	reqs[n].passphrase = "short";
+	reqs[n].ssid = psk_test_case_1_ssid;
+	reqs[n++].ssid_len = sizeof(psk_test_case_1_ssid);
+
+	reqs[n].passphrase = "password";
+	reqs[n].ssid = psk_test_case_1_ssid;
+	reqs[n++].ssid_len = 0;
+
+	crypto_psk_from_passphrase_batch(reqs, n);
+
+	for (i = 0; i < 2 * L_ARRAY_SIZE(tests); i++) {
+		const struct psk_data *test = tests[i % L_ARRAY_SIZE(tests)];
+
+		assert(reqs[i].err == 0);
+
+		for (j = 0; j < sizeof(reqs[i].psk); j++)
+			sprintf(psk + (j * 2), "%02x", reqs[i].psk[j]);
+
+		assert(strcmp(test->psk, psk) == 0);
+	}
+
+	assert(reqs[n - 2].err == -ERANGE);
+	assert(reqs[n - 1].err == -ERANGE);
+}
+
+/*
+ * Compares each lane of the batched derivation against ell's generic
+ * PBKDF2, with passphrase and SSID lengths across the valid range
+ */
+static void psk_batch_pbkdf2_test(const void *data)
+{
+	static const size_t passphrase_lens[] = {
+		8, 9, 13, 20, 31, 32, 33, 47, 55, 56, 63,
+	};
+	static const size_t ssid_lens[] = {
+		1, 32, 4, 7, 12, 20, 19, 31, 8, 2, 27,
+	};
+	struct crypto_psk_derivation reqs[L_ARRAY_SIZE(passphrase_lens)] = {};
+	char passphrases[L_ARRAY_SIZE(passphrase_lens)][64];
+	unsigned char ssids[L_ARRAY_SIZE(ssid_lens)][32];
+	unsigned char psk[32];
+	unsigned int i;
+	unsigned int j;
+
+	for (i = 0; i < L_ARRAY_SIZE(reqs); i++) {
+		for (j = 0; j < passphrase_lens[i]; j++)
+			passphrases[i][j] = ' ' + (i * 7 + j * 13) % 95;
+
+		passphrases[i][j] = '\0';
+
+		for (j = 0; j < ssid_lens[i]; j++)
+			ssids[i][j] = i * 31 + j;
+
+		reqs[i].passphrase = passphrases[i];
+		reqs[i].ssid = ssids[i];
+		reqs[i].ssid_len = ssid_lens[i];
+	}
+
+	crypto_psk_from_passphrase_batch(reqs, L_ARRAY_SIZE(reqs));
+
+	for (i = 0; i < L_ARRAY_SIZE(reqs); i++) {
+		assert(l_cert_pkcs5_pbkdf2(L_CHECKSUM_SHA1, passphrases[i],
+						ssids[i], ssid_lens[i],
+						4096, psk, sizeof(psk)));
+
+		assert(reqs[i].err == 0);
+		assert(!memcmp(reqs[i].psk, psk, sizeof(psk)));
+	}
+}
+
 struct ptk_data {
 	const unsigned char *pmk;
 	const unsigned char *aa;
@@ -403,6 +495,95 @@ static void aes_siv_test(const void *data)
 	assert(memcmp(decrypted, plaintext, sizeof(decrypted)) == 0);
 }
 
+static void checksum_compare(struct l_checksum *expected,
+				struct crypto_checksum *checksum,
+				const uint8_t *msg, size_t msg_len)
+{
+	uint8_t digest1[64];
+	uint8_t digest2[64];
+	ssize_t len;
+	unsigned int i;
+
+	/* Both digests are taken twice, the checksum is reset in between */
+	for (i = 0; i < 2; i++) {
+		assert(l_checksum_update(expected, msg, msg_len));
+		len = l_checksum_get_digest(expected, digest1, sizeof(digest1));
+
+		assert(crypto_checksum_update(checksum, msg, msg_len / 3));
+		assert(crypto_checksum_update(checksum, msg + msg_len / 3,
+						msg_len - msg_len / 3));
+		assert(crypto_checksum_get_digest(checksum, digest2,
+						sizeof(digest2)) == len);
+		assert(!memcmp(digest1, digest2, len));
+	}
+
+	l_checksum_free(expected);
+	crypto_checksum_free(checksum);
+}
+
+/* The configured crypto backend must agree with ell */
+static void crypto_backend_test(const void *data)
+{
+	static const enum l_checksum_type types[] = {
+		L_CHECKSUM_MD5, L_CHECKSUM_SHA1, L_CHECKSUM_SHA256,
+		L_CHECKSUM_SHA384, L_CHECKSUM_SHA512,
+	};
+	static const size_t key_lens[] = { 16, 24, 32, 150 };
+	static const size_t msg_lens[] = { 0, 16, 55, 64, 200, 300 };
+	uint8_t key[150];
+	uint8_t msg[300];
+	uint8_t out1[64];
+	uint8_t out2[64];
+	struct l_cipher *cipher;
+	struct crypto_aes *aes;
+	unsigned int i;
+	unsigned int j;
+	unsigned int k;
+
+	for (i = 0; i < sizeof(key); i++)
+		key[i] = i * 7 + 3;
+
+	for (i = 0; i < sizeof(msg); i++)
+		msg[i] = i * 13 + 1;
+
+	for (i = 0; i < L_ARRAY_SIZE(types); i++)
+		for (k = 0; k < L_ARRAY_SIZE(msg_lens); k++) {
+			checksum_compare(l_checksum_new(types[i]),
+					crypto_checksum_new(types[i]),
+					msg, msg_lens[k]);
+
+			for (j = 0; j < L_ARRAY_SIZE(key_lens); j++)
+				checksum_compare(l_checksum_new_hmac(types[i],
+							key, key_lens[j]),
+					crypto_checksum_new_hmac(types[i],
+							key, key_lens[j]),
+					msg, msg_lens[k]);
+		}
+
+	for (j = 0; j < 3; j++) {
+		for (k = 0; k < L_ARRAY_SIZE(msg_lens); k++)
+			checksum_compare(l_checksum_new_cmac_aes(key,
+							key_lens[j]),
+					crypto_checksum_new_cmac_aes(key,
+							key_lens[j]),
+					msg, msg_lens[k]);
+
+		cipher = l_cipher_new(L_CIPHER_AES, key, key_lens[j]);
+		aes = crypto_aes_new(key, key_lens[j]);
+		assert(cipher && aes);
+
+		assert(l_cipher_encrypt(cipher, msg, out1, sizeof(out1)));
+		assert(crypto_aes_encrypt(aes, msg, out2, sizeof(out2)));
+		assert(!memcmp(out1, out2, sizeof(out1)));
+
+		assert(crypto_aes_decrypt(aes, out2, out2, sizeof(out2)));
+		assert(!memcmp(msg, out2, sizeof(out2)));
+
+		l_cipher_free(cipher);
+		crypto_aes_free(aes);
+	}
+}
+
 int main(int argc, char *argv[])
 {
 	l_test_init(&argc, &argv);
@@ -423,6 +604,10 @@ int main(int argc, char *argv[])
 			psk_test, &psk_test_case_2);
 	l_test_add("/Passphrase Generator/PSK Test Case 3",
 			psk_test, &psk_test_case_3);
+	l_test_add("/Passphrase Generator/PSK Batch",
+			psk_batch_test, NULL);
+	l_test_add("/Passphrase Generator/PSK Batch vs PBKDF2",
+			psk_batch_pbkdf2_test, NULL);
 
 	l_test_add("/PTK Derivation/PTK Test Case 1",
 			ptk_test, &ptk_test_1);
@@ -437,6 +622,9 @@ int main(int argc, char *argv[])
 			aes_wrap_test, NULL);
 	l_test_add("/AES-SIV", aes_siv_test, NULL);
 
+	l_test_add("/Crypto backend/Compare with ell",
+			crypto_backend_test, NULL);
+
 done:
 	return l_test_run();
 }
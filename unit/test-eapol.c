@@ -3530,6 +3530,9 @@ struct test_ap_sta_data {
 	int to_ap_msg_cnt;
 	struct eapol_sm *ap_sm;
 	struct eapol_sm *sta_sm;
+	uint8_t sta_gtk[32];
+	uint16_t sta_gtk_index;
+	bool group_rekey_done;
 };
 
 static int test_ap_sta_eapol_tx(uint32_t ifindex,
@@ -3898,6 +3901,144 @@ static void eapol_ap_sta_handshake_ip_alloc_no_req_test(const void *data)
 	assert(!memcmp(s.ap_tk, s.sta_tk, 16));
 }
 
+static void test_ap_sta_group_hs_event(struct handshake_state *hs,
+					enum handshake_event event,
+					void *user_data, ...)
+{
+	struct test_ap_sta_data *s = user_data;
+
+	assert(event != HANDSHAKE_EVENT_FAILED);
+
+	if (event == HANDSHAKE_EVENT_GROUP_REKEY_COMPLETE) {
+		assert(hs == s->ap_hs);
+		s->group_rekey_done = true;
+	}
+}
+
+static struct test_ap_sta_data *test_ap_sta_gtk_data;
+
+static void test_ap_sta_install_gtk(struct handshake_state *hs,
+					uint16_t key_index,
+					const uint8_t *gtk, uint8_t gtk_len,
+					const uint8_t *rsc, uint8_t rsc_len,
+					uint32_t cipher)
+{
+	struct test_ap_sta_data *s = test_ap_sta_gtk_data;
+
+	assert(hs == s->sta_hs);
+	assert(gtk_len == 16);
+	memcpy(s->sta_gtk, gtk, gtk_len);
+	s->sta_gtk_index = key_index;
+}
+
+static void test_ap_sta_flush(struct test_ap_sta_data *s)
+{
+	while (s->to_sta_data_len) {
+		int len = s->to_sta_data_len;
+		s->to_sta_data_len = 0;
+		__eapol_rx_packet(s->sta_hs->ifindex, s->ap_address, ETH_P_PAE,
+					s->to_sta_data, len, false);
+	}
+}
+
+static void eapol_ap_sta_group_handshake_test(const void *data)
+{
+	static const unsigned char ap_rsne[] = {
+		0x30, 0x14, 0x01, 0x00, 0x00, 0x0f, 0xac, 0x04,
+		0x01, 0x00, 0x00, 0x0f, 0xac, 0x04, 0x01, 0x00,
+		0x00, 0x0f, 0xac, 0x02, 0x81, 0x00 };
+	static const unsigned char sta_rsne[] = {
+		0x30, 0x12, 0x01, 0x00, 0x00, 0x0f, 0xac, 0x04,
+		0x01, 0x00, 0x00, 0x0f, 0xac, 0x04, 0x01, 0x00,
+		0x00, 0x0f, 0xac, 0x02 };
+	static const char *ssid = "TestWPA2PSK";
+	static const uint8_t psk[32] = {	/* secretsecret */
+		0x6a, 0xa3, 0xf0, 0x0b, 0x68, 0xbd, 0x8b, 0x46,
+		0x69, 0x83, 0xa5, 0x29, 0xa3, 0xfa, 0x57, 0x1c,
+		0x6c, 0x7b, 0x72, 0x41, 0x1d, 0xce, 0x33, 0x02,
+		0xa2, 0x2d, 0xdf, 0x77, 0xd1, 0x93, 0xdb, 0x5f };
+	static const uint8_t gtk1[16] = {
+		0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
+		0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f };
+	static const uint8_t gtk2[16] = {
+		0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27,
+		0x28, 0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f };
+	static const uint8_t rsc[6];
+	struct test_ap_sta_data s = {
+		.ap_hs = test_ap_sta_hs_new(&s, 1),
+		.sta_hs = test_ap_sta_hs_new(&s, 2),
+		.ap_address = { 0x02, 0x03, 0x04, 0x05, 0x06, 0x07 },
+		.sta_address = { 0x02, 0x03, 0x04, 0x05, 0x06, 0x08 },
+	};
+
+	test_ap_sta_gtk_data = &s;
+	__handshake_set_get_nonce_func(random_nonce);
+	__handshake_set_install_tk_func(test_ap_sta_install_tk);
+	__handshake_set_install_gtk_func(test_ap_sta_install_gtk);
+
+	handshake_state_set_authenticator(s.ap_hs, true);
+	handshake_state_set_event_func(s.ap_hs, test_ap_sta_group_hs_event,
+					&s);
+	handshake_state_set_authenticator_address(s.ap_hs, s.ap_address);
+	handshake_state_set_supplicant_address(s.ap_hs, s.sta_address);
+	handshake_state_set_supplicant_ie(s.ap_hs, sta_rsne);
+	handshake_state_set_authenticator_ie(s.ap_hs, ap_rsne);
+	handshake_state_set_ssid(s.ap_hs, (void *) ssid, strlen(ssid));
+	handshake_state_set_pmk(s.ap_hs, psk, 32);
+	handshake_state_set_gtk(s.ap_hs, gtk1, 1, rsc);
+
+	handshake_state_set_authenticator(s.sta_hs, false);
+	handshake_state_set_event_func(s.sta_hs, test_ap_sta_group_hs_event,
+					&s);
+	handshake_state_set_authenticator_address(s.sta_hs, s.ap_address);
+	handshake_state_set_supplicant_address(s.sta_hs, s.sta_address);
+	handshake_state_set_supplicant_ie(s.sta_hs, sta_rsne);
+	handshake_state_set_authenticator_ie(s.sta_hs, ap_rsne);
+	handshake_state_set_ssid(s.sta_hs, (void *) ssid, strlen(ssid));
+	handshake_state_set_pmk(s.sta_hs, psk, 32);
+
+	eap_init();
+	eapol_init();
+	__eapol_set_tx_packet_func(test_ap_sta_eapol_tx);
+	__eapol_set_tx_user_data(&s);
+
+	s.ap_sm = eapol_sm_new(s.ap_hs);
+	eapol_register(s.ap_sm);
+
+	s.sta_sm = eapol_sm_new(s.sta_hs);
+	eapol_register(s.sta_sm);
+
+	/* Not possible before the PTK is in place */
+	assert(!eapol_start_group_rekey(s.ap_sm));
+
+	eapol_start(s.sta_sm);
+	eapol_start(s.ap_sm);
+	test_ap_sta_flush(&s);
+
+	assert(s.ap_success && s.sta_success);
+	assert(s.to_ap_msg_cnt == 2 && s.to_sta_msg_cnt == 2);
+	assert(s.sta_gtk_index == 1 && !memcmp(s.sta_gtk, gtk1, 16));
+
+	handshake_state_set_gtk(s.ap_hs, gtk2, 2, rsc);
+	assert(eapol_start_group_rekey(s.ap_sm));
+	test_ap_sta_flush(&s);
+
+	assert(s.group_rekey_done);
+	assert(s.to_ap_msg_cnt == 3 && s.to_sta_msg_cnt == 3);
+	assert(s.sta_gtk_index == 2 && !memcmp(s.sta_gtk, gtk2, 16));
+
+	eapol_sm_free(s.ap_sm);
+	eapol_sm_free(s.sta_sm);
+
+	eapol_exit();
+	eap_exit();
+
+	handshake_state_free(s.ap_hs);
+	handshake_state_free(s.sta_hs);
+	__handshake_set_install_tk_func(NULL);
+	__handshake_set_install_gtk_func(NULL);
+}
+
 #define IS_ENABLED(config_macro) _IS_ENABLED1(config_macro)
 #define _IS_ENABLED1(config_macro) _IS_ENABLED2(_XXXX##config_macro)
 #define _XXXX1 _YYYY,
@@ -4046,6 +4187,8 @@ int main(int argc, char *argv[])
 			&eapol_ap_sta_handshake_ip_alloc_ok_test, NULL);
 	l_test_add("EAPoL/Supplicant+Authenticator IP Allocation no request",
 			&eapol_ap_sta_handshake_ip_alloc_no_req_test, NULL);
+	l_test_add("EAPoL/Supplicant+Authenticator Group Key Handshake",
+			&eapol_ap_sta_group_handshake_test, NULL);
 
 done:
 	return l_test_run();
@@ -694,6 +694,146 @@ static void ie_test_encapsulate_wsc(const void *data)
 	l_free(packed);
 }
 
+static const uint8_t rnr_data[] = {
+	/* 6 GHz channel 5, one entry with BSSID, Short SSID, BSS Parameters */
+	0x00, 0x0d, 0x83, 0x05,
+	0xff, 0x02, 0x00, 0x00, 0x00, 0x01, 0x00, 0x95, 0x1f, 0xf6, 0x9e,
+	0x42, 0xfe,
+	/* 5 GHz channel 36, two entries with BSSID only */
+	0x10, 0x07, 0x73, 0x24,
+	0x10, 0x02, 0x00, 0x00, 0x00, 0x02, 0x00,
+	0x20, 0x02, 0x00, 0x00, 0x00, 0x03, 0x00,
+};
+
+static void ie_test_rnr_collect(const struct ie_rnr_info *info,
+				void *user_data)
+{
+	struct l_queue *list = user_data;
+
+	l_queue_push_tail(list, l_memdup(info, sizeof(*info)));
+}
+
+static void ie_test_reduced_neighbor_report(const void *data)
+{
+	static const uint8_t bssid1[6] = { 0x02, 0, 0, 0, 0x01, 0 };
+	static const uint8_t bssid3[6] = { 0x02, 0, 0, 0, 0x03, 0 };
+	struct l_queue *list = l_queue_new();
+	const struct ie_rnr_info *info;
+
+	assert(!ie_parse_reduced_neighbor_report(rnr_data, sizeof(rnr_data),
+							ie_test_rnr_collect,
+							list));
+	assert(l_queue_length(list) == 3);
+
+	info = l_queue_peek_head(list);
+	assert(info->oper_class == 131 && info->channel == 5);
+	assert(info->bssid_present && !memcmp(info->bssid, bssid1, 6));
+	assert(info->short_ssid_present && info->short_ssid == 0x9ef61f95);
+	assert(info->bss_params_present);
+	assert(info->bss_params & IE_RNR_BSS_PARAM_SAME_SSID);
+	assert(info->bss_params & IE_RNR_BSS_PARAM_COLOCATED_AP);
+
+	info = l_queue_peek_tail(list);
+	assert(info->oper_class == 115 && info->channel == 36);
+	assert(info->bssid_present && !memcmp(info->bssid, bssid3, 6));
+	assert(!info->short_ssid_present && !info->bss_params_present);
+
+	l_queue_destroy(list, l_free);
+
+	/* Truncated element must not be reported at all */
+	list = l_queue_new();
+	assert(ie_parse_reduced_neighbor_report(rnr_data,
+						sizeof(rnr_data) - 1,
+						ie_test_rnr_collect, list) < 0);
+	assert(l_queue_isempty(list));
+	l_queue_destroy(list, l_free);
+}
+
+static const uint8_t mbssid_ies[] = {
+	/* SSID "tx", Supported Rates, RSN, Vendor Specific */
+	0x00, 0x02, 0x74, 0x78,
+	0x01, 0x02, 0x82, 0x84,
+	0x30, 0x02, 0xaa, 0xbb,
+	0xdd, 0x05, 0x00, 0x50, 0xf2, 0x02, 0x01,
+	/* Multiple BSSID, MaxBSSID Indicator 2 */
+	0x47, 0x23, 0x02,
+	/*
+	 * Nontransmitted BSSID Profile: Capability, SSID "vap", Index 1,
+	 * RSN, Non-Inheritance of Supported Rates
+	 */
+	0x00, 0x16,
+	0x53, 0x02, 0x11, 0x04,
+	0x00, 0x03, 0x76, 0x61, 0x70,
+	0x55, 0x01, 0x01,
+	0x30, 0x02, 0xcc, 0xdd,
+	0xff, 0x04, 0x38, 0x01, 0x01, 0x00,
+	/* Profile without a Nontransmitted BSSID Capability, ignored */
+	0x00, 0x08,
+	0x00, 0x03, 0x62, 0x61, 0x64,
+	0x55, 0x01, 0x02,
+};
+
+struct ie_test_nontransmitted_bss {
+	uint8_t bssid[6];
+	uint16_t capability;
+	uint8_t *ies;
+	size_t ies_len;
+};
+
+static void ie_test_nontransmitted_bss_free(void *data)
+{
+	struct ie_test_nontransmitted_bss *bss = data;
+
+	l_free(bss->ies);
+	l_free(bss);
+}
+
+static void ie_test_mbssid_collect(const uint8_t *bssid, uint16_t capability,
+					const uint8_t *ies, size_t ies_len,
+					void *user_data)
+{
+	struct l_queue *list = user_data;
+	struct ie_test_nontransmitted_bss *bss =
+				l_new(struct ie_test_nontransmitted_bss, 1);
+
+	memcpy(bss->bssid, bssid, 6);
+	bss->capability = capability;
+	bss->ies = l_memdup(ies, ies_len);
+	bss->ies_len = ies_len;
+
+	l_queue_push_tail(list, bss);
+}
+
+static void ie_test_multiple_bssid(const void *data)
+{
+	static const uint8_t transmitted_bssid[6] = {
+		0x02, 0x00, 0x00, 0x00, 0x00, 0x13
+	};
+	static const uint8_t expected_bssid[6] = {
+		0x02, 0x00, 0x00, 0x00, 0x00, 0x10
+	};
+	static const uint8_t expected_ies[] = {
+		0x00, 0x03, 0x76, 0x61, 0x70,
+		0x30, 0x02, 0xcc, 0xdd,
+		0xdd, 0x05, 0x00, 0x50, 0xf2, 0x02, 0x01,
+	};
+	struct l_queue *list = l_queue_new();
+	const struct ie_test_nontransmitted_bss *bss;
+
+	assert(ie_parse_multiple_bssid(mbssid_ies, sizeof(mbssid_ies),
+					transmitted_bssid,
+					ie_test_mbssid_collect, list) == 1);
+	assert(l_queue_length(list) == 1);
+
+	bss = l_queue_peek_head(list);
+	assert(!memcmp(bss->bssid, expected_bssid, 6));
+	assert(bss->capability == 0x0411);
+	assert(bss->ies_len == sizeof(expected_ies));
+	assert(!memcmp(bss->ies, expected_ies, sizeof(expected_ies)));
+
+	l_queue_destroy(list, ie_test_nontransmitted_bss_free);
+}
+
 int main(int argc, char *argv[])
 {
 	l_test_init(&argc, &argv);
@@ -755,5 +895,10 @@ int main(int argc, char *argv[])
 				ie_test_encapsulate_wsc,
 				&ie_tlv_concat_test_data_1);
 
+	l_test_add("/ie/Reduced Neighbor Report/Parser",
+				ie_test_reduced_neighbor_report, NULL);
+	l_test_add("/ie/Multiple BSSID/Parser",
+				ie_test_multiple_bssid, NULL);
+
 	return l_test_run();
 }
@@ -0,0 +1,139 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2024  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <assert.h>
+#include <ell/ell.h>
+
+#include "src/ie.h"
+#include "src/pmksa.h"
+
+static const uint8_t spa[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+static const uint8_t aa1[6] = { 0x02, 0x00, 0x00, 0x00, 0x01, 0x00 };
+static const uint8_t aa2[6] = { 0x02, 0x00, 0x00, 0x00, 0x02, 0x00 };
+static const uint8_t aa3[6] = { 0x02, 0x00, 0x00, 0x00, 0x03, 0x00 };
+static const char *ssid = "example";
+
+static struct pmksa *new_pmksa(const uint8_t *aa, uint32_t akm,
+				uint64_t expiration, uint8_t fill)
+{
+	struct pmksa *pmksa = l_new(struct pmksa, 1);
+
+	memcpy(pmksa->spa, spa, 6);
+	memcpy(pmksa->aa, aa, 6);
+	memcpy(pmksa->ssid, ssid, strlen(ssid));
+	pmksa->ssid_len = strlen(ssid);
+	pmksa->akm = akm;
+	pmksa->expiration = expiration;
+	memset(pmksa->pmkid, fill, 16);
+	memset(pmksa->pmk, fill, 32);
+	pmksa->pmk_len = 32;
+
+	return pmksa;
+}
+
+static struct pmksa *cache_get(const uint8_t *aa, uint32_t akm)
+{
+	return pmksa_cache_get(spa, aa, (const uint8_t *) ssid, strlen(ssid),
+				akm);
+}
+
+static void test_pmksa_get_put(const void *data)
+{
+	uint64_t future = l_time_offset(l_time_now(), 3600 * L_USEC_PER_SEC);
+	struct pmksa *pmksa;
+
+	assert(pmksa_cache_put(new_pmksa(aa1, IE_RSN_AKM_SUITE_8021X,
+						future, 0x11)) == 0);
+	assert(pmksa_cache_put(new_pmksa(aa2, IE_RSN_AKM_SUITE_SAE_SHA256,
+						future, 0x22)) == 0);
+	assert(pmksa_cache_length() == 2);
+
+	/* AKM must match */
+	assert(!cache_get(aa1, IE_RSN_AKM_SUITE_SAE_SHA256));
+	assert(!cache_get(aa3, IE_RSN_AKM_SUITE_8021X));
+	assert(!pmksa_cache_get(spa, aa1, (const uint8_t *) "other", 5,
+					IE_RSN_AKM_SUITE_8021X));
+
+	/* A successful lookup hands the entry over to the caller */
+	pmksa = cache_get(aa1, IE_RSN_AKM_SUITE_8021X);
+	assert(pmksa);
+	assert(pmksa->pmkid[0] == 0x11);
+	assert(pmksa_cache_length() == 1);
+	assert(!cache_get(aa1, IE_RSN_AKM_SUITE_8021X));
+
+	assert(pmksa_cache_put(pmksa) == 0);
+	assert(pmksa_cache_length() == 2);
+
+	/* Putting a PMKSA for the same peer replaces the old one */
+	assert(pmksa_cache_put(new_pmksa(aa1, IE_RSN_AKM_SUITE_8021X,
+						future, 0x33)) == 0);
+	assert(pmksa_cache_length() == 2);
+
+	pmksa = cache_get(aa1, IE_RSN_AKM_SUITE_8021X);
+	assert(pmksa);
+	assert(pmksa->pmkid[0] == 0x33);
+	pmksa_cache_free(pmksa);
+
+	assert(pmksa_cache_flush() == 1);
+	assert(pmksa_cache_length() == 0);
+}
+
+static void test_pmksa_expire(const void *data)
+{
+	uint64_t now = l_time_now();
+	struct pmksa *pmksa;
+
+	assert(pmksa_cache_put(new_pmksa(aa1, IE_RSN_AKM_SUITE_8021X,
+						now + 1000, 0x11)) == 0);
+	assert(pmksa_cache_put(new_pmksa(aa2, IE_RSN_AKM_SUITE_8021X,
+						now + 3000, 0x22)) == 0);
+	assert(pmksa_cache_put(new_pmksa(aa3, IE_RSN_AKM_SUITE_8021X,
+						now + 2000, 0x33)) == 0);
+
+	assert(pmksa_cache_expire(now + 1500) == 1);
+	assert(pmksa_cache_length() == 2);
+	assert(pmksa_cache_expire(now + 2500) == 1);
+
+	pmksa = cache_get(aa2, IE_RSN_AKM_SUITE_8021X);
+	assert(pmksa);
+	pmksa_cache_free(pmksa);
+
+	/* Entries which have already expired are never returned */
+	assert(pmksa_cache_put(new_pmksa(aa1, IE_RSN_AKM_SUITE_8021X,
+						now - 1, 0x11)) == 0);
+	assert(!cache_get(aa1, IE_RSN_AKM_SUITE_8021X));
+	assert(pmksa_cache_length() == 0);
+}
+
+int main(int argc, char *argv[])
+{
+	l_test_init(&argc, &argv);
+
+	l_test_add("/pmksa/get and put", test_pmksa_get_put, NULL);
+	l_test_add("/pmksa/expire", test_pmksa_expire, NULL);
+
+	return l_test_run();
+}
@@ -748,6 +748,7 @@ static void test_pt_pwe(const void *data)
 	uint8_t zero[64] = { 0 };
 	uint8_t val_buf[32];
 	uint8_t sorted_macs[12];
+	uint8_t pt_buf[64];
 
 	curve = l_ecc_curve_from_ike_group(19);
 	assert(curve);
@@ -836,6 +837,15 @@ static void test_pt_pwe(const void *data)
 	assert(l_ecc_points_are_equal(p1, pt));
 	l_ecc_point_free(p1);
 
+	assert(crypto_derive_sae_pt_u_ecc(19, ssid, password, identifier,
+						ubuf, ubuf + 32));
+	assert(!memcmp(ubuf, u1_data, sizeof(u1_data)));
+	assert(!memcmp(ubuf + 32, u2_data, sizeof(u2_data)));
+
+	assert(crypto_sae_pt_from_u_ecc(19, u1_data, u2_data, pt_buf));
+	assert(!memcmp(pt_buf, ptx_data, sizeof(ptx_data)));
+	assert(!memcmp(pt_buf + 32, pty_data, sizeof(pty_data)));
+
 	if (memcmp(mac1, mac2, 6) > 0) {
 		memcpy(sorted_macs, mac1, 6);
 		memcpy(sorted_macs + 6, mac2, 6);
@@ -873,6 +883,49 @@ static void test_pt_pwe(const void *data)
 	l_ecc_point_free(pt);
 }
 
+/* The self-contained PT derivation done by the crypto worker against ell */
+static void test_pt_from_u(const void *data)
+{
+	static const unsigned int groups[] = { 19, 20 };
+	static const char *passwords[] = { "mekmitasdigoat", "password", "a" };
+	uint8_t u1[L_ECC_SCALAR_MAX_BYTES];
+	uint8_t u2[L_ECC_SCALAR_MAX_BYTES];
+	uint8_t pt_buf[L_ECC_POINT_MAX_BYTES];
+	unsigned int i;
+	unsigned int j;
+
+	for (i = 0; i < L_ARRAY_SIZE(groups); i++) {
+		const struct l_ecc_curve *curve =
+					l_ecc_curve_from_ike_group(groups[i]);
+		size_t len = l_ecc_curve_get_scalar_bytes(curve);
+
+		for (j = 0; j < L_ARRAY_SIZE(passwords); j++) {
+			struct l_ecc_point *pt;
+			struct l_ecc_point *expected;
+
+			assert(crypto_derive_sae_pt_u_ecc(groups[i], "byteme",
+							passwords[j], NULL,
+							u1, u2));
+			assert(crypto_sae_pt_from_u_ecc(groups[i], u1, u2,
+							pt_buf));
+
+			pt = l_ecc_point_from_data(curve, L_ECC_POINT_TYPE_FULL,
+							pt_buf, len * 2);
+			assert(pt);
+
+			expected = crypto_derive_sae_pt_ecc(groups[i], "byteme",
+							passwords[j], NULL);
+			assert(expected);
+			assert(l_ecc_points_are_equal(pt, expected));
+
+			l_ecc_point_free(expected);
+			l_ecc_point_free(pt);
+		}
+	}
+
+	assert(!crypto_sae_pt_from_u_ecc(21, u1, u2, pt_buf));
+}
+
 int main(int argc, char *argv[])
 {
 	l_test_init(&argc, &argv);
@@ -898,6 +951,7 @@ int main(int argc, char *argv[])
 	l_test_add("SAE end-to-end", test_end_to_end, NULL);
 
 	l_test_add("SAE pt-pwe", test_pt_pwe, NULL);
+	l_test_add("SAE pt from u", test_pt_from_u, NULL);
 
 done:
 	return l_test_run();
@@ -183,11 +183,38 @@ static void ip_prefix_test(const void *data)
 	}
 }
 
+static void ssid_short_test(const void *data)
+{
+	static const uint8_t check[] = "123456789";
+
+	assert(util_ssid_short(0, NULL) == 0);
+	assert(util_ssid_short(9, check) == 0xcbf43926);
+	assert(util_ssid_short(6, (const uint8_t *) "foobar") ==
+							0x9ef61f95);
+}
+
+static void hash_test(const void *data)
+{
+	static const uint8_t addr[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+	unsigned int hash;
+
+	assert(util_hash_bytes(UTIL_HASH_INIT, NULL, 0) == UTIL_HASH_INIT);
+	assert(util_hash_bytes(UTIL_HASH_INIT, "foobar", 6) == 0xbf9cf968);
+
+	hash = util_hash_bytes(UTIL_HASH_INIT, "foo", 3);
+	assert(util_hash_bytes(hash, "bar", 3) == 0xbf9cf968);
+
+	assert(util_address_hash(addr) ==
+			util_hash_bytes(UTIL_HASH_INIT, addr, sizeof(addr)));
+}
+
 int main(int argc, char *argv[])
 {
 	l_test_init(&argc, &argv);
 
 	l_test_add("/util/ssid_to_utf8/", ssid_to_utf8, ssid_samples);
+	l_test_add("/util/ssid_short/", ssid_short_test, NULL);
+	l_test_add("/util/hash/", hash_test, NULL);
 	l_test_add("/util/get_domain/", get_domain_test, NULL);
 	l_test_add("/util/get_username/", get_username_test, NULL);
 	l_test_add("/util/ip_prefix/", ip_prefix_test, NULL);